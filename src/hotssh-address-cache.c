@@ -0,0 +1,260 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "hotssh-address-cache.h"
+#include "hotssh-hostdb.h"
+
+#include "libgsystem.h"
+
+#include <string.h>
+
+/* Give startup a head start before using the network */
+#define PREFETCH_DELAY_SECONDS 5
+
+static guint
+get_ttl (void)
+{
+  gs_unref_object GSettings *settings = g_settings_new ("org.gnome.hotssh");
+  return g_settings_get_uint (settings, "address-cache-ttl");
+}
+
+static gboolean
+is_fresh (const char *id)
+{
+  gs_unref_object HotSshHostDB *hostdb = hotssh_hostdb_get_instance ();
+  guint expires = hotssh_hostdb_get_entry_uint (hostdb, id, "addresses-expires", 0);
+  return expires > g_get_real_time () / G_USEC_PER_SEC;
+}
+
+/**
+ * hotssh_address_cache_lookup:
+ *
+ * Returns: (transfer full) (element-type GInetAddress): Unexpired
+ * addresses for @id, or %NULL; free with g_resolver_free_addresses()
+ */
+GList *
+hotssh_address_cache_lookup (const char *id)
+{
+  gs_unref_object HotSshHostDB *hostdb = hotssh_hostdb_get_instance ();
+  gs_strfreev char **strs = NULL;
+  GList *ret = NULL;
+  char **iter;
+
+  if (id == NULL || get_ttl () == 0 || !is_fresh (id))
+    return NULL;
+
+  strs = hotssh_hostdb_get_entry_strv (hostdb, id, "addresses");
+  if (!strs)
+    return NULL;
+
+  for (iter = strs; *iter; iter++)
+    {
+      GInetAddress *addr = g_inet_address_new_from_string (*iter);
+      if (addr)
+        ret = g_list_prepend (ret, addr);
+    }
+  return g_list_reverse (ret);
+}
+
+static void
+add_address (GPtrArray    *strs,
+             GInetAddress *addr)
+{
+  char *str = g_inet_address_to_string (addr);
+  guint i;
+
+  for (i = 0; i < strs->len; i++)
+    {
+      if (strcmp (strs->pdata[i], str) == 0)
+        {
+          g_free (str);
+          return;
+        }
+    }
+  g_ptr_array_add (strs, str);
+}
+
+/**
+ * hotssh_address_cache_store:
+ * @winner: (allow-none): The address that connected
+ * @resolved: (allow-none) (element-type GInetAddress): A completed lookup
+ *
+ * The expiry only moves on with a completed lookup; a winner alone is
+ * just put at the front of what's already there.
+ */
+void
+hotssh_address_cache_store (const char   *id,
+                            GInetAddress *winner,
+                            GList        *resolved)
+{
+  gs_unref_object HotSshHostDB *hostdb = hotssh_hostdb_get_instance ();
+  gs_unref_ptrarray GPtrArray *strs = g_ptr_array_new_with_free_func (g_free);
+  guint ttl = get_ttl ();
+  GList *l;
+
+  if (id == NULL || ttl == 0)
+    return;
+
+  if (winner)
+    add_address (strs, winner);
+
+  if (resolved)
+    {
+      for (l = resolved; l; l = l->next)
+        add_address (strs, l->data);
+      hotssh_hostdb_set_entry_uint (hostdb, id, "addresses-expires",
+                                    g_get_real_time () / G_USEC_PER_SEC + ttl);
+    }
+  else
+    {
+      gs_strfreev char **old = hotssh_hostdb_get_entry_strv (hostdb, id, "addresses");
+      char **iter;
+
+      /* Nothing known to keep it alive with */
+      if (!old)
+        return;
+      for (iter = old; *iter; iter++)
+        {
+          gs_unref_object GInetAddress *addr = g_inet_address_new_from_string (*iter);
+          if (addr)
+            add_address (strs, addr);
+        }
+    }
+
+  if (strs->len == 0)
+    return;
+  g_ptr_array_add (strs, NULL);
+  hotssh_hostdb_set_entry_strv (hostdb, id, "addresses",
+                                (const char * const *)strs->pdata);
+}
+
+static void
+on_prefetch_resolved (GObject      *src,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+  gs_free char *id = user_data;
+  GError *local_error = NULL;
+  GList *addresses;
+
+  addresses = g_resolver_lookup_by_name_finish ((GResolver*)src, res, &local_error);
+  if (!addresses)
+    {
+      g_debug ("prefetch: lookup for %s failed: %s", id, local_error->message);
+      g_clear_error (&local_error);
+      return;
+    }
+
+  g_debug ("prefetch: resolved %s", id);
+  hotssh_address_cache_store (id, NULL, addresses);
+  g_resolver_free_addresses (addresses);
+}
+
+typedef struct {
+  char *id;
+  char *hostname;
+  guint64 last_used;
+} PrefetchCandidate;
+
+static void
+prefetch_candidate_free (gpointer data)
+{
+  PrefetchCandidate *candidate = data;
+  g_free (candidate->id);
+  g_free (candidate->hostname);
+  g_slice_free (PrefetchCandidate, candidate);
+}
+
+static int
+compare_by_last_used (gconstpointer a,
+                      gconstpointer b)
+{
+  const PrefetchCandidate *ca = *(PrefetchCandidate**)a;
+  const PrefetchCandidate *cb = *(PrefetchCandidate**)b;
+
+  if (ca->last_used == cb->last_used)
+    return 0;
+  return ca->last_used > cb->last_used ? -1 : 1;
+}
+
+static gboolean
+on_prefetch_timeout (gpointer user_data)
+{
+  gs_unref_object GSettings *settings = g_settings_new ("org.gnome.hotssh");
+  gs_unref_object HotSshHostDB *hostdb = hotssh_hostdb_get_instance ();
+  gs_unref_object GtkTreeModel *model = hotssh_hostdb_get_model (hostdb);
+  gs_unref_object GResolver *resolver = g_resolver_get_default ();
+  gs_unref_ptrarray GPtrArray *candidates =
+    g_ptr_array_new_with_free_func (prefetch_candidate_free);
+  guint max_hosts = g_settings_get_uint (settings, "address-prefetch-hosts");
+  GtkTreeIter iter;
+  guint i;
+
+  if (!gtk_tree_model_get_iter_first (model, &iter))
+    return FALSE;
+
+  do
+    {
+      PrefetchCandidate *candidate = g_slice_new0 (PrefetchCandidate);
+      gtk_tree_model_get (model, &iter,
+                          HOTSSH_HOSTDB_COLUMN_ID, &candidate->id,
+                          HOTSSH_HOSTDB_COLUMN_HOSTNAME, &candidate->hostname,
+                          HOTSSH_HOSTDB_COLUMN_LAST_USED, &candidate->last_used,
+                          -1);
+      g_ptr_array_add (candidates, candidate);
+    }
+  while (gtk_tree_model_iter_next (model, &iter));
+
+  g_ptr_array_sort (candidates, compare_by_last_used);
+
+  for (i = 0; i < candidates->len && i < max_hosts; i++)
+    {
+      PrefetchCandidate *candidate = candidates->pdata[i];
+      gs_unref_object GInetAddress *literal = NULL;
+
+      /* Never connected, so probably not about to be */
+      if (candidate->last_used == 0)
+        break;
+      if (is_fresh (candidate->id))
+        continue;
+      literal = g_inet_address_new_from_string (candidate->hostname);
+      if (literal)
+        continue;
+
+      g_debug ("prefetch: looking up %s", candidate->hostname);
+      g_resolver_lookup_by_name_async (resolver, candidate->hostname, NULL,
+                                       on_prefetch_resolved,
+                                       g_strdup (candidate->id));
+    }
+
+  return FALSE;
+}
+
+void
+hotssh_address_cache_start_prefetch (void)
+{
+  gs_unref_object GSettings *settings = g_settings_new ("org.gnome.hotssh");
+
+  if (g_settings_get_uint (settings, "address-cache-ttl") == 0
+      || g_settings_get_uint (settings, "address-prefetch-hosts") == 0)
+    return;
+
+  g_timeout_add_seconds (PREFETCH_DELAY_SECONDS, on_prefetch_timeout, NULL);
+}
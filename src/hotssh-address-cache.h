@@ -0,0 +1,43 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Addresses each hostdb entry last resolved to, kept in the hostdb so
+ * that connecting can start on them straight away after a restart
+ * while a fresh lookup runs alongside.  The address that last won the
+ * connection race is stored first.  Entries expire after the
+ * address-cache-ttl setting; the system resolver doesn't tell us the
+ * records' own TTLs.
+ *
+ * At startup the most recently used hosts whose addresses have expired
+ * are looked up again in the background.
+ */
+
+GList          *hotssh_address_cache_lookup         (const char    *id);
+void            hotssh_address_cache_store          (const char    *id,
+                                                     GInetAddress  *winner,
+                                                     GList         *resolved);
+
+void            hotssh_address_cache_start_prefetch (void);
+
+G_END_DECLS
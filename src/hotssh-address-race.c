@@ -0,0 +1,634 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "hotssh-address-race.h"
+
+#include "libgsystem.h"
+
+/* RFC 8305's recommended Connection Attempt Delay */
+#define ATTEMPT_DELAY_MS (250)
+
+/* A GNetworkAddress that enumerates just the address that won, or
+ * the addresses we didn't need to race, in order.
+ */
+
+typedef struct {
+  GSocketAddressEnumerator parent;
+  GPtrArray *addresses;
+  guint next;
+} HotSshRacedEnumerator;
+
+typedef struct {
+  GSocketAddressEnumeratorClass parent_class;
+} HotSshRacedEnumeratorClass;
+
+G_DEFINE_TYPE (HotSshRacedEnumerator, hotssh_raced_enumerator, G_TYPE_SOCKET_ADDRESS_ENUMERATOR)
+
+/* The default next_async() calls this, which never blocks */
+static GSocketAddress *
+hotssh_raced_enumerator_next (GSocketAddressEnumerator  *enumerator,
+                              GCancellable              *cancellable,
+                              GError                   **error)
+{
+  HotSshRacedEnumerator *self = (HotSshRacedEnumerator*)enumerator;
+
+  if (self->next >= self->addresses->len)
+    return NULL;
+  return g_object_ref (self->addresses->pdata[self->next++]);
+}
+
+static void
+hotssh_raced_enumerator_finalize (GObject *object)
+{
+  HotSshRacedEnumerator *self = (HotSshRacedEnumerator*)object;
+
+  g_ptr_array_unref (self->addresses);
+
+  G_OBJECT_CLASS (hotssh_raced_enumerator_parent_class)->finalize (object);
+}
+
+static void
+hotssh_raced_enumerator_init (HotSshRacedEnumerator *self)
+{
+}
+
+static void
+hotssh_raced_enumerator_class_init (HotSshRacedEnumeratorClass *class)
+{
+  G_OBJECT_CLASS (class)->finalize = hotssh_raced_enumerator_finalize;
+  G_SOCKET_ADDRESS_ENUMERATOR_CLASS (class)->next = hotssh_raced_enumerator_next;
+}
+
+typedef struct {
+  GNetworkAddress parent;
+  GPtrArray *addresses;         /* GSocketAddress */
+} HotSshRacedAddress;
+
+typedef struct {
+  GNetworkAddressClass parent_class;
+} HotSshRacedAddressClass;
+
+static void hotssh_raced_address_connectable_iface_init (GSocketConnectableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (HotSshRacedAddress, hotssh_raced_address, G_TYPE_NETWORK_ADDRESS,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_SOCKET_CONNECTABLE,
+                                                hotssh_raced_address_connectable_iface_init))
+
+static GSocketAddressEnumerator *
+hotssh_raced_address_enumerate (GSocketConnectable *connectable)
+{
+  HotSshRacedAddress *self = (HotSshRacedAddress*)connectable;
+  HotSshRacedEnumerator *enumerator = g_object_new (hotssh_raced_enumerator_get_type (), NULL);
+
+  enumerator->addresses = g_ptr_array_ref (self->addresses);
+  return (GSocketAddressEnumerator*)enumerator;
+}
+
+static void
+hotssh_raced_address_connectable_iface_init (GSocketConnectableIface *iface)
+{
+  /* The rest of the vtable is copied from GNetworkAddress.  Its
+   * proxy_enumerate() still comes back here for a direct connection,
+   * and asks any proxy by host name, which is what we want.
+   */
+  iface->enumerate = hotssh_raced_address_enumerate;
+}
+
+static void
+hotssh_raced_address_finalize (GObject *object)
+{
+  HotSshRacedAddress *self = (HotSshRacedAddress*)object;
+
+  g_clear_pointer (&self->addresses, g_ptr_array_unref);
+
+  G_OBJECT_CLASS (hotssh_raced_address_parent_class)->finalize (object);
+}
+
+static void
+hotssh_raced_address_init (HotSshRacedAddress *self)
+{
+}
+
+static void
+hotssh_raced_address_class_init (HotSshRacedAddressClass *class)
+{
+  G_OBJECT_CLASS (class)->finalize = hotssh_raced_address_finalize;
+}
+
+/* Takes a reference to @addresses */
+static GSocketConnectable *
+raced_address_new (const char *hostname,
+                   guint16     port,
+                   GPtrArray  *addresses)
+{
+  HotSshRacedAddress *self = g_object_new (hotssh_raced_address_get_type (),
+                                           "hostname", hostname,
+                                           "port", port,
+                                           NULL);
+  self->addresses = g_ptr_array_ref (addresses);
+  return (GSocketConnectable*)self;
+}
+
+/* The race itself */
+
+typedef struct {
+  char *hostname;
+  guint16 port;
+  HotSshAddressRaceEventFunc event_func;
+  gpointer event_data;
+
+  GPtrArray *addresses;         /* GSocketAddress, in the order to try */
+  guint next;
+  guint n_running;
+  guint stagger_id;
+  gboolean resolving;
+  GList *resolved;              /* GInetAddress, from the lookup */
+  GInetAddress *winner;
+  /* Cancelled to stop every attempt, once one wins or the caller
+   * gives up.
+   */
+  GCancellable *attempts_cancellable;
+  gulong cancelled_id;
+  GError *last_error;
+  gboolean done;
+} AddressRace;
+
+typedef struct {
+  GTask *task;
+  GSocketAddress *address;
+} RaceAttempt;
+
+static void start_attempt (GTask *task);
+static gboolean single_family (GPtrArray *addresses);
+
+static void
+address_race_free (gpointer data)
+{
+  AddressRace *race = data;
+
+  g_assert (race->stagger_id == 0);
+  g_free (race->hostname);
+  g_ptr_array_unref (race->addresses);
+  g_resolver_free_addresses (race->resolved);
+  g_clear_object (&race->winner);
+  g_object_unref (race->attempts_cancellable);
+  g_clear_error (&race->last_error);
+  g_slice_free (AddressRace, race);
+}
+
+static void
+race_emit (AddressRace        *race,
+           GSocketClientEvent  event,
+           GSocketAddress     *address)
+{
+  if (race->event_func && !race->done)
+    race->event_func (event, address, race->event_data);
+}
+
+/* Finish with @winner, or with @addresses to be tried in turn, or
+ * with the last error if both are %NULL.
+ */
+static void
+race_finish (GTask          *task,
+             GSocketAddress *winner,
+             GPtrArray      *addresses)
+{
+  AddressRace *race = g_task_get_task_data (task);
+  GCancellable *cancellable = g_task_get_cancellable (task);
+
+  race->done = TRUE;
+  if (race->stagger_id)
+    {
+      g_source_remove (race->stagger_id);
+      race->stagger_id = 0;
+    }
+  if (race->cancelled_id)
+    {
+      g_cancellable_disconnect (cancellable, race->cancelled_id);
+      race->cancelled_id = 0;
+    }
+  g_cancellable_cancel (race->attempts_cancellable);
+
+  if (winner)
+    {
+      gs_unref_ptrarray GPtrArray *just_winner = g_ptr_array_new_with_free_func (g_object_unref);
+
+      race->winner = g_object_ref (g_inet_socket_address_get_address ((GInetSocketAddress*)winner));
+      g_ptr_array_add (just_winner, g_object_ref (winner));
+      g_task_return_pointer (task, raced_address_new (race->hostname, race->port, just_winner),
+                             g_object_unref);
+    }
+  else if (addresses)
+    g_task_return_pointer (task, raced_address_new (race->hostname, race->port, addresses),
+                           g_object_unref);
+  else if (!g_task_return_error_if_cancelled (task))
+    {
+      /* Maybe only a proxy can get there; let the connection try it
+       * the usual way, and report its own error if it fails too.
+       */
+      if (race->last_error)
+        g_debug ("race: no address connected (%s); connecting by name",
+                 race->last_error->message);
+      g_task_return_pointer (task, g_network_address_new (race->hostname, race->port),
+                             g_object_unref);
+    }
+}
+
+static void
+on_attempt_connected (GObject      *src,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+  RaceAttempt *attempt = user_data;
+  GTask *task = attempt->task;
+  AddressRace *race = g_task_get_task_data (task);
+  GError *local_error = NULL;
+  gs_unref_object GSocketConnection *connection = NULL;
+
+  connection = g_socket_client_connect_finish ((GSocketClient*)src, res, &local_error);
+  race->n_running--;
+
+  if (race->done)
+    {
+      g_clear_error (&local_error);
+      goto out;
+    }
+
+  if (connection)
+    {
+      /* Only the address is wanted.  GSshConnection makes its own
+       * socket, so the caller connects again; we avoid racing where
+       * that's not worth it.
+       */
+      (void) g_io_stream_close ((GIOStream*)connection, NULL, NULL);
+      race_finish (task, attempt->address, NULL);
+      goto out;
+    }
+
+  g_debug ("race: attempt failed: %s", local_error->message);
+  g_clear_error (&race->last_error);
+  race->last_error = local_error;
+
+  /* Don't wait out the delay for the next one after a failure */
+  if (!g_cancellable_is_cancelled (race->attempts_cancellable)
+      && race->next < race->addresses->len)
+    start_attempt (task);
+  else if (race->n_running == 0 && !race->resolving)
+    race_finish (task, NULL, NULL);
+
+ out:
+  g_object_unref (attempt->address);
+  g_object_unref (attempt->task);
+  g_slice_free (RaceAttempt, attempt);
+}
+
+static gboolean
+on_stagger_timeout (gpointer user_data)
+{
+  GTask *task = user_data;
+  AddressRace *race = g_task_get_task_data (task);
+
+  race->stagger_id = 0;
+  if (race->done || g_cancellable_is_cancelled (race->attempts_cancellable))
+    return FALSE;
+  /* The lookup is slow; go with what we remembered, untried */
+  if (race->next == 0 && single_family (race->addresses))
+    {
+      race_finish (task, NULL, race->addresses);
+      return FALSE;
+    }
+  start_attempt (task);
+  return FALSE;
+}
+
+static void
+start_attempt (GTask *task)
+{
+  AddressRace *race = g_task_get_task_data (task);
+  gs_unref_object GSocketClient *client = g_socket_client_new ();
+  RaceAttempt *attempt;
+
+  if (race->stagger_id)
+    {
+      g_source_remove (race->stagger_id);
+      race->stagger_id = 0;
+    }
+
+  attempt = g_slice_new0 (RaceAttempt);
+  attempt->task = g_object_ref (task);
+  attempt->address = g_object_ref (race->addresses->pdata[race->next++]);
+  race->n_running++;
+
+  race_emit (race, G_SOCKET_CLIENT_CONNECTING, attempt->address);
+  g_socket_client_set_enable_proxy (client, FALSE);
+  g_socket_client_connect_async (client, (GSocketConnectable*)attempt->address,
+                                 race->attempts_cancellable,
+                                 on_attempt_connected, attempt);
+
+  if (race->next < race->addresses->len)
+    race->stagger_id = g_timeout_add_full (G_PRIORITY_DEFAULT, ATTEMPT_DELAY_MS,
+                                           on_stagger_timeout,
+                                           g_object_ref (task), g_object_unref);
+}
+
+static gboolean
+have_address (GPtrArray    *addresses,
+              GInetAddress *addr)
+{
+  guint i;
+
+  for (i = 0; i < addresses->len; i++)
+    {
+      GInetAddress *known =
+        g_inet_socket_address_get_address (addresses->pdata[i]);
+      if (g_inet_address_equal (known, addr))
+        return TRUE;
+    }
+  return FALSE;
+}
+
+static gboolean
+single_family (GPtrArray *addresses)
+{
+  guint i;
+
+  for (i = 1; i < addresses->len; i++)
+    if (g_socket_address_get_family (addresses->pdata[i])
+        != g_socket_address_get_family (addresses->pdata[0]))
+      return FALSE;
+  return addresses->len > 0;
+}
+
+/* Queue up @inet_addresses that aren't already, alternating families
+ * and starting with whichever the resolver put first (which has
+ * already applied the system's address preference).
+ */
+static void
+add_addresses (AddressRace *race,
+               GList       *inet_addresses)
+{
+  GQueue first = G_QUEUE_INIT;
+  GQueue other = G_QUEUE_INIT;
+  GSocketFamily first_family;
+  GList *l;
+
+  if (!inet_addresses)
+    return;
+
+  first_family = g_inet_address_get_family (inet_addresses->data);
+  for (l = inet_addresses; l; l = l->next)
+    {
+      if (have_address (race->addresses, l->data))
+        continue;
+      if (g_inet_address_get_family (l->data) == first_family)
+        g_queue_push_tail (&first, l->data);
+      else
+        g_queue_push_tail (&other, l->data);
+    }
+
+  while (!g_queue_is_empty (&first) || !g_queue_is_empty (&other))
+    {
+      GInetAddress *addr;
+
+      if ((addr = g_queue_pop_head (&first)) != NULL)
+        g_ptr_array_add (race->addresses, g_inet_socket_address_new (addr, race->port));
+      if ((addr = g_queue_pop_head (&other)) != NULL)
+        g_ptr_array_add (race->addresses, g_inet_socket_address_new (addr, race->port));
+    }
+}
+
+static void
+on_resolved (GObject      *src,
+             GAsyncResult *res,
+             gpointer      user_data)
+{
+  GTask *task = user_data;
+  AddressRace *race = g_task_get_task_data (task);
+  GError *local_error = NULL;
+  GList *inet_addresses;
+
+  inet_addresses = g_resolver_lookup_by_name_finish ((GResolver*)src, res, &local_error);
+  race->resolving = FALSE;
+  if (race->done)
+    {
+      g_resolver_free_addresses (inet_addresses);
+      g_clear_error (&local_error);
+      goto out;
+    }
+
+  if (!inet_addresses)
+    {
+      if (race->next == 0 && single_family (race->addresses))
+        {
+          g_debug ("race: lookup failed: %s", local_error->message);
+          g_clear_error (&local_error);
+          race_finish (task, NULL, race->addresses);
+          goto out;
+        }
+      /* Cached addresses may yet get through */
+      if (race->n_running > 0 || race->next < race->addresses->len)
+        {
+          g_debug ("race: lookup failed: %s", local_error->message);
+          g_clear_error (&local_error);
+          goto out;
+        }
+      g_clear_error (&race->last_error);
+      race->last_error = local_error;
+      race_finish (task, NULL, NULL);
+      goto out;
+    }
+
+  race->resolved = inet_addresses;
+  /* Nothing tried yet, so what we remembered gives way to the lookup */
+  if (race->next == 0)
+    g_ptr_array_set_size (race->addresses, 0);
+  add_addresses (race, inet_addresses);
+
+  /* Nothing has started and there's only one family: the connection
+   * can just try them in order itself, without a throwaway handshake.
+   */
+  if (race->next == 0 && single_family (race->addresses))
+    {
+      race_finish (task, NULL, race->addresses);
+      goto out;
+    }
+
+  if (race->next < race->addresses->len)
+    {
+      if (race->n_running == 0)
+        start_attempt (task);
+      else if (race->stagger_id == 0)
+        race->stagger_id = g_timeout_add_full (G_PRIORITY_DEFAULT, ATTEMPT_DELAY_MS,
+                                               on_stagger_timeout,
+                                               g_object_ref (task), g_object_unref);
+    }
+  else if (race->n_running == 0)
+    race_finish (task, NULL, NULL);
+
+ out:
+  g_object_unref (task);
+}
+
+static void
+on_cancelled (GCancellable *cancellable,
+              gpointer      user_data)
+{
+  g_cancellable_cancel ((GCancellable*)user_data);
+}
+
+static void
+start_race (GTask *task)
+{
+  AddressRace *race = g_task_get_task_data (task);
+  gs_unref_object GResolver *resolver = g_resolver_get_default ();
+
+  race->resolving = TRUE;
+  g_resolver_lookup_by_name_async (resolver, race->hostname, race->attempts_cancellable,
+                                   on_resolved, g_object_ref (task));
+
+  /* Remembered addresses of one family needn't be raced: give the
+   * lookup a moment to confirm or replace them, then use them.  Only
+   * two families are worth a probe.
+   */
+  if (single_family (race->addresses))
+    race->stagger_id = g_timeout_add_full (G_PRIORITY_DEFAULT, ATTEMPT_DELAY_MS,
+                                           on_stagger_timeout,
+                                           g_object_ref (task), g_object_unref);
+  else if (race->addresses->len > 0)
+    start_attempt (task);
+}
+
+/* The probes go direct, so only race when the connection would too */
+static void
+on_proxy_lookup (GObject      *src,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+  GTask *task = user_data;
+  AddressRace *race = g_task_get_task_data (task);
+  GError *local_error = NULL;
+  gs_strfreev char **proxies = NULL;
+
+  proxies = g_proxy_resolver_lookup_finish ((GProxyResolver*)src, res, &local_error);
+  if (g_cancellable_is_cancelled (race->attempts_cancellable))
+    {
+      g_clear_error (&local_error);
+      race_finish (task, NULL, NULL);
+      goto out;
+    }
+
+  if (!proxies)
+    {
+      g_debug ("race: proxy lookup failed: %s", local_error->message);
+      g_clear_error (&local_error);
+    }
+  else if (proxies[0] && strcmp (proxies[0], "direct://") != 0)
+    {
+      g_debug ("race: %s goes through a proxy; not racing", race->hostname);
+      race_finish (task, NULL, NULL);
+      goto out;
+    }
+
+  start_race (task);
+
+ out:
+  g_object_unref (task);
+}
+
+/**
+ * hotssh_address_race_async:
+ * @cached: (allow-none) (element-type GInetAddress): Addresses
+ * remembered from last time.  If they are all one family they are
+ * used as they are when the lookup is slow; otherwise they are raced
+ * while it runs.
+ * @event_func: (allow-none): Told about each step, for status display
+ *
+ * Resolve @hostname and race connections to its addresses.  Must be
+ * called on the main context.  If @hostname is reached through a
+ * proxy, or no address connects, the result is a plain
+ * GNetworkAddress for the connection to resolve and proxy as usual.
+ */
+void
+hotssh_address_race_async (const char                 *hostname,
+                           guint16                     port,
+                           GList                      *cached,
+                           GCancellable               *cancellable,
+                           HotSshAddressRaceEventFunc  event_func,
+                           gpointer                    event_data,
+                           GAsyncReadyCallback         callback,
+                           gpointer                    user_data)
+{
+  GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+  AddressRace *race = g_slice_new0 (AddressRace);
+  gs_free char *uri = NULL;
+
+  race->hostname = g_strdup (hostname);
+  race->port = port;
+  race->event_func = event_func;
+  race->event_data = event_data;
+  race->attempts_cancellable = g_cancellable_new ();
+  race->addresses = g_ptr_array_new_with_free_func (g_object_unref);
+  g_task_set_task_data (task, race, address_race_free);
+
+  if (cancellable)
+    race->cancelled_id = g_cancellable_connect (cancellable, G_CALLBACK (on_cancelled),
+                                                race->attempts_cancellable, NULL);
+
+  race_emit (race, G_SOCKET_CLIENT_RESOLVING, NULL);
+  add_addresses (race, cached);
+
+  /* As GNetworkAddress asks, for a connection with no scheme */
+  uri = g_strdup_printf (strchr (hostname, ':') ? "none://[%s]:%u" : "none://%s:%u",
+                         hostname, (guint)port);
+  g_proxy_resolver_lookup_async (g_proxy_resolver_get_default (), uri,
+                                 race->attempts_cancellable,
+                                 on_proxy_lookup, g_object_ref (task));
+
+  g_object_unref (task);
+}
+
+/**
+ * hotssh_address_race_finish:
+ * @out_winner: (out) (transfer full) (allow-none): The address that
+ * connected, or %NULL if there was no need to race
+ * @out_resolved: (out) (transfer full) (element-type GInetAddress):
+ * What the lookup found, or %NULL if it was beaten to it
+ *
+ * Returns: (transfer full): Where to connect to
+ */
+GSocketConnectable *
+hotssh_address_race_finish (GAsyncResult  *result,
+                            GInetAddress **out_winner,
+                            GList        **out_resolved,
+                            GError       **error)
+{
+  AddressRace *race = g_task_get_task_data ((GTask*)result);
+  GSocketConnectable *ret = g_task_propagate_pointer ((GTask*)result, error);
+
+  if (ret)
+    {
+      *out_winner = race->winner ? g_object_ref (race->winner) : NULL;
+      *out_resolved = race->resolved;
+      race->resolved = NULL;
+    }
+  return ret;
+}
@@ -0,0 +1,63 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Connecting to a host name with several addresses, try them
+ * concurrently in the manner of RFC 8305 ("happy eyeballs"): resolve,
+ * alternate address families, start a new attempt every so often
+ * without waiting for the last to time out, and keep whichever
+ * connects first.  Addresses remembered from last time stand in for
+ * a slow lookup, and a fresh lookup replaces them.
+ *
+ * The result is a GNetworkAddress for the same host and port that
+ * enumerates only the winning address, so that whatever connects to it
+ * next goes straight there without resolving again.  When the lookup
+ * comes back with a single address family before anything has been
+ * tried, there is no race: the result enumerates those addresses in
+ * order, saving the extra connection a probe costs.  A host reached
+ * through a proxy is never raced, as the probes go direct; nor is a
+ * host none of whose addresses connect.  Either way the result is a
+ * plain GNetworkAddress.
+ */
+
+/* Called on the main context for each attempt, with a socket address
+ * for G_SOCKET_CLIENT_CONNECTING or NULL for G_SOCKET_CLIENT_RESOLVING.
+ */
+typedef void (*HotSshAddressRaceEventFunc) (GSocketClientEvent  event,
+                                            GSocketAddress     *address,
+                                            gpointer            user_data);
+
+void                hotssh_address_race_async  (const char                 *hostname,
+                                                guint16                     port,
+                                                GList                      *cached,
+                                                GCancellable               *cancellable,
+                                                HotSshAddressRaceEventFunc  event_func,
+                                                gpointer                    event_data,
+                                                GAsyncReadyCallback         callback,
+                                                gpointer                    user_data);
+GSocketConnectable *hotssh_address_race_finish (GAsyncResult               *result,
+                                                GInetAddress              **out_winner,
+                                                GList                     **out_resolved,
+                                                GError                    **error);
+
+G_END_DECLS
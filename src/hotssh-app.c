@@ -19,6 +19,10 @@
 #include "config.h"
 
 #include "hotssh-app.h"
+#include "hotssh-address-cache.h"
+#include "hotssh-connection-pool.h"
+#include "hotssh-io-worker.h"
+#include "hotssh-preconnect.h"
 #include "hotssh-search-provider.h"
 #include "hotssh-win.h"
 #include "hotssh-prefs.h"
@@ -31,6 +35,10 @@ struct _HotSshApp
 {
   GtkApplication parent;
   HotSshSearchProvider *search_provider;
+
+  guint network_changed_id;
+  GDBusConnection *system_bus;
+  guint prepare_for_sleep_id;
 };
 
 struct _HotSshAppClass
@@ -100,6 +108,100 @@ static GActionEntry app_entries[] =
   { "quit", quit_activated, NULL, NULL, NULL }
 };
 
+/* Network changes come in bursts; look once it has settled */
+#define NETWORK_CHANGED_DELAY_MS (1000)
+
+static gboolean
+on_network_changed_timeout (gpointer user_data)
+{
+  HotSshApp *self = user_data;
+  GList *l;
+
+  self->network_changed_id = 0;
+  g_debug ("network changed; checking tabs");
+
+  for (l = gtk_application_get_windows ((GtkApplication*)self); l; l = l->next)
+    {
+      GList *tabs;
+      GList *ll;
+
+      if (!HOTSSH_IS_WINDOW (l->data))
+        continue;
+
+      tabs = hotssh_window_get_tabs (l->data);
+      for (ll = tabs; ll; ll = ll->next)
+        hotssh_tab_network_changed (ll->data);
+      g_list_free (tabs);
+    }
+
+  return FALSE;
+}
+
+static void
+queue_network_changed (HotSshApp *self)
+{
+  if (self->network_changed_id)
+    g_source_remove (self->network_changed_id);
+  self->network_changed_id = g_timeout_add (NETWORK_CHANGED_DELAY_MS,
+                                            on_network_changed_timeout, self);
+}
+
+static void
+on_network_changed (GNetworkMonitor *monitor,
+                    gboolean         available,
+                    gpointer         user_data)
+{
+  if (available)
+    queue_network_changed (user_data);
+}
+
+static void
+on_prepare_for_sleep (GDBusConnection *connection,
+                      const char      *sender_name,
+                      const char      *object_path,
+                      const char      *interface_name,
+                      const char      *signal_name,
+                      GVariant        *parameters,
+                      gpointer         user_data)
+{
+  gboolean sleeping;
+
+  if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(b)")))
+    return;
+
+  g_variant_get (parameters, "(b)", &sleeping);
+  if (!sleeping)
+    queue_network_changed (user_data);
+}
+
+static void
+on_system_bus_ready (GObject      *src,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+  HotSshApp *self = user_data;
+  GError *local_error = NULL;
+
+  self->system_bus = g_bus_get_finish (res, &local_error);
+  if (!self->system_bus)
+    {
+      g_debug ("no system bus, won't notice resume: %s", local_error->message);
+      g_error_free (local_error);
+      g_object_unref (self);
+      return;
+    }
+
+  self->prepare_for_sleep_id =
+    g_dbus_connection_signal_subscribe (self->system_bus,
+                                        "org.freedesktop.login1",
+                                        "org.freedesktop.login1.Manager",
+                                        "PrepareForSleep",
+                                        "/org/freedesktop/login1",
+                                        NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                        on_prepare_for_sleep, self, NULL);
+  g_object_unref (self);
+}
+
 static void
 hotssh_app_startup (GApplication *app)
 {
@@ -110,7 +212,19 @@ hotssh_app_startup (GApplication *app)
 
   G_APPLICATION_CLASS (hotssh_app_parent_class)->startup (app);
 
+  {
+    gs_unref_object GSettings *settings = g_settings_new ("org.gnome.hotssh");
+    hotssh_io_workers_init (g_settings_get_uint (settings, "io-threads"));
+  }
+
   hotssh_app->search_provider = hotssh_search_provider_new (hotssh_app);
+  hotssh_address_cache_start_prefetch ();
+  hotssh_preconnect_start ();
+
+  /* To reconnect tabs when the network comes back */
+  g_signal_connect_object (g_network_monitor_get_default (), "network-changed",
+                           G_CALLBACK (on_network_changed), app, 0);
+  g_bus_get (G_BUS_TYPE_SYSTEM, NULL, on_system_bus_ready, g_object_ref (app));
 
   g_action_map_add_action_entries (G_ACTION_MAP (app),
                                    app_entries, G_N_ELEMENTS (app_entries),
@@ -121,7 +235,11 @@ hotssh_app_startup (GApplication *app)
   gtk_application_set_app_menu (GTK_APPLICATION (app), app_menu);
   g_object_unref (builder);
 
-  gtk_application_add_accelerator ((GtkApplication*)app, "<Control><Shift>T", "win.new-tab", NULL);
+  gtk_application_add_accelerator ((GtkApplication*)app, "<Control><Shift>T", "win.new-autotab", NULL);
+  gtk_application_add_accelerator ((GtkApplication*)app, "<Control><Shift>Up", "win.previous-command", NULL);
+  gtk_application_add_accelerator ((GtkApplication*)app, "<Control><Shift>Down", "win.next-command", NULL);
+  gtk_application_add_accelerator ((GtkApplication*)app, "<Control><Shift>F", "win.find", NULL);
+  gtk_application_add_accelerator ((GtkApplication*)app, "<Control><Shift>B", "win.broadcast", NULL);
   {
     guint i = 0;
     for (i = 1; i <= 9; i++)
@@ -135,6 +253,30 @@ hotssh_app_startup (GApplication *app)
   }
 }
 
+static void
+hotssh_app_shutdown (GApplication *app)
+{
+  HotSshApp *self = HOTSSH_APP (app);
+
+  G_APPLICATION_CLASS (hotssh_app_parent_class)->shutdown (app);
+
+  if (self->network_changed_id)
+    {
+      g_source_remove (self->network_changed_id);
+      self->network_changed_id = 0;
+    }
+  if (self->prepare_for_sleep_id)
+    {
+      g_dbus_connection_signal_unsubscribe (self->system_bus, self->prepare_for_sleep_id);
+      self->prepare_for_sleep_id = 0;
+    }
+  g_clear_object (&self->system_bus);
+
+  hotssh_preconnect_shutdown ();
+  hotssh_connection_pool_shutdown ();
+  hotssh_io_workers_shutdown ();
+}
+
 static void
 hotssh_app_activate (GApplication *app)
 {
@@ -213,6 +355,7 @@ static void
 hotssh_app_class_init (HotSshAppClass *class)
 {
   G_APPLICATION_CLASS (class)->startup = hotssh_app_startup;
+  G_APPLICATION_CLASS (class)->shutdown = hotssh_app_shutdown;
   G_APPLICATION_CLASS (class)->activate = hotssh_app_activate;
   G_APPLICATION_CLASS (class)->command_line = hotssh_app_command_line;
 }
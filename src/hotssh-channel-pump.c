@@ -0,0 +1,448 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "hotssh-channel-pump.h"
+#include "hotssh-ring-buffer.h"
+
+#include <glib/gi18n.h>
+
+#define READ_SIZE (8192)
+
+/* Chunks of output the worker may get ahead of the main thread by
+ * before it stops reading; must be a power of two.
+ */
+#define OUTPUT_QUEUE_SIZE (64)
+
+struct _HotSshChannelPump
+{
+  volatile gint refcount;
+  HotSshIoWorker *worker;
+  GSshChannel *channel;
+  GCancellable *cancellable;
+
+  /* Main thread only; NULL once stopped */
+  const HotSshChannelPumpCallbacks *callbacks;
+  gpointer user_data;
+  gboolean error_reported;
+
+  /* Worker to main: the worker owns output_tail, main owns output_head */
+  GBytes *output_slots[OUTPUT_QUEUE_SIZE];
+  volatile gint output_head;
+  volatile gint output_tail;
+  GBytes *stalled;              /* Worker only; read that didn't fit */
+  volatile gint read_paused;
+
+  /* Main to worker */
+  HotSshRingBuffer input;
+  volatile gint write_active;
+  volatile gint drained_pending;
+
+  volatile gint main_wakeup_pending;
+  volatile gint failed;
+  GError *error;                /* Set by the worker before failed */
+};
+
+static HotSshChannelPump *
+pump_ref (HotSshChannelPump *self)
+{
+  g_atomic_int_inc (&self->refcount);
+  return self;
+}
+
+static gboolean
+pump_free (gpointer data)
+{
+  HotSshChannelPump *self = data;
+  guint i;
+
+  for (i = 0; i < OUTPUT_QUEUE_SIZE; i++)
+    g_clear_pointer (&self->output_slots[i], g_bytes_unref);
+  g_clear_pointer (&self->stalled, g_bytes_unref);
+  hotssh_ring_buffer_clear (&self->input);
+  g_clear_error (&self->error);
+  g_clear_object (&self->cancellable);
+  g_clear_object (&self->channel);
+  g_slice_free (HotSshChannelPump, self);
+  return FALSE;
+}
+
+static void
+pump_unref (gpointer data)
+{
+  HotSshChannelPump *self = data;
+
+  if (!g_atomic_int_dec_and_test (&self->refcount))
+    return;
+
+  /* Whoever lets go last, the channel is the worker's to finalize */
+  hotssh_io_worker_invoke (self->worker, pump_free, self, NULL);
+}
+
+static gboolean
+output_push (HotSshChannelPump *self,
+             GBytes            *bytes)
+{
+  guint tail = (guint)self->output_tail;
+  guint head = (guint)g_atomic_int_get (&self->output_head);
+
+  if (tail - head == OUTPUT_QUEUE_SIZE)
+    return FALSE;
+
+  self->output_slots[tail & (OUTPUT_QUEUE_SIZE - 1)] = bytes;
+  g_atomic_int_set (&self->output_tail, (gint)(tail + 1));
+  return TRUE;
+}
+
+static gboolean
+output_has_space (HotSshChannelPump *self)
+{
+  guint tail = (guint)self->output_tail;
+  guint head = (guint)g_atomic_int_get (&self->output_head);
+
+  return tail - head < OUTPUT_QUEUE_SIZE;
+}
+
+static GBytes *
+output_pop (HotSshChannelPump *self)
+{
+  guint head = (guint)self->output_head;
+  guint tail = (guint)g_atomic_int_get (&self->output_tail);
+  GBytes *bytes;
+
+  if (head == tail)
+    return NULL;
+
+  bytes = self->output_slots[head & (OUTPUT_QUEUE_SIZE - 1)];
+  self->output_slots[head & (OUTPUT_QUEUE_SIZE - 1)] = NULL;
+  g_atomic_int_set (&self->output_head, (gint)(head + 1));
+  return bytes;
+}
+
+static void
+start_read (HotSshChannelPump *self);
+
+static gboolean
+worker_resume_read (gpointer data)
+{
+  HotSshChannelPump *self = data;
+
+  if (g_cancellable_is_cancelled (self->cancellable))
+    {
+      g_clear_pointer (&self->stalled, g_bytes_unref);
+      return FALSE;
+    }
+
+  start_read (self);
+  return FALSE;
+}
+
+static gboolean
+main_dispatch (gpointer data)
+{
+  HotSshChannelPump *self = data;
+  GBytes *bytes;
+
+  /* Anything the worker queues from here on schedules another pass */
+  g_atomic_int_set (&self->main_wakeup_pending, 0);
+
+  while ((bytes = output_pop (self)) != NULL)
+    {
+      if (self->callbacks)
+        self->callbacks->output (bytes, self->user_data);
+      g_bytes_unref (bytes);
+    }
+
+  if (g_atomic_int_compare_and_exchange (&self->read_paused, 1, 0))
+    hotssh_io_worker_invoke (self->worker, worker_resume_read,
+                             pump_ref (self), pump_unref);
+
+  if (g_atomic_int_compare_and_exchange (&self->drained_pending, 1, 0)
+      && self->callbacks)
+    self->callbacks->drained (self->user_data);
+
+  if (g_atomic_int_get (&self->failed) && !self->error_reported
+      && self->callbacks)
+    {
+      self->error_reported = TRUE;
+      self->callbacks->error (g_error_copy (self->error), self->user_data);
+    }
+
+  return FALSE;
+}
+
+/* Worker side: make sure the main thread looks at the queues soon,
+ * without flooding its context with one source per chunk.
+ */
+static void
+wake_main (HotSshChannelPump *self)
+{
+  if (g_atomic_int_compare_and_exchange (&self->main_wakeup_pending, 0, 1))
+    hotssh_io_worker_invoke_main (main_dispatch, pump_ref (self), pump_unref);
+}
+
+static void
+fail (HotSshChannelPump *self,
+      GError            *error)
+{
+  if (self->error)
+    {
+      g_error_free (error);
+      return;
+    }
+
+  self->error = error;
+  g_atomic_int_set (&self->failed, 1);
+  wake_main (self);
+}
+
+/* Returns %TRUE if reading should continue. */
+static gboolean
+queue_output (HotSshChannelPump *self,
+              GBytes            *bytes)
+{
+  if (output_push (self, bytes))
+    {
+      wake_main (self);
+      return TRUE;
+    }
+
+  self->stalled = bytes;
+  g_atomic_int_set (&self->read_paused, 1);
+  wake_main (self);
+
+  /* The main thread may have drained the queue between the failed
+   * push and setting the flag, in which case it won't resume us.
+   */
+  if (output_has_space (self)
+      && g_atomic_int_compare_and_exchange (&self->read_paused, 1, 0))
+    {
+      self->stalled = NULL;
+      return queue_output (self, bytes);
+    }
+
+  return FALSE;
+}
+
+static void
+on_read_complete (GObject      *src,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+  HotSshChannelPump *self = user_data;
+  GBytes *bytes;
+  GError *local_error = NULL;
+
+  bytes = g_input_stream_read_bytes_finish ((GInputStream*)src, res, &local_error);
+  if (!bytes)
+    goto out;
+
+  if (g_bytes_get_size (bytes) == 0)
+    {
+      g_bytes_unref (bytes);
+      g_set_error_literal (&local_error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                           _("Connection closed by remote host"));
+      goto out;
+    }
+
+  if (queue_output (self, bytes))
+    start_read (self);
+
+ out:
+  if (local_error)
+    fail (self, local_error);
+  pump_unref (self);
+}
+
+static void
+start_read (HotSshChannelPump *self)
+{
+  GInputStream *istream;
+
+  /* Output that stalled on a full queue goes first */
+  if (self->stalled)
+    {
+      GBytes *stalled = self->stalled;
+      self->stalled = NULL;
+      if (!queue_output (self, stalled))
+        return;
+    }
+
+  istream = g_io_stream_get_input_stream ((GIOStream*)self->channel);
+  g_input_stream_read_bytes_async (istream, READ_SIZE, G_PRIORITY_DEFAULT,
+                                   self->cancellable, on_read_complete,
+                                   pump_ref (self));
+}
+
+static void
+write_next (HotSshChannelPump *self);
+
+static void
+on_write_complete (GObject      *src,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  HotSshChannelPump *self = user_data;
+  gssize result;
+  GError *local_error = NULL;
+
+  result = g_output_stream_write_finish ((GOutputStream*)src, res, &local_error);
+  if (result < 0)
+    goto out;
+
+  hotssh_ring_buffer_consume (&self->input, result);
+  g_atomic_int_set (&self->drained_pending, 1);
+  wake_main (self);
+
+  write_next (self);
+
+ out:
+  if (local_error)
+    fail (self, local_error);
+  pump_unref (self);
+}
+
+/* Worker side.  Everything queued since the last write went out is
+ * sent in one go; only when the ring wraps does the remainder wait for
+ * the next write.
+ */
+static void
+write_next (HotSshChannelPump *self)
+{
+  GOutputStream *ostream;
+  const guint8 *buf;
+  gsize len;
+
+  buf = hotssh_ring_buffer_peek (&self->input, &len);
+  while (len == 0)
+    {
+      g_atomic_int_set (&self->write_active, 0);
+      /* Input may have been queued after the peek but before the
+       * flag was cleared; if so the writer didn't wake us.
+       */
+      if (hotssh_ring_buffer_get_length (&self->input) == 0
+          || !g_atomic_int_compare_and_exchange (&self->write_active, 0, 1))
+        return;
+      buf = hotssh_ring_buffer_peek (&self->input, &len);
+    }
+
+  ostream = g_io_stream_get_output_stream ((GIOStream*)self->channel);
+  g_output_stream_write_async (ostream, buf, len, G_PRIORITY_DEFAULT,
+                               self->cancellable, on_write_complete,
+                               pump_ref (self));
+}
+
+static gboolean
+worker_start_write (gpointer data)
+{
+  HotSshChannelPump *self = data;
+
+  if (!g_cancellable_is_cancelled (self->cancellable))
+    write_next (self);
+
+  return FALSE;
+}
+
+static gboolean
+worker_start_read (gpointer data)
+{
+  HotSshChannelPump *self = data;
+
+  start_read (self);
+
+  return FALSE;
+}
+
+/**
+ * hotssh_channel_pump_new:
+ * @worker: Worker that owns the channel's connection
+ * @channel: An open shell channel
+ * @write_capacity: Size of the input ring; a power of two
+ * @callbacks: (not nullable): Main context callbacks
+ * @user_data: Passed to @callbacks
+ */
+HotSshChannelPump *
+hotssh_channel_pump_new (HotSshIoWorker                   *worker,
+                         GSshChannel                      *channel,
+                         gsize                             write_capacity,
+                         const HotSshChannelPumpCallbacks *callbacks,
+                         gpointer                          user_data)
+{
+  HotSshChannelPump *self = g_slice_new0 (HotSshChannelPump);
+
+  self->refcount = 1;
+  self->worker = worker;
+  self->channel = g_object_ref (channel);
+  self->cancellable = g_cancellable_new ();
+  self->callbacks = callbacks;
+  self->user_data = user_data;
+  hotssh_ring_buffer_init (&self->input, write_capacity);
+
+  return self;
+}
+
+void
+hotssh_channel_pump_start (HotSshChannelPump *self)
+{
+  hotssh_io_worker_invoke (self->worker, worker_start_read,
+                           pump_ref (self), pump_unref);
+}
+
+/**
+ * hotssh_channel_pump_stop:
+ *
+ * Cancel outstanding I/O and drop the caller's reference.  No more
+ * callbacks are made after this returns.
+ */
+void
+hotssh_channel_pump_stop (HotSshChannelPump *self)
+{
+  self->callbacks = NULL;
+  self->user_data = NULL;
+  g_cancellable_cancel (self->cancellable);
+  pump_unref (self);
+}
+
+/**
+ * hotssh_channel_pump_write:
+ *
+ * Queue as much of @buf as fits in the input ring.
+ *
+ * Returns: Number of bytes taken
+ */
+gsize
+hotssh_channel_pump_write (HotSshChannelPump *self,
+                           const guint8      *buf,
+                           gsize              len)
+{
+  gsize taken = hotssh_ring_buffer_append (&self->input, buf, len);
+
+  if (taken > 0
+      && g_atomic_int_compare_and_exchange (&self->write_active, 0, 1))
+    hotssh_io_worker_invoke (self->worker, worker_start_write,
+                             pump_ref (self), pump_unref);
+
+  return taken;
+}
+
+gsize
+hotssh_channel_pump_get_write_queued (HotSshChannelPump *self)
+{
+  return hotssh_ring_buffer_get_length (&self->input);
+}
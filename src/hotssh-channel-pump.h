@@ -0,0 +1,59 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "hotssh-io-worker.h"
+#include "gssh.h"
+
+G_BEGIN_DECLS
+
+/* Moves a shell channel's data between its I/O worker and the main
+ * thread.  Reads run continuously on the worker and are handed over
+ * through a lock-free single-producer/single-consumer queue; input
+ * goes the other way through a lock-free ring.  All callbacks run on
+ * the main context.
+ */
+typedef struct _HotSshChannelPump HotSshChannelPump;
+
+typedef struct {
+  /* A chunk of output from the remote */
+  void (*output)  (GBytes   *bytes,
+                   gpointer  user_data);
+  /* Queued input has gone out; there is room for more */
+  void (*drained) (gpointer  user_data);
+  /* The channel failed or was closed; takes ownership of @error */
+  void (*error)   (GError   *error,
+                   gpointer  user_data);
+} HotSshChannelPumpCallbacks;
+
+HotSshChannelPump *hotssh_channel_pump_new              (HotSshIoWorker                   *worker,
+                                                         GSshChannel                      *channel,
+                                                         gsize                             write_capacity,
+                                                         const HotSshChannelPumpCallbacks *callbacks,
+                                                         gpointer                          user_data);
+
+void               hotssh_channel_pump_start            (HotSshChannelPump *self);
+void               hotssh_channel_pump_stop             (HotSshChannelPump *self);
+
+gsize              hotssh_channel_pump_write            (HotSshChannelPump *self,
+                                                         const guint8      *buf,
+                                                         gsize              len);
+gsize              hotssh_channel_pump_get_write_queued (HotSshChannelPump *self);
+
+G_END_DECLS
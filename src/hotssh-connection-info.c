@@ -0,0 +1,132 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "hotssh-connection-info.h"
+#include "hotssh-io-worker.h"
+
+#define HOST_KEY_KEY "hotssh-host-key"
+#define AUTH_MECHANISMS_KEY "hotssh-auth-mechanisms"
+
+HotSshHostKey *
+hotssh_host_key_copy (const HotSshHostKey *key)
+{
+  HotSshHostKey *ret;
+
+  if (key == NULL)
+    return NULL;
+
+  ret = g_slice_new0 (HotSshHostKey);
+  ret->type = g_strdup (key->type);
+  ret->sha1 = g_strdup (key->sha1);
+  ret->base64 = g_strdup (key->base64);
+  return ret;
+}
+
+void
+hotssh_host_key_free (HotSshHostKey *key)
+{
+  g_free (key->type);
+  g_free (key->sha1);
+  g_free (key->base64);
+  g_slice_free (HotSshHostKey, key);
+}
+
+/**
+ * hotssh_connection_info_return_handshake:
+ *
+ * Completion callback for gssh_connection_handshake_async(), with
+ * user data from hotssh_io_worker_return_to_main(); the host key is
+ * then available from hotssh_connection_info_get_host_key().
+ */
+void
+hotssh_connection_info_return_handshake (GObject      *source,
+                                         GAsyncResult *result,
+                                         gpointer      user_data)
+{
+  GSshConnection *connection = (GSshConnection*)source;
+
+  if (gssh_connection_get_state (connection) == GSSH_CONNECTION_STATE_PREAUTH)
+    {
+      HotSshHostKey *key = g_slice_new0 (HotSshHostKey);
+
+      gssh_connection_preauth_get_host_key (connection,
+                                            &key->type, &key->sha1, &key->base64);
+      g_object_set_data_full ((GObject*)result, HOST_KEY_KEY, key,
+                              (GDestroyNotify)hotssh_host_key_free);
+    }
+  hotssh_io_worker_return_callback (source, result, user_data);
+}
+
+/**
+ * hotssh_connection_info_return_negotiate:
+ *
+ * Completion callback for gssh_connection_negotiate_async(), with user
+ * data from hotssh_io_worker_return_to_main(); the mechanisms the
+ * server accepts are then available from
+ * hotssh_connection_info_get_auth_mechanisms().
+ */
+void
+hotssh_connection_info_return_negotiate (GObject      *source,
+                                         GAsyncResult *result,
+                                         gpointer      user_data)
+{
+  GArray *mechanisms = g_array_new (FALSE, FALSE, sizeof (guint));
+  guint *available = NULL;
+  guint n_available = 0;
+
+  gssh_connection_get_authentication_mechanisms ((GSshConnection*)source,
+                                                 &available, &n_available);
+  g_array_append_vals (mechanisms, available, n_available);
+  g_object_set_data_full ((GObject*)result, AUTH_MECHANISMS_KEY, mechanisms,
+                          (GDestroyNotify)g_array_unref);
+  hotssh_io_worker_return_callback (source, result, user_data);
+}
+
+/**
+ * hotssh_connection_info_get_host_key:
+ *
+ * Returns: (transfer none) (allow-none): The key the host presented,
+ * if @result is a successful handshake
+ */
+const HotSshHostKey *
+hotssh_connection_info_get_host_key (GAsyncResult *result)
+{
+  HotSshHostKey *key = g_object_get_data ((GObject*)result, HOST_KEY_KEY);
+
+  if (key == NULL || key->type == NULL)
+    return NULL;
+  return key;
+}
+
+/**
+ * hotssh_connection_info_get_auth_mechanisms:
+ *
+ * Returns: (transfer full) (element-type guint): What the server
+ * accepts, empty if @result is not from a negotiation
+ */
+GArray *
+hotssh_connection_info_get_auth_mechanisms (GAsyncResult *result)
+{
+  GArray *mechanisms = g_object_get_data ((GObject*)result, AUTH_MECHANISMS_KEY);
+
+  if (mechanisms == NULL)
+    return g_array_new (FALSE, FALSE, sizeof (guint));
+  return g_array_ref (mechanisms);
+}
@@ -0,0 +1,51 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "gssh.h"
+
+G_BEGIN_DECLS
+
+/* A connection belongs to its I/O worker, so what the main thread
+ * needs to know about it once an operation completes is read there, in
+ * the completion callback, and carried back with the result.  Use the
+ * return functions below in place of hotssh_io_worker_return_callback()
+ * for the operations they name.
+ */
+
+typedef struct {
+  char *type;
+  char *sha1;
+  char *base64;
+} HotSshHostKey;
+
+HotSshHostKey       *hotssh_host_key_copy                  (const HotSshHostKey *key);
+void                 hotssh_host_key_free                  (HotSshHostKey       *key);
+
+void                 hotssh_connection_info_return_handshake (GObject      *source,
+                                                              GAsyncResult *result,
+                                                              gpointer      user_data);
+void                 hotssh_connection_info_return_negotiate (GObject      *source,
+                                                              GAsyncResult *result,
+                                                              gpointer      user_data);
+
+const HotSshHostKey *hotssh_connection_info_get_host_key     (GAsyncResult *result);
+GArray              *hotssh_connection_info_get_auth_mechanisms (GAsyncResult *result);
+
+G_END_DECLS
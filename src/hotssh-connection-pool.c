@@ -0,0 +1,525 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "hotssh-connection-pool.h"
+
+#include "libgsystem.h"
+
+typedef struct {
+  char *key;
+  GSshConnection *connection;
+  HotSshIoWorker *worker;
+  /* As last reported by the worker */
+  GSshConnectionState state;
+  guint uses;
+  guint idle_id;
+
+  /* A shell opened ahead of time for the next tab */
+  GSshChannel *spare;
+  GCancellable *spare_cancellable;
+} PoolEntry;
+
+static GHashTable *entries_by_key;          /* key -> PoolEntry */
+static GHashTable *entries_by_connection;   /* GSshConnection -> PoolEntry */
+static GSettings *settings;
+
+static void
+on_connection_state_notify (GSshConnection *connection,
+                            GParamSpec     *pspec,
+                            gpointer        user_data);
+
+/* Connections and channels are only touched on their worker; these
+ * carry them there and back.
+ */
+typedef struct {
+  HotSshIoWorker *worker;
+  GSshConnection *connection;
+  GSshChannel *spare;
+  GSshConnectionState state;
+  gboolean close;
+} WorkerOp;
+
+static WorkerOp *
+worker_op_new (HotSshIoWorker *worker,
+               GSshConnection *connection)
+{
+  WorkerOp *op = g_slice_new0 (WorkerOp);
+
+  op->worker = worker;
+  op->connection = g_object_ref (connection);
+  return op;
+}
+
+/* The references go back to the worker, whichever thread this is */
+static void
+worker_op_free (gpointer data)
+{
+  WorkerOp *op = data;
+
+  hotssh_io_worker_release (op->worker, op->spare);
+  hotssh_io_worker_release (op->worker, op->connection);
+  g_slice_free (WorkerOp, op);
+}
+
+/* Nobody else has a spare, so hang it up rather than leave a shell
+ * open on the host.
+ */
+static gboolean
+op_close_spare (gpointer data)
+{
+  GSshChannel *spare = data;
+
+  g_io_stream_close_async ((GIOStream*)spare, G_PRIORITY_DEFAULT, NULL, NULL, NULL);
+  g_object_unref (spare);
+  return FALSE;
+}
+
+static gboolean
+op_release (gpointer data)
+{
+  WorkerOp *op = data;
+
+  g_signal_handlers_disconnect_by_func (op->connection, on_connection_state_notify, op->worker);
+  if (op->spare)
+    (void) op_close_spare (op->spare);
+  op->spare = NULL;
+  /* Tabs may still hold references, so don't count on finalizing it */
+  if (op->close)
+    gssh_connection_reset (op->connection);
+  g_clear_object (&op->connection);
+  g_slice_free (WorkerOp, op);
+  return FALSE;
+}
+
+static void
+pool_entry_free (PoolEntry *entry)
+{
+  WorkerOp *op;
+
+  if (entry->idle_id)
+    g_source_remove (entry->idle_id);
+  if (entry->spare_cancellable)
+    g_cancellable_cancel (entry->spare_cancellable);
+  g_clear_object (&entry->spare_cancellable);
+  /* Hand over our references rather than dropping them here */
+  op = g_slice_new0 (WorkerOp);
+  op->worker = entry->worker;
+  op->connection = entry->connection;
+  op->spare = entry->spare;
+  op->close = entry->uses == 0 || entry->state != GSSH_CONNECTION_STATE_CONNECTED;
+  hotssh_io_worker_invoke (entry->worker, op_release, op, NULL);
+  g_free (entry->key);
+  g_slice_free (PoolEntry, entry);
+}
+
+static void
+ensure_pool (void)
+{
+  if (entries_by_key)
+    return;
+
+  entries_by_key = g_hash_table_new (g_str_hash, g_str_equal);
+  entries_by_connection = g_hash_table_new (NULL, NULL);
+  settings = g_settings_new ("org.gnome.hotssh");
+}
+
+static void
+remove_entry (PoolEntry *entry)
+{
+  g_debug ("pool: closing connection for %s", entry->key);
+  g_hash_table_remove (entries_by_key, entry->key);
+  g_hash_table_remove (entries_by_connection, entry->connection);
+  pool_entry_free (entry);
+}
+
+static gboolean
+on_idle_expired (gpointer user_data)
+{
+  PoolEntry *entry = user_data;
+
+  entry->idle_id = 0;
+  remove_entry (entry);
+  return FALSE;
+}
+
+static PoolEntry *
+lookup_connection (GSshConnection *connection)
+{
+  if (!entries_by_connection)
+    return NULL;
+  return g_hash_table_lookup (entries_by_connection, connection);
+}
+
+static gboolean
+on_connection_state_main (gpointer data)
+{
+  WorkerOp *op = data;
+  PoolEntry *entry = lookup_connection (op->connection);
+
+  if (!entry)
+    return FALSE;
+
+  entry->state = op->state;
+  /* Nobody is using it, so nobody else will notice */
+  if (entry->state != GSSH_CONNECTION_STATE_CONNECTED && entry->uses == 0)
+    remove_entry (entry);
+  return FALSE;
+}
+
+/* On the worker */
+static void
+on_connection_state_notify (GSshConnection *connection,
+                            GParamSpec     *pspec,
+                            gpointer        user_data)
+{
+  WorkerOp *op = worker_op_new (user_data, connection);
+
+  op->state = gssh_connection_get_state (connection);
+  hotssh_io_worker_invoke_main (on_connection_state_main, op, worker_op_free);
+}
+
+static gboolean
+op_watch (gpointer data)
+{
+  WorkerOp *op = data;
+
+  g_signal_connect (op->connection, "notify::state",
+                    G_CALLBACK (on_connection_state_notify), op->worker);
+  /* In case it changed on the way here */
+  if (gssh_connection_get_state (op->connection) != GSSH_CONNECTION_STATE_CONNECTED)
+    on_connection_state_notify (op->connection, NULL, op->worker);
+  return FALSE;
+}
+
+/* Set on a spare's cancellable, so that a spare opened after its
+ * entry went away can still be closed on the right worker.
+ */
+#define SPARE_WORKER_KEY "hotssh-pool-worker"
+
+typedef struct {
+  GSshConnection *connection;
+  GCancellable *cancellable;
+} SpareOp;
+
+static void
+spare_op_free (gpointer data)
+{
+  SpareOp *op = data;
+
+  g_object_unref (op->connection);
+  g_object_unref (op->cancellable);
+  g_slice_free (SpareOp, op);
+}
+
+static void
+on_spare_opened (GObject      *src,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+  GCancellable *cancellable = user_data;
+  GError *local_error = NULL;
+  gs_unref_object GSshChannel *channel = NULL;
+  PoolEntry *entry;
+
+  channel = gssh_connection_open_shell_finish ((GSshConnection*)src, res, &local_error);
+  entry = lookup_connection ((GSshConnection*)src);
+  if (!entry || entry->spare_cancellable != cancellable)
+    {
+      /* Evicted meanwhile */
+      if (channel)
+        {
+          hotssh_io_worker_invoke (g_object_get_data ((GObject*)cancellable, SPARE_WORKER_KEY),
+                                   op_close_spare, channel, NULL);
+          channel = NULL;
+        }
+      goto out;
+    }
+
+  g_clear_object (&entry->spare_cancellable);
+  if (!channel)
+    goto out;
+
+  g_debug ("pool: spare channel ready for %s", entry->key);
+  entry->spare = g_object_ref (channel);
+
+ out:
+  if (local_error)
+    {
+      g_debug ("pool: opening spare channel failed: %s", local_error->message);
+      g_error_free (local_error);
+    }
+}
+
+static gboolean
+op_open_spare (gpointer data)
+{
+  SpareOp *op = data;
+  gssh_connection_open_shell_async (op->connection, op->cancellable,
+                                    hotssh_io_worker_return_callback,
+                                    hotssh_io_worker_return_to_main (on_spare_opened,
+                                                                     (GObject*)op->cancellable));
+  return FALSE;
+}
+
+static void
+ensure_spare (PoolEntry *entry)
+{
+  SpareOp *op;
+
+  if (entry->spare || entry->spare_cancellable
+      || !g_settings_get_boolean (settings, "spare-channel")
+      || entry->state != GSSH_CONNECTION_STATE_CONNECTED)
+    return;
+
+  entry->spare_cancellable = g_cancellable_new ();
+  g_object_set_data ((GObject*)entry->spare_cancellable, SPARE_WORKER_KEY, entry->worker);
+  op = g_slice_new0 (SpareOp);
+  op->connection = g_object_ref (entry->connection);
+  op->cancellable = g_object_ref (entry->spare_cancellable);
+  hotssh_io_worker_invoke (entry->worker, op_open_spare, op, spare_op_free);
+}
+
+char *
+hotssh_connection_pool_make_key (const char *username,
+                                 const char *hostname,
+                                 guint       port)
+{
+  return g_strdup_printf ("%s@%s:%u", username ? username : "", hostname, port);
+}
+
+/**
+ * hotssh_connection_pool_add:
+ * @key: From hotssh_connection_pool_make_key()
+ * @worker: The worker @connection runs on
+ * @connection: A connection that has just authenticated
+ *
+ * Offer @connection to other tabs, counting one use by the caller.
+ *
+ * Returns: %TRUE if @connection was added and must be released later;
+ * %FALSE if @key already has a connection
+ */
+gboolean
+hotssh_connection_pool_add (const char     *key,
+                            HotSshIoWorker *worker,
+                            GSshConnection *connection)
+{
+  PoolEntry *entry;
+
+  ensure_pool ();
+
+  if (g_hash_table_contains (entries_by_key, key)
+      || g_hash_table_contains (entries_by_connection, connection))
+    return FALSE;
+
+  entry = g_slice_new0 (PoolEntry);
+  entry->key = g_strdup (key);
+  entry->connection = g_object_ref (connection);
+  entry->worker = worker;
+  entry->state = GSSH_CONNECTION_STATE_CONNECTED;
+  entry->uses = 1;
+  g_hash_table_insert (entries_by_key, entry->key, entry);
+  g_hash_table_insert (entries_by_connection, connection, entry);
+  g_debug ("pool: added connection for %s", key);
+  hotssh_io_worker_invoke (worker, op_watch, worker_op_new (worker, connection), worker_op_free);
+  ensure_spare (entry);
+  return TRUE;
+}
+
+/**
+ * hotssh_connection_pool_acquire:
+ * @out_worker: (out): The worker the connection runs on
+ *
+ * Returns: (transfer full) (allow-none): A live authenticated
+ * connection for @key with a use counted against it, or %NULL
+ */
+GSshConnection *
+hotssh_connection_pool_acquire (const char      *key,
+                                HotSshIoWorker **out_worker)
+{
+  PoolEntry *entry;
+
+  if (!entries_by_key)
+    return NULL;
+
+  entry = g_hash_table_lookup (entries_by_key, key);
+  if (!entry)
+    return NULL;
+
+  /* Don't hand out something the server or network already dropped */
+  if (entry->state != GSSH_CONNECTION_STATE_CONNECTED)
+    {
+      remove_entry (entry);
+      return NULL;
+    }
+
+  if (entry->idle_id)
+    {
+      g_source_remove (entry->idle_id);
+      entry->idle_id = 0;
+    }
+  entry->uses++;
+  *out_worker = entry->worker;
+  g_debug ("pool: reusing connection for %s (%u uses)", key, entry->uses);
+  return g_object_ref (entry->connection);
+}
+
+/* Whether @key has a live connection, without using it */
+gboolean
+hotssh_connection_pool_contains (const char *key)
+{
+  PoolEntry *entry;
+
+  if (!entries_by_key)
+    return FALSE;
+
+  entry = g_hash_table_lookup (entries_by_key, key);
+  return entry != NULL && entry->state == GSSH_CONNECTION_STATE_CONNECTED;
+}
+
+/**
+ * hotssh_connection_pool_hold:
+ *
+ * Count another use of @connection, as for a new channel on a
+ * connection the caller already has.
+ *
+ * Returns: %TRUE if @connection is pooled and must be released later
+ */
+gboolean
+hotssh_connection_pool_hold (GSshConnection *connection)
+{
+  PoolEntry *entry = lookup_connection (connection);
+
+  if (!entry)
+    return FALSE;
+
+  if (entry->idle_id)
+    {
+      g_source_remove (entry->idle_id);
+      entry->idle_id = 0;
+    }
+  entry->uses++;
+  return TRUE;
+}
+
+void
+hotssh_connection_pool_release (GSshConnection *connection)
+{
+  PoolEntry *entry = lookup_connection (connection);
+  guint timeout;
+
+  if (!entry)
+    return;
+
+  g_assert (entry->uses > 0);
+  if (--entry->uses > 0)
+    return;
+
+  timeout = g_settings_get_uint (settings, "connection-pool-idle-timeout");
+  if (timeout == 0 || entry->state != GSSH_CONNECTION_STATE_CONNECTED)
+    remove_entry (entry);
+  else
+    entry->idle_id = g_timeout_add_seconds (timeout, on_idle_expired, entry);
+}
+
+/**
+ * hotssh_connection_pool_take_spare:
+ *
+ * If the spare-channel setting is on, each pooled connection keeps a
+ * shell open that nobody is using yet, so a new tab can start on it
+ * without waiting for the server.  Take it, if it is ready, and start
+ * opening the next one.
+ *
+ * Returns: (transfer full) (allow-none): An open shell channel
+ */
+GSshChannel *
+hotssh_connection_pool_take_spare (GSshConnection *connection)
+{
+  PoolEntry *entry = lookup_connection (connection);
+  GSshChannel *spare;
+
+  if (!entry)
+    return NULL;
+
+  spare = entry->spare;
+  entry->spare = NULL;
+  ensure_spare (entry);
+  return spare;
+}
+
+/**
+ * hotssh_connection_pool_discard:
+ *
+ * @connection failed; stop handing it out and close it.  Whoever
+ * still uses it keeps their own reference, and their releases are
+ * ignored.
+ */
+void
+hotssh_connection_pool_discard (GSshConnection *connection)
+{
+  PoolEntry *entry = lookup_connection (connection);
+
+  if (!entry)
+    return;
+  entry->state = GSSH_CONNECTION_STATE_ERROR;
+  remove_entry (entry);
+}
+
+/**
+ * hotssh_connection_pool_evict:
+ *
+ * The user disconnected from @connection; stop handing it out, and
+ * close it now rather than after the idle timeout unless other tabs
+ * are still using it.  Call after releasing the caller's own use.
+ */
+void
+hotssh_connection_pool_evict (GSshConnection *connection)
+{
+  PoolEntry *entry = lookup_connection (connection);
+
+  if (entry)
+    remove_entry (entry);
+}
+
+/**
+ * hotssh_connection_pool_shutdown:
+ *
+ * Drop the pool's references, which closes any connection no tab is
+ * using; must be called before the I/O workers are shut down.
+ */
+void
+hotssh_connection_pool_shutdown (void)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  if (!entries_by_key)
+    return;
+
+  g_hash_table_iter_init (&iter, entries_by_connection);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      g_hash_table_iter_remove (&iter);
+      g_hash_table_remove (entries_by_key, ((PoolEntry*)value)->key);
+      pool_entry_free (value);
+    }
+  g_clear_pointer (&entries_by_key, g_hash_table_unref);
+  g_clear_pointer (&entries_by_connection, g_hash_table_unref);
+  g_clear_object (&settings);
+}
@@ -0,0 +1,56 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "hotssh-io-worker.h"
+#include "gssh.h"
+
+G_BEGIN_DECLS
+
+/* Authenticated connections shared across every tab in the
+ * application, keyed by "user@host:port", so that opening another
+ * shell to a host already logged in to costs a channel open rather
+ * than a full login.
+ *
+ * Each tab using a pooled connection holds a use on it.  Once the last
+ * use is released the connection stays open for the
+ * connection-pool-idle-timeout setting, then is closed on its worker.
+ * Only the main thread uses the pool.
+ */
+
+char           *hotssh_connection_pool_make_key (const char      *username,
+                                                 const char      *hostname,
+                                                 guint            port);
+
+gboolean        hotssh_connection_pool_add      (const char      *key,
+                                                 HotSshIoWorker  *worker,
+                                                 GSshConnection  *connection);
+GSshConnection *hotssh_connection_pool_acquire  (const char      *key,
+                                                 HotSshIoWorker **out_worker);
+gboolean        hotssh_connection_pool_contains (const char      *key);
+gboolean        hotssh_connection_pool_hold     (GSshConnection  *connection);
+void            hotssh_connection_pool_release  (GSshConnection  *connection);
+void            hotssh_connection_pool_discard  (GSshConnection  *connection);
+void            hotssh_connection_pool_evict    (GSshConnection  *connection);
+
+GSshChannel    *hotssh_connection_pool_take_spare (GSshConnection *connection);
+
+void            hotssh_connection_pool_shutdown (void);
+
+G_END_DECLS
@@ -0,0 +1,360 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "hotssh-expect.h"
+#include "libgsystem.h"
+
+/* A response of this answers with the password given at login.  A
+ * literal response to anything that looks like a password prompt is
+ * refused, so secrets stay out of hostdb.ini.
+ */
+#define EXPECT_PASSWORD_RESPONSE "@password"
+
+typedef struct {
+  GBytes *prompt;
+  GBytes *response;             /* NULL to send the password */
+  gsize *failure;               /* KMP failure function of prompt */
+} ExpectStep;
+
+/* Where output is in an escape sequence.  SGR sequences are skipped
+ * by the matcher, so a colored prompt still matches; any other
+ * sequence breaks a partial match.
+ */
+typedef enum {
+  EXPECT_ESCAPE_NONE,
+  EXPECT_ESCAPE_ESC,
+  EXPECT_ESCAPE_CSI
+} ExpectEscapeState;
+
+struct _HotSshExpect
+{
+  GArray *steps;                /* ExpectStep */
+  guint current;
+  guint max_steps;
+  guint steps_taken;
+  gboolean repeat;
+
+  /* Length of the prompt prefix matched so far; all the state the
+   * matcher carries between reads.
+   */
+  gsize matched;
+  ExpectEscapeState escape;
+
+  char *password;
+
+  guint timeout_seconds;
+  guint timeout_id;
+
+  HotSshExpectSendFunc send_func;
+  gpointer user_data;
+};
+
+static void
+expect_step_clear (gpointer data)
+{
+  ExpectStep *step = data;
+  g_bytes_unref (step->prompt);
+  if (step->response)
+    g_bytes_unref (step->response);
+  g_free (step->failure);
+}
+
+static gsize *
+compute_failure (const guint8 *pat,
+                 gsize         len)
+{
+  gsize *failure = g_new0 (gsize, len);
+  gsize i, k = 0;
+
+  for (i = 1; i < len; i++)
+    {
+      while (k > 0 && pat[i] != pat[k])
+        k = failure[k - 1];
+      if (pat[i] == pat[k])
+        k++;
+      failure[i] = k;
+    }
+
+  return failure;
+}
+
+static gboolean
+prompt_wants_secret (const char *prompt)
+{
+  static const char * const secret_words[] = { "password", "passphrase", "passcode", "pin:" };
+  gs_free char *folded = g_ascii_strdown (prompt, -1);
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (secret_words); i++)
+    if (strstr (folded, secret_words[i]) != NULL)
+      return TRUE;
+  return FALSE;
+}
+
+static void
+stop (HotSshExpect *self)
+{
+  if (self->timeout_id)
+    {
+      g_source_remove (self->timeout_id);
+      self->timeout_id = 0;
+    }
+  self->current = self->steps->len;
+}
+
+static gboolean
+on_timeout (gpointer user_data)
+{
+  HotSshExpect *self = user_data;
+  ExpectStep *step = &g_array_index (self->steps, ExpectStep, self->current);
+  gsize len;
+  const char *prompt = g_bytes_get_data (step->prompt, &len);
+
+  g_debug ("expect: timed out waiting for \"%.*s\"", (int)len, prompt);
+  self->timeout_id = 0;
+  stop (self);
+
+  return FALSE;
+}
+
+static void
+restart_timeout (HotSshExpect *self)
+{
+  if (self->timeout_id)
+    g_source_remove (self->timeout_id);
+  self->timeout_id = 0;
+  if (self->timeout_seconds > 0 && self->current < self->steps->len)
+    self->timeout_id = g_timeout_add_seconds (self->timeout_seconds, on_timeout, self);
+}
+
+/**
+ * hotssh_expect_new:
+ * @script: Alternating prompts and responses, with C-style escapes
+ * @password: (allow-none): Sent for a response of "@password"
+ * @timeout_seconds: How long to wait for each prompt; 0 waits forever
+ * @max_steps: Stop after sending this many responses
+ * @repeat: Start over after the last step
+ * @send_func: Called with each response
+ *
+ * Returns: (allow-none): A running script, or %NULL if @script has no
+ * steps, @max_steps is 0, or it holds a literal password
+ */
+HotSshExpect *
+hotssh_expect_new (const char * const   *script,
+                   const char           *password,
+                   guint                 timeout_seconds,
+                   guint                 max_steps,
+                   gboolean              repeat,
+                   HotSshExpectSendFunc  send_func,
+                   gpointer              user_data)
+{
+  HotSshExpect *self;
+  guint n = script ? g_strv_length ((char**)script) : 0;
+  guint i;
+
+  if (n % 2 != 0)
+    g_warning ("expect: ignoring prompt \"%s\" with no response", script[n - 1]);
+  if (n < 2 || max_steps == 0)
+    return NULL;
+
+  self = g_slice_new0 (HotSshExpect);
+  self->steps = g_array_sized_new (FALSE, TRUE, sizeof (ExpectStep), n / 2);
+  g_array_set_clear_func (self->steps, expect_step_clear);
+
+  for (i = 0; i + 1 < n; i += 2)
+    {
+      char *prompt = g_strcompress (script[i]);
+      ExpectStep step;
+
+      if (*prompt == '\0')
+        {
+          g_free (prompt);
+          continue;
+        }
+
+      if (strcmp (script[i + 1], EXPECT_PASSWORD_RESPONSE) == 0)
+        step.response = NULL;
+      else if (prompt_wants_secret (prompt))
+        {
+          g_warning ("expect: refusing script with a literal response to \"%s\"; "
+                     "use \"" EXPECT_PASSWORD_RESPONSE "\" instead", script[i]);
+          g_free (prompt);
+          hotssh_expect_free (self);
+          return NULL;
+        }
+      else
+        {
+          char *response = g_strcompress (script[i + 1]);
+          step.response = g_bytes_new_take (response, strlen (response));
+        }
+
+      step.failure = compute_failure ((guint8*)prompt, strlen (prompt));
+      step.prompt = g_bytes_new_take (prompt, strlen (prompt));
+      g_array_append_val (self->steps, step);
+    }
+
+  if (self->steps->len == 0)
+    {
+      hotssh_expect_free (self);
+      return NULL;
+    }
+
+  self->password = g_strdup (password);
+  self->max_steps = max_steps;
+  self->repeat = repeat;
+  self->timeout_seconds = timeout_seconds;
+  self->send_func = send_func;
+  self->user_data = user_data;
+
+  restart_timeout (self);
+
+  return self;
+}
+
+void
+hotssh_expect_free (HotSshExpect *self)
+{
+  stop (self);
+  g_array_unref (self->steps);
+  if (self->password)
+    {
+      memset (self->password, 0, strlen (self->password));
+      g_free (self->password);
+    }
+  g_slice_free (HotSshExpect, self);
+}
+
+gboolean
+hotssh_expect_is_running (HotSshExpect *self)
+{
+  return self->current < self->steps->len;
+}
+
+static void
+send_response (HotSshExpect *self,
+               ExpectStep   *step)
+{
+  gsize rlen;
+  const guint8 *response;
+
+  if (step->response)
+    {
+      response = g_bytes_get_data (step->response, &rlen);
+      self->send_func (response, rlen, FALSE, self->user_data);
+    }
+  else if (self->password)
+    {
+      self->send_func ((const guint8*)self->password, strlen (self->password),
+                       TRUE, self->user_data);
+      self->send_func ((const guint8*)"\r", 1, FALSE, self->user_data);
+    }
+}
+
+/**
+ * hotssh_expect_feed:
+ *
+ * Advance the script over the next chunk of output.  Nothing is
+ * buffered; a prompt split across reads is tracked by the length of
+ * its prefix matched so far, and an escape sequence by how far into
+ * it we are.
+ */
+void
+hotssh_expect_feed (HotSshExpect *self,
+                    const guint8 *buf,
+                    gsize         len)
+{
+  const guint8 *p = buf;
+  const guint8 *end = buf + len;
+
+  for (; p < end && hotssh_expect_is_running (self); p++)
+    {
+      ExpectStep *step = &g_array_index (self->steps, ExpectStep, self->current);
+      gsize plen;
+      const guint8 *prompt = g_bytes_get_data (step->prompt, &plen);
+      guint8 c = *p;
+
+      if (c == '\033')
+        {
+          if (self->escape != EXPECT_ESCAPE_NONE)
+            self->matched = 0;
+          self->escape = EXPECT_ESCAPE_ESC;
+          continue;
+        }
+
+      switch (self->escape)
+        {
+        case EXPECT_ESCAPE_NONE:
+          break;
+        case EXPECT_ESCAPE_ESC:
+          if (c == '[')
+            self->escape = EXPECT_ESCAPE_CSI;
+          else
+            {
+              self->escape = EXPECT_ESCAPE_NONE;
+              self->matched = 0;
+            }
+          continue;
+        case EXPECT_ESCAPE_CSI:
+          if (c >= 0x40 && c <= 0x7e)
+            {
+              self->escape = EXPECT_ESCAPE_NONE;
+              if (c != 'm')
+                self->matched = 0;
+            }
+          continue;
+        }
+
+      while (self->matched > 0 && c != prompt[self->matched])
+        self->matched = step->failure[self->matched - 1];
+      if (c == prompt[self->matched])
+        self->matched++;
+
+      if (self->matched == plen)
+        {
+          if (!step->response && !self->password)
+            {
+              g_debug ("expect: no password to answer step %u", self->current);
+              stop (self);
+              break;
+            }
+
+          g_debug ("expect: matched step %u", self->current);
+          self->matched = 0;
+          self->current++;
+          if (self->repeat && self->current == self->steps->len)
+            self->current = 0;
+          self->steps_taken++;
+          send_response (self, step);
+
+          if (self->steps_taken >= self->max_steps)
+            {
+              g_debug ("expect: step limit of %u reached", self->max_steps);
+              stop (self);
+            }
+          else
+            restart_timeout (self);
+        }
+    }
+
+  if (!hotssh_expect_is_running (self))
+    stop (self);
+}
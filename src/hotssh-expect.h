@@ -0,0 +1,58 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Runs a per-host expect/send script against a channel's output.  The
+ * script is a list of alternating prompt and response strings; each
+ * prompt is waited for in turn and answered as soon as its last byte
+ * arrives.  A repeating script starts over after its last step, for
+ * confirmations that keep coming; the step limit bounds it.  Secrets
+ * never appear in the script: a response of "@password" sends the
+ * password given at login.
+ */
+typedef struct _HotSshExpect HotSshExpect;
+
+/* @secret is set when @buf is the password, which must not be
+ * recorded or logged.
+ */
+typedef void (*HotSshExpectSendFunc) (const guint8 *buf,
+                                      gsize         len,
+                                      gboolean      secret,
+                                      gpointer      user_data);
+
+HotSshExpect  *hotssh_expect_new         (const char * const   *script,
+                                          const char           *password,
+                                          guint                 timeout_seconds,
+                                          guint                 max_steps,
+                                          gboolean              repeat,
+                                          HotSshExpectSendFunc  send_func,
+                                          gpointer              user_data);
+void           hotssh_expect_free        (HotSshExpect         *self);
+
+gboolean       hotssh_expect_is_running  (HotSshExpect         *self);
+
+void           hotssh_expect_feed        (HotSshExpect         *self,
+                                          const guint8         *buf,
+                                          gsize                 len);
+
+G_END_DECLS
@@ -0,0 +1,399 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib/gi18n.h>
+
+#include "hotssh-fleet-window.h"
+#include "hotssh-fleet.h"
+#include "hotssh-hostdb.h"
+#include "hotssh-tab.h"
+
+#include "libgsystem.h"
+
+/* Only this much of a group's output is put in the text view */
+#define DISPLAY_MAX (256 * 1024)
+
+enum {
+  GROUPS_COLUMN_LABEL,
+  GROUPS_COLUMN_GROUP
+};
+
+struct _HotSshFleetWindow
+{
+  GtkWindow parent;
+};
+
+struct _HotSshFleetWindowClass
+{
+  GtkWindowClass parent_class;
+};
+
+typedef struct _HotSshFleetWindowPrivate HotSshFleetWindowPrivate;
+
+struct _HotSshFleetWindowPrivate
+{
+  GSettings *settings;
+  HotSshFleet *fleet;
+  /* Top level row for each group, by group number */
+  GPtrArray *group_rows;        /* GtkTreeRowReference */
+
+  /* Bound via template */
+  GtkWidget *hosts_entry;
+  GtkWidget *command_entry;
+  GtkWidget *run_button;
+  GtkWidget *cancel_button;
+  GtkWidget *progress_label;
+  GtkWidget *groups_view;
+  GtkWidget *output_view;
+  GtkTreeStore *groups_store;
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE(HotSshFleetWindow, hotssh_fleet_window, GTK_TYPE_WINDOW)
+
+static void
+clear_fleet (HotSshFleetWindow *self)
+{
+  HotSshFleetWindowPrivate *priv = hotssh_fleet_window_get_instance_private (self);
+
+  if (!priv->fleet)
+    return;
+
+  g_signal_handlers_disconnect_by_data (priv->fleet, self);
+  hotssh_fleet_cancel (priv->fleet);
+  g_clear_object (&priv->fleet);
+}
+
+static char *
+group_label (HotSshFleet *fleet,
+             guint        group)
+{
+  gs_unref_ptrarray GPtrArray *hosts = hotssh_fleet_get_group_hosts (fleet, group);
+  const char *error = hotssh_fleet_get_group_error (fleet, group);
+
+  if (error)
+    return g_strdup_printf (ngettext ("%s (%u host)", "%s (%u hosts)", hosts->len),
+                            error, hosts->len);
+  return g_strdup_printf (ngettext ("Exit status %d (%u host)", "Exit status %d (%u hosts)", hosts->len),
+                          hotssh_fleet_get_group_status (fleet, group), hosts->len);
+}
+
+static void
+update_group_row (HotSshFleetWindow *self,
+                  guint              group)
+{
+  HotSshFleetWindowPrivate *priv = hotssh_fleet_window_get_instance_private (self);
+  gs_unref_ptrarray GPtrArray *hosts = hotssh_fleet_get_group_hosts (priv->fleet, group);
+  gs_free char *label = group_label (priv->fleet, group);
+  GtkTreePath *path;
+  GtkTreeIter iter;
+  GtkTreeIter child;
+
+  path = gtk_tree_row_reference_get_path (priv->group_rows->pdata[group]);
+  gtk_tree_model_get_iter ((GtkTreeModel*)priv->groups_store, &iter, path);
+  gtk_tree_path_free (path);
+  gtk_tree_store_set (priv->groups_store, &iter,
+                      GROUPS_COLUMN_LABEL, label,
+                      -1);
+  /* Hosts are only ever added, one at a time, at the end */
+  gtk_tree_store_append (priv->groups_store, &child, &iter);
+  gtk_tree_store_set (priv->groups_store, &child,
+                      GROUPS_COLUMN_LABEL, hosts->pdata[hosts->len - 1],
+                      GROUPS_COLUMN_GROUP, group,
+                      -1);
+}
+
+static void
+on_group_added (HotSshFleet       *fleet,
+                guint              group,
+                HotSshFleetWindow *self)
+{
+  HotSshFleetWindowPrivate *priv = hotssh_fleet_window_get_instance_private (self);
+  GtkTreePath *path;
+  GtkTreeIter iter;
+
+  gtk_tree_store_append (priv->groups_store, &iter, NULL);
+  gtk_tree_store_set (priv->groups_store, &iter,
+                      GROUPS_COLUMN_GROUP, group,
+                      -1);
+  path = gtk_tree_model_get_path ((GtkTreeModel*)priv->groups_store, &iter);
+  g_ptr_array_add (priv->group_rows,
+                   gtk_tree_row_reference_new ((GtkTreeModel*)priv->groups_store, path));
+  gtk_tree_path_free (path);
+  update_group_row (self, group);
+}
+
+static void
+on_group_changed (HotSshFleet       *fleet,
+                  guint              group,
+                  HotSshFleetWindow *self)
+{
+  update_group_row (self, group);
+}
+
+static void
+on_progress (HotSshFleet       *fleet,
+             HotSshFleetWindow *self)
+{
+  HotSshFleetWindowPrivate *priv = hotssh_fleet_window_get_instance_private (self);
+  gs_free char *text = NULL;
+  guint done, running, total;
+
+  hotssh_fleet_get_progress (fleet, &done, &running, &total);
+  text = g_strdup_printf (_("%u of %u hosts done, %u in progress"), done, total, running);
+  gtk_label_set_text ((GtkLabel*)priv->progress_label, text);
+}
+
+static void
+on_finished (HotSshFleet       *fleet,
+             HotSshFleetWindow *self)
+{
+  HotSshFleetWindowPrivate *priv = hotssh_fleet_window_get_instance_private (self);
+
+  on_progress (fleet, self);
+  gtk_widget_set_sensitive (priv->run_button, TRUE);
+  gtk_widget_set_sensitive (priv->cancel_button, FALSE);
+}
+
+/* Every connected tab in the application, by hostdb entry, so that a
+ * host already open gets a channel on that connection.
+ */
+static GHashTable *
+collect_connections (HotSshFleetWindow *self)
+{
+  GHashTable *connections = g_hash_table_new (g_str_hash, g_str_equal);
+  GtkApplication *app = gtk_window_get_application ((GtkWindow*)self);
+  GList *l;
+
+  if (!app)
+    return connections;
+
+  for (l = gtk_application_get_windows (app); l; l = l->next)
+    {
+      GList *tabs;
+      GList *ll;
+
+      if (!HOTSSH_IS_WINDOW (l->data))
+        continue;
+
+      tabs = hotssh_window_get_tabs (l->data);
+      for (ll = tabs; ll; ll = ll->next)
+        {
+          GSshConnection *connection = hotssh_tab_get_connection (ll->data);
+          const char *id = hotssh_tab_get_connection_id (ll->data);
+          if (connection && id)
+            g_hash_table_replace (connections, (char*)id, connection);
+        }
+      g_list_free (tabs);
+    }
+
+  return connections;
+}
+
+static void
+on_run_clicked (HotSshFleetWindow *self)
+{
+  HotSshFleetWindowPrivate *priv = hotssh_fleet_window_get_instance_private (self);
+  const char *command = gtk_entry_get_text ((GtkEntry*)priv->command_entry);
+  const char *pattern = gtk_entry_get_text ((GtkEntry*)priv->hosts_entry);
+  gs_unref_object GtkTreeModel *model = NULL;
+  gs_unref_hashtable GHashTable *connections = NULL;
+  GPatternSpec *spec = NULL;
+  GtkTreeIter iter;
+
+  if (!gtk_widget_get_sensitive (priv->run_button))
+    return;
+  if (*command == '\0')
+    {
+      gtk_widget_grab_focus (priv->command_entry);
+      return;
+    }
+
+  clear_fleet (self);
+  g_ptr_array_set_size (priv->group_rows, 0);
+  gtk_tree_store_clear (priv->groups_store);
+  gtk_text_buffer_set_text (gtk_text_view_get_buffer ((GtkTextView*)priv->output_view), "", -1);
+
+  priv->fleet = hotssh_fleet_new (command,
+                                  g_settings_get_uint (priv->settings, "fleet-concurrency"),
+                                  g_settings_get_uint (priv->settings, "fleet-timeout"));
+  g_signal_connect (priv->fleet, "group-added", G_CALLBACK (on_group_added), self);
+  g_signal_connect (priv->fleet, "group-changed", G_CALLBACK (on_group_changed), self);
+  g_signal_connect (priv->fleet, "progress", G_CALLBACK (on_progress), self);
+  g_signal_connect (priv->fleet, "finished", G_CALLBACK (on_finished), self);
+
+  if (*pattern)
+    spec = g_pattern_spec_new (pattern);
+  connections = collect_connections (self);
+  model = hotssh_hostdb_get_model (hotssh_hostdb_get_instance ());
+  if (gtk_tree_model_get_iter_first (model, &iter))
+    {
+      do
+        {
+          gs_free char *id = NULL;
+          gs_free char *hostname = NULL;
+
+          gtk_tree_model_get (model, &iter,
+                              HOTSSH_HOSTDB_COLUMN_ID, &id,
+                              HOTSSH_HOSTDB_COLUMN_HOSTNAME, &hostname,
+                              -1);
+          if (spec && !g_pattern_match_string (spec, hostname))
+            continue;
+          hotssh_fleet_add_host (priv->fleet, id, g_hash_table_lookup (connections, id));
+        }
+      while (gtk_tree_model_iter_next (model, &iter));
+    }
+  if (spec)
+    g_pattern_spec_free (spec);
+
+  gtk_widget_set_sensitive (priv->run_button, FALSE);
+  gtk_widget_set_sensitive (priv->cancel_button, TRUE);
+  hotssh_fleet_start (priv->fleet);
+}
+
+static void
+on_cancel_clicked (HotSshFleetWindow *self)
+{
+  HotSshFleetWindowPrivate *priv = hotssh_fleet_window_get_instance_private (self);
+
+  if (priv->fleet)
+    hotssh_fleet_cancel (priv->fleet);
+}
+
+/* The text view only takes UTF-8; show anything else as
+ * replacement characters rather than nothing.
+ */
+static void
+append_output (GString      *text,
+               const char   *buf,
+               gsize         len)
+{
+  const char *end;
+
+  while (!g_utf8_validate (buf, len, &end))
+    {
+      g_string_append_len (text, buf, end - buf);
+      g_string_append (text, "\xEF\xBF\xBD");
+      len -= (end - buf) + 1;
+      buf = end + 1;
+    }
+  g_string_append_len (text, buf, len);
+}
+
+static void
+on_group_selection_changed (HotSshFleetWindow *self,
+                            GtkTreeSelection  *selection)
+{
+  HotSshFleetWindowPrivate *priv = hotssh_fleet_window_get_instance_private (self);
+  GtkTextBuffer *buffer = gtk_text_view_get_buffer ((GtkTextView*)priv->output_view);
+  gs_unref_bytes GBytes *output = NULL;
+  GString *text = NULL;
+  GError *local_error = NULL;
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  guint group;
+  guint64 total;
+  const char *error;
+
+  if (!priv->fleet || !gtk_tree_selection_get_selected (selection, &model, &iter))
+    return;
+
+  gtk_tree_model_get (model, &iter, GROUPS_COLUMN_GROUP, &group, -1);
+  text = g_string_new ("");
+
+  error = hotssh_fleet_get_group_error (priv->fleet, group);
+  if (error)
+    {
+      g_string_append (text, error);
+      goto out;
+    }
+
+  output = hotssh_fleet_read_group_output (priv->fleet, group, DISPLAY_MAX, &total, &local_error);
+  if (!output)
+    {
+      g_string_append (text, local_error->message);
+      g_clear_error (&local_error);
+      goto out;
+    }
+
+  append_output (text, g_bytes_get_data (output, NULL), g_bytes_get_size (output));
+  if (total > g_bytes_get_size (output))
+    {
+      gs_free char *size = g_format_size (total - g_bytes_get_size (output));
+      g_string_append_printf (text, _("\n[%s more not shown]\n"), size);
+    }
+
+ out:
+  gtk_text_buffer_set_text (buffer, text->str, text->len);
+  g_string_free (text, TRUE);
+}
+
+static void
+hotssh_fleet_window_init (HotSshFleetWindow *self)
+{
+  HotSshFleetWindowPrivate *priv = hotssh_fleet_window_get_instance_private (self);
+
+  gtk_widget_init_template (GTK_WIDGET (self));
+  priv->settings = g_settings_new ("org.gnome.hotssh");
+  priv->group_rows = g_ptr_array_new_with_free_func ((GDestroyNotify)gtk_tree_row_reference_free);
+}
+
+static void
+hotssh_fleet_window_dispose (GObject *object)
+{
+  HotSshFleetWindow *self = HOTSSH_FLEET_WINDOW (object);
+  HotSshFleetWindowPrivate *priv = hotssh_fleet_window_get_instance_private (self);
+
+  clear_fleet (self);
+  g_clear_pointer (&priv->group_rows, g_ptr_array_unref);
+  g_clear_object (&priv->settings);
+
+  G_OBJECT_CLASS (hotssh_fleet_window_parent_class)->dispose (object);
+}
+
+static void
+hotssh_fleet_window_class_init (HotSshFleetWindowClass *class)
+{
+  G_OBJECT_CLASS (class)->dispose = hotssh_fleet_window_dispose;
+
+  gtk_widget_class_set_template_from_resource (GTK_WIDGET_CLASS (class),
+                                               "/org/gnome/hotssh/fleet-window.ui");
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshFleetWindow, hosts_entry);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshFleetWindow, command_entry);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshFleetWindow, run_button);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshFleetWindow, cancel_button);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshFleetWindow, progress_label);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshFleetWindow, groups_view);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshFleetWindow, output_view);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshFleetWindow, groups_store);
+
+  gtk_widget_class_bind_template_callback (GTK_WIDGET_CLASS (class), on_run_clicked);
+  gtk_widget_class_bind_template_callback (GTK_WIDGET_CLASS (class), on_cancel_clicked);
+  gtk_widget_class_bind_template_callback (GTK_WIDGET_CLASS (class), on_group_selection_changed);
+}
+
+HotSshFleetWindow *
+hotssh_fleet_window_new (HotSshWindow *win)
+{
+  return g_object_new (HOTSSH_TYPE_FLEET_WINDOW,
+                       "transient-for", win,
+                       "application", gtk_window_get_application ((GtkWindow*)win),
+                       NULL);
+}
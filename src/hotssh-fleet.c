@@ -0,0 +1,1298 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <glib/gi18n.h>
+
+#include "hotssh-fleet.h"
+#include "hotssh-channel-pump.h"
+#include "hotssh-connection-info.h"
+#include "hotssh-gssapi.h"
+#include "hotssh-hostdb.h"
+#include "hotssh-io-worker.h"
+
+#include "libgsystem.h"
+
+/* Only the script goes in; keep the ring small */
+#define WRITE_BUFFER_SIZE 4096
+/* Output is collected this much at a time before going to disk */
+#define OUTPUT_BUFFER_SIZE 4096
+/* Whatever a login prints before our marker is thrown away; don't
+ * hold on to more than this of it while looking.
+ */
+#define PREAMBLE_MAX (64 * 1024)
+
+#define BEGIN_MARKER "HOTSSH-BEGIN-"
+#define END_MARKER "HOTSSH-END-"
+
+#define JOB_DATA_KEY "hotssh-fleet-job"
+#define WORKER_DATA_KEY "hotssh-fleet-worker"
+
+struct _HotSshFleet
+{
+  GObject parent;
+};
+
+struct _HotSshFleetClass
+{
+  GObjectClass parent_class;
+};
+
+typedef struct {
+  guint64 offset;
+  guint64 length;
+} FleetExtent;
+
+typedef enum {
+  JOB_STATE_PREAMBLE,
+  JOB_STATE_BODY,
+  JOB_STATE_STATUS
+} FleetJobState;
+
+typedef struct _HotSshFleetPrivate HotSshFleetPrivate;
+
+typedef struct {
+  HotSshFleet *fleet;
+  char *connection_id;
+  char *hostname;
+  char *username;
+  guint port;
+
+  HotSshIoWorker *worker;
+  GSshConnection *connection;
+  gboolean reused;
+  GArray *auth_mechanisms;
+  GSshConnectionAuthMechanism auth_mech;
+  gboolean tried_gssapi;
+  GCancellable *cancellable;
+  GSshChannel *channel;
+  HotSshChannelPump *pump;
+  guint timeout_id;
+
+  char *script;
+  gsize script_written;
+
+  FleetJobState state;
+  GByteArray *pending;
+  guint8 *outbuf;
+  gsize outbuf_len;
+  GArray *extents;              /* FleetExtent */
+  guint64 total;
+  GChecksum *checksum;
+} FleetJob;
+
+typedef struct {
+  char *key;
+  GPtrArray *hosts;
+  int status;
+  char *error;
+  GArray *extents;              /* FleetExtent */
+  guint64 total;
+} FleetGroup;
+
+struct _HotSshFleetPrivate
+{
+  char *command;
+  char *begin_marker;
+  char *end_marker;
+  guint concurrency;
+  guint timeout_seconds;
+
+  GQueue pending;               /* FleetJob */
+  GHashTable *running;          /* set of FleetJob */
+  guint n_done;
+  guint n_total;
+  gboolean started;
+  gboolean cancelled;
+
+  GPtrArray *groups;            /* FleetGroup */
+  GHashTable *group_index;      /* key -> group number + 1 */
+
+  int spill_fd;
+  guint64 spill_size;
+  gboolean spill_failed;
+};
+
+enum {
+  SIGNAL_GROUP_ADDED,
+  SIGNAL_GROUP_CHANGED,
+  SIGNAL_PROGRESS,
+  SIGNAL_FINISHED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+G_DEFINE_TYPE_WITH_PRIVATE(HotSshFleet, hotssh_fleet, G_TYPE_OBJECT)
+
+static void start_jobs (HotSshFleet *self);
+
+typedef struct {
+  GSshConnection *connection;
+  GSshChannel *channel;
+} JobRelease;
+
+/* Close the job's channel, so that a command still running on it,
+ * e.g. on a connection borrowed from a tab, is hung up on rather than
+ * left behind; then drop the connection.  Runs on the worker, which
+ * owns both.
+ */
+static gboolean
+op_release_job (gpointer data)
+{
+  JobRelease *release = data;
+
+  if (release->channel)
+    {
+      g_io_stream_close_async ((GIOStream*)release->channel, G_PRIORITY_DEFAULT,
+                               NULL, NULL, NULL);
+      g_object_unref (release->channel);
+    }
+  g_clear_object (&release->connection);
+  g_slice_free (JobRelease, release);
+  return FALSE;
+}
+
+static void
+fleet_job_free (FleetJob *job)
+{
+  if (job->connection || job->channel)
+    {
+      JobRelease *release = g_slice_new0 (JobRelease);
+      /* A job still pending has no worker yet; it would get this one */
+      HotSshIoWorker *worker = job->worker ? job->worker :
+        hotssh_io_worker_get_for_key (job->connection_id);
+
+      release->connection = job->connection;
+      release->channel = job->channel;
+      job->connection = NULL;
+      job->channel = NULL;
+      hotssh_io_worker_invoke (worker, op_release_job, release, NULL);
+    }
+
+  g_free (job->connection_id);
+  g_free (job->hostname);
+  g_free (job->username);
+  g_clear_object (&job->cancellable);
+  g_clear_pointer (&job->auth_mechanisms, g_array_unref);
+  g_free (job->script);
+  if (job->pending)
+    g_byte_array_unref (job->pending);
+  g_free (job->outbuf);
+  if (job->extents)
+    g_array_unref (job->extents);
+  if (job->checksum)
+    g_checksum_free (job->checksum);
+  g_slice_free (FleetJob, job);
+}
+
+static void
+fleet_group_free (gpointer data)
+{
+  FleetGroup *group = data;
+
+  g_free (group->key);
+  g_ptr_array_unref (group->hosts);
+  g_free (group->error);
+  g_array_unref (group->extents);
+  g_slice_free (FleetGroup, group);
+}
+
+static gboolean
+spill_write (HotSshFleet  *self,
+             const guint8 *buf,
+             gsize         len,
+             guint64      *out_offset)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  guint64 offset;
+
+  if (priv->spill_failed)
+    return FALSE;
+
+  if (priv->spill_fd < 0)
+    {
+      gs_free char *path = NULL;
+
+      priv->spill_fd = g_file_open_tmp ("hotssh-fleet-XXXXXX", &path, NULL);
+      if (priv->spill_fd < 0)
+        {
+          priv->spill_failed = TRUE;
+          return FALSE;
+        }
+      (void) g_unlink (path);
+    }
+
+  offset = priv->spill_size;
+  *out_offset = offset;
+  while (len > 0)
+    {
+      gssize n = pwrite (priv->spill_fd, buf, len, offset);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          priv->spill_failed = TRUE;
+          return FALSE;
+        }
+      buf += n;
+      len -= n;
+      offset += n;
+    }
+  priv->spill_size = offset;
+  return TRUE;
+}
+
+static void
+job_flush_output (FleetJob *job)
+{
+  FleetExtent extent;
+
+  if (job->outbuf_len == 0)
+    return;
+
+  extent.length = job->outbuf_len;
+  job->outbuf_len = 0;
+  if (!spill_write (job->fleet, job->outbuf, extent.length, &extent.offset))
+    return;
+
+  /* Jobs interleave in the file; only merge when nobody else wrote */
+  if (job->extents->len > 0)
+    {
+      FleetExtent *last = &g_array_index (job->extents, FleetExtent, job->extents->len - 1);
+      if (last->offset + last->length == extent.offset)
+        {
+          last->length += extent.length;
+          return;
+        }
+    }
+  g_array_append_val (job->extents, extent);
+}
+
+/* Append command output, turning the pty's CRLF back into LF.  A
+ * trailing CR is never passed in; callers hold it back until they know
+ * what follows.
+ */
+static void
+job_emit_output (FleetJob     *job,
+                 const guint8 *buf,
+                 gsize         len)
+{
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    {
+      if (buf[i] == '\r' && i + 1 < len && buf[i + 1] == '\n')
+        continue;
+      job->outbuf[job->outbuf_len++] = buf[i];
+      if (job->outbuf_len == OUTPUT_BUFFER_SIZE)
+        {
+          g_checksum_update (job->checksum, job->outbuf, job->outbuf_len);
+          job->total += job->outbuf_len;
+          job_flush_output (job);
+        }
+    }
+}
+
+static void
+job_finish_output (FleetJob *job)
+{
+  g_checksum_update (job->checksum, job->outbuf, job->outbuf_len);
+  job->total += job->outbuf_len;
+  job_flush_output (job);
+}
+
+static gssize
+find_bytes (const guint8 *haystack,
+            gsize         haystack_len,
+            const char   *needle)
+{
+  gsize needle_len = strlen (needle);
+  gsize i;
+
+  if (haystack_len < needle_len)
+    return -1;
+  for (i = 0; i + needle_len <= haystack_len; i++)
+    if (haystack[i] == (guint8)needle[0]
+        && memcmp (haystack + i, needle, needle_len) == 0)
+      return i;
+  return -1;
+}
+
+static guint
+add_group (HotSshFleet *self,
+           const char  *key,
+           FleetJob    *job,
+           int          status,
+           const char  *error)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  gpointer index;
+  FleetGroup *group;
+  guint n;
+
+  if (g_hash_table_lookup_extended (priv->group_index, key, NULL, &index))
+    {
+      n = GPOINTER_TO_UINT (index) - 1;
+      group = priv->groups->pdata[n];
+      g_ptr_array_add (group->hosts, g_strdup (job->hostname));
+      g_signal_emit (self, signals[SIGNAL_GROUP_CHANGED], 0, n);
+      return n;
+    }
+
+  group = g_slice_new0 (FleetGroup);
+  group->key = g_strdup (key);
+  group->hosts = g_ptr_array_new_with_free_func (g_free);
+  g_ptr_array_add (group->hosts, g_strdup (job->hostname));
+  group->status = status;
+  group->error = g_strdup (error);
+  if (job->extents)
+    {
+      group->extents = g_array_ref (job->extents);
+      group->total = job->total;
+    }
+  else
+    group->extents = g_array_new (FALSE, FALSE, sizeof (FleetExtent));
+
+  n = priv->groups->len;
+  g_ptr_array_add (priv->groups, group);
+  g_hash_table_insert (priv->group_index, g_strdup (key), GUINT_TO_POINTER (n + 1));
+  g_signal_emit (self, signals[SIGNAL_GROUP_ADDED], 0, n);
+  return n;
+}
+
+/* Retire @job, either with an exit status or with @error set.  Output
+ * for a job that failed is dropped; the group only says why.
+ */
+static void
+finish_job (FleetJob    *job,
+            int          status,
+            const char  *error)
+{
+  HotSshFleet *self = job->fleet;
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  gs_free char *key = NULL;
+
+  if (job->timeout_id)
+    {
+      g_source_remove (job->timeout_id);
+      job->timeout_id = 0;
+    }
+  if (job->pump)
+    {
+      hotssh_channel_pump_stop (job->pump);
+      job->pump = NULL;
+    }
+  if (job->cancellable)
+    {
+      g_cancellable_cancel (job->cancellable);
+      g_object_set_data ((GObject*)job->cancellable, JOB_DATA_KEY, NULL);
+    }
+  g_hash_table_remove (priv->running, job);
+
+  if (error)
+    {
+      key = g_strconcat ("E", error, NULL);
+      g_clear_pointer (&job->extents, g_array_unref);
+      add_group (self, key, job, -1, error);
+    }
+  else
+    {
+      job_finish_output (job);
+      key = g_strdup_printf ("%d:%s", status, g_checksum_get_string (job->checksum));
+      add_group (self, key, job, status, NULL);
+    }
+
+  priv->n_done++;
+  fleet_job_free (job);
+
+  g_signal_emit (self, signals[SIGNAL_PROGRESS], 0);
+  start_jobs (self);
+}
+
+static void
+fail_job (FleetJob   *job,
+          GError     *error)
+{
+  finish_job (job, -1, error->message);
+  g_error_free (error);
+}
+
+static gboolean
+on_job_timeout (gpointer user_data)
+{
+  FleetJob *job = user_data;
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (job->fleet);
+  gs_free char *msg = g_strdup_printf (_("Timed out after %u seconds"), priv->timeout_seconds);
+
+  job->timeout_id = 0;
+  finish_job (job, -1, msg);
+  return FALSE;
+}
+
+/* Look up the job a completed operation belongs to; NULL if it has
+ * already finished one way or another.  Operations return to the main
+ * thread with the job's cancellable as their callback data, which
+ * leads back to the job until it finishes; the connection can't, as
+ * jobs may share one.
+ */
+static FleetJob *
+lookup_job (gpointer target)
+{
+  return g_object_get_data (target, JOB_DATA_KEY);
+}
+
+/* The worker the job's connection and channels live on, still known
+ * once the job is gone.
+ */
+static HotSshIoWorker *
+lookup_worker (gpointer target)
+{
+  return g_object_get_data (target, WORKER_DATA_KEY);
+}
+
+typedef struct {
+  GSshConnection *connection;
+  GCancellable *cancellable;
+  GSshConnectionAuthMechanism mech;
+  GAsyncReadyCallback callback;
+} FleetOp;
+
+static FleetOp *
+fleet_op_new (FleetJob            *job,
+              GAsyncReadyCallback  callback)
+{
+  FleetOp *op = g_slice_new0 (FleetOp);
+
+  op->connection = g_object_ref (job->connection);
+  op->cancellable = g_object_ref (job->cancellable);
+  op->callback = callback;
+
+  return op;
+}
+
+static void
+fleet_op_free (gpointer data)
+{
+  FleetOp *op = data;
+
+  g_clear_object (&op->connection);
+  g_clear_object (&op->cancellable);
+  g_slice_free (FleetOp, op);
+}
+
+static gpointer
+fleet_op_return (FleetOp *op)
+{
+  return hotssh_io_worker_return_to_main (op->callback, (GObject*)op->cancellable);
+}
+
+static void
+on_handshake_complete (GObject      *src,
+                       GAsyncResult *res,
+                       gpointer      user_data);
+
+/* Made on the worker, then handed to the main thread */
+typedef struct {
+  HotSshIoWorker *worker;
+  GSocketConnectable *address;
+  char *username;
+  GCancellable *cancellable;
+  GSshConnection *connection;
+} CreateOp;
+
+static void
+create_op_free (gpointer data)
+{
+  CreateOp *op = data;
+
+  g_object_unref (op->address);
+  g_free (op->username);
+  g_object_unref (op->cancellable);
+  hotssh_io_worker_release (op->worker, op->connection);
+  g_slice_free (CreateOp, op);
+}
+
+static gboolean
+on_connection_created (gpointer data)
+{
+  CreateOp *op = data;
+  FleetJob *job = lookup_job (op->cancellable);
+
+  /* Finished meanwhile */
+  if (!job)
+    return FALSE;
+
+  job->connection = op->connection;
+  op->connection = NULL;
+  return FALSE;
+}
+
+static gboolean
+op_create_connection (gpointer data)
+{
+  CreateOp *op = data;
+
+  op->connection = gssh_connection_new (op->address, op->username);
+  /* Started here so that no hop back to the main thread is needed */
+  gssh_connection_handshake_async (op->connection, op->cancellable,
+                                   hotssh_connection_info_return_handshake,
+                                   hotssh_io_worker_return_to_main (on_handshake_complete,
+                                                                    (GObject*)op->cancellable));
+  hotssh_io_worker_invoke_main (on_connection_created, op, create_op_free);
+  return FALSE;
+}
+
+static gboolean
+op_negotiate (gpointer data)
+{
+  FleetOp *op = data;
+  gssh_connection_negotiate_async (op->connection, op->cancellable,
+                                   hotssh_connection_info_return_negotiate, fleet_op_return (op));
+  return FALSE;
+}
+
+static gboolean
+op_auth (gpointer data)
+{
+  FleetOp *op = data;
+  gssh_connection_auth_async (op->connection, op->mech, op->cancellable,
+                              hotssh_io_worker_return_callback, fleet_op_return (op));
+  return FALSE;
+}
+
+static gboolean
+op_open_shell (gpointer data)
+{
+  FleetOp *op = data;
+  gssh_connection_open_shell_async (op->connection, op->cancellable,
+                                    hotssh_io_worker_return_callback, fleet_op_return (op));
+  return FALSE;
+}
+
+static void
+run_op (FleetJob    *job,
+        GSourceFunc  func,
+        FleetOp     *op)
+{
+  hotssh_io_worker_invoke (job->worker, func, op, fleet_op_free);
+}
+
+static void
+write_script (FleetJob *job)
+{
+  gsize len = strlen (job->script);
+
+  if (job->script_written < len)
+    job->script_written +=
+      hotssh_channel_pump_write (job->pump,
+                                 (guint8*)job->script + job->script_written,
+                                 len - job->script_written);
+}
+
+static void
+process_output (FleetJob *job)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (job->fleet);
+  GByteArray *pending = job->pending;
+  gssize pos;
+
+  if (job->state == JOB_STATE_PREAMBLE)
+    {
+      const guint8 *nl;
+      gsize skip;
+
+      pos = find_bytes (pending->data, pending->len, priv->begin_marker);
+      if (pos < 0)
+        {
+          if (pending->len > PREAMBLE_MAX)
+            g_byte_array_remove_range (pending, 0, pending->len - strlen (priv->begin_marker));
+          return;
+        }
+      nl = memchr (pending->data + pos, '\n', pending->len - pos);
+      if (!nl)
+        return;
+      skip = (nl - pending->data) + 1;
+      g_byte_array_remove_range (pending, 0, skip);
+      job->state = JOB_STATE_BODY;
+    }
+
+  if (job->state == JOB_STATE_BODY)
+    {
+      gsize end_len = strlen (priv->end_marker);
+      gsize body_len;
+
+      pos = find_bytes (pending->data, pending->len, priv->end_marker);
+      if (pos < 0)
+        {
+          /* Keep back enough that a marker split across reads, and the
+           * newline we put before it, are still there next time.
+           */
+          if (pending->len <= end_len + 2)
+            return;
+          body_len = pending->len - (end_len + 2);
+          if (pending->data[body_len - 1] == '\r')
+            body_len--;
+          job_emit_output (job, pending->data, body_len);
+          g_byte_array_remove_range (pending, 0, body_len);
+          return;
+        }
+
+      body_len = pos;
+      if (body_len > 0 && pending->data[body_len - 1] == '\n')
+        body_len--;
+      if (body_len > 0 && pending->data[body_len - 1] == '\r')
+        body_len--;
+      job_emit_output (job, pending->data, body_len);
+      g_byte_array_remove_range (pending, 0, pos + end_len);
+      job->state = JOB_STATE_STATUS;
+    }
+
+  if (job->state == JOB_STATE_STATUS)
+    {
+      const guint8 *nl = memchr (pending->data, '\n', pending->len);
+      gs_free char *line = NULL;
+
+      if (!nl)
+        return;
+      line = g_strndup ((char*)pending->data, nl - pending->data);
+      finish_job (job, (int) g_ascii_strtoll (line, NULL, 10), NULL);
+    }
+}
+
+static void
+on_pump_output (GBytes   *bytes,
+                gpointer  user_data)
+{
+  FleetJob *job = user_data;
+  gsize len;
+  const guint8 *buf = g_bytes_get_data (bytes, &len);
+
+  g_byte_array_append (job->pending, buf, len);
+  process_output (job);
+}
+
+static void
+on_pump_drained (gpointer user_data)
+{
+  write_script (user_data);
+}
+
+static void
+on_pump_error (GError   *error,
+               gpointer  user_data)
+{
+  fail_job (user_data, error);
+}
+
+static const HotSshChannelPumpCallbacks pump_callbacks = {
+  on_pump_output,
+  on_pump_drained,
+  on_pump_error
+};
+
+static void
+on_open_shell_complete (GObject      *src,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+  FleetJob *job = lookup_job (user_data);
+  GError *local_error = NULL;
+  gs_unref_object GSshChannel *channel = NULL;
+
+  channel = gssh_connection_open_shell_finish ((GSshConnection*)src, res, &local_error);
+  if (!job)
+    {
+      /* Finished meanwhile; close the channel where it lives */
+      if (channel)
+        {
+          JobRelease *release = g_slice_new0 (JobRelease);
+          release->channel = channel;
+          channel = NULL;
+          hotssh_io_worker_invoke (lookup_worker (user_data), op_release_job, release, NULL);
+        }
+      g_clear_error (&local_error);
+      return;
+    }
+  if (!channel)
+    goto out;
+
+  job->channel = g_object_ref (channel);
+  job->pump = hotssh_channel_pump_new (job->worker, job->channel,
+                                       WRITE_BUFFER_SIZE, &pump_callbacks, job);
+  hotssh_channel_pump_start (job->pump);
+  write_script (job);
+
+ out:
+  if (local_error)
+    fail_job (job, local_error);
+}
+
+static gboolean
+have_mechanism (FleetJob                    *job,
+                GSshConnectionAuthMechanism  mech)
+{
+  guint i;
+
+  for (i = 0; i < job->auth_mechanisms->len; i++)
+    if (g_array_index (job->auth_mechanisms, guint, i) == mech)
+      return TRUE;
+  return FALSE;
+}
+
+static void
+on_auth_complete (GObject      *src,
+                  GAsyncResult *res,
+                  gpointer      user_data);
+
+/* Anything but a Kerberos ticket or a key would need someone to type */
+static gboolean
+start_auth (FleetJob  *job,
+            GError   **error)
+{
+  FleetOp *op;
+
+  if (!job->tried_gssapi
+      && have_mechanism (job, GSSH_CONNECTION_AUTH_MECHANISM_GSSAPI_MIC)
+      && hotssh_gssapi_have_credentials ())
+    {
+      job->tried_gssapi = TRUE;
+      job->auth_mech = GSSH_CONNECTION_AUTH_MECHANISM_GSSAPI_MIC;
+    }
+  else if (have_mechanism (job, GSSH_CONNECTION_AUTH_MECHANISM_PUBLICKEY))
+    job->auth_mech = GSSH_CONNECTION_AUTH_MECHANISM_PUBLICKEY;
+  else
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   _("The server does not accept public key authentication"));
+      return FALSE;
+    }
+
+  op = fleet_op_new (job, on_auth_complete);
+  op->mech = job->auth_mech;
+  run_op (job, op_auth, op);
+  return TRUE;
+}
+
+static void
+on_auth_complete (GObject      *src,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+  FleetJob *job = lookup_job (user_data);
+  GError *local_error = NULL;
+
+  if (!gssh_connection_auth_finish ((GSshConnection*)src, res, &local_error))
+    {
+      /* The host couldn't use our ticket; a key may still do */
+      if (job && job->auth_mech == GSSH_CONNECTION_AUTH_MECHANISM_GSSAPI_MIC
+          && !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_debug ("%s: GSSAPI failed: %s", job->hostname, local_error->message);
+          g_clear_error (&local_error);
+          (void) start_auth (job, &local_error);
+        }
+      goto out;
+    }
+  if (!job)
+    goto out;
+
+  run_op (job, op_open_shell, fleet_op_new (job, on_open_shell_complete));
+
+ out:
+  if (local_error)
+    {
+      if (job)
+        fail_job (job, local_error);
+      else
+        g_clear_error (&local_error);
+    }
+}
+
+static void
+on_gssapi_checked (GObject      *src,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  gs_unref_object GCancellable *cancellable = user_data;
+  FleetJob *job = lookup_job (cancellable);
+  GError *local_error = NULL;
+
+  /* start_auth() picks the answer up from the cache */
+  (void) hotssh_gssapi_check_credentials_finish (res, NULL);
+  if (job && !start_auth (job, &local_error))
+    fail_job (job, local_error);
+}
+
+static void
+on_negotiate_complete (GObject      *src,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+  FleetJob *job = lookup_job (user_data);
+  GError *local_error = NULL;
+
+  if (!gssh_connection_negotiate_finish ((GSshConnection*)src, res, &local_error))
+    goto out;
+  if (!job)
+    goto out;
+
+  job->auth_mechanisms = hotssh_connection_info_get_auth_mechanisms (res);
+  /* Wait for the look at the credential cache started with the job */
+  if (have_mechanism (job, GSSH_CONNECTION_AUTH_MECHANISM_GSSAPI_MIC))
+    {
+      hotssh_gssapi_check_credentials_async (job->cancellable, on_gssapi_checked,
+                                             g_object_ref (job->cancellable));
+      goto out;
+    }
+  if (!start_auth (job, &local_error))
+    goto out;
+
+ out:
+  if (local_error)
+    {
+      if (job)
+        fail_job (job, local_error);
+      else
+        g_clear_error (&local_error);
+    }
+}
+
+static void
+on_handshake_complete (GObject      *src,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+  FleetJob *job = lookup_job (user_data);
+  GError *local_error = NULL;
+  gs_unref_object GtkTreeModel *model = NULL;
+  gs_free char *saved_type = NULL;
+  gs_free char *saved_base64 = NULL;
+  const HotSshHostKey *connected;
+  GtkTreeIter iter;
+
+  if (!gssh_connection_handshake_finish ((GSshConnection*)src, res, &local_error))
+    goto out;
+  if (!job)
+    goto out;
+
+  connected = hotssh_connection_info_get_host_key (res);
+  if (connected == NULL)
+    {
+      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                   _("Connection closed by remote host"));
+      goto out;
+    }
+
+  model = hotssh_hostdb_get_model (hotssh_hostdb_get_instance ());
+  if (hotssh_hostdb_lookup_by_id (hotssh_hostdb_get_instance (), job->connection_id, &iter))
+    gtk_tree_model_get (model, &iter,
+                        HOTSSH_HOSTDB_COLUMN_HOST_KEY_TYPE, &saved_type,
+                        HOTSSH_HOSTDB_COLUMN_HOST_KEY_BASE64, &saved_base64,
+                        -1);
+
+  /* There is nobody to ask, so an unknown key is as good as a bad one */
+  if (saved_type == NULL || saved_base64 == NULL)
+    {
+      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   _("The host key is not known yet; connect once interactively to accept it"));
+      goto out;
+    }
+  if (strcmp (connected->type, saved_type) != 0
+      || strcmp (connected->base64, saved_base64) != 0)
+    {
+      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   _("The remote host key has changed"));
+      goto out;
+    }
+
+  run_op (job, op_negotiate, fleet_op_new (job, on_negotiate_complete));
+
+ out:
+  if (local_error)
+    {
+      if (job)
+        fail_job (job, local_error);
+      else
+        g_clear_error (&local_error);
+    }
+}
+
+static void
+start_job (HotSshFleet *self,
+           FleetJob    *job)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+
+  job->worker = hotssh_io_worker_get_for_key (job->connection_id);
+  job->cancellable = g_cancellable_new ();
+  job->state = JOB_STATE_PREAMBLE;
+  job->pending = g_byte_array_new ();
+  job->outbuf = g_malloc (OUTPUT_BUFFER_SIZE);
+  job->extents = g_array_new (FALSE, FALSE, sizeof (FleetExtent));
+  job->checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+  /* The leading space keeps it out of the remote shell's history
+   * where that is configured; the markers are split in the command so
+   * that the pty echoing it back can't be mistaken for them.
+   */
+  job->script = g_strdup_printf (" stty -echo 2>/dev/null; printf '%%s%%s\\n' %s %s; "
+                                 "( %s ) </dev/null; "
+                                 "printf '\\n%%s%%s %%d\\n' %s %s $?; exit\n",
+                                 BEGIN_MARKER, priv->begin_marker + strlen (BEGIN_MARKER),
+                                 priv->command,
+                                 END_MARKER, priv->end_marker + strlen (END_MARKER));
+
+  g_object_set_data ((GObject*)job->cancellable, JOB_DATA_KEY, job);
+  g_object_set_data ((GObject*)job->cancellable, WORKER_DATA_KEY, job->worker);
+  g_hash_table_add (priv->running, job);
+
+  if (priv->timeout_seconds > 0)
+    job->timeout_id = g_timeout_add_seconds (priv->timeout_seconds, on_job_timeout, job);
+
+  if (job->reused)
+    run_op (job, op_open_shell, fleet_op_new (job, on_open_shell_complete));
+  else
+    {
+      CreateOp *op = g_slice_new0 (CreateOp);
+
+      op->worker = job->worker;
+      op->address = g_network_address_new (job->hostname, job->port);
+      op->username = g_strdup (job->username);
+      op->cancellable = g_object_ref (job->cancellable);
+      hotssh_gssapi_refresh_credentials ();
+      hotssh_io_worker_invoke (job->worker, op_create_connection, op, NULL);
+    }
+}
+
+static void
+start_jobs (HotSshFleet *self)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  gboolean started_any = FALSE;
+
+  while (!priv->cancelled
+         && g_hash_table_size (priv->running) < priv->concurrency
+         && !g_queue_is_empty (&priv->pending))
+    {
+      start_job (self, g_queue_pop_head (&priv->pending));
+      started_any = TRUE;
+    }
+
+  if (started_any)
+    g_signal_emit (self, signals[SIGNAL_PROGRESS], 0);
+  else if (priv->n_done == priv->n_total
+           && g_hash_table_size (priv->running) == 0)
+    g_signal_emit (self, signals[SIGNAL_FINISHED], 0);
+}
+
+static void
+hotssh_fleet_init (HotSshFleet *self)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+
+  g_queue_init (&priv->pending);
+  priv->running = g_hash_table_new (NULL, NULL);
+  priv->groups = g_ptr_array_new_with_free_func (fleet_group_free);
+  priv->group_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  priv->spill_fd = -1;
+}
+
+static void
+hotssh_fleet_dispose (GObject *object)
+{
+  hotssh_fleet_cancel ((HotSshFleet*)object);
+
+  G_OBJECT_CLASS (hotssh_fleet_parent_class)->dispose (object);
+}
+
+static void
+hotssh_fleet_finalize (GObject *object)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private ((HotSshFleet*)object);
+
+  g_free (priv->command);
+  g_free (priv->begin_marker);
+  g_free (priv->end_marker);
+  g_hash_table_unref (priv->running);
+  g_ptr_array_unref (priv->groups);
+  g_hash_table_unref (priv->group_index);
+  if (priv->spill_fd >= 0)
+    (void) close (priv->spill_fd);
+
+  G_OBJECT_CLASS (hotssh_fleet_parent_class)->finalize (object);
+}
+
+static void
+hotssh_fleet_class_init (HotSshFleetClass *class)
+{
+  G_OBJECT_CLASS (class)->dispose = hotssh_fleet_dispose;
+  G_OBJECT_CLASS (class)->finalize = hotssh_fleet_finalize;
+
+  signals[SIGNAL_GROUP_ADDED] =
+    g_signal_new ("group-added", G_TYPE_FROM_CLASS (class),
+                  G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 1, G_TYPE_UINT);
+  signals[SIGNAL_GROUP_CHANGED] =
+    g_signal_new ("group-changed", G_TYPE_FROM_CLASS (class),
+                  G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 1, G_TYPE_UINT);
+  signals[SIGNAL_PROGRESS] =
+    g_signal_new ("progress", G_TYPE_FROM_CLASS (class),
+                  G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 0);
+  signals[SIGNAL_FINISHED] =
+    g_signal_new ("finished", G_TYPE_FROM_CLASS (class),
+                  G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 0);
+}
+
+/**
+ * hotssh_fleet_new:
+ * @command: Shell command line to run on each host
+ * @concurrency: How many hosts to work on at once
+ * @timeout_seconds: Per host, from starting to connect; 0 for none
+ */
+HotSshFleet *
+hotssh_fleet_new (const char *command,
+                  guint       concurrency,
+                  guint       timeout_seconds)
+{
+  HotSshFleet *self = g_object_new (HOTSSH_TYPE_FLEET, NULL);
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  gs_free char *nonce = g_strdup_printf ("%08x%08x", g_random_int (), g_random_int ());
+
+  priv->command = g_strdup (command);
+  priv->begin_marker = g_strconcat (BEGIN_MARKER, nonce, NULL);
+  priv->end_marker = g_strconcat (END_MARKER, nonce, " ", NULL);
+  priv->concurrency = MAX (concurrency, 1);
+  priv->timeout_seconds = timeout_seconds;
+
+  return self;
+}
+
+/**
+ * hotssh_fleet_add_host:
+ * @connection_id: A hostdb entry
+ * @connection: (allow-none): An authenticated connection to it to open
+ * a channel on, rather than making a new one
+ *
+ * Must be called before hotssh_fleet_start().  Adding an entry twice
+ * has no effect.
+ */
+void
+hotssh_fleet_add_host (HotSshFleet    *self,
+                       const char     *connection_id,
+                       GSshConnection *connection)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  gs_unref_object GtkTreeModel *model = hotssh_hostdb_get_model (hotssh_hostdb_get_instance ());
+  GtkTreeIter iter;
+  FleetJob *job;
+  GList *l;
+
+  g_return_if_fail (!priv->started);
+
+  for (l = priv->pending.head; l; l = l->next)
+    if (strcmp (((FleetJob*)l->data)->connection_id, connection_id) == 0)
+      return;
+
+  if (!hotssh_hostdb_lookup_by_id (hotssh_hostdb_get_instance (), connection_id, &iter))
+    return;
+
+  job = g_slice_new0 (FleetJob);
+  job->fleet = self;
+  job->connection_id = g_strdup (connection_id);
+  gtk_tree_model_get (model, &iter,
+                      HOTSSH_HOSTDB_COLUMN_HOSTNAME, &job->hostname,
+                      HOTSSH_HOSTDB_COLUMN_PORT, &job->port,
+                      HOTSSH_HOSTDB_COLUMN_USERNAME, &job->username,
+                      -1);
+  if (connection)
+    {
+      job->connection = g_object_ref (connection);
+      job->reused = TRUE;
+    }
+
+  g_queue_push_tail (&priv->pending, job);
+  priv->n_total++;
+}
+
+void
+hotssh_fleet_start (HotSshFleet *self)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+
+  g_return_if_fail (!priv->started);
+
+  priv->started = TRUE;
+  start_jobs (self);
+}
+
+/**
+ * hotssh_fleet_cancel:
+ *
+ * Stop every host that hasn't finished; each ends up in a
+ * "Cancelled" group.
+ */
+void
+hotssh_fleet_cancel (HotSshFleet *self)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  FleetJob *job;
+  GHashTableIter hiter;
+  gpointer value;
+
+  if (priv->cancelled)
+    return;
+  priv->cancelled = TRUE;
+
+  while ((job = g_queue_pop_head (&priv->pending)) != NULL)
+    finish_job (job, -1, _("Cancelled"));
+
+  g_hash_table_iter_init (&hiter, priv->running);
+  while (g_hash_table_iter_next (&hiter, NULL, &value))
+    {
+      finish_job (value, -1, _("Cancelled"));
+      g_hash_table_iter_init (&hiter, priv->running);
+    }
+}
+
+void
+hotssh_fleet_get_progress (HotSshFleet *self,
+                           guint       *out_done,
+                           guint       *out_running,
+                           guint       *out_total)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+
+  *out_done = priv->n_done;
+  *out_running = g_hash_table_size (priv->running);
+  *out_total = priv->n_total;
+}
+
+guint
+hotssh_fleet_get_n_groups (HotSshFleet *self)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  return priv->groups->len;
+}
+
+/**
+ * hotssh_fleet_get_group_hosts:
+ *
+ * Returns: (transfer container): Host names in the group, in the order
+ * they finished
+ */
+GPtrArray *
+hotssh_fleet_get_group_hosts (HotSshFleet *self,
+                              guint        group)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  g_return_val_if_fail (group < priv->groups->len, NULL);
+  return g_ptr_array_ref (((FleetGroup*)priv->groups->pdata[group])->hosts);
+}
+
+/**
+ * hotssh_fleet_get_group_status:
+ *
+ * Returns: The command's exit status, or -1 if the group is for hosts
+ * where it couldn't be run
+ */
+int
+hotssh_fleet_get_group_status (HotSshFleet *self,
+                               guint        group)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  g_return_val_if_fail (group < priv->groups->len, -1);
+  return ((FleetGroup*)priv->groups->pdata[group])->status;
+}
+
+const char *
+hotssh_fleet_get_group_error (HotSshFleet *self,
+                              guint        group)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  g_return_val_if_fail (group < priv->groups->len, NULL);
+  return ((FleetGroup*)priv->groups->pdata[group])->error;
+}
+
+/**
+ * hotssh_fleet_read_group_output:
+ * @max_bytes: Read no more than this from the start of the output
+ * @out_total: (out): Full size of the output
+ *
+ * Returns: (transfer full): The group's output, or its first @max_bytes
+ */
+GBytes *
+hotssh_fleet_read_group_output (HotSshFleet  *self,
+                                guint         group,
+                                gsize         max_bytes,
+                                guint64      *out_total,
+                                GError      **error)
+{
+  HotSshFleetPrivate *priv = hotssh_fleet_get_instance_private (self);
+  FleetGroup *g;
+  GByteArray *buf;
+  guint i;
+
+  g_return_val_if_fail (group < priv->groups->len, NULL);
+  g = priv->groups->pdata[group];
+
+  *out_total = g->total;
+  if (priv->spill_failed)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   _("Output could not be saved to a temporary file"));
+      return NULL;
+    }
+
+  buf = g_byte_array_new ();
+  for (i = 0; i < g->extents->len && buf->len < max_bytes; i++)
+    {
+      FleetExtent *extent = &g_array_index (g->extents, FleetExtent, i);
+      gsize want = MIN (extent->length, max_bytes - buf->len);
+      gsize done = 0;
+      guint start = buf->len;
+
+      g_byte_array_set_size (buf, start + want);
+      while (done < want)
+        {
+          gssize n = pread (priv->spill_fd, buf->data + start + done, want - done,
+                            extent->offset + done);
+          if (n < 0 && errno == EINTR)
+            continue;
+          if (n <= 0)
+            {
+              int errsv = errno;
+              g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                           "%s", g_strerror (errsv));
+              g_byte_array_unref (buf);
+              return NULL;
+            }
+          done += n;
+        }
+    }
+
+  return g_byte_array_free_to_bytes (buf);
+}
@@ -0,0 +1,66 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "gssh.h"
+
+#define HOTSSH_TYPE_FLEET (hotssh_fleet_get_type ())
+#define HOTSSH_FLEET(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), HOTSSH_TYPE_FLEET, HotSshFleet))
+
+/* Runs one non-interactive command on many hostdb entries, a bounded
+ * number at a time, each with a deadline.  New connections only use
+ * Kerberos or public key authentication and a host key already in the
+ * hostdb, so nothing ever prompts.
+ *
+ * Results are grouped: hosts whose command exited the same way with
+ * byte-identical output share a group, which keeps one copy of the
+ * output.  Output goes to an unlinked temporary file as it arrives, so
+ * memory stays flat however much comes back.
+ */
+typedef struct _HotSshFleet          HotSshFleet;
+typedef struct _HotSshFleetClass     HotSshFleetClass;
+
+GType                   hotssh_fleet_get_type     (void);
+HotSshFleet            *hotssh_fleet_new          (const char      *command,
+                                                   guint            concurrency,
+                                                   guint            timeout_seconds);
+
+void                    hotssh_fleet_add_host     (HotSshFleet     *self,
+                                                   const char      *connection_id,
+                                                   GSshConnection  *connection);
+void                    hotssh_fleet_start        (HotSshFleet     *self);
+void                    hotssh_fleet_cancel       (HotSshFleet     *self);
+
+void                    hotssh_fleet_get_progress (HotSshFleet     *self,
+                                                   guint           *out_done,
+                                                   guint           *out_running,
+                                                   guint           *out_total);
+
+guint                   hotssh_fleet_get_n_groups       (HotSshFleet *self);
+GPtrArray              *hotssh_fleet_get_group_hosts    (HotSshFleet *self,
+                                                         guint        group);
+int                     hotssh_fleet_get_group_status   (HotSshFleet *self,
+                                                         guint        group);
+const char             *hotssh_fleet_get_group_error    (HotSshFleet *self,
+                                                         guint        group);
+GBytes                 *hotssh_fleet_read_group_output  (HotSshFleet *self,
+                                                         guint        group,
+                                                         gsize        max_bytes,
+                                                         guint64     *out_total,
+                                                         GError     **error);
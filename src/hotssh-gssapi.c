@@ -0,0 +1,190 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "hotssh-gssapi.h"
+
+#ifdef HAVE_GSSAPI
+#include <gssapi/gssapi.h>
+
+/* How long a look at the credential cache is trusted for */
+#define CREDENTIALS_CHECK_SECONDS 30
+
+static GSettings *settings;
+static gint64 checked_until;
+static gboolean checking;
+/* Tasks waiting for the look in progress */
+static GSList *waiters;
+
+/* Returns the seconds left on the default initiator credentials, or 0 */
+static guint32
+get_credentials_lifetime (void)
+{
+  OM_uint32 major, minor;
+  OM_uint32 lifetime = 0;
+  gss_cred_id_t cred = GSS_C_NO_CREDENTIAL;
+
+  major = gss_acquire_cred (&minor, GSS_C_NO_NAME, GSS_C_INDEFINITE,
+                            GSS_C_NO_OID_SET, GSS_C_INITIATE,
+                            &cred, NULL, &lifetime);
+  if (GSS_ERROR (major))
+    {
+      g_debug ("no GSSAPI credentials (major %u, minor %u)", major, minor);
+      return 0;
+    }
+  (void) gss_release_cred (&minor, &cred);
+  return lifetime;
+}
+
+static gboolean
+is_enabled (void)
+{
+  if (!settings)
+    settings = g_settings_new ("org.gnome.hotssh");
+  return g_settings_get_boolean (settings, "gssapi-authentication");
+}
+
+/* In a thread; the mechanism may read files or ask a daemon */
+static void
+check_credentials_thread (GTask        *task,
+                          gpointer      source_object,
+                          gpointer      task_data,
+                          GCancellable *cancellable)
+{
+  g_task_return_int (task, get_credentials_lifetime ());
+}
+
+static void
+on_credentials_checked (GObject      *src,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+  guint32 lifetime = g_task_propagate_int ((GTask*)res, NULL);
+  GSList *done = g_slist_reverse (waiters);
+  GSList *iter;
+
+  checking = FALSE;
+  waiters = NULL;
+  /* Don't go on trusting a ticket past its expiry.  Having none isn't
+   * remembered at all: the next connection looks again, so a kinit
+   * in between is noticed. */
+  if (lifetime > 0)
+    checked_until = g_get_monotonic_time ()
+      + MIN (lifetime, CREDENTIALS_CHECK_SECONDS) * G_USEC_PER_SEC;
+  else
+    checked_until = 0;
+
+  for (iter = done; iter; iter = iter->next)
+    {
+      GTask *task = iter->data;
+      if (!g_task_return_error_if_cancelled (task))
+        g_task_return_boolean (task, lifetime > 0);
+      g_object_unref (task);
+    }
+  g_slist_free (done);
+}
+
+static void
+start_check (void)
+{
+  GTask *task;
+
+  if (checking)
+    return;
+
+  checking = TRUE;
+  task = g_task_new (NULL, NULL, on_credentials_checked, NULL);
+  g_task_run_in_thread (task, check_credentials_thread);
+  g_object_unref (task);
+}
+#endif
+
+/**
+ * hotssh_gssapi_refresh_credentials:
+ *
+ * Start looking at the credential cache, unless GSSAPI is turned off
+ * or the last look is still fresh.  Call this when starting to
+ * connect; the answer is usually back before the host asks how we'd
+ * like to log in.
+ */
+void
+hotssh_gssapi_refresh_credentials (void)
+{
+#ifdef HAVE_GSSAPI
+  if (g_get_monotonic_time () < checked_until || !is_enabled ())
+    return;
+
+  start_check ();
+#endif
+}
+
+/**
+ * hotssh_gssapi_check_credentials_async:
+ *
+ * Find out whether there are credentials, waiting for a look already
+ * in progress rather than starting another.  Completes at once when
+ * the last look found some and is still fresh, or when GSSAPI is
+ * turned off.
+ */
+void
+hotssh_gssapi_check_credentials_async (GCancellable        *cancellable,
+                                       GAsyncReadyCallback  callback,
+                                       gpointer             user_data)
+{
+  GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+
+#ifdef HAVE_GSSAPI
+  if (!is_enabled ())
+    g_task_return_boolean (task, FALSE);
+  else if (g_get_monotonic_time () < checked_until)
+    g_task_return_boolean (task, TRUE);
+  else
+    {
+      waiters = g_slist_prepend (waiters, g_object_ref (task));
+      start_check ();
+    }
+#else
+  g_task_return_boolean (task, FALSE);
+#endif
+
+  g_object_unref (task);
+}
+
+gboolean
+hotssh_gssapi_check_credentials_finish (GAsyncResult  *result,
+                                        GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+  return g_task_propagate_boolean ((GTask*)result, error);
+}
+
+/**
+ * hotssh_gssapi_have_credentials:
+ *
+ * Never blocks: only a fresh look that found credentials counts.  Use
+ * this once hotssh_gssapi_check_credentials_async() has completed.
+ */
+gboolean
+hotssh_gssapi_have_credentials (void)
+{
+#ifdef HAVE_GSSAPI
+  return is_enabled () && g_get_monotonic_time () < checked_until;
+#else
+  return FALSE;
+#endif
+}
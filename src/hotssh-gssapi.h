@@ -0,0 +1,44 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Whether Kerberos credentials to log in with are at hand, so that
+ * GSSAPI authentication is only offered to a host when it can work.
+ * The credential cache is looked at in a thread, and the answer is
+ * remembered for a little while; opening many sessions at once looks
+ * only once.  Finding none isn't remembered, so a fresh kinit is
+ * noticed by the next connection.  Main thread only.
+ *
+ * GSSAPI stays off unless the gssapi-authentication setting is on.
+ * Without GSS-API support at build time, there never are any.
+ */
+
+void            hotssh_gssapi_refresh_credentials   (void);
+void            hotssh_gssapi_check_credentials_async  (GCancellable        *cancellable,
+                                                        GAsyncReadyCallback  callback,
+                                                        gpointer             user_data);
+gboolean        hotssh_gssapi_check_credentials_finish (GAsyncResult        *result,
+                                                        GError             **error);
+gboolean        hotssh_gssapi_have_credentials      (void);
+
+G_END_DECLS
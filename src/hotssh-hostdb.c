@@ -479,11 +479,104 @@ hotssh_hostdb_update_last_used (HotSshHostDB    *self,
     return;
 
   g_key_file_set_uint64 (priv->hostdb, id, "last-used", g_get_real_time () / G_USEC_PER_SEC);
+  g_key_file_set_uint64 (priv->hostdb, id, "use-count",
+                         hotssh_hostdb_get_entry_uint (self, id, "use-count", 0) + 1);
 
   (void) set_row_from_group (self, id, &iter);
   queue_save_hostdb (self);
 }
 
+/* Per-host options live as extra keys in the entry's group; they're
+ * edited by hand in hostdb.ini.
+ */
+gboolean
+hotssh_hostdb_get_entry_boolean (HotSshHostDB    *self,
+                                 const char      *id,
+                                 const char      *key,
+                                 gboolean         default_value)
+{
+  HotSshHostDBPrivate *priv = hotssh_hostdb_get_instance_private (self);
+  GError *local_error = NULL;
+  gboolean ret;
+
+  g_return_val_if_fail (id != NULL, default_value);
+
+  ret = g_key_file_get_boolean (priv->hostdb, id, key, &local_error);
+  if (local_error)
+    {
+      g_clear_error (&local_error);
+      return default_value;
+    }
+  return ret;
+}
+
+guint
+hotssh_hostdb_get_entry_uint (HotSshHostDB    *self,
+                              const char      *id,
+                              const char      *key,
+                              guint            default_value)
+{
+  HotSshHostDBPrivate *priv = hotssh_hostdb_get_instance_private (self);
+  GError *local_error = NULL;
+  guint64 ret;
+
+  g_return_val_if_fail (id != NULL, default_value);
+
+  ret = g_key_file_get_uint64 (priv->hostdb, id, key, &local_error);
+  if (local_error || ret > G_MAXUINT)
+    {
+      g_clear_error (&local_error);
+      return default_value;
+    }
+  return (guint)ret;
+}
+
+/* Returns %NULL if the key isn't set */
+char **
+hotssh_hostdb_get_entry_strv (HotSshHostDB    *self,
+                              const char      *id,
+                              const char      *key)
+{
+  HotSshHostDBPrivate *priv = hotssh_hostdb_get_instance_private (self);
+
+  g_return_val_if_fail (id != NULL, NULL);
+
+  return g_key_file_get_string_list (priv->hostdb, id, key, NULL, NULL);
+}
+
+/* For keys hotssh maintains itself, rather than options */
+void
+hotssh_hostdb_set_entry_uint (HotSshHostDB    *self,
+                              const char      *id,
+                              const char      *key,
+                              guint            value)
+{
+  HotSshHostDBPrivate *priv = hotssh_hostdb_get_instance_private (self);
+  GtkTreeIter iter;
+
+  if (!hotssh_hostdb_lookup_by_id (self, id, &iter))
+    return;
+
+  g_key_file_set_uint64 (priv->hostdb, id, key, value);
+  queue_save_hostdb (self);
+}
+
+void
+hotssh_hostdb_set_entry_strv (HotSshHostDB       *self,
+                              const char         *id,
+                              const char         *key,
+                              const char * const *value)
+{
+  HotSshHostDBPrivate *priv = hotssh_hostdb_get_instance_private (self);
+  GtkTreeIter iter;
+
+  if (!hotssh_hostdb_lookup_by_id (self, id, &iter))
+    return;
+
+  g_key_file_set_string_list (priv->hostdb, id, key, value, g_strv_length ((char**)value));
+  queue_save_hostdb (self);
+}
+
 static void
 on_knownhosts_splice_complete (GObject            *src,
                                GAsyncResult       *result,
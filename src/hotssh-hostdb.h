@@ -67,3 +67,26 @@ void                   hotssh_hostdb_set_entry_host_key_known (HotSshHostDB    *
                                                                const char      *keytype,
                                                                const char      *key_base64,
                                                                const char      *last_ip_address);
+
+gboolean               hotssh_hostdb_get_entry_boolean (HotSshHostDB    *self,
+                                                        const char      *id,
+                                                        const char      *key,
+                                                        gboolean         default_value);
+
+guint                  hotssh_hostdb_get_entry_uint    (HotSshHostDB    *self,
+                                                        const char      *id,
+                                                        const char      *key,
+                                                        guint            default_value);
+
+char **                hotssh_hostdb_get_entry_strv    (HotSshHostDB    *self,
+                                                        const char      *id,
+                                                        const char      *key);
+
+void                   hotssh_hostdb_set_entry_uint    (HotSshHostDB       *self,
+                                                        const char         *id,
+                                                        const char         *key,
+                                                        guint               value);
+void                   hotssh_hostdb_set_entry_strv    (HotSshHostDB       *self,
+                                                        const char         *id,
+                                                        const char         *key,
+                                                        const char * const *value);
@@ -0,0 +1,316 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "hotssh-io-worker.h"
+
+/* More than this buys nothing for an interactive client */
+#define MAX_IO_WORKERS (16)
+
+struct _HotSshIoWorker
+{
+  guint index;
+  GMainContext *context;
+  GMainLoop *loop;
+  GThread *thread;
+};
+
+typedef struct {
+  GAsyncReadyCallback callback;
+  GObject *target;
+  /* Belong to the worker the operation ran on */
+  GMainContext *context;
+  GObject *source;
+  GAsyncResult *result;
+} HotSshIoWorkerReturn;
+
+typedef struct {
+  GSourceFunc func;
+  gpointer data;
+  GMutex lock;
+  GCond cond;
+  gboolean done;
+} HotSshIoWorkerSyncCall;
+
+/* Used when the pool is empty; dispatches on the main context */
+static HotSshIoWorker main_worker;
+static HotSshIoWorker **workers;
+static guint n_workers;
+
+static gpointer
+worker_thread_main (gpointer data)
+{
+  HotSshIoWorker *self = data;
+
+  g_main_context_push_thread_default (self->context);
+  g_main_loop_run (self->loop);
+  g_main_context_pop_thread_default (self->context);
+
+  return NULL;
+}
+
+/**
+ * hotssh_io_workers_init:
+ * @n_threads: Number of worker threads; 0 keeps all I/O on the main context
+ *
+ * Start the worker pool.  Must be called once from the main thread
+ * before any connection is created.
+ */
+void
+hotssh_io_workers_init (guint n_threads)
+{
+  guint i;
+
+  g_return_if_fail (workers == NULL);
+
+  n_workers = MIN (n_threads, MAX_IO_WORKERS);
+  if (n_workers == 0)
+    return;
+
+  g_debug ("starting %u I/O worker threads", n_workers);
+
+  workers = g_new0 (HotSshIoWorker*, n_workers);
+  for (i = 0; i < n_workers; i++)
+    {
+      HotSshIoWorker *worker = g_new0 (HotSshIoWorker, 1);
+      char name[16];
+
+      g_snprintf (name, sizeof (name), "hotssh-io-%u", i);
+      worker->index = i;
+      worker->context = g_main_context_new ();
+      worker->loop = g_main_loop_new (worker->context, FALSE);
+      worker->thread = g_thread_new (name, worker_thread_main, worker);
+      workers[i] = worker;
+    }
+}
+
+void
+hotssh_io_workers_shutdown (void)
+{
+  guint i;
+
+  for (i = 0; i < n_workers; i++)
+    {
+      HotSshIoWorker *worker = workers[i];
+
+      g_main_loop_quit (worker->loop);
+      g_thread_join (worker->thread);
+      g_main_loop_unref (worker->loop);
+      g_main_context_unref (worker->context);
+      g_free (worker);
+    }
+  g_clear_pointer (&workers, g_free);
+  n_workers = 0;
+}
+
+/**
+ * hotssh_io_worker_get_for_key:
+ * @key: Sharding key, e.g. "user@host:port"
+ *
+ * Returns: (transfer none): The worker that connections for @key run on
+ */
+HotSshIoWorker *
+hotssh_io_worker_get_for_key (const char *key)
+{
+  if (n_workers == 0)
+    return &main_worker;
+
+  return workers[g_str_hash (key) % n_workers];
+}
+
+GMainContext *
+hotssh_io_worker_get_context (HotSshIoWorker *self)
+{
+  if (self->context == NULL)
+    return g_main_context_default ();
+  return self->context;
+}
+
+gboolean
+hotssh_io_worker_is_main (HotSshIoWorker *self)
+{
+  return self->thread == NULL;
+}
+
+/**
+ * hotssh_io_worker_invoke:
+ *
+ * Run @func on the worker's context.  When called from the worker's
+ * own thread (or when the worker is the main context and we're on the
+ * main thread), @func runs immediately.
+ */
+void
+hotssh_io_worker_invoke (HotSshIoWorker *self,
+                         GSourceFunc     func,
+                         gpointer        data,
+                         GDestroyNotify  notify)
+{
+  g_main_context_invoke_full (hotssh_io_worker_get_context (self),
+                              G_PRIORITY_DEFAULT, func, data, notify);
+}
+
+static gboolean
+run_sync_call (gpointer data)
+{
+  HotSshIoWorkerSyncCall *call = data;
+
+  (void) call->func (call->data);
+
+  g_mutex_lock (&call->lock);
+  call->done = TRUE;
+  g_cond_signal (&call->cond);
+  g_mutex_unlock (&call->lock);
+
+  return FALSE;
+}
+
+/**
+ * hotssh_io_worker_invoke_sync:
+ *
+ * Run @func on the worker's context and wait for it to return.  Only
+ * for short setup work, such as constructing objects that must be
+ * created with the worker's context as thread default.
+ */
+void
+hotssh_io_worker_invoke_sync (HotSshIoWorker *self,
+                              GSourceFunc     func,
+                              gpointer        data)
+{
+  HotSshIoWorkerSyncCall call = { 0, };
+
+  if (hotssh_io_worker_is_main (self) || self->thread == g_thread_self ())
+    {
+      (void) func (data);
+      return;
+    }
+
+  call.func = func;
+  call.data = data;
+  g_mutex_init (&call.lock);
+  g_cond_init (&call.cond);
+
+  g_main_context_invoke (self->context, run_sync_call, &call);
+
+  g_mutex_lock (&call.lock);
+  while (!call.done)
+    g_cond_wait (&call.cond, &call.lock);
+  g_mutex_unlock (&call.lock);
+
+  g_mutex_clear (&call.lock);
+  g_cond_clear (&call.cond);
+}
+
+static gboolean
+release_object (gpointer data)
+{
+  g_object_unref (data);
+  return FALSE;
+}
+
+/**
+ * hotssh_io_worker_release:
+ * @object: (transfer full): A connection, channel or other object
+ * that lives on the worker
+ *
+ * Drop a reference to @object on the worker, so that if it is the
+ * last, the object is finalized on the thread that uses it.
+ */
+void
+hotssh_io_worker_release (HotSshIoWorker *self,
+                          gpointer        object)
+{
+  if (object == NULL)
+    return;
+  hotssh_io_worker_invoke (self, release_object, object, NULL);
+}
+
+void
+hotssh_io_worker_invoke_main (GSourceFunc     func,
+                              gpointer        data,
+                              GDestroyNotify  notify)
+{
+  g_main_context_invoke_full (NULL, G_PRIORITY_DEFAULT, func, data, notify);
+}
+
+static gboolean
+dispatch_return (gpointer data)
+{
+  HotSshIoWorkerReturn *ret = data;
+
+  ret->callback (ret->source, ret->result, ret->target);
+
+  return FALSE;
+}
+
+static gboolean
+release_return (gpointer data)
+{
+  HotSshIoWorkerReturn *ret = data;
+
+  g_clear_object (&ret->result);
+  g_clear_object (&ret->source);
+  g_main_context_unref (ret->context);
+  g_slice_free (HotSshIoWorkerReturn, ret);
+  return FALSE;
+}
+
+static void
+free_return (gpointer data)
+{
+  HotSshIoWorkerReturn *ret = data;
+
+  g_clear_object (&ret->target);
+  /* The result holds the source too; both go back to the worker */
+  g_main_context_invoke (ret->context, release_return, ret);
+}
+
+/**
+ * hotssh_io_worker_return_to_main:
+ * @callback: Callback to run on the main context
+ * @target: Passed to @callback as user data; kept alive until then
+ *
+ * Returns: user data for hotssh_io_worker_return_callback(), so that an
+ * asynchronous operation started on a worker completes on the main
+ * context, where @callback can call the matching _finish().
+ */
+gpointer
+hotssh_io_worker_return_to_main (GAsyncReadyCallback  callback,
+                                 GObject             *target)
+{
+  HotSshIoWorkerReturn *ret = g_slice_new0 (HotSshIoWorkerReturn);
+
+  ret->callback = callback;
+  ret->target = g_object_ref (target);
+
+  return ret;
+}
+
+void
+hotssh_io_worker_return_callback (GObject      *source,
+                                  GAsyncResult *result,
+                                  gpointer      user_data)
+{
+  HotSshIoWorkerReturn *ret = user_data;
+
+  ret->context = g_main_context_ref_thread_default ();
+  ret->source = source ? g_object_ref (source) : NULL;
+  ret->result = g_object_ref (result);
+
+  hotssh_io_worker_invoke_main (dispatch_return, ret, free_return);
+}
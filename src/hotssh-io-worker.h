@@ -0,0 +1,65 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* A small pool of threads, each running its own GMainContext, that
+ * connections are sharded across.  Everything touching a given
+ * GSshConnection (and its channels) runs on that connection's worker;
+ * results come back to the main context.
+ *
+ * With a pool size of zero there is a single worker which is simply
+ * the main context, and behaviour is identical to doing everything on
+ * the GTK thread.
+ */
+typedef struct _HotSshIoWorker HotSshIoWorker;
+
+void              hotssh_io_workers_init          (guint            n_threads);
+void              hotssh_io_workers_shutdown      (void);
+
+HotSshIoWorker   *hotssh_io_worker_get_for_key    (const char      *key);
+
+GMainContext     *hotssh_io_worker_get_context    (HotSshIoWorker  *self);
+gboolean          hotssh_io_worker_is_main        (HotSshIoWorker  *self);
+
+void              hotssh_io_worker_invoke         (HotSshIoWorker  *self,
+                                                   GSourceFunc      func,
+                                                   gpointer         data,
+                                                   GDestroyNotify   notify);
+void              hotssh_io_worker_invoke_sync    (HotSshIoWorker  *self,
+                                                   GSourceFunc      func,
+                                                   gpointer         data);
+
+void              hotssh_io_worker_release        (HotSshIoWorker  *self,
+                                                   gpointer         object);
+
+void              hotssh_io_worker_invoke_main    (GSourceFunc      func,
+                                                   gpointer         data,
+                                                   GDestroyNotify   notify);
+
+gpointer          hotssh_io_worker_return_to_main (GAsyncReadyCallback  callback,
+                                                   GObject             *target);
+void              hotssh_io_worker_return_callback (GObject            *source,
+                                                    GAsyncResult       *result,
+                                                    gpointer            user_data);
+
+G_END_DECLS
@@ -0,0 +1,159 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "hotssh-keepalive.h"
+
+#include "libgsystem.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define SOCKET_KEY "hotssh-socket"
+
+typedef struct {
+  GSshConnection *connection;   /* Owns the client we're connected to */
+  guint interval_seconds;
+  guint max_misses;
+} KeepaliveConfig;
+
+static void
+keepalive_config_free (gpointer data,
+                       GClosure *closure)
+{
+  g_slice_free (KeepaliveConfig, data);
+}
+
+static void
+set_tcp_option (GSocket *socket,
+                int      option,
+                int      value)
+{
+  if (setsockopt (g_socket_get_fd (socket), IPPROTO_TCP, option,
+                  &value, sizeof (value)) != 0)
+    g_debug ("keepalive: setting TCP option %d failed", option);
+}
+
+static void
+configure_socket (GSocket         *socket,
+                  KeepaliveConfig *config)
+{
+  g_socket_set_keepalive (socket, TRUE);
+#ifdef TCP_KEEPIDLE
+  set_tcp_option (socket, TCP_KEEPIDLE, config->interval_seconds);
+  set_tcp_option (socket, TCP_KEEPINTVL, config->interval_seconds);
+  set_tcp_option (socket, TCP_KEEPCNT, config->max_misses);
+#endif
+#ifdef TCP_USER_TIMEOUT
+  set_tcp_option (socket, TCP_USER_TIMEOUT,
+                  config->interval_seconds * config->max_misses * 1000);
+#endif
+}
+
+/* On the connection's worker */
+static void
+on_socket_client_event (GSocketClient      *client,
+                        GSocketClientEvent  event,
+                        GSocketConnectable *connectable,
+                        GIOStream          *stream,
+                        gpointer            user_data)
+{
+  KeepaliveConfig *config = user_data;
+  GSocket *socket;
+
+  if (event != G_SOCKET_CLIENT_CONNECTED || !G_IS_SOCKET_CONNECTION (stream))
+    return;
+
+  socket = g_socket_connection_get_socket ((GSocketConnection*)stream);
+  if (config->interval_seconds > 0)
+    configure_socket (socket, config);
+  g_object_set_data_full ((GObject*)config->connection, SOCKET_KEY,
+                          g_object_ref (socket), g_object_unref);
+}
+
+/**
+ * hotssh_keepalive_attach:
+ * @interval_seconds: Idle time before each probe, or 0 for the system
+ * default behaviour
+ * @max_misses: Unanswered probes before the connection fails
+ *
+ * Call on @connection's worker before it connects.  Its socket is
+ * remembered for hotssh_keepalive_sample() whatever @interval_seconds.
+ */
+void
+hotssh_keepalive_attach (GSshConnection *connection,
+                         guint           interval_seconds,
+                         guint           max_misses)
+{
+  KeepaliveConfig *config = g_slice_new0 (KeepaliveConfig);
+
+  config->connection = connection;
+  config->interval_seconds = interval_seconds;
+  config->max_misses = MAX (max_misses, 1);
+  g_signal_connect_data (gssh_connection_get_socket_client (connection), "event",
+                         G_CALLBACK (on_socket_client_event), config,
+                         keepalive_config_free, 0);
+}
+
+/**
+ * hotssh_keepalive_get_socket:
+ *
+ * Returns: (transfer none) (allow-none): The socket under @connection,
+ * if it was attached to before connecting
+ */
+GSocket *
+hotssh_keepalive_get_socket (GSshConnection *connection)
+{
+  return g_object_get_data ((GObject*)connection, SOCKET_KEY);
+}
+
+/**
+ * hotssh_keepalive_sample:
+ * @stall_ms: How long data may go unacknowledged before @connection
+ * counts as stalled
+ *
+ * Returns: %FALSE if @connection's socket isn't known, or the system
+ * doesn't say
+ */
+gboolean
+hotssh_keepalive_sample (GSshConnection        *connection,
+                         guint                  stall_ms,
+                         HotSshKeepaliveSample *out_sample)
+{
+#ifdef TCP_INFO
+  GSocket *socket = hotssh_keepalive_get_socket (connection);
+  struct tcp_info info;
+  socklen_t len = sizeof (info);
+
+  if (!socket || g_socket_is_closed (socket))
+    return FALSE;
+
+  if (getsockopt (g_socket_get_fd (socket), IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+    return FALSE;
+
+  out_sample->rtt_usec = info.tcpi_rtt;
+  out_sample->rtt_var_usec = info.tcpi_rttvar;
+  out_sample->stalled = info.tcpi_probes > 0
+    || (info.tcpi_unacked > 0 && info.tcpi_last_ack_recv >= stall_ms);
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
@@ -0,0 +1,48 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "gssh.h"
+
+G_BEGIN_DECLS
+
+/* Dead peer detection and round trip times for a connection, from its
+ * TCP socket.  The kernel sends a keepalive probe whenever the
+ * connection has been idle for the interval and gives up after that
+ * many go unanswered, or after data has gone unacknowledged for as
+ * long; either way the connection then fails as if the peer had
+ * closed it, rather than after the system's default of hours.
+ */
+
+typedef struct {
+  guint rtt_usec;          /* The kernel's smoothed estimate */
+  guint rtt_var_usec;      /* and its mean deviation */
+  /* Data or a probe has been waiting for an answer too long */
+  gboolean stalled;
+} HotSshKeepaliveSample;
+
+void       hotssh_keepalive_attach      (GSshConnection        *connection,
+                                         guint                  interval_seconds,
+                                         guint                  max_misses);
+GSocket   *hotssh_keepalive_get_socket  (GSshConnection        *connection);
+gboolean   hotssh_keepalive_sample      (GSshConnection        *connection,
+                                         guint                  stall_ms,
+                                         HotSshKeepaliveSample *out_sample);
+
+G_END_DECLS
@@ -0,0 +1,290 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "hotssh-mirror.h"
+#include "hotssh-scanner.h"
+
+/* Past this much output since the last barrier, the oldest buffers are
+ * let go.  A view joining then may miss attributes or lines set up
+ * long ago, but anything still on screen has been redrawn well within
+ * this for an ordinary shell.
+ */
+#define SNAPSHOT_MAX (512 * 1024)
+
+typedef struct {
+  guint id;
+  const HotSshMirrorViewCallbacks *callbacks;
+  gpointer user_data;
+} MirrorView;
+
+struct _HotSshMirror
+{
+  GArray *views;                /* MirrorView */
+  guint next_id;
+
+  GQueue snapshot;              /* GBytes since the last barrier */
+  gsize snapshot_size;
+  gboolean alt_screen;
+  guint width;
+  guint height;
+
+  guint input_view;
+  gboolean input_throttled;
+  HotSshMirrorInputFunc source_input;
+  gpointer user_data;
+};
+
+static MirrorView *
+find_view (HotSshMirror *self,
+           guint         id,
+           guint        *out_index)
+{
+  guint i;
+
+  for (i = 0; i < self->views->len; i++)
+    {
+      MirrorView *view = &g_array_index (self->views, MirrorView, i);
+      if (view->id == id)
+        {
+          if (out_index)
+            *out_index = i;
+          return view;
+        }
+    }
+  return NULL;
+}
+
+static void
+clear_snapshot (HotSshMirror *self)
+{
+  GBytes *bytes;
+
+  while ((bytes = g_queue_pop_head (&self->snapshot)) != NULL)
+    g_bytes_unref (bytes);
+  self->snapshot_size = 0;
+}
+
+static void
+notify_input (HotSshMirror *self)
+{
+  guint i;
+
+  self->source_input (self->input_view == 0 && !self->input_throttled, self->user_data);
+  for (i = 0; i < self->views->len; i++)
+    {
+      MirrorView *view = &g_array_index (self->views, MirrorView, i);
+      view->callbacks->input (self->input_view == view->id && !self->input_throttled,
+                              view->user_data);
+    }
+}
+
+/**
+ * hotssh_mirror_new:
+ * @width: Current size of the source's terminal
+ * @height: Current size of the source's terminal
+ * @source_input: Called when input moves to or from the source
+ */
+HotSshMirror *
+hotssh_mirror_new (guint                  width,
+                   guint                  height,
+                   HotSshMirrorInputFunc  source_input,
+                   gpointer               user_data)
+{
+  HotSshMirror *self = g_slice_new0 (HotSshMirror);
+
+  self->views = g_array_new (FALSE, FALSE, sizeof (MirrorView));
+  self->next_id = 1;
+  g_queue_init (&self->snapshot);
+  self->width = width;
+  self->height = height;
+  self->source_input = source_input;
+  self->user_data = user_data;
+
+  return self;
+}
+
+/**
+ * hotssh_mirror_free:
+ *
+ * Detach every view, telling each that the source is gone.  Input is
+ * not handed back to the source; it is going away too.
+ */
+void
+hotssh_mirror_free (HotSshMirror *self)
+{
+  GArray *views = self->views;
+  guint i;
+
+  /* Views may call back in while closing; they'll find nothing */
+  self->views = g_array_new (FALSE, FALSE, sizeof (MirrorView));
+  for (i = 0; i < views->len; i++)
+    {
+      MirrorView *view = &g_array_index (views, MirrorView, i);
+      view->callbacks->closed (view->user_data);
+    }
+  g_array_unref (views);
+  g_array_unref (self->views);
+
+  clear_snapshot (self);
+  g_slice_free (HotSshMirror, self);
+}
+
+void
+hotssh_mirror_output (HotSshMirror *self,
+                      GBytes       *bytes)
+{
+  gsize len;
+  const guint8 *buf = g_bytes_get_data (bytes, &len);
+  guint i;
+
+  if (hotssh_scanner_find_barrier (buf, len, &self->alt_screen))
+    clear_snapshot (self);
+
+  g_queue_push_tail (&self->snapshot, g_bytes_ref (bytes));
+  self->snapshot_size += len;
+  while (self->snapshot_size > SNAPSHOT_MAX && self->snapshot.length > 1)
+    {
+      GBytes *oldest = g_queue_pop_head (&self->snapshot);
+      self->snapshot_size -= g_bytes_get_size (oldest);
+      g_bytes_unref (oldest);
+    }
+
+  for (i = 0; i < self->views->len; i++)
+    {
+      MirrorView *view = &g_array_index (self->views, MirrorView, i);
+      view->callbacks->output (bytes, view->user_data);
+    }
+}
+
+void
+hotssh_mirror_resize (HotSshMirror *self,
+                      guint         width,
+                      guint         height)
+{
+  guint i;
+
+  if (width == self->width && height == self->height)
+    return;
+
+  self->width = width;
+  self->height = height;
+  for (i = 0; i < self->views->len; i++)
+    {
+      MirrorView *view = &g_array_index (self->views, MirrorView, i);
+      view->callbacks->resize (width, height, view->user_data);
+    }
+}
+
+/**
+ * hotssh_mirror_add_view:
+ *
+ * Attach a view and bring it up to date from the snapshot, before
+ * returning.  New views don't have input.
+ *
+ * Returns: An id for the view, never 0
+ */
+guint
+hotssh_mirror_add_view (HotSshMirror                    *self,
+                        const HotSshMirrorViewCallbacks *callbacks,
+                        gpointer                         user_data)
+{
+  MirrorView view;
+
+  view.id = self->next_id++;
+  view.callbacks = callbacks;
+  view.user_data = user_data;
+  g_array_append_val (self->views, view);
+
+  hotssh_mirror_resync_view (self, view.id);
+
+  return view.id;
+}
+
+void
+hotssh_mirror_remove_view (HotSshMirror *self,
+                           guint         id)
+{
+  guint index;
+
+  if (!find_view (self, id, &index))
+    return;
+
+  g_array_remove_index (self->views, index);
+  if (self->input_view == id)
+    {
+      self->input_view = 0;
+      notify_input (self);
+    }
+}
+
+/**
+ * hotssh_mirror_resync_view:
+ *
+ * Reset the view and replay the snapshot to it, for a view that has
+ * fallen behind and thrown away what it had queued.
+ */
+void
+hotssh_mirror_resync_view (HotSshMirror *self,
+                           guint         id)
+{
+  MirrorView *view = find_view (self, id, NULL);
+  GList *l;
+
+  if (!view)
+    return;
+
+  view->callbacks->reset (self->width, self->height, view->user_data);
+  for (l = self->snapshot.head; l; l = l->next)
+    view->callbacks->output (l->data, view->user_data);
+}
+
+/**
+ * hotssh_mirror_set_input_view:
+ * @id: A view, or 0 for the source
+ *
+ * Make @id the one view whose keystrokes go to the channel.
+ */
+void
+hotssh_mirror_set_input_view (HotSshMirror *self,
+                              guint         id)
+{
+  if (id != 0 && !find_view (self, id, NULL))
+    return;
+
+  self->input_view = id;
+  notify_input (self);
+}
+
+/**
+ * hotssh_mirror_set_input_throttled:
+ *
+ * The source's write queue is full (or has drained); pass that on to
+ * whichever view has input.
+ */
+void
+hotssh_mirror_set_input_throttled (HotSshMirror *self,
+                                   gboolean      throttled)
+{
+  if (self->input_throttled == throttled)
+    return;
+
+  self->input_throttled = throttled;
+  notify_input (self);
+}
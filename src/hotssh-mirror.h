@@ -0,0 +1,81 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Shares one channel's output with any number of extra views.  Every
+ * view gets a reference to the same buffers the channel was read
+ * into; nothing is copied.  A view added later starts from a snapshot:
+ * the output since the screen was last cleared or switched, bounded in
+ * size, rather than the whole history.
+ *
+ * Of the source and its views, exactly one is designated to send
+ * input at a time; view 0 is the source.
+ */
+typedef struct _HotSshMirror HotSshMirror;
+
+typedef struct {
+  /* Start over with an empty terminal of the given size */
+  void (*reset)  (guint      width,
+                  guint      height,
+                  gpointer   user_data);
+  void (*output) (GBytes    *bytes,
+                  gpointer   user_data);
+  void (*resize) (guint      width,
+                  guint      height,
+                  gpointer   user_data);
+  /* Whether keystrokes in this view should go to the channel now */
+  void (*input)  (gboolean   enabled,
+                  gpointer   user_data);
+  /* The source is gone; the view is detached and its id is dead */
+  void (*closed) (gpointer   user_data);
+} HotSshMirrorViewCallbacks;
+
+typedef void (*HotSshMirrorInputFunc) (gboolean  enabled,
+                                       gpointer  user_data);
+
+HotSshMirror *hotssh_mirror_new               (guint                            width,
+                                               guint                            height,
+                                               HotSshMirrorInputFunc            source_input,
+                                               gpointer                         user_data);
+void          hotssh_mirror_free              (HotSshMirror                    *self);
+
+void          hotssh_mirror_output            (HotSshMirror                    *self,
+                                               GBytes                          *bytes);
+void          hotssh_mirror_resize            (HotSshMirror                    *self,
+                                               guint                            width,
+                                               guint                            height);
+
+guint         hotssh_mirror_add_view          (HotSshMirror                    *self,
+                                               const HotSshMirrorViewCallbacks *callbacks,
+                                               gpointer                         user_data);
+void          hotssh_mirror_remove_view       (HotSshMirror                    *self,
+                                               guint                            id);
+void          hotssh_mirror_resync_view       (HotSshMirror                    *self,
+                                               guint                            id);
+
+void          hotssh_mirror_set_input_view    (HotSshMirror                    *self,
+                                               guint                            id);
+void          hotssh_mirror_set_input_throttled (HotSshMirror                  *self,
+                                                 gboolean                       throttled);
+
+G_END_DECLS
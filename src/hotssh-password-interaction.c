@@ -24,7 +24,11 @@ struct _HotSshPasswordInteraction
 {
   GTlsInteraction parent_instance;
 
-  GtkEntry *entry;
+  /* Asked for from the connection's I/O worker, so it can't read the
+   * entry directly.
+   */
+  GMutex lock;
+  char *password;
 };
 
 struct _HotSshPasswordInteractionClass
@@ -46,26 +50,74 @@ hotssh_password_interaction_ask_password (GTlsInteraction    *interaction,
   if (g_cancellable_set_error_if_cancelled (cancellable, error))
     return G_TLS_INTERACTION_FAILED;
 
-  g_tls_password_set_value (password, (guint8*)gtk_entry_get_text (self->entry), -1);
+  g_mutex_lock (&self->lock);
+  g_tls_password_set_value (password, (guint8*)(self->password ? self->password : ""), -1);
+  g_mutex_unlock (&self->lock);
   return G_TLS_INTERACTION_HANDLED;
 }
 
 static void
 hotssh_password_interaction_init (HotSshPasswordInteraction *interaction)
 {
+  g_mutex_init (&interaction->lock);
+}
+
+static void
+hotssh_password_interaction_finalize (GObject *object)
+{
+  HotSshPasswordInteraction *self = (HotSshPasswordInteraction*)object;
+
+  hotssh_password_interaction_set_password (self, NULL);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (hotssh_password_interaction_parent_class)->finalize (object);
 }
 
 static void
 hotssh_password_interaction_class_init (HotSshPasswordInteractionClass *klass)
 {
   GTlsInteractionClass *interaction_class = G_TLS_INTERACTION_CLASS (klass);
+  G_OBJECT_CLASS (klass)->finalize = hotssh_password_interaction_finalize;
   interaction_class->ask_password = hotssh_password_interaction_ask_password;
 }
 
 HotSshPasswordInteraction *
-hotssh_password_interaction_new (GtkEntry *entry)
+hotssh_password_interaction_new (void)
+{
+  return g_object_new (HOTSSH_TYPE_PASSWORD_INTERACTION, NULL);
+}
+
+/**
+ * hotssh_password_interaction_set_password:
+ * @password: (allow-none): Password to answer with, or %NULL to forget it
+ */
+void
+hotssh_password_interaction_set_password (HotSshPasswordInteraction *self,
+                                          const char                *password)
+{
+  g_mutex_lock (&self->lock);
+  if (self->password)
+    {
+      memset (self->password, 0, strlen (self->password));
+      g_free (self->password);
+    }
+  self->password = g_strdup (password);
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * hotssh_password_interaction_dup_password:
+ *
+ * Returns: (transfer full) (allow-none): A copy of the password, which
+ * the caller should clear before freeing
+ */
+char *
+hotssh_password_interaction_dup_password (HotSshPasswordInteraction *self)
 {
-  HotSshPasswordInteraction *self = g_object_new (HOTSSH_TYPE_PASSWORD_INTERACTION, NULL);
-  self->entry = entry;
-  return self;
+  char *ret;
+
+  g_mutex_lock (&self->lock);
+  ret = g_strdup (self->password);
+  g_mutex_unlock (&self->lock);
+  return ret;
 }
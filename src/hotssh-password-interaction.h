@@ -34,6 +34,10 @@ typedef struct _HotSshPasswordInteractionClass   HotSshPasswordInteractionClass;
 
 GType                            hotssh_password_interaction_get_type    (void) G_GNUC_CONST;
 
-HotSshPasswordInteraction *      hotssh_password_interaction_new         (GtkEntry *entry);
+HotSshPasswordInteraction *      hotssh_password_interaction_new         (void);
+
+void                             hotssh_password_interaction_set_password (HotSshPasswordInteraction *self,
+                                                                           const char                *password);
+char *                           hotssh_password_interaction_dup_password (HotSshPasswordInteraction *self);
 
 G_END_DECLS
@@ -0,0 +1,430 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "hotssh-preconnect.h"
+#include "hotssh-address-cache.h"
+#include "hotssh-address-race.h"
+#include "hotssh-connection-pool.h"
+#include "hotssh-hostdb.h"
+#include "hotssh-keepalive.h"
+
+#include "libgsystem.h"
+
+/* Let startup settle before the frequently used hosts are connected */
+#define STARTUP_DELAY_SECONDS 5
+
+typedef struct {
+  char *id;
+  char *username;
+  HotSshIoWorker *worker;
+  GSocketConnectable *address;
+  GSshConnection *connection;   /* Once the address race is won */
+  GCancellable *cancellable;
+  gboolean ready;               /* Key exchange done */
+  HotSshHostKey *host_key;      /* As of the key exchange */
+  guint idle_id;
+} Preconnect;
+
+static GHashTable *preconnects;   /* id -> Preconnect */
+static GQueue preconnect_order = G_QUEUE_INIT;  /* Oldest first */
+static GSettings *settings;
+
+static void
+preconnect_free (Preconnect *pc)
+{
+  if (pc->idle_id)
+    g_source_remove (pc->idle_id);
+  g_cancellable_cancel (pc->cancellable);
+  g_object_unref (pc->cancellable);
+  g_clear_object (&pc->address);
+  hotssh_io_worker_release (pc->worker, pc->connection);
+  if (pc->host_key)
+    hotssh_host_key_free (pc->host_key);
+  g_free (pc->username);
+  g_free (pc->id);
+  g_slice_free (Preconnect, pc);
+}
+
+static void
+remove_preconnect (Preconnect *pc)
+{
+  g_hash_table_remove (preconnects, pc->id);
+  g_queue_remove (&preconnect_order, pc);
+  preconnect_free (pc);
+}
+
+static gboolean
+ensure_preconnects (void)
+{
+  if (!settings)
+    settings = g_settings_new ("org.gnome.hotssh");
+  if (!preconnects)
+    preconnects = g_hash_table_new (g_str_hash, g_str_equal);
+  return g_settings_get_boolean (settings, "speculative-connect");
+}
+
+static Preconnect *
+lookup_connection (GSshConnection *connection)
+{
+  GList *l;
+
+  for (l = preconnect_order.head; l; l = l->next)
+    {
+      Preconnect *pc = l->data;
+      if (pc->connection == connection)
+        return pc;
+    }
+  return NULL;
+}
+
+static gboolean
+on_idle_expired (gpointer user_data)
+{
+  Preconnect *pc = user_data;
+
+  g_debug ("preconnect: %s unused, closing", pc->id);
+  pc->idle_id = 0;
+  remove_preconnect (pc);
+  return FALSE;
+}
+
+static void
+on_handshake_complete (GObject      *src,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+  GError *local_error = NULL;
+  Preconnect *pc;
+
+  if (!gssh_connection_handshake_finish ((GSshConnection*)src, res, &local_error))
+    {
+      pc = lookup_connection ((GSshConnection*)src);
+      if (pc)
+        {
+          g_debug ("preconnect: handshake with %s failed: %s", pc->id, local_error->message);
+          remove_preconnect (pc);
+        }
+      g_error_free (local_error);
+      return;
+    }
+
+  pc = lookup_connection ((GSshConnection*)src);
+  if (!pc)
+    return;
+
+  g_debug ("preconnect: %s ready", pc->id);
+  pc->ready = TRUE;
+  pc->host_key = hotssh_host_key_copy (hotssh_connection_info_get_host_key (res));
+  pc->idle_id = g_timeout_add_seconds (g_settings_get_uint (settings, "speculative-connect-idle-timeout"),
+                                       on_idle_expired, pc);
+}
+
+/* Made on the worker, then handed to the main thread */
+typedef struct {
+  char *id;
+  HotSshIoWorker *worker;
+  GSocketConnectable *address;
+  char *username;
+  GCancellable *cancellable;
+  guint keepalive_interval;
+  guint keepalive_count;
+  GSshConnection *connection;
+} CreateOp;
+
+static void
+create_op_free (gpointer data)
+{
+  CreateOp *op = data;
+
+  g_free (op->id);
+  g_object_unref (op->address);
+  g_free (op->username);
+  g_object_unref (op->cancellable);
+  hotssh_io_worker_release (op->worker, op->connection);
+  g_slice_free (CreateOp, op);
+}
+
+static gboolean
+on_connection_created (gpointer data)
+{
+  CreateOp *op = data;
+  Preconnect *pc;
+
+  /* Replaced or dropped meanwhile */
+  pc = preconnects ? g_hash_table_lookup (preconnects, op->id) : NULL;
+  if (!pc || pc->cancellable != op->cancellable)
+    return FALSE;
+
+  pc->connection = op->connection;
+  op->connection = NULL;
+  return FALSE;
+}
+
+static gboolean
+op_create_connection (gpointer data)
+{
+  CreateOp *op = data;
+
+  op->connection = gssh_connection_new (op->address, op->username);
+  hotssh_keepalive_attach (op->connection, op->keepalive_interval, op->keepalive_count);
+  /* Started here so that no hop back to the main thread is needed */
+  gssh_connection_handshake_async (op->connection, op->cancellable,
+                                   hotssh_connection_info_return_handshake,
+                                   hotssh_io_worker_return_to_main (on_handshake_complete,
+                                                                    (GObject*)op->cancellable));
+  hotssh_io_worker_invoke_main (on_connection_created, op, create_op_free);
+  return FALSE;
+}
+
+static void
+on_address_race_complete (GObject      *src,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+  gs_free char *id = user_data;
+  GError *local_error = NULL;
+  gs_unref_object GSocketConnectable *address = NULL;
+  gs_unref_object GInetAddress *winner = NULL;
+  GList *resolved = NULL;
+  Preconnect *pc;
+  CreateOp *op;
+
+  address = hotssh_address_race_finish (res, &winner, &resolved, &local_error);
+
+  /* Replaced or dropped while racing */
+  pc = preconnects ? g_hash_table_lookup (preconnects, id) : NULL;
+  if (!pc || pc->cancellable != g_task_get_cancellable ((GTask*)res))
+    goto out;
+
+  if (!address)
+    {
+      g_debug ("preconnect: connecting to %s failed: %s", id, local_error->message);
+      remove_preconnect (pc);
+      goto out;
+    }
+
+  hotssh_address_cache_store (id, winner, resolved);
+
+  pc->address = g_object_ref (address);
+
+  op = g_slice_new0 (CreateOp);
+  op->id = g_strdup (id);
+  op->worker = pc->worker;
+  op->address = g_object_ref (address);
+  op->username = g_strdup (pc->username);
+  op->cancellable = g_object_ref (pc->cancellable);
+  op->keepalive_interval = g_settings_get_uint (settings, "keepalive-interval");
+  op->keepalive_count = g_settings_get_uint (settings, "keepalive-count");
+  hotssh_io_worker_invoke (pc->worker, op_create_connection, op, NULL);
+
+ out:
+  g_clear_error (&local_error);
+  g_resolver_free_addresses (resolved);
+}
+
+/**
+ * hotssh_preconnect_request:
+ * @id: A hostdb entry
+ *
+ * The user may be about to open @id; get a connection to it ready.
+ */
+void
+hotssh_preconnect_request (const char *id)
+{
+  gs_unref_object HotSshHostDB *hostdb = hotssh_hostdb_get_instance ();
+  gs_unref_object GtkTreeModel *model = NULL;
+  gs_free char *hostname = NULL;
+  gs_free char *username = NULL;
+  gs_free char *pool_key = NULL;
+  GtkTreeIter iter;
+  GList *cached;
+  Preconnect *pc;
+  guint port;
+  guint max;
+
+  if (!ensure_preconnects ())
+    return;
+
+  max = g_settings_get_uint (settings, "speculative-connect-max");
+  if (max == 0 || g_hash_table_contains (preconnects, id))
+    return;
+
+  if (!hotssh_hostdb_lookup_by_id (hostdb, id, &iter))
+    return;
+
+  model = hotssh_hostdb_get_model (hostdb);
+  gtk_tree_model_get (model, &iter,
+                      HOTSSH_HOSTDB_COLUMN_HOSTNAME, &hostname,
+                      HOTSSH_HOSTDB_COLUMN_PORT, &port,
+                      HOTSSH_HOSTDB_COLUMN_USERNAME, &username,
+                      -1);
+
+  /* Already logged in; nothing to gain */
+  pool_key = hotssh_connection_pool_make_key (username, hostname, port);
+  if (hotssh_connection_pool_contains (pool_key))
+    return;
+
+  while (g_queue_get_length (&preconnect_order) >= max)
+    {
+      Preconnect *oldest = g_queue_peek_head (&preconnect_order);
+      g_debug ("preconnect: dropping %s for %s", oldest->id, id);
+      remove_preconnect (oldest);
+    }
+
+  g_debug ("preconnect: connecting to %s", id);
+  pc = g_slice_new0 (Preconnect);
+  pc->id = g_strdup (id);
+  pc->username = username;
+  username = NULL;
+  pc->worker = hotssh_io_worker_get_for_key (id);
+  pc->cancellable = g_cancellable_new ();
+  g_hash_table_insert (preconnects, pc->id, pc);
+  g_queue_push_tail (&preconnect_order, pc);
+
+  cached = hotssh_address_cache_lookup (id);
+  hotssh_address_race_async (hostname, port, cached, pc->cancellable, NULL, NULL,
+                             on_address_race_complete, g_strdup (id));
+  g_resolver_free_addresses (cached);
+}
+
+/**
+ * hotssh_preconnect_take:
+ * @out_worker: (out): The worker the connection runs on
+ * @out_host_key: (out) (transfer full): The key the server presented
+ *
+ * Claim the speculative connection to @id, if its key exchange has
+ * finished; one still on its way is abandoned, as the caller is about
+ * to connect itself.  The connection may have been dropped since; the
+ * caller finds out once it watches its state on the worker.
+ *
+ * Returns: (transfer full) (allow-none): A connection awaiting host key
+ * verification and authentication
+ */
+GSshConnection *
+hotssh_preconnect_take (const char      *id,
+                        HotSshIoWorker **out_worker,
+                        HotSshHostKey  **out_host_key)
+{
+  GSshConnection *ret = NULL;
+  Preconnect *pc;
+
+  if (!preconnects || id == NULL)
+    return NULL;
+
+  pc = g_hash_table_lookup (preconnects, id);
+  if (!pc)
+    return NULL;
+
+  if (pc->ready && pc->host_key)
+    {
+      g_debug ("preconnect: using connection to %s", id);
+      ret = g_object_ref (pc->connection);
+      *out_worker = pc->worker;
+      *out_host_key = pc->host_key;
+      pc->host_key = NULL;
+    }
+  remove_preconnect (pc);
+  return ret;
+}
+
+typedef struct {
+  char *id;
+  guint uses;
+} StartupCandidate;
+
+static int
+compare_by_uses (gconstpointer a,
+                 gconstpointer b)
+{
+  const StartupCandidate *ca = a;
+  const StartupCandidate *cb = b;
+
+  if (ca->uses == cb->uses)
+    return 0;
+  return ca->uses > cb->uses ? -1 : 1;
+}
+
+static gboolean
+on_startup_timeout (gpointer user_data)
+{
+  gs_unref_object HotSshHostDB *hostdb = hotssh_hostdb_get_instance ();
+  gs_unref_object GtkTreeModel *model = hotssh_hostdb_get_model (hostdb);
+  GArray *candidates = g_array_new (FALSE, FALSE, sizeof (StartupCandidate));
+  guint n_hosts = g_settings_get_uint (settings, "speculative-connect-startup-hosts");
+  GtkTreeIter iter;
+  guint i;
+
+  if (gtk_tree_model_get_iter_first (model, &iter))
+    {
+      do
+        {
+          StartupCandidate candidate;
+
+          gtk_tree_model_get (model, &iter, HOTSSH_HOSTDB_COLUMN_ID, &candidate.id, -1);
+          candidate.uses = hotssh_hostdb_get_entry_uint (hostdb, candidate.id, "use-count", 0);
+          g_array_append_val (candidates, candidate);
+        }
+      while (gtk_tree_model_iter_next (model, &iter));
+    }
+
+  g_array_sort (candidates, compare_by_uses);
+
+  for (i = 0; i < candidates->len; i++)
+    {
+      StartupCandidate *candidate = &g_array_index (candidates, StartupCandidate, i);
+      if (i < n_hosts && candidate->uses > 0)
+        hotssh_preconnect_request (candidate->id);
+      g_free (candidate->id);
+    }
+  g_array_unref (candidates);
+
+  return FALSE;
+}
+
+/**
+ * hotssh_preconnect_start:
+ *
+ * Schedule connecting to the most used hosts, as set by
+ * speculative-connect-startup-hosts.
+ */
+void
+hotssh_preconnect_start (void)
+{
+  if (!ensure_preconnects ()
+      || g_settings_get_uint (settings, "speculative-connect-startup-hosts") == 0)
+    return;
+
+  g_timeout_add_seconds (STARTUP_DELAY_SECONDS, on_startup_timeout, NULL);
+}
+
+/**
+ * hotssh_preconnect_shutdown:
+ *
+ * Close every unclaimed connection; must be called before the I/O
+ * workers are shut down.
+ */
+void
+hotssh_preconnect_shutdown (void)
+{
+  while (!g_queue_is_empty (&preconnect_order))
+    remove_preconnect (g_queue_peek_head (&preconnect_order));
+  g_clear_pointer (&preconnects, g_hash_table_unref);
+  g_clear_object (&settings);
+}
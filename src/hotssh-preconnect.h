@@ -0,0 +1,47 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "hotssh-connection-info.h"
+#include "hotssh-io-worker.h"
+#include "gssh.h"
+
+G_BEGIN_DECLS
+
+/* Speculative connections: when the user looks likely to open a saved
+ * host (it is selected or hovered in the list, it is the only match for
+ * what has been typed, or it is among the most used at startup),
+ * resolve, connect and do the SSH key exchange ahead of time.  Opening
+ * the host then starts from host key verification.
+ *
+ * Off unless the speculative-connect setting is on.  At most
+ * speculative-connect-max exist at once, the oldest making way for the
+ * newest; one left unclaimed for speculative-connect-idle-timeout is
+ * closed.  Only the main thread uses these.
+ */
+
+void            hotssh_preconnect_request  (const char      *id);
+GSshConnection *hotssh_preconnect_take     (const char      *id,
+                                            HotSshIoWorker **out_worker,
+                                            HotSshHostKey  **out_host_key);
+
+void            hotssh_preconnect_start    (void);
+void            hotssh_preconnect_shutdown (void);
+
+G_END_DECLS
@@ -0,0 +1,448 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "hotssh-predictor.h"
+
+/* Predictive local echo, loosely after mosh.
+ *
+ * Printable characters typed by the user are painted immediately,
+ * underlined, over the cells following the cursor.  They are drawn
+ * after the terminal has drawn itself and never enter it, so its
+ * contents and cursor are only ever what the server sent.  When the
+ * server's echo arrives the terminal shows the real characters and the
+ * matching predictions are dropped; anything else drops them all.
+ *
+ * Predictions are only drawn once the server has echoed something
+ * since the last Return (an "epoch").  Until then they're tracked but
+ * invisible, which keeps passwords typed at a no-echo prompt off the
+ * screen.
+ *
+ * Only typing at the end of what has been echoed is modelled, plus
+ * Backspace over characters still awaiting their echo.  Predictions
+ * are confirmed by matching the echo byte for byte, and the echo of a
+ * cursor movement or of erasing an echoed character depends on the
+ * line editor ("\b", "\b \b", "\b\033[K", a redraw of the rest of the
+ * line), so those drop all predictions rather than guess.
+ */
+
+#define PREDICTION_MAX (256)
+#define PREDICTION_MIN_TIMEOUT_MS (1000)
+#define RTT_MAX_SAMPLE_MS (5000)
+
+struct _HotSshPredictor
+{
+  VteTerminal *terminal;
+
+  HotSshPredictorMode mode;
+  guint threshold_ms;
+
+  GdkRGBA foreground;
+  GdkRGBA background;
+
+  /* Smoothed echo round trip, in microseconds */
+  gint64 srtt;
+  /* A typed character whose echo is being timed */
+  gint64 rtt_probe_start;
+  guint8 rtt_probe_byte;
+
+  GString *pending;
+  gboolean epoch_confirmed;
+  gboolean awaiting_epoch_end;
+  gboolean alt_screen;
+
+  guint timeout_id;
+};
+
+static gboolean on_terminal_draw (GtkWidget       *widget,
+                                  cairo_t         *cr,
+                                  HotSshPredictor *self);
+
+HotSshPredictor *
+hotssh_predictor_new (VteTerminal *terminal)
+{
+  HotSshPredictor *self = g_slice_new0 (HotSshPredictor);
+
+  self->terminal = terminal;
+  self->mode = HOTSSH_PREDICTOR_MODE_NEVER;
+  self->pending = g_string_new ("");
+  self->foreground.alpha = 1;
+  self->background.red = self->background.green = self->background.blue = 1;
+  self->background.alpha = 1;
+
+  g_signal_connect_after (terminal, "draw", G_CALLBACK (on_terminal_draw), self);
+
+  return self;
+}
+
+void
+hotssh_predictor_free (HotSshPredictor *self)
+{
+  g_signal_handlers_disconnect_by_data (self->terminal, self);
+  if (self->timeout_id)
+    g_source_remove (self->timeout_id);
+  g_string_free (self->pending, TRUE);
+  g_slice_free (HotSshPredictor, self);
+}
+
+/* Predictions are painted in the terminal's own colors */
+void
+hotssh_predictor_set_colors (HotSshPredictor *self,
+                             const GdkRGBA   *foreground,
+                             const GdkRGBA   *background)
+{
+  self->foreground = *foreground;
+  self->background = *background;
+  gtk_widget_queue_draw ((GtkWidget*)self->terminal);
+}
+
+static gboolean
+is_active (HotSshPredictor *self)
+{
+  if (self->alt_screen)
+    return FALSE;
+
+  switch (self->mode)
+    {
+    case HOTSSH_PREDICTOR_MODE_NEVER:
+      return FALSE;
+    case HOTSSH_PREDICTOR_MODE_ADAPTIVE:
+      return self->srtt / 1000 >= self->threshold_ms;
+    case HOTSSH_PREDICTOR_MODE_ALWAYS:
+      return TRUE;
+    }
+  return FALSE;
+}
+
+/* Erase every prediction that is currently drawn and forget them all */
+static void
+rollback (HotSshPredictor *self)
+{
+  if (self->pending->len > 0)
+    gtk_widget_queue_draw ((GtkWidget*)self->terminal);
+
+  g_string_truncate (self->pending, 0);
+  self->epoch_confirmed = FALSE;
+  self->awaiting_epoch_end = FALSE;
+
+  if (self->timeout_id)
+    {
+      g_source_remove (self->timeout_id);
+      self->timeout_id = 0;
+    }
+}
+
+static gboolean
+on_prediction_timeout (gpointer user_data)
+{
+  HotSshPredictor *self = user_data;
+
+  self->timeout_id = 0;
+  g_debug ("predictions not confirmed in time, rolling back");
+  rollback (self);
+
+  return FALSE;
+}
+
+static void
+restart_timeout (HotSshPredictor *self)
+{
+  guint timeout_ms = MAX (PREDICTION_MIN_TIMEOUT_MS, (self->srtt / 1000) * 3);
+
+  if (self->timeout_id)
+    g_source_remove (self->timeout_id);
+  self->timeout_id = g_timeout_add (timeout_ms, on_prediction_timeout, self);
+}
+
+static gboolean
+on_terminal_draw (GtkWidget       *widget,
+                  cairo_t         *cr,
+                  HotSshPredictor *self)
+{
+  GtkAdjustment *vadjustment;
+  GtkBorder padding;
+  PangoLayout *layout;
+  PangoAttrList *attrs;
+  glong column, row;
+  glong char_width, char_height;
+  glong n_columns;
+  double x, y;
+  gsize i;
+
+  if (!self->epoch_confirmed || self->pending->len == 0 || !is_active (self))
+    return FALSE;
+
+  vte_terminal_get_cursor_position (self->terminal, &column, &row);
+  n_columns = vte_terminal_get_column_count (self->terminal);
+  char_width = vte_terminal_get_char_width (self->terminal);
+  char_height = vte_terminal_get_char_height (self->terminal);
+
+  /* Past the right margin the server would wrap, and we can't say where */
+  if (column + (glong)self->pending->len >= n_columns)
+    return FALSE;
+
+  /* The cursor row counts scrollback; the view may not be at the bottom */
+  vadjustment = gtk_scrollable_get_vadjustment ((GtkScrollable*)self->terminal);
+  row -= (glong)gtk_adjustment_get_value (vadjustment);
+  if (row < 0 || row >= vte_terminal_get_row_count (self->terminal))
+    return FALSE;
+
+  gtk_style_context_get_padding (gtk_widget_get_style_context (widget),
+                                 gtk_widget_get_state_flags (widget), &padding);
+  x = padding.left + column * char_width;
+  y = padding.top + row * char_height;
+
+  cairo_save (cr);
+  gdk_cairo_set_source_rgba (cr, &self->background);
+  cairo_rectangle (cr, x, y, self->pending->len * char_width, char_height);
+  cairo_fill (cr);
+
+  layout = pango_cairo_create_layout (cr);
+  pango_layout_set_font_description (layout, vte_terminal_get_font (self->terminal));
+  attrs = pango_attr_list_new ();
+  pango_attr_list_insert (attrs, pango_attr_underline_new (PANGO_UNDERLINE_SINGLE));
+  pango_layout_set_attributes (layout, attrs);
+  pango_attr_list_unref (attrs);
+
+  gdk_cairo_set_source_rgba (cr, &self->foreground);
+  /* One cell each, whatever the font's own advance */
+  for (i = 0; i < self->pending->len; i++)
+    {
+      pango_layout_set_text (layout, self->pending->str + i, 1);
+      cairo_move_to (cr, x + i * char_width, y);
+      pango_cairo_show_layout (cr, layout);
+    }
+
+  g_object_unref (layout);
+  cairo_restore (cr);
+
+  return FALSE;
+}
+
+void
+hotssh_predictor_set_mode (HotSshPredictor     *self,
+                           HotSshPredictorMode  mode,
+                           guint                threshold_ms)
+{
+  self->mode = mode;
+  self->threshold_ms = threshold_ms;
+  if (!is_active (self))
+    rollback (self);
+}
+
+/* Forget everything, e.g. because the terminal itself was reset */
+void
+hotssh_predictor_reset (HotSshPredictor *self)
+{
+  if (self->timeout_id)
+    {
+      g_source_remove (self->timeout_id);
+      self->timeout_id = 0;
+    }
+  if (self->pending->len > 0)
+    gtk_widget_queue_draw ((GtkWidget*)self->terminal);
+  g_string_truncate (self->pending, 0);
+  self->epoch_confirmed = FALSE;
+  self->awaiting_epoch_end = FALSE;
+  self->alt_screen = FALSE;
+  self->srtt = 0;
+  self->rtt_probe_start = 0;
+}
+
+void
+hotssh_predictor_input (HotSshPredictor     *self,
+                        const guint8        *buf,
+                        gsize                len)
+{
+  gint64 now = g_get_monotonic_time ();
+  gsize i;
+
+  /* Time the echo of one typed character at a time; one that never
+   * comes back, as at a password prompt, is given up on.
+   */
+  if (self->rtt_probe_start != 0
+      && now - self->rtt_probe_start >= RTT_MAX_SAMPLE_MS * 1000)
+    self->rtt_probe_start = 0;
+  if (self->rtt_probe_start == 0)
+    {
+      for (i = 0; i < len; i++)
+        if (buf[i] >= 0x20 && buf[i] < 0x7f)
+          {
+            self->rtt_probe_start = now;
+            self->rtt_probe_byte = buf[i];
+            break;
+          }
+    }
+
+  if (!is_active (self))
+    return;
+
+  for (i = 0; i < len; i++)
+    {
+      guint8 c = buf[i];
+
+      if (c >= 0x20 && c < 0x7f)
+        {
+          /* After Return, wait until the old line is fully accounted
+           * for before predicting on the new one.
+           */
+          if (self->awaiting_epoch_end || self->pending->len >= PREDICTION_MAX)
+            continue;
+          g_string_append_c (self->pending, c);
+          if (self->epoch_confirmed)
+            gtk_widget_queue_draw ((GtkWidget*)self->terminal);
+          restart_timeout (self);
+        }
+      /* Only over a prediction; over echoed text see above */
+      else if ((c == 0x7f || c == '\b') && self->pending->len > 0 && !self->awaiting_epoch_end)
+        {
+          g_string_truncate (self->pending, self->pending->len - 1);
+          gtk_widget_queue_draw ((GtkWidget*)self->terminal);
+        }
+      else if (c == '\r')
+        {
+          if (self->pending->len > 0)
+            self->awaiting_epoch_end = TRUE;
+          self->epoch_confirmed = FALSE;
+        }
+      else
+        {
+          /* Cursor keys, Backspace over echoed text, control
+           * characters, multibyte input: we can't model where these
+           * leave the cursor.
+           */
+          rollback (self);
+          self->awaiting_epoch_end = FALSE;
+        }
+    }
+}
+
+static void
+update_alt_screen (HotSshPredictor *self,
+                   const guint8    *buf,
+                   gsize            len)
+{
+  static const char prefix[] = "\033[?";
+  const guint8 *p = buf;
+  const guint8 *end = buf + len;
+
+  while ((p = memchr (p, '\033', end - p)) != NULL)
+    {
+      const guint8 *q = p + 3;
+      guint mode = 0;
+
+      if ((gsize)(end - p) < 5 || memcmp (p, prefix, 3) != 0)
+        {
+          p++;
+          continue;
+        }
+      while (q < end && *q >= '0' && *q <= '9')
+        mode = mode * 10 + (*q++ - '0');
+      if (q < end && (mode == 47 || mode == 1047 || mode == 1049))
+        {
+          if (*q == 'h')
+            self->alt_screen = TRUE;
+          else if (*q == 'l')
+            self->alt_screen = FALSE;
+        }
+      p++;
+    }
+}
+
+/* Feed server output to the terminal, reconciling it with any
+ * outstanding predictions on the way.
+ */
+void
+hotssh_predictor_feed (HotSshPredictor     *self,
+                       const guint8        *buf,
+                       gsize                len)
+{
+  gsize matched = 0;
+
+  /* Only the echo of the character being timed is a sample; a prompt
+   * or other output arriving meanwhile says nothing about the round
+   * trip.
+   */
+  if (self->rtt_probe_start != 0 && len > 0 && buf[0] == self->rtt_probe_byte)
+    {
+      gint64 sample = g_get_monotonic_time () - self->rtt_probe_start;
+      self->rtt_probe_start = 0;
+      if (sample < RTT_MAX_SAMPLE_MS * 1000)
+        {
+          if (self->srtt == 0)
+            self->srtt = sample;
+          else
+            self->srtt = (7 * self->srtt + sample) / 8;
+        }
+    }
+
+  update_alt_screen (self, buf, len);
+
+  vte_terminal_feed (self->terminal, (const char*)buf, len);
+
+  if (self->pending->len == 0)
+    return;
+
+  while (matched < len && matched < self->pending->len &&
+         buf[matched] == (guint8)self->pending->str[matched])
+    matched++;
+
+  if (matched > 0)
+    {
+      g_string_erase (self->pending, 0, matched);
+      self->epoch_confirmed = TRUE;
+    }
+
+  if (matched < len && self->pending->len > 0)
+    {
+      g_debug ("prediction mismatch, dropping %" G_GSIZE_FORMAT " predictions",
+               self->pending->len);
+      rollback (self);
+    }
+
+  /* The echoed cells, and where the cursor now is, changed */
+  gtk_widget_queue_draw ((GtkWidget*)self->terminal);
+
+  if (self->pending->len == 0)
+    {
+      /* The line the user hit Return on is fully echoed; whatever comes
+       * next needs a fresh confirmation.
+       */
+      if (self->awaiting_epoch_end)
+        self->epoch_confirmed = FALSE;
+      self->awaiting_epoch_end = FALSE;
+      if (self->timeout_id)
+        {
+          g_source_remove (self->timeout_id);
+          self->timeout_id = 0;
+        }
+    }
+  else if (!self->alt_screen && is_active (self))
+    restart_timeout (self);
+  else
+    rollback (self);
+}
+
+guint
+hotssh_predictor_get_srtt_ms (HotSshPredictor *self)
+{
+  return self->srtt / 1000;
+}
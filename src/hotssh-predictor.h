@@ -0,0 +1,50 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vte/vte.h>
+
+typedef enum {
+  HOTSSH_PREDICTOR_MODE_NEVER,
+  HOTSSH_PREDICTOR_MODE_ADAPTIVE,
+  HOTSSH_PREDICTOR_MODE_ALWAYS
+} HotSshPredictorMode;
+
+typedef struct _HotSshPredictor HotSshPredictor;
+
+HotSshPredictor *hotssh_predictor_new        (VteTerminal         *terminal);
+void             hotssh_predictor_free       (HotSshPredictor     *self);
+
+void             hotssh_predictor_set_mode   (HotSshPredictor     *self,
+                                              HotSshPredictorMode  mode,
+                                              guint                threshold_ms);
+void             hotssh_predictor_set_colors (HotSshPredictor     *self,
+                                              const GdkRGBA       *foreground,
+                                              const GdkRGBA       *background);
+
+void             hotssh_predictor_reset      (HotSshPredictor     *self);
+
+void             hotssh_predictor_input      (HotSshPredictor     *self,
+                                              const guint8        *buf,
+                                              gsize                len);
+void             hotssh_predictor_feed       (HotSshPredictor     *self,
+                                              const guint8        *buf,
+                                              gsize                len);
+
+guint            hotssh_predictor_get_srtt_ms (HotSshPredictor    *self);
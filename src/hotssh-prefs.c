@@ -38,6 +38,7 @@ struct _HotSshPrefsPrivate
 {
   GSettings *settings;
   GtkWidget *match_system_terminal_style;
+  GtkWidget *predictive_echo;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(HotSshPrefs, hotssh_prefs, GTK_TYPE_DIALOG)
@@ -60,6 +61,9 @@ hotssh_prefs_init (HotSshPrefs *prefs)
   g_settings_bind (priv->settings, "match-system-terminal-style",
                    priv->match_system_terminal_style, "active",
                    G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind (priv->settings, "predictive-echo",
+                   priv->predictive_echo, "active-id",
+                   G_SETTINGS_BIND_DEFAULT);
 }
 
 static void
@@ -81,6 +85,7 @@ hotssh_prefs_class_init (HotSshPrefsClass *class)
   gtk_widget_class_set_template_from_resource (GTK_WIDGET_CLASS (class),
                                                "/org/gnome/hotssh/prefs.ui");
   gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshPrefs, match_system_terminal_style);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshPrefs, predictive_echo);
 
   gtk_widget_class_bind_template_callback (GTK_WIDGET_CLASS (class), preferences_closed);
 }
@@ -0,0 +1,587 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <gio/gio.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "hotssh-recorder.h"
+#include "libgsystem.h"
+
+/* Bytes the writer may be behind by before events are dropped */
+#define RECORDER_MAX_QUEUED (8 * 1024 * 1024)
+/* Formatted text collected before handing it to the stream */
+#define RECORDER_WRITE_CHUNK (64 * 1024)
+/* How long a quiet session may sit in buffers before it is on disk */
+#define RECORDER_FLUSH_INTERVAL_USEC (G_USEC_PER_SEC)
+#define RECORDER_ZSTD_LEVEL 3
+
+#define REPLACEMENT_CHARACTER "\xef\xbf\xbd"
+
+typedef enum {
+  RECORDER_EVENT_OUTPUT,
+  RECORDER_EVENT_INPUT,
+  RECORDER_EVENT_RESIZE,
+  RECORDER_EVENT_MARKER,
+  RECORDER_EVENT_CLOSE
+} RecorderEventType;
+
+typedef struct {
+  RecorderEventType type;
+  gint64 usec;                  /* Since the start of the recording */
+  GBytes *data;
+  guint width;
+  guint height;
+} RecorderEvent;
+
+typedef enum {
+  RECORDER_CONTINUE,
+  RECORDER_FLUSH,
+  RECORDER_END
+} RecorderWriteMode;
+
+struct _HotSshRecorder
+{
+  GAsyncQueue *queue;
+  gint64 start_time;
+  volatile gint queued_bytes;
+
+  /* Main thread only */
+  guint64 dropped_bytes;
+
+  /* Writer thread only, after creation */
+  char *path;
+  char *title;
+  gboolean compress;
+  guint width;
+  guint height;
+  gint64 start_wallclock;
+  GOutputStream *out;
+  GString *line;
+  gint64 last_flush;
+  gboolean dirty;
+  gboolean failed;
+  /* Trailing bytes of a UTF-8 sequence split across reads, for
+   * output and input respectively.
+   */
+  guint8 carry[2][4];
+  gsize carry_len[2];
+#ifdef HAVE_ZSTD
+  ZSTD_CCtx *zctx;
+  guint8 *zbuf;
+  gsize zbuf_size;
+#endif
+};
+
+static void
+recorder_event_free (RecorderEvent *event)
+{
+  if (event->data)
+    g_bytes_unref (event->data);
+  g_slice_free (RecorderEvent, event);
+}
+
+static void
+append_json_text (GString      *line,
+                  guint8       *carry,
+                  gsize        *carry_len,
+                  const guint8 *buf,
+                  gsize         len)
+{
+  gs_free guint8 *joined = NULL;
+  const guint8 *p;
+  const guint8 *end;
+
+  if (carry_len && *carry_len > 0)
+    {
+      joined = g_malloc (*carry_len + len);
+      memcpy (joined, carry, *carry_len);
+      memcpy (joined + *carry_len, buf, len);
+      len += *carry_len;
+      buf = joined;
+      *carry_len = 0;
+    }
+
+  p = buf;
+  end = buf + len;
+  while (p < end)
+    {
+      const guint8 *run = p;
+      gunichar ch;
+
+      while (p < end && *p >= 0x20 && *p < 0x7f && *p != '"' && *p != '\\')
+        p++;
+      if (p > run)
+        g_string_append_len (line, (const char*)run, p - run);
+      if (p == end)
+        break;
+
+      if (*p < 0x80)
+        {
+          switch (*p)
+            {
+            case '"': g_string_append (line, "\\\""); break;
+            case '\\': g_string_append (line, "\\\\"); break;
+            case '\n': g_string_append (line, "\\n"); break;
+            case '\r': g_string_append (line, "\\r"); break;
+            case '\t': g_string_append (line, "\\t"); break;
+            default: g_string_append_printf (line, "\\u%04x", *p); break;
+            }
+          p++;
+          continue;
+        }
+
+      ch = g_utf8_get_char_validated ((const char*)p, end - p);
+      if (ch == (gunichar)-2 && carry_len && end - p < 4)
+        {
+          /* The rest of this character is in the next read */
+          memcpy (carry, p, end - p);
+          *carry_len = end - p;
+          break;
+        }
+      else if (ch == (gunichar)-1 || ch == (gunichar)-2)
+        {
+          g_string_append (line, REPLACEMENT_CHARACTER);
+          p++;
+        }
+      else
+        {
+          guint n = g_utf8_skip[*p];
+          g_string_append_len (line, (const char*)p, n);
+          p += n;
+        }
+    }
+}
+
+static void
+append_timestamp (GString *line,
+                  gint64   usec)
+{
+  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append_c (line, '[');
+  g_string_append (line, g_ascii_formatd (buf, sizeof (buf), "%.6f",
+                                          (double)usec / G_USEC_PER_SEC));
+}
+
+static void
+format_event (HotSshRecorder *self,
+              RecorderEvent  *event)
+{
+  GString *line = self->line;
+  const guint8 *buf = NULL;
+  gsize len = 0;
+  char label[64];
+
+  if (event->data)
+    buf = g_bytes_get_data (event->data, &len);
+
+  append_timestamp (line, event->usec);
+  switch (event->type)
+    {
+    case RECORDER_EVENT_OUTPUT:
+      g_string_append (line, ", \"o\", \"");
+      append_json_text (line, self->carry[0], &self->carry_len[0], buf, len);
+      break;
+    case RECORDER_EVENT_INPUT:
+      g_string_append (line, ", \"i\", \"");
+      append_json_text (line, self->carry[1], &self->carry_len[1], buf, len);
+      break;
+    case RECORDER_EVENT_RESIZE:
+      g_snprintf (label, sizeof (label), "%ux%u", event->width, event->height);
+      g_string_append (line, ", \"r\", \"");
+      g_string_append (line, label);
+      break;
+    case RECORDER_EVENT_MARKER:
+      g_string_append (line, ", \"m\", \"");
+      append_json_text (line, NULL, NULL, buf, len);
+      break;
+    case RECORDER_EVENT_CLOSE:
+      g_assert_not_reached ();
+    }
+  g_string_append (line, "\"]\n");
+}
+
+static gboolean
+write_stream (HotSshRecorder    *self,
+              const guint8      *buf,
+              gsize              len,
+              RecorderWriteMode  mode,
+              GError           **error)
+{
+#ifdef HAVE_ZSTD
+  if (self->zctx)
+    {
+      ZSTD_EndDirective directive;
+      ZSTD_inBuffer in = { buf, len, 0 };
+      gboolean done;
+
+      switch (mode)
+        {
+        case RECORDER_FLUSH: directive = ZSTD_e_flush; break;
+        case RECORDER_END: directive = ZSTD_e_end; break;
+        default: directive = ZSTD_e_continue; break;
+        }
+
+      do
+        {
+          ZSTD_outBuffer out = { self->zbuf, self->zbuf_size, 0 };
+          size_t remaining = ZSTD_compressStream2 (self->zctx, &out, &in, directive);
+
+          if (ZSTD_isError (remaining))
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "zstd: %s", ZSTD_getErrorName (remaining));
+              return FALSE;
+            }
+          if (out.pos > 0 &&
+              !g_output_stream_write_all (self->out, self->zbuf, out.pos,
+                                          NULL, NULL, error))
+            return FALSE;
+          if (directive == ZSTD_e_continue)
+            done = in.pos == in.size;
+          else
+            done = remaining == 0;
+        }
+      while (!done);
+      return TRUE;
+    }
+#endif
+
+  if (len > 0 &&
+      !g_output_stream_write_all (self->out, buf, len, NULL, NULL, error))
+    return FALSE;
+  return TRUE;
+}
+
+static gboolean
+write_pending (HotSshRecorder    *self,
+               RecorderWriteMode  mode,
+               GError           **error)
+{
+  gboolean ret = FALSE;
+
+  if (!write_stream (self, (const guint8*)self->line->str, self->line->len,
+                     mode, error))
+    goto out;
+  g_string_truncate (self->line, 0);
+
+  if (mode != RECORDER_CONTINUE)
+    {
+      if (!g_output_stream_flush (self->out, NULL, error))
+        goto out;
+      self->last_flush = g_get_monotonic_time ();
+      self->dirty = FALSE;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+recorder_open (HotSshRecorder  *self,
+               GError         **error)
+{
+  gboolean ret = FALSE;
+  gs_free char *dir = g_path_get_dirname (self->path);
+  gs_unref_object GFile *file = g_file_new_for_path (self->path);
+  GFileOutputStream *out;
+
+  if (g_mkdir_with_parents (dir, 0700) < 0)
+    {
+      int errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "%s: %s", dir, g_strerror (errsv));
+      goto out;
+    }
+
+  /* Recordings may contain anything that was on screen */
+  out = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, error);
+  if (!out)
+    goto out;
+  self->out = (GOutputStream*)out;
+
+#ifdef HAVE_ZSTD
+  if (self->compress)
+    {
+      self->zctx = ZSTD_createCCtx ();
+      ZSTD_CCtx_setParameter (self->zctx, ZSTD_c_compressionLevel, RECORDER_ZSTD_LEVEL);
+      self->zbuf_size = ZSTD_CStreamOutSize ();
+      self->zbuf = g_malloc (self->zbuf_size);
+    }
+#endif
+
+  g_string_append_printf (self->line,
+                          "{\"version\": 2, \"width\": %u, \"height\": %u, "
+                          "\"timestamp\": %" G_GINT64_FORMAT ", \"title\": \"",
+                          self->width, self->height, self->start_wallclock);
+  if (self->title)
+    append_json_text (self->line, NULL, NULL,
+                      (const guint8*)self->title, strlen (self->title));
+  g_string_append (self->line, "\"}\n");
+  self->dirty = TRUE;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+recorder_finish (HotSshRecorder  *self,
+                 GError         **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+
+  /* Drop any character cut off by the end of the session */
+  for (i = 0; i < G_N_ELEMENTS (self->carry_len); i++)
+    self->carry_len[i] = 0;
+
+  if (!write_pending (self, RECORDER_END, error))
+    goto out;
+  if (!g_output_stream_close (self->out, NULL, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+recorder_free (HotSshRecorder *self)
+{
+  g_async_queue_unref (self->queue);
+  g_free (self->path);
+  g_free (self->title);
+  g_clear_object (&self->out);
+  g_string_free (self->line, TRUE);
+#ifdef HAVE_ZSTD
+  if (self->zctx)
+    ZSTD_freeCCtx (self->zctx);
+  g_free (self->zbuf);
+#endif
+  g_free (self);
+}
+
+static void
+recorder_fail (HotSshRecorder *self,
+               GError         *error)
+{
+  g_warning ("Recording to %s: %s", self->path, error->message);
+  g_error_free (error);
+  self->failed = TRUE;
+  self->dirty = FALSE;
+  g_string_truncate (self->line, 0);
+}
+
+static gpointer
+recorder_thread_main (gpointer data)
+{
+  HotSshRecorder *self = data;
+  GError *local_error = NULL;
+
+  if (!recorder_open (self, &local_error))
+    recorder_fail (self, local_error);
+  self->last_flush = g_get_monotonic_time ();
+
+  while (TRUE)
+    {
+      RecorderEvent *event;
+      gint64 now;
+
+      if (self->dirty)
+        {
+          gint64 wait = self->last_flush + RECORDER_FLUSH_INTERVAL_USEC - g_get_monotonic_time ();
+          event = g_async_queue_timeout_pop (self->queue, MAX (wait, 0));
+        }
+      else
+        event = g_async_queue_pop (self->queue);
+
+      if (event && event->type == RECORDER_EVENT_CLOSE)
+        {
+          recorder_event_free (event);
+          break;
+        }
+
+      if (event)
+        {
+          /* Only what reserve() counted; markers aren't */
+          if (event->type == RECORDER_EVENT_OUTPUT || event->type == RECORDER_EVENT_INPUT)
+            g_atomic_int_add (&self->queued_bytes, -(gint)g_bytes_get_size (event->data));
+          if (!self->failed)
+            {
+              format_event (self, event);
+              self->dirty = TRUE;
+            }
+          recorder_event_free (event);
+        }
+
+      if (self->failed)
+        continue;
+
+      now = g_get_monotonic_time ();
+      if (self->dirty && now - self->last_flush >= RECORDER_FLUSH_INTERVAL_USEC)
+        {
+          if (!write_pending (self, RECORDER_FLUSH, &local_error))
+            recorder_fail (self, local_error);
+        }
+      else if (self->line->len >= RECORDER_WRITE_CHUNK)
+        {
+          if (!write_pending (self, RECORDER_CONTINUE, &local_error))
+            recorder_fail (self, local_error);
+        }
+    }
+
+  if (!self->failed && !recorder_finish (self, &local_error))
+    recorder_fail (self, local_error);
+
+  recorder_free (self);
+  return NULL;
+}
+
+HotSshRecorder *
+hotssh_recorder_new (const char *path,
+                     gboolean    compress,
+                     guint       width,
+                     guint       height,
+                     const char *title)
+{
+  HotSshRecorder *self = g_new0 (HotSshRecorder, 1);
+  GThread *thread;
+
+  self->queue = g_async_queue_new ();
+  self->start_time = g_get_monotonic_time ();
+  self->start_wallclock = g_get_real_time () / G_USEC_PER_SEC;
+  self->path = g_strdup (path);
+  self->title = g_strdup (title);
+  self->compress = compress && hotssh_recorder_can_compress ();
+  self->width = width;
+  self->height = height;
+  self->line = g_string_sized_new (RECORDER_WRITE_CHUNK);
+
+  thread = g_thread_new ("recorder", recorder_thread_main, self);
+  g_thread_unref (thread);
+
+  return self;
+}
+
+static void
+push_event (HotSshRecorder    *self,
+            RecorderEventType  type,
+            GBytes            *data,
+            guint              width,
+            guint              height)
+{
+  RecorderEvent *event = g_slice_new0 (RecorderEvent);
+
+  event->type = type;
+  event->usec = g_get_monotonic_time () - self->start_time;
+  event->data = data;
+  event->width = width;
+  event->height = height;
+  g_async_queue_push (self->queue, event);
+}
+
+/* Returns %FALSE if the writer is too far behind to take @len more
+ * bytes; they are counted and reported by a marker once it catches up.
+ */
+static gboolean
+reserve (HotSshRecorder *self,
+         gsize           len)
+{
+  if ((gsize)g_atomic_int_get (&self->queued_bytes) + len > RECORDER_MAX_QUEUED)
+    {
+      self->dropped_bytes += len;
+      return FALSE;
+    }
+
+  if (self->dropped_bytes > 0)
+    {
+      char *label = g_strdup_printf ("recording dropped %" G_GUINT64_FORMAT " bytes",
+                                     self->dropped_bytes);
+      push_event (self, RECORDER_EVENT_MARKER,
+                  g_bytes_new_take (label, strlen (label)), 0, 0);
+      self->dropped_bytes = 0;
+    }
+
+  g_atomic_int_add (&self->queued_bytes, (gint)len);
+  return TRUE;
+}
+
+void
+hotssh_recorder_output (HotSshRecorder *self,
+                        GBytes         *bytes)
+{
+  if (!reserve (self, g_bytes_get_size (bytes)))
+    return;
+  push_event (self, RECORDER_EVENT_OUTPUT, g_bytes_ref (bytes), 0, 0);
+}
+
+void
+hotssh_recorder_input (HotSshRecorder *self,
+                       const guint8   *buf,
+                       gsize           len)
+{
+  if (!reserve (self, len))
+    return;
+  push_event (self, RECORDER_EVENT_INPUT, g_bytes_new (buf, len), 0, 0);
+}
+
+void
+hotssh_recorder_resize (HotSshRecorder *self,
+                        guint           width,
+                        guint           height)
+{
+  push_event (self, RECORDER_EVENT_RESIZE, NULL, width, height);
+}
+
+void
+hotssh_recorder_close (HotSshRecorder *self)
+{
+  /* The writer thread owns @self from here on */
+  push_event (self, RECORDER_EVENT_CLOSE, NULL, 0, 0);
+}
+
+gboolean
+hotssh_recorder_can_compress (void)
+{
+#ifdef HAVE_ZSTD
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+/* The recording-directory setting, or its default if unset */
+char *
+hotssh_recorder_dup_directory (GSettings *settings)
+{
+  char *dir = g_settings_get_string (settings, "recording-directory");
+
+  if (*dir)
+    return dir;
+
+  g_free (dir);
+  return g_build_filename (g_get_user_data_dir (), "hotssh", "recordings", NULL);
+}
@@ -0,0 +1,54 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Records a session as an asciicast v2 file.  Formatting, compression
+ * and disk I/O all happen on a private writer thread; the calls below
+ * only take a reference or make a small copy and queue it.  If the
+ * writer falls too far behind, events are dropped and the gap is
+ * recorded as a marker rather than making the caller wait.
+ */
+typedef struct _HotSshRecorder HotSshRecorder;
+
+HotSshRecorder *hotssh_recorder_new     (const char   *path,
+                                         gboolean      compress,
+                                         guint         width,
+                                         guint         height,
+                                         const char   *title);
+
+/* Finishes the file in the background and frees @self */
+void            hotssh_recorder_close   (HotSshRecorder *self);
+
+void            hotssh_recorder_output  (HotSshRecorder *self,
+                                         GBytes         *bytes);
+void            hotssh_recorder_input   (HotSshRecorder *self,
+                                         const guint8   *buf,
+                                         gsize           len);
+void            hotssh_recorder_resize  (HotSshRecorder *self,
+                                         guint           width,
+                                         guint           height);
+
+gboolean        hotssh_recorder_can_compress (void);
+char           *hotssh_recorder_dup_directory (GSettings *settings);
+
+G_END_DECLS
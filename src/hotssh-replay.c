@@ -0,0 +1,737 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "hotssh-replay.h"
+#include "hotssh-scanner.h"
+#include "libgsystem.h"
+
+/* A keyframe is placed at least this often, in recording time or in
+ * output, which bounds how much a seek has to replay.
+ */
+#define KEYFRAME_INTERVAL_USEC (10 * G_USEC_PER_SEC)
+#define KEYFRAME_INTERVAL_BYTES (256 * 1024)
+/* Output replayed before a keyframe to repaint the screen, when there
+ * is no closer point where the screen was cleared.
+ */
+#define WARMUP_BYTES (64 * 1024)
+#define CHECKPOINT_BYTES (4 * 1024)
+
+/* Terminal state at the start of an event */
+typedef struct {
+  gsize offset;
+  gsize output;                 /* Output bytes before this event */
+  guint width;
+  guint height;
+  gboolean alt_screen;
+} ReplayPoint;
+
+typedef struct {
+  gint64 usec;
+  gsize offset;                 /* First event played in full */
+  ReplayPoint warmup;           /* Where feeding starts */
+} ReplayKeyframe;
+
+typedef struct {
+  gsize offset;
+  gsize next;
+  gint64 usec;
+  char type;
+  const char *str;
+  const char *str_end;
+} ReplayEvent;
+
+struct _HotSshReplay
+{
+  GMappedFile *mapped;
+  const char *data;
+  gsize len;
+  gsize events_start;
+
+  char *title;
+  guint width;
+  guint height;
+  gint64 duration;
+  GArray *keyframes;            /* ReplayKeyframe */
+
+  gsize pos;                    /* Next event to play */
+  gint64 position;
+  GByteArray *scratch;
+};
+
+static const char *
+skip_space (const char *p,
+            const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    p++;
+  return p;
+}
+
+/* Returns the closing quote of the JSON string starting after @p */
+static const char *
+find_string_end (const char *p,
+                 const char *end)
+{
+  while (p < end)
+    {
+      if (*p == '\\')
+        p += 2;
+      else if (*p == '"')
+        return p;
+      else
+        p++;
+    }
+  return NULL;
+}
+
+static int
+hex_value (char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static gboolean
+parse_hex4 (const char *p,
+            const char *end,
+            gunichar   *out)
+{
+  gunichar v = 0;
+  guint i;
+
+  if (end - p < 4)
+    return FALSE;
+  for (i = 0; i < 4; i++)
+    {
+      int h = hex_value (p[i]);
+      if (h < 0)
+        return FALSE;
+      v = (v << 4) | h;
+    }
+  *out = v;
+  return TRUE;
+}
+
+static void
+decode_json_string (const char *p,
+                    const char *end,
+                    GByteArray *out)
+{
+  g_byte_array_set_size (out, 0);
+
+  while (p < end)
+    {
+      const char *run = p;
+      char utf8[6];
+      gunichar ch;
+
+      while (p < end && *p != '\\')
+        p++;
+      if (p > run)
+        g_byte_array_append (out, (const guint8*)run, p - run);
+      if (p + 1 >= end)
+        break;
+
+      p++;
+      switch (*p)
+        {
+        case 'n': g_byte_array_append (out, (const guint8*)"\n", 1); break;
+        case 'r': g_byte_array_append (out, (const guint8*)"\r", 1); break;
+        case 't': g_byte_array_append (out, (const guint8*)"\t", 1); break;
+        case 'b': g_byte_array_append (out, (const guint8*)"\b", 1); break;
+        case 'f': g_byte_array_append (out, (const guint8*)"\f", 1); break;
+        case 'u':
+          if (!parse_hex4 (p + 1, end, &ch))
+            break;
+          p += 4;
+          if (ch >= 0xd800 && ch < 0xdc00)
+            {
+              gunichar low;
+              if (p + 2 < end && p[1] == '\\' && p[2] == 'u' &&
+                  parse_hex4 (p + 3, end, &low) && low >= 0xdc00 && low < 0xe000)
+                {
+                  ch = 0x10000 + ((ch - 0xd800) << 10) + (low - 0xdc00);
+                  p += 6;
+                }
+              else
+                ch = 0xfffd;
+            }
+          g_byte_array_append (out, (const guint8*)utf8, g_unichar_to_utf8 (ch, utf8));
+          break;
+        default:
+          /* \" \\ \/ */
+          g_byte_array_append (out, (const guint8*)p, 1);
+          break;
+        }
+      p++;
+    }
+}
+
+/* Parses the event line at @pos; lines that aren't events are skipped */
+static gboolean
+next_event (HotSshReplay *self,
+            gsize         pos,
+            ReplayEvent  *ev)
+{
+  while (pos < self->len)
+    {
+      const char *line = self->data + pos;
+      const char *nl = memchr (line, '\n', self->len - pos);
+      const char *end = nl ? nl : self->data + self->len;
+      const char *p;
+      char number[32];
+      char *number_end;
+      gsize n;
+
+      ev->offset = pos;
+      ev->next = nl ? (gsize)(nl + 1 - self->data) : self->len;
+      pos = ev->next;
+
+      p = skip_space (line, end);
+      if (p == end || *p != '[')
+        continue;
+      p = skip_space (p + 1, end);
+
+      /* The mapping isn't nul-terminated */
+      n = MIN ((gsize)(end - p), sizeof (number) - 1);
+      memcpy (number, p, n);
+      number[n] = '\0';
+      ev->usec = (gint64)(g_ascii_strtod (number, &number_end) * G_USEC_PER_SEC);
+      if (number_end == number)
+        continue;
+      p += number_end - number;
+
+      p = skip_space (p, end);
+      if (p == end || *p != ',')
+        continue;
+      p = skip_space (p + 1, end);
+      if (end - p < 3 || p[0] != '"' || p[2] != '"')
+        continue;
+      ev->type = p[1];
+      p = skip_space (p + 3, end);
+      if (p == end || *p != ',')
+        continue;
+      p = skip_space (p + 1, end);
+      if (p == end || *p != '"')
+        continue;
+      ev->str = p + 1;
+      ev->str_end = find_string_end (ev->str, end);
+      if (!ev->str_end)
+        continue;
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+parse_size (GByteArray *buf,
+            guint      *out_width,
+            guint      *out_height)
+{
+  gs_free char *text = g_strndup ((const char*)buf->data, buf->len);
+  char *end;
+  guint64 w, h;
+
+  w = g_ascii_strtoull (text, &end, 10);
+  if (*end != 'x')
+    return FALSE;
+  h = g_ascii_strtoull (end + 1, NULL, 10);
+  if (w == 0 || h == 0 || w > G_MAXUINT16 || h > G_MAXUINT16)
+    return FALSE;
+
+  *out_width = w;
+  *out_height = h;
+  return TRUE;
+}
+
+static gboolean
+build_index (HotSshReplay  *self,
+             GCancellable  *cancellable,
+             GError       **error)
+{
+  gboolean ret = FALSE;
+  GArray *checkpoints = g_array_new (FALSE, FALSE, sizeof (ReplayPoint));
+  ReplayPoint point = { 0, };
+  ReplayEvent ev;
+  gint64 last_keyframe_usec = 0;
+  gsize last_keyframe_output = 0;
+  gsize pos = self->events_start;
+  guint n_events = 0;
+
+  point.width = self->width;
+  point.height = self->height;
+
+  while (next_event (self, pos, &ev))
+    {
+      gboolean barrier = FALSE;
+      ReplayPoint before;
+
+      pos = ev.next;
+      point.offset = ev.offset;
+      before = point;
+
+      if ((++n_events % 4096) == 0 &&
+          g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      if (ev.type != 'o' && ev.type != 'r')
+        continue;
+
+      if (checkpoints->len == 0 ||
+          point.output - g_array_index (checkpoints, ReplayPoint, checkpoints->len - 1).output >= CHECKPOINT_BYTES)
+        g_array_append_val (checkpoints, point);
+
+      /* Keep the latest checkpoint that is at least WARMUP_BYTES back */
+      while (checkpoints->len > 1 &&
+             g_array_index (checkpoints, ReplayPoint, 1).output + WARMUP_BYTES <= point.output)
+        g_array_remove_index (checkpoints, 0);
+
+      if (self->keyframes->len == 0 ||
+          ev.usec - last_keyframe_usec >= KEYFRAME_INTERVAL_USEC ||
+          point.output - last_keyframe_output >= KEYFRAME_INTERVAL_BYTES)
+        {
+          ReplayKeyframe keyframe;
+
+          keyframe.usec = self->keyframes->len == 0 ? 0 : ev.usec;
+          keyframe.offset = ev.offset;
+          keyframe.warmup = g_array_index (checkpoints, ReplayPoint, 0);
+          g_array_append_val (self->keyframes, keyframe);
+          last_keyframe_usec = ev.usec;
+          last_keyframe_output = point.output;
+        }
+
+      decode_json_string (ev.str, ev.str_end, self->scratch);
+      if (ev.type == 'o')
+        {
+          barrier = hotssh_scanner_find_barrier (self->scratch->data, self->scratch->len,
+                                                 &point.alt_screen);
+          point.output += self->scratch->len;
+        }
+      else
+        barrier = parse_size (self->scratch, &point.width, &point.height);
+
+      /* Replaying from just before this event is exact */
+      if (barrier)
+        {
+          g_array_set_size (checkpoints, 0);
+          g_array_append_val (checkpoints, before);
+        }
+
+      self->duration = MAX (self->duration, ev.usec);
+    }
+
+  ret = TRUE;
+ out:
+  g_array_unref (checkpoints);
+  return ret;
+}
+
+static guint
+header_get_uint (const char *header,
+                 const char *end,
+                 const char *key,
+                 guint       default_value)
+{
+  gs_free char *needle = g_strdup_printf ("\"%s\"", key);
+  const char *p = g_strstr_len (header, end - header, needle);
+  guint64 v = 0;
+
+  if (!p)
+    return default_value;
+  p = skip_space (p + strlen (needle), end);
+  if (p == end || *p != ':')
+    return default_value;
+  p = skip_space (p + 1, end);
+  if (p == end || !g_ascii_isdigit (*p))
+    return default_value;
+  while (p < end && g_ascii_isdigit (*p) && v < G_MAXUINT)
+    v = v * 10 + (*p++ - '0');
+
+  return MIN (v, G_MAXUINT);
+}
+
+static char *
+header_get_string (const char *header,
+                   const char *end,
+                   const char *key,
+                   GByteArray *scratch)
+{
+  gs_free char *needle = g_strdup_printf ("\"%s\"", key);
+  const char *p = g_strstr_len (header, end - header, needle);
+  const char *str_end;
+
+  if (!p)
+    return NULL;
+  p = skip_space (p + strlen (needle), end);
+  if (p == end || *p != ':')
+    return NULL;
+  p = skip_space (p + 1, end);
+  if (p == end || *p != '"')
+    return NULL;
+  str_end = find_string_end (p + 1, end);
+  if (!str_end)
+    return NULL;
+
+  decode_json_string (p + 1, str_end, scratch);
+  return g_strndup ((const char*)scratch->data, scratch->len);
+}
+
+static gboolean
+write_all (int            fd,
+           const guint8  *buf,
+           gsize          len,
+           GError       **error)
+{
+  while (len > 0)
+    {
+      gssize n = write (fd, buf, len);
+      if (n < 0)
+        {
+          int errsv = errno;
+          if (errsv == EINTR)
+            continue;
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                       "%s", g_strerror (errsv));
+          return FALSE;
+        }
+      buf += n;
+      len -= n;
+    }
+  return TRUE;
+}
+
+static gboolean
+is_zstd (GMappedFile *mapped)
+{
+  static const guint8 magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+  return g_mapped_file_get_length (mapped) >= sizeof (magic) &&
+    memcmp (g_mapped_file_get_contents (mapped), magic, sizeof (magic)) == 0;
+}
+
+/* A compressed recording is unpacked into an anonymous temporary file
+ * once, so it can be mapped and seeked like any other.
+ */
+static GMappedFile *
+map_decompressed (GMappedFile   *compressed,
+                  GCancellable  *cancellable,
+                  GError       **error)
+{
+#ifdef HAVE_ZSTD
+  GMappedFile *ret = NULL;
+  gs_free char *tmp_path = NULL;
+  gs_free guint8 *buf = NULL;
+  gsize buf_size = ZSTD_DStreamOutSize ();
+  ZSTD_DCtx *dctx = NULL;
+  ZSTD_inBuffer in;
+  ZSTD_outBuffer out;
+  int fd;
+
+  fd = g_file_open_tmp ("hotssh-replay-XXXXXX", &tmp_path, error);
+  if (fd < 0)
+    goto out;
+  (void) g_unlink (tmp_path);
+
+  dctx = ZSTD_createDCtx ();
+  buf = g_malloc (buf_size);
+  in.src = g_mapped_file_get_contents (compressed);
+  in.size = g_mapped_file_get_length (compressed);
+  in.pos = 0;
+  do
+    {
+      size_t r;
+
+      out.dst = buf;
+      out.size = buf_size;
+      out.pos = 0;
+      r = ZSTD_decompressStream (dctx, &out, &in);
+      if (ZSTD_isError (r))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "zstd: %s", ZSTD_getErrorName (r));
+          goto out;
+        }
+      if (!write_all (fd, buf, out.pos, error))
+        goto out;
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+    }
+  while (in.pos < in.size || out.pos == out.size);
+
+  ret = g_mapped_file_new_from_fd (fd, FALSE, error);
+ out:
+  if (dctx)
+    ZSTD_freeDCtx (dctx);
+  if (fd >= 0)
+    (void) close (fd);
+  return ret;
+#else
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+               "Compressed recordings are not supported by this build");
+  return NULL;
+#endif
+}
+
+void
+hotssh_replay_free (HotSshReplay *self)
+{
+  if (self->mapped)
+    g_mapped_file_unref (self->mapped);
+  g_free (self->title);
+  g_array_unref (self->keyframes);
+  g_byte_array_unref (self->scratch);
+  g_free (self);
+}
+
+static HotSshReplay *
+replay_load (const char    *path,
+             GCancellable  *cancellable,
+             GError       **error)
+{
+  HotSshReplay *ret = NULL;
+  HotSshReplay *self = g_new0 (HotSshReplay, 1);
+  const char *nl;
+
+  self->keyframes = g_array_new (FALSE, FALSE, sizeof (ReplayKeyframe));
+  self->scratch = g_byte_array_new ();
+
+  self->mapped = g_mapped_file_new (path, FALSE, error);
+  if (!self->mapped)
+    goto out;
+  if (is_zstd (self->mapped))
+    {
+      GMappedFile *decompressed = map_decompressed (self->mapped, cancellable, error);
+      if (!decompressed)
+        goto out;
+      g_mapped_file_unref (self->mapped);
+      self->mapped = decompressed;
+    }
+
+  self->data = g_mapped_file_get_contents (self->mapped);
+  self->len = g_mapped_file_get_length (self->mapped);
+  nl = self->data ? memchr (self->data, '\n', self->len) : NULL;
+  if (!nl || self->data[0] != '{' ||
+      header_get_uint (self->data, nl, "version", 0) != 2)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "%s is not an asciicast v2 recording", path);
+      goto out;
+    }
+  self->events_start = nl + 1 - self->data;
+  self->width = header_get_uint (self->data, nl, "width", 80);
+  self->height = header_get_uint (self->data, nl, "height", 24);
+  self->title = header_get_string (self->data, nl, "title", self->scratch);
+
+  if (!build_index (self, cancellable, error))
+    goto out;
+  g_debug ("indexed %s: %u keyframes over %" G_GINT64_FORMAT "s",
+           path, self->keyframes->len, self->duration / G_USEC_PER_SEC);
+
+  self->pos = self->events_start;
+  ret = self;
+  self = NULL;
+ out:
+  if (self)
+    hotssh_replay_free (self);
+  return ret;
+}
+
+static void
+open_in_thread (GTask        *task,
+                gpointer      source_object,
+                gpointer      task_data,
+                GCancellable *cancellable)
+{
+  GError *local_error = NULL;
+  HotSshReplay *replay = replay_load (task_data, cancellable, &local_error);
+
+  if (replay)
+    g_task_return_pointer (task, replay, (GDestroyNotify)hotssh_replay_free);
+  else
+    g_task_return_error (task, local_error);
+}
+
+void
+hotssh_replay_open_async (const char          *path,
+                          GCancellable        *cancellable,
+                          GAsyncReadyCallback  callback,
+                          gpointer             user_data)
+{
+  GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+
+  g_task_set_task_data (task, g_strdup (path), g_free);
+  g_task_run_in_thread (task, open_in_thread);
+  g_object_unref (task);
+}
+
+HotSshReplay *
+hotssh_replay_open_finish (GAsyncResult  *result,
+                           GError       **error)
+{
+  return g_task_propagate_pointer ((GTask*)result, error);
+}
+
+const char *
+hotssh_replay_get_title (HotSshReplay *self)
+{
+  return self->title;
+}
+
+gint64
+hotssh_replay_get_duration (HotSshReplay *self)
+{
+  return self->duration;
+}
+
+gint64
+hotssh_replay_get_position (HotSshReplay *self)
+{
+  return self->position;
+}
+
+static gsize
+emit_event (HotSshReplay     *self,
+            ReplayEvent      *ev,
+            HotSshReplayFunc  func,
+            gpointer          user_data)
+{
+  guint width, height;
+
+  switch (ev->type)
+    {
+    case 'o':
+      decode_json_string (ev->str, ev->str_end, self->scratch);
+      func (HOTSSH_REPLAY_EVENT_OUTPUT, self->scratch->data, self->scratch->len,
+            0, 0, user_data);
+      return self->scratch->len;
+    case 'r':
+      decode_json_string (ev->str, ev->str_end, self->scratch);
+      if (parse_size (self->scratch, &width, &height))
+        func (HOTSSH_REPLAY_EVENT_RESIZE, NULL, 0, width, height, user_data);
+      return 0;
+    default:
+      /* Input is already in the output as echo; markers aren't shown */
+      return 0;
+    }
+}
+
+void
+hotssh_replay_seek (HotSshReplay     *self,
+                    gint64            usec,
+                    HotSshReplayFunc  func,
+                    gpointer          user_data)
+{
+  const ReplayKeyframe *keyframe;
+  ReplayEvent ev;
+  guint lo, hi;
+  gsize pos;
+
+  usec = CLAMP (usec, 0, self->duration);
+
+  if (self->keyframes->len == 0)
+    {
+      func (HOTSSH_REPLAY_EVENT_RESET, NULL, 0, self->width, self->height, user_data);
+      self->pos = self->len;
+      self->position = 0;
+      return;
+    }
+
+  /* Last keyframe at or before @usec */
+  lo = 0;
+  hi = self->keyframes->len;
+  while (hi - lo > 1)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      if (g_array_index (self->keyframes, ReplayKeyframe, mid).usec <= usec)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  keyframe = &g_array_index (self->keyframes, ReplayKeyframe, lo);
+
+  func (HOTSSH_REPLAY_EVENT_RESET, NULL, 0,
+        keyframe->warmup.width, keyframe->warmup.height, user_data);
+  if (keyframe->warmup.alt_screen)
+    func (HOTSSH_REPLAY_EVENT_OUTPUT, (const guint8*)"\033[?1049h", 8, 0, 0, user_data);
+
+  pos = keyframe->warmup.offset;
+  while (pos < keyframe->offset && next_event (self, pos, &ev))
+    {
+      if (ev.offset >= keyframe->offset)
+        break;
+      emit_event (self, &ev, func, user_data);
+      pos = ev.next;
+    }
+
+  self->pos = keyframe->offset;
+  self->position = keyframe->usec;
+  hotssh_replay_play_until (self, usec, G_MAXSIZE, func, user_data);
+}
+
+/**
+ * hotssh_replay_play_until:
+ *
+ * Plays events up to @usec, stopping early once @max_bytes of output
+ * have been emitted.  Returns the time of the next event, or -1 at the
+ * end of the recording.
+ */
+gint64
+hotssh_replay_play_until (HotSshReplay     *self,
+                          gint64            usec,
+                          gsize             max_bytes,
+                          HotSshReplayFunc  func,
+                          gpointer          user_data)
+{
+  ReplayEvent ev;
+  gsize emitted = 0;
+
+  while (next_event (self, self->pos, &ev))
+    {
+      if (ev.usec > usec)
+        {
+          self->position = MAX (self->position, usec);
+          return ev.usec;
+        }
+      if (emitted >= max_bytes)
+        return ev.usec;
+
+      emitted += emit_event (self, &ev, func, user_data);
+      self->pos = ev.next;
+      self->position = MAX (self->position, ev.usec);
+    }
+
+  self->pos = self->len;
+  self->position = self->duration;
+  return -1;
+}
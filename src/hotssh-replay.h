@@ -0,0 +1,68 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* A memory-mapped asciicast v2 recording with a keyframe index.  A
+ * keyframe is a point in the stream from which a terminal can be
+ * brought to the right state by replaying a bounded amount of output,
+ * so seeking anywhere costs about the same as seeking near the start.
+ */
+typedef struct _HotSshReplay HotSshReplay;
+
+typedef enum {
+  /* Start over with an empty terminal of the given size */
+  HOTSSH_REPLAY_EVENT_RESET,
+  HOTSSH_REPLAY_EVENT_OUTPUT,
+  HOTSSH_REPLAY_EVENT_RESIZE
+} HotSshReplayEventType;
+
+typedef void (*HotSshReplayFunc) (HotSshReplayEventType  type,
+                                  const guint8          *buf,
+                                  gsize                  len,
+                                  guint                  width,
+                                  guint                  height,
+                                  gpointer               user_data);
+
+void           hotssh_replay_open_async    (const char           *path,
+                                            GCancellable         *cancellable,
+                                            GAsyncReadyCallback   callback,
+                                            gpointer              user_data);
+HotSshReplay  *hotssh_replay_open_finish   (GAsyncResult         *result,
+                                            GError              **error);
+void           hotssh_replay_free          (HotSshReplay         *self);
+
+const char    *hotssh_replay_get_title     (HotSshReplay         *self);
+gint64         hotssh_replay_get_duration  (HotSshReplay         *self);
+gint64         hotssh_replay_get_position  (HotSshReplay         *self);
+
+void           hotssh_replay_seek          (HotSshReplay         *self,
+                                            gint64                usec,
+                                            HotSshReplayFunc      func,
+                                            gpointer              user_data);
+gint64         hotssh_replay_play_until    (HotSshReplay         *self,
+                                            gint64                usec,
+                                            gsize                 max_bytes,
+                                            HotSshReplayFunc      func,
+                                            gpointer              user_data);
+
+G_END_DECLS
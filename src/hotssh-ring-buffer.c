@@ -0,0 +1,135 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "hotssh-ring-buffer.h"
+
+void
+hotssh_ring_buffer_init (HotSshRingBuffer *self,
+                         gsize             capacity)
+{
+  g_return_if_fail (capacity > 0);
+  g_return_if_fail ((capacity & (capacity - 1)) == 0);
+  g_return_if_fail (capacity <= G_MAXINT / 2);
+
+  self->data = NULL;
+  self->capacity = capacity;
+  self->read_pos = 0;
+  self->write_pos = 0;
+}
+
+void
+hotssh_ring_buffer_clear (HotSshRingBuffer *self)
+{
+  g_clear_pointer (&self->data, g_free);
+  hotssh_ring_buffer_reset (self);
+}
+
+/* Drop any queued data, but keep the storage around for reuse.  Only
+ * valid while neither side is in use.
+ */
+void
+hotssh_ring_buffer_reset (HotSshRingBuffer *self)
+{
+  g_atomic_int_set (&self->read_pos, 0);
+  g_atomic_int_set (&self->write_pos, 0);
+}
+
+gsize
+hotssh_ring_buffer_get_length (HotSshRingBuffer *self)
+{
+  guint write_pos = (guint)g_atomic_int_get (&self->write_pos);
+  guint read_pos = (guint)g_atomic_int_get (&self->read_pos);
+
+  return write_pos - read_pos;
+}
+
+gsize
+hotssh_ring_buffer_get_space (HotSshRingBuffer *self)
+{
+  return self->capacity - hotssh_ring_buffer_get_length (self);
+}
+
+/* Copies as much of @buf as fits; returns the number of bytes taken.
+ * Producer side.
+ */
+gsize
+hotssh_ring_buffer_append (HotSshRingBuffer *self,
+                           const guint8     *buf,
+                           gsize             len)
+{
+  guint write_pos = (guint)self->write_pos;
+  gsize tail;
+  gsize first;
+
+  len = MIN (len, hotssh_ring_buffer_get_space (self));
+  if (len == 0)
+    return 0;
+
+  if (G_UNLIKELY (self->data == NULL))
+    self->data = g_malloc (self->capacity);
+
+  tail = write_pos & (self->capacity - 1);
+  first = MIN (len, self->capacity - tail);
+  memcpy (self->data + tail, buf, first);
+  if (first < len)
+    memcpy (self->data, buf + first, len - first);
+
+  /* Publishes the copied bytes to the consumer */
+  g_atomic_int_set (&self->write_pos, (gint)(write_pos + len));
+  return len;
+}
+
+/* Returns the longest contiguous run of queued bytes starting at the
+ * head.  The region stays valid until it is consumed, even if more
+ * data is appended in the meantime, so it can be handed directly to an
+ * asynchronous write.  Consumer side.
+ */
+const guint8 *
+hotssh_ring_buffer_peek (HotSshRingBuffer *self,
+                         gsize            *out_len)
+{
+  guint read_pos = (guint)self->read_pos;
+  gsize length = (guint)g_atomic_int_get (&self->write_pos) - read_pos;
+  gsize head;
+
+  if (length == 0)
+    {
+      *out_len = 0;
+      return NULL;
+    }
+
+  head = read_pos & (self->capacity - 1);
+  *out_len = MIN (length, self->capacity - head);
+  return self->data + head;
+}
+
+/* Consumer side. */
+void
+hotssh_ring_buffer_consume (HotSshRingBuffer *self,
+                            gsize             len)
+{
+  guint read_pos = (guint)self->read_pos;
+
+  g_return_if_fail (len <= hotssh_ring_buffer_get_length (self));
+
+  g_atomic_int_set (&self->read_pos, (gint)(read_pos + len));
+}
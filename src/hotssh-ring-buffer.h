@@ -0,0 +1,56 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/* A fixed-capacity byte FIFO.  The storage is allocated once on first
+ * use and never grows; callers check the free space and apply their
+ * own backpressure instead.
+ *
+ * One thread may append while another peeks and consumes without any
+ * locking; the read and write positions are free-running counters
+ * updated atomically.  The capacity must be a power of two.
+ */
+typedef struct _HotSshRingBuffer HotSshRingBuffer;
+
+struct _HotSshRingBuffer
+{
+  guint8 *data;
+  gsize   capacity;
+  volatile gint read_pos;
+  volatile gint write_pos;
+};
+
+void     hotssh_ring_buffer_init        (HotSshRingBuffer *self,
+                                         gsize             capacity);
+void     hotssh_ring_buffer_clear       (HotSshRingBuffer *self);
+void     hotssh_ring_buffer_reset       (HotSshRingBuffer *self);
+
+gsize    hotssh_ring_buffer_get_length  (HotSshRingBuffer *self);
+gsize    hotssh_ring_buffer_get_space   (HotSshRingBuffer *self);
+
+gsize    hotssh_ring_buffer_append      (HotSshRingBuffer *self,
+                                         const guint8     *buf,
+                                         gsize             len);
+
+const guint8 *hotssh_ring_buffer_peek   (HotSshRingBuffer *self,
+                                         gsize            *out_len);
+void     hotssh_ring_buffer_consume     (HotSshRingBuffer *self,
+                                         gsize             len);
@@ -0,0 +1,542 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "hotssh-scanner.h"
+
+#include "libgsystem.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SCANNER_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+/* Patterns are spread over eight buckets, one bit each in the
+ * fingerprint tables; the built-in escapes get buckets of their own so
+ * user patterns can't make ordinary CSI sequences look like candidates.
+ */
+#define N_BUCKETS (8)
+#define N_BUILTIN_BUCKETS (5)
+#define MAX_PATTERN_LEN (256)
+
+/* Internal matches that only drive the OSC state */
+#define SCANNER_MATCH_OSC_START (HOTSSH_SCANNER_MATCH_PATTERN + 1)
+#define SCANNER_MATCH_STRING_TERMINATOR (HOTSSH_SCANNER_MATCH_PATTERN + 2)
+
+typedef struct {
+  guint8 *bytes;
+  gsize len;
+  guint match;
+  GRegex *regex;                /* Confirms a regex around its literal */
+} ScannerPattern;
+
+struct _HotSshScanner
+{
+  GPtrArray *patterns;
+  GPtrArray *buckets[N_BUCKETS];
+  GPtrArray *unanchored;        /* Regexes with no literal to look for */
+
+  /* Teddy-style fingerprint of the first two bytes of each pattern: a
+   * bit per bucket, looked up by low and high nibble.  mask[] is the
+   * same thing flattened for the scalar path.
+   */
+  guint8 lo[2][16];
+  guint8 hi[2][16];
+  guint8 mask[2][256];
+
+  gsize max_len;
+  guint8 tail[MAX_PATTERN_LEN];
+  gsize tail_len;
+  gboolean in_osc;
+  gboolean use_ssse3;
+};
+
+static void
+scanner_pattern_free (gpointer data)
+{
+  ScannerPattern *pat = data;
+  g_free (pat->bytes);
+  if (pat->regex)
+    g_regex_unref (pat->regex);
+  g_slice_free (ScannerPattern, pat);
+}
+
+static void
+add_pattern (HotSshScanner *self,
+             guint          bucket,
+             const guint8  *bytes,
+             gsize          len,
+             guint          match,
+             GRegex        *regex)
+{
+  ScannerPattern *pat = g_slice_new0 (ScannerPattern);
+  guint8 bit = 1 << bucket;
+  guint j;
+
+  pat->bytes = g_memdup (bytes, len);
+  pat->len = len;
+  pat->match = match;
+  pat->regex = regex ? g_regex_ref (regex) : NULL;
+  g_ptr_array_add (self->patterns, pat);
+
+  if (!self->buckets[bucket])
+    self->buckets[bucket] = g_ptr_array_new ();
+  g_ptr_array_add (self->buckets[bucket], pat);
+
+  for (j = 0; j < 2; j++)
+    {
+      if (j < len)
+        {
+          self->lo[j][bytes[j] & 0xf] |= bit;
+          self->hi[j][bytes[j] >> 4] |= bit;
+        }
+      else
+        {
+          guint k;
+          /* Shorter than the fingerprint; any byte will do */
+          for (k = 0; k < 16; k++)
+            {
+              self->lo[j][k] |= bit;
+              self->hi[j][k] |= bit;
+            }
+        }
+    }
+
+  self->max_len = MAX (self->max_len, len);
+}
+
+/* Find a run of literal characters that any match of @re must
+ * contain, so the regex only has to run where the prefilter finds it.
+ * Deliberately conservative: anything with alternation, inline flags,
+ * or where the run sits inside a group gets no literal.
+ */
+static char *
+regex_required_literal (const char *re)
+{
+  const char *p;
+  const char *run = NULL;
+  const char *best = NULL;
+  gsize best_len = 0;
+  int depth = 0;
+
+  if (strchr (re, '|') || strstr (re, "(?"))
+    return NULL;
+
+  for (p = re; ; p++)
+    {
+      gboolean plain = *p != '\0' && depth == 0 &&
+        (g_ascii_isalnum (*p) || strchr (" _-:=,;/<>!@#%&'\"", *p) != NULL);
+
+      if (run && !plain)
+        {
+          gsize n = p - run;
+          /* A quantifier applies to the last character only */
+          if (*p == '?' || *p == '*' || *p == '{')
+            n--;
+          if (n > best_len)
+            {
+              best = run;
+              best_len = n;
+            }
+          run = NULL;
+        }
+      else if (!run && plain)
+        run = p;
+
+      if (*p == '\0')
+        break;
+      else if (*p == '\\')
+        {
+          if (p[1] == '\0')
+            break;
+          p++;
+        }
+      else if (*p == '[')
+        {
+          const char *close = p[1] ? strchr (p + 2, ']') : NULL;
+          if (!close)
+            break;
+          p = close;
+        }
+      else if (*p == '(')
+        depth++;
+      else if (*p == ')' && depth > 0)
+        depth--;
+    }
+
+  return best_len >= 2 ? g_strndup (best, best_len) : NULL;
+}
+
+static void
+add_regex_pattern (HotSshScanner *self,
+                   guint          bucket,
+                   const char    *source)
+{
+  gs_free char *literal = regex_required_literal (source);
+  GError *local_error = NULL;
+  GRegex *regex;
+
+  regex = g_regex_new (source, G_REGEX_RAW | G_REGEX_OPTIMIZE, 0, &local_error);
+  if (!regex)
+    {
+      g_warning ("Ignoring alert pattern /%s/: %s", source, local_error->message);
+      g_error_free (local_error);
+      return;
+    }
+
+  if (literal && strlen (literal) <= MAX_PATTERN_LEN)
+    add_pattern (self, bucket, (const guint8*)literal, strlen (literal),
+                 HOTSSH_SCANNER_MATCH_PATTERN, regex);
+  else
+    g_ptr_array_add (self->unanchored, g_regex_ref (regex));
+
+  g_regex_unref (regex);
+}
+
+/**
+ * hotssh_scanner_new:
+ * @patterns: (allow-none): User patterns; "/.../" is a regular
+ * expression, anything else a literal string
+ */
+HotSshScanner *
+hotssh_scanner_new (const char * const *patterns)
+{
+  HotSshScanner *self = g_slice_new0 (HotSshScanner);
+  guint user_bucket = 0;
+  guint j, c;
+
+  self->patterns = g_ptr_array_new_with_free_func (scanner_pattern_free);
+  self->unanchored = g_ptr_array_new_with_free_func ((GDestroyNotify)g_regex_unref);
+
+  add_pattern (self, 0, (const guint8*)"\a", 1, HOTSSH_SCANNER_MATCH_BELL, NULL);
+  add_pattern (self, 1, (const guint8*)"\033]", 2, SCANNER_MATCH_OSC_START, NULL);
+  add_pattern (self, 2, (const guint8*)"\033\\", 2, SCANNER_MATCH_STRING_TERMINATOR, NULL);
+  add_pattern (self, 3, (const guint8*)"\033]133;C", 7, HOTSSH_SCANNER_MATCH_COMMAND_START, NULL);
+  add_pattern (self, 4, (const guint8*)"\033]133;D", 7, HOTSSH_SCANNER_MATCH_COMMAND_DONE, NULL);
+
+  for (; patterns && *patterns; patterns++)
+    {
+      const char *pattern = *patterns;
+      gsize len = strlen (pattern);
+      guint bucket = N_BUILTIN_BUCKETS + (user_bucket++ % (N_BUCKETS - N_BUILTIN_BUCKETS));
+
+      if (len > 2 && pattern[0] == '/' && pattern[len - 1] == '/')
+        {
+          gs_free char *source = g_strndup (pattern + 1, len - 2);
+          add_regex_pattern (self, bucket, source);
+        }
+      else if (len > 0 && len <= MAX_PATTERN_LEN)
+        add_pattern (self, bucket, (const guint8*)pattern, len,
+                     HOTSSH_SCANNER_MATCH_PATTERN, NULL);
+      else if (len > 0)
+        g_warning ("Ignoring alert pattern longer than %u bytes", MAX_PATTERN_LEN);
+    }
+
+  for (j = 0; j < 2; j++)
+    for (c = 0; c < 256; c++)
+      self->mask[j][c] = self->lo[j][c & 0xf] & self->hi[j][c >> 4];
+
+#ifdef HAVE_SCANNER_SSSE3
+  self->use_ssse3 = __builtin_cpu_supports ("ssse3");
+#endif
+
+  return self;
+}
+
+void
+hotssh_scanner_free (HotSshScanner *self)
+{
+  guint i;
+
+  for (i = 0; i < N_BUCKETS; i++)
+    g_clear_pointer (&self->buckets[i], g_ptr_array_unref);
+  g_ptr_array_unref (self->patterns);
+  g_ptr_array_unref (self->unanchored);
+  g_slice_free (HotSshScanner, self);
+}
+
+/* Forget any partial match and escape state, e.g. for a new channel */
+void
+hotssh_scanner_reset (HotSshScanner *self)
+{
+  self->tail_len = 0;
+  self->in_osc = FALSE;
+}
+
+static void
+emit (HotSshScanner     *self,
+      guint              match,
+      HotSshScannerFunc  func,
+      gpointer           user_data)
+{
+  switch (match)
+    {
+    case SCANNER_MATCH_OSC_START:
+      self->in_osc = TRUE;
+      return;
+    case SCANNER_MATCH_STRING_TERMINATOR:
+      self->in_osc = FALSE;
+      return;
+    case HOTSSH_SCANNER_MATCH_BELL:
+      /* BEL also terminates OSC sequences, e.g. window title updates */
+      if (self->in_osc)
+        {
+          self->in_osc = FALSE;
+          return;
+        }
+      break;
+    default:
+      break;
+    }
+
+  func ((HotSshScannerMatch)match, user_data);
+}
+
+static gboolean
+regex_matches_line (GRegex       *regex,
+                    const guint8 *buf,
+                    gsize         len,
+                    gsize         pos)
+{
+  const guint8 *start = buf + pos;
+  const guint8 *end = memchr (buf + pos, '\n', len - pos);
+
+  while (start > buf && start[-1] != '\n')
+    start--;
+  if (!end)
+    end = buf + len;
+
+  return g_regex_match_full (regex, (const char*)start, end - start, 0, 0, NULL, NULL);
+}
+
+/* Exact verification of a fingerprint hit.  Matches ending at or
+ * before @min_end were already reported from the previous chunk.
+ */
+static void
+verify_at (HotSshScanner     *self,
+           const guint8      *buf,
+           gsize              len,
+           gsize              pos,
+           guint8             bits,
+           gsize              min_end,
+           HotSshScannerFunc  func,
+           gpointer           user_data)
+{
+  guint b, i;
+
+  for (b = 0; b < N_BUCKETS; b++)
+    {
+      GPtrArray *bucket = self->buckets[b];
+
+      if (!(bits & (1 << b)) || !bucket)
+        continue;
+
+      for (i = 0; i < bucket->len; i++)
+        {
+          ScannerPattern *pat = bucket->pdata[i];
+
+          if (pos + pat->len > len || pos + pat->len <= min_end)
+            continue;
+          if (memcmp (buf + pos, pat->bytes, pat->len) != 0)
+            continue;
+          if (pat->regex && !regex_matches_line (pat->regex, buf, len, pos))
+            continue;
+          emit (self, pat->match, func, user_data);
+        }
+    }
+}
+
+static void
+scan_scalar (HotSshScanner     *self,
+             const guint8      *buf,
+             gsize              len,
+             gsize              start,
+             gsize              end,
+             gsize              min_end,
+             HotSshScannerFunc  func,
+             gpointer           user_data)
+{
+  gsize i;
+
+  for (i = start; i < end; i++)
+    {
+      guint8 m = self->mask[0][buf[i]] & (i + 1 < len ? self->mask[1][buf[i + 1]] : 0xff);
+      if (G_UNLIKELY (m))
+        verify_at (self, buf, len, i, m, min_end, func, user_data);
+    }
+}
+
+#ifdef HAVE_SCANNER_SSSE3
+/* Sixteen positions at a time: look up both fingerprint bytes by
+ * nibble with PSHUFB and AND the bucket bits together.  Returns where
+ * the scalar path should pick up.
+ */
+__attribute__((target ("ssse3")))
+static gsize
+scan_ssse3 (HotSshScanner     *self,
+            const guint8      *buf,
+            gsize              len,
+            HotSshScannerFunc  func,
+            gpointer           user_data)
+{
+  const __m128i lo0 = _mm_loadu_si128 ((const __m128i*)self->lo[0]);
+  const __m128i hi0 = _mm_loadu_si128 ((const __m128i*)self->hi[0]);
+  const __m128i lo1 = _mm_loadu_si128 ((const __m128i*)self->lo[1]);
+  const __m128i hi1 = _mm_loadu_si128 ((const __m128i*)self->hi[1]);
+  const __m128i nibble = _mm_set1_epi8 (0x0f);
+  const __m128i zero = _mm_setzero_si128 ();
+  gsize i;
+
+  for (i = 0; i + 17 <= len; i += 16)
+    {
+      __m128i c0 = _mm_loadu_si128 ((const __m128i*)(buf + i));
+      __m128i c1 = _mm_loadu_si128 ((const __m128i*)(buf + i + 1));
+      __m128i m0 = _mm_and_si128 (_mm_shuffle_epi8 (lo0, _mm_and_si128 (c0, nibble)),
+                                  _mm_shuffle_epi8 (hi0, _mm_and_si128 (_mm_srli_epi16 (c0, 4), nibble)));
+      __m128i m1 = _mm_and_si128 (_mm_shuffle_epi8 (lo1, _mm_and_si128 (c1, nibble)),
+                                  _mm_shuffle_epi8 (hi1, _mm_and_si128 (_mm_srli_epi16 (c1, 4), nibble)));
+      __m128i m = _mm_and_si128 (m0, m1);
+      guint hits = _mm_movemask_epi8 (_mm_cmpeq_epi8 (m, zero)) ^ 0xffff;
+
+      if (G_UNLIKELY (hits))
+        {
+          guint8 bits[16];
+
+          _mm_storeu_si128 ((__m128i*)bits, m);
+          while (hits)
+            {
+              guint k = __builtin_ctz (hits);
+              verify_at (self, buf, len, i + k, bits[k], 0, func, user_data);
+              hits &= hits - 1;
+            }
+        }
+    }
+
+  return i;
+}
+#endif
+
+/**
+ * hotssh_scanner_scan:
+ *
+ * Scan the next chunk of the stream.  Matches that straddle the
+ * previous chunk are found too; regular expressions only see the line
+ * around their literal within one chunk.
+ */
+void
+hotssh_scanner_scan (HotSshScanner     *self,
+                     const guint8      *buf,
+                     gsize              len,
+                     HotSshScannerFunc  func,
+                     gpointer           user_data)
+{
+  gsize keep = self->max_len - 1;
+  gsize start = 0;
+  guint i;
+
+  if (len == 0)
+    return;
+
+  /* Matches starting in the previous chunk's tail */
+  if (self->tail_len > 0)
+    {
+      guint8 seam[2 * MAX_PATTERN_LEN];
+      gsize n = MIN (len, keep);
+
+      memcpy (seam, self->tail, self->tail_len);
+      memcpy (seam + self->tail_len, buf, n);
+      scan_scalar (self, seam, self->tail_len + n, 0, self->tail_len,
+                   self->tail_len, func, user_data);
+    }
+
+#ifdef HAVE_SCANNER_SSSE3
+  if (self->use_ssse3)
+    start = scan_ssse3 (self, buf, len, func, user_data);
+#endif
+  scan_scalar (self, buf, len, start, len, 0, func, user_data);
+
+  for (i = 0; i < self->unanchored->len; i++)
+    if (g_regex_match_full (self->unanchored->pdata[i], (const char*)buf, len,
+                            0, 0, NULL, NULL))
+      func (HOTSSH_SCANNER_MATCH_PATTERN, user_data);
+
+  /* Keep enough of the end to complete any pattern next time */
+  if (len >= keep)
+    {
+      memcpy (self->tail, buf + len - keep, keep);
+      self->tail_len = keep;
+    }
+  else
+    {
+      gsize drop = (self->tail_len + len > keep) ? self->tail_len + len - keep : 0;
+      memmove (self->tail, self->tail + drop, self->tail_len - drop);
+      memcpy (self->tail + self->tail_len - drop, buf, len);
+      self->tail_len = self->tail_len - drop + len;
+    }
+}
+
+static gboolean
+has_prefix (const guint8 *p,
+            const guint8 *end,
+            const char   *prefix)
+{
+  gsize n = strlen (prefix);
+  return (gsize)(end - p) >= n && memcmp (p, prefix, n) == 0;
+}
+
+/**
+ * hotssh_scanner_find_barrier:
+ *
+ * Looks for sequences after which the screen no longer depends on
+ * earlier output: a full reset or clear, or a switch between the
+ * normal and alternate screens, which also updates @alt_screen.
+ * Sequences split across calls are not seen.
+ */
+gboolean
+hotssh_scanner_find_barrier (const guint8 *buf,
+                             gsize         len,
+                             gboolean     *alt_screen)
+{
+  const guint8 *p = buf;
+  const guint8 *end = buf + len;
+  gboolean found = FALSE;
+
+  while ((p = memchr (p, '\033', end - p)) != NULL)
+    {
+      if (has_prefix (p, end, "\033c") || has_prefix (p, end, "\033[2J"))
+        found = TRUE;
+      else if (has_prefix (p, end, "\033[?1049h") || has_prefix (p, end, "\033[?1047h") ||
+               has_prefix (p, end, "\033[?47h"))
+        {
+          *alt_screen = TRUE;
+          found = TRUE;
+        }
+      else if (has_prefix (p, end, "\033[?1049l") || has_prefix (p, end, "\033[?1047l") ||
+               has_prefix (p, end, "\033[?47l"))
+        {
+          *alt_screen = FALSE;
+          found = TRUE;
+        }
+      p++;
+    }
+
+  return found;
+}
@@ -0,0 +1,57 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Watches a raw terminal byte stream for things worth telling the user
+ * about on a tab they aren't looking at: the bell, OSC 133 command
+ * start/finish marks from shell integration, and user patterns.
+ */
+typedef struct _HotSshScanner HotSshScanner;
+
+typedef enum {
+  HOTSSH_SCANNER_MATCH_BELL,
+  HOTSSH_SCANNER_MATCH_COMMAND_START,
+  HOTSSH_SCANNER_MATCH_COMMAND_DONE,
+  HOTSSH_SCANNER_MATCH_PATTERN
+} HotSshScannerMatch;
+
+/* Called for each match, in stream order */
+typedef void (*HotSshScannerFunc) (HotSshScannerMatch  match,
+                                   gpointer            user_data);
+
+HotSshScanner *hotssh_scanner_new          (const char * const *patterns);
+void           hotssh_scanner_free         (HotSshScanner      *self);
+
+void           hotssh_scanner_reset        (HotSshScanner      *self);
+
+void           hotssh_scanner_scan         (HotSshScanner      *self,
+                                            const guint8       *buf,
+                                            gsize               len,
+                                            HotSshScannerFunc   func,
+                                            gpointer            user_data);
+
+gboolean       hotssh_scanner_find_barrier (const guint8       *buf,
+                                            gsize               len,
+                                            gboolean           *alt_screen);
+
+G_END_DECLS
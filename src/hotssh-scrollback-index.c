@@ -0,0 +1,1204 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "hotssh-scrollback-index.h"
+#include "libgsystem.h"
+
+/* Lines are grouped into chunks; a chunk is the unit of the trigram
+ * index, of spilling to disk and of forgetting.
+ */
+#define CHUNK_MAX_BYTES (4096)
+#define CHUNK_MAX_LINES (64)
+/* Only this much of a very long line is kept */
+#define LINE_MAX_BYTES (1024)
+#define SEQUENCE_MAX_BYTES (256)
+#define COMMANDS_MAX (65536)
+
+typedef enum {
+  PARSE_GROUND,
+  PARSE_ESC,
+  PARSE_CSI,
+  PARSE_STRING,
+  PARSE_STRING_ESC
+} ParseState;
+
+typedef struct {
+  gint64 first_row;
+  guint n_lines;
+  guint32 row_offsets[CHUNK_MAX_LINES];
+  GString *text;                /* Lines joined by \n; NULL if spilled */
+  goffset spill_offset;
+  gsize spill_len;
+} Chunk;
+
+typedef struct {
+  gint64 row;
+  int exit_status;              /* -1 if unknown */
+  char *text;
+} Command;
+
+/* Chunk ids containing a trigram, as ascending varint deltas */
+typedef struct {
+  GByteArray *ids;
+  guint32 last;
+} Posting;
+
+struct _HotSshScrollbackIndex
+{
+  gsize memory_limit;
+  gboolean disk_backed;
+  guint columns;
+  guint rows;
+
+  /* Output parser */
+  ParseState state;
+  gboolean is_osc;
+  GString *sequence;
+  gboolean pending_cr;
+  gboolean alt_screen;
+  GString *line;
+  guint line_width;
+  gint64 next_row;              /* Row of the line being built */
+  gint64 screen_top;            /* Row at the top of the screen */
+  gint64 end_row;               /* Rows the terminal has, scrollback included */
+  gint64 saved_row;             /* From screen_top, for DECSC/DECRC */
+
+  /* Command marks */
+  gboolean have_shell_integration;
+  gint64 prompt_row;
+  gssize command_start;         /* In line, or -1 */
+  gboolean typing;
+  gboolean enter_pending;
+  GArray *commands;             /* Command */
+  gsize commands_bytes;
+
+  /* Text */
+  Chunk *open;
+  GPtrArray *chunks;            /* Sealed Chunk, oldest first */
+  guint32 chunk_base;           /* Id of chunks->pdata[0] */
+  guint32 dropped_since_prune;
+  gsize text_bytes;             /* Sealed text held in memory */
+  GHashTable *postings;         /* trigram -> Posting */
+  gsize postings_bytes;
+  int spill_fd;
+  goffset spill_size;
+};
+
+static void
+chunk_free (gpointer data)
+{
+  Chunk *chunk = data;
+  if (chunk->text)
+    g_string_free (chunk->text, TRUE);
+  g_slice_free (Chunk, chunk);
+}
+
+static void
+posting_free (gpointer data)
+{
+  Posting *posting = data;
+  g_byte_array_unref (posting->ids);
+  g_slice_free (Posting, posting);
+}
+
+static void
+command_clear (gpointer data)
+{
+  Command *command = data;
+  g_free (command->text);
+}
+
+HotSshScrollbackIndex *
+hotssh_scrollback_index_new (gsize    memory_limit,
+                             gboolean disk_backed)
+{
+  HotSshScrollbackIndex *self = g_new0 (HotSshScrollbackIndex, 1);
+
+  self->memory_limit = memory_limit;
+  self->disk_backed = disk_backed;
+  self->columns = 80;
+  self->rows = 24;
+  self->sequence = g_string_new ("");
+  self->line = g_string_new ("");
+  self->commands = g_array_new (FALSE, FALSE, sizeof (Command));
+  g_array_set_clear_func (self->commands, command_clear);
+  self->chunks = g_ptr_array_new_with_free_func (chunk_free);
+  self->postings = g_hash_table_new_full (NULL, NULL, NULL, posting_free);
+  self->spill_fd = -1;
+  self->prompt_row = -1;
+  self->command_start = -1;
+
+  return self;
+}
+
+/* Forget the text and commands, but not where the terminal is */
+static void
+drop_contents (HotSshScrollbackIndex *self)
+{
+  g_string_truncate (self->line, 0);
+  self->line_width = 0;
+  self->pending_cr = FALSE;
+
+  self->prompt_row = -1;
+  self->command_start = -1;
+  self->typing = self->enter_pending = FALSE;
+  g_array_set_size (self->commands, 0);
+  self->commands_bytes = 0;
+
+  g_clear_pointer (&self->open, chunk_free);
+  g_ptr_array_set_size (self->chunks, 0);
+  self->chunk_base = 0;
+  self->dropped_since_prune = 0;
+  self->text_bytes = 0;
+  g_hash_table_remove_all (self->postings);
+  self->postings_bytes = 0;
+  if (self->spill_fd >= 0)
+    {
+      (void) close (self->spill_fd);
+      self->spill_fd = -1;
+    }
+  self->spill_size = 0;
+}
+
+void
+hotssh_scrollback_index_reset (HotSshScrollbackIndex *self)
+{
+  self->state = PARSE_GROUND;
+  g_string_truncate (self->sequence, 0);
+  self->alt_screen = FALSE;
+  self->have_shell_integration = FALSE;
+  self->next_row = self->screen_top = self->end_row = 0;
+  self->saved_row = 0;
+  drop_contents (self);
+}
+
+void
+hotssh_scrollback_index_free (HotSshScrollbackIndex *self)
+{
+  hotssh_scrollback_index_reset (self);
+  g_string_free (self->sequence, TRUE);
+  g_string_free (self->line, TRUE);
+  g_array_unref (self->commands);
+  g_ptr_array_unref (self->chunks);
+  g_hash_table_unref (self->postings);
+  g_free (self);
+}
+
+/* Rewrapping moves every line, so a change of width starts the index
+ * over; either way, positions continue from where the terminal says
+ * its cursor and screen are.
+ */
+void
+hotssh_scrollback_index_set_size (HotSshScrollbackIndex *self,
+                                  guint                  columns,
+                                  guint                  rows,
+                                  gint64                 cursor_row,
+                                  gint64                 screen_top)
+{
+  columns = MAX (columns, 1);
+  rows = MAX (rows, 1);
+
+  if (columns == self->columns && rows == self->rows)
+    return;
+
+  if (columns != self->columns)
+    drop_contents (self);
+  else if (self->line_width > 0)
+    /* Keep the partial line, starting on the cursor's row */
+    cursor_row -= (self->line_width - 1) / self->columns;
+
+  self->columns = columns;
+  self->rows = rows;
+  if (!self->alt_screen)
+    {
+      self->next_row = MAX (cursor_row, 0);
+      self->screen_top = MAX (screen_top, 0);
+      self->end_row = MAX (self->end_row, self->next_row + 1);
+    }
+}
+
+/* The row the cursor is on, given that a line is only wrapped once a
+ * character lands past its last column.
+ */
+static gint64
+cursor_row (HotSshScrollbackIndex *self)
+{
+  if (self->line_width == 0)
+    return self->next_row;
+  return self->next_row + (self->line_width - 1) / self->columns;
+}
+
+/* The terminal scrolls once the cursor goes below the screen, and has
+ * rows as far down as the cursor has been.
+ */
+static void
+note_row (HotSshScrollbackIndex *self,
+          gint64                 row)
+{
+  if (row >= self->screen_top + self->rows)
+    self->screen_top = row - self->rows + 1;
+  self->end_row = MAX (self->end_row, row + 1);
+}
+
+static gsize
+memory_used (HotSshScrollbackIndex *self)
+{
+  return self->text_bytes + self->postings_bytes + self->commands_bytes;
+}
+
+/* Trigrams are matched without regard to ASCII case */
+static inline guint32
+trigram_key (const guint8 *p)
+{
+  return ((guint32)g_ascii_tolower (p[0]) << 16) |
+    ((guint32)g_ascii_tolower (p[1]) << 8) |
+    (guint32)g_ascii_tolower (p[2]);
+}
+
+static void
+append_varint (GByteArray *buf,
+               guint32     v)
+{
+  guint8 b;
+
+  while (v >= 0x80)
+    {
+      b = (v & 0x7f) | 0x80;
+      g_byte_array_append (buf, &b, 1);
+      v >>= 7;
+    }
+  b = v;
+  g_byte_array_append (buf, &b, 1);
+}
+
+static void
+decode_posting (Posting *posting,
+                GArray  *out)
+{
+  const guint8 *p = posting->ids->data;
+  const guint8 *end = p + posting->ids->len;
+  guint32 id = 0;
+
+  g_array_set_size (out, 0);
+  while (p < end)
+    {
+      guint32 delta = 0;
+      guint shift = 0;
+
+      while (p < end)
+        {
+          delta |= (guint32)(*p & 0x7f) << shift;
+          shift += 7;
+          if (!(*p++ & 0x80))
+            break;
+        }
+      id += delta;
+      g_array_append_val (out, id);
+    }
+}
+
+static void
+add_to_postings (HotSshScrollbackIndex *self,
+                 guint32                id,
+                 const GString         *text)
+{
+  const guint8 *p = (const guint8*)text->str;
+  gsize i;
+
+  for (i = 0; i + 2 < text->len; i++)
+    {
+      guint32 key;
+      Posting *posting;
+      guint old_len;
+
+      if (p[i] == '\n' || p[i + 1] == '\n' || p[i + 2] == '\n')
+        continue;
+
+      key = trigram_key (p + i);
+      posting = g_hash_table_lookup (self->postings, GUINT_TO_POINTER (key));
+      if (!posting)
+        {
+          posting = g_slice_new0 (Posting);
+          posting->ids = g_byte_array_new ();
+          g_hash_table_insert (self->postings, GUINT_TO_POINTER (key), posting);
+          self->postings_bytes += sizeof (Posting) + 2 * sizeof (gpointer);
+        }
+      else if (posting->last == id)
+        continue;
+
+      old_len = posting->ids->len;
+      append_varint (posting->ids, posting->ids->len > 0 ? id - posting->last : id);
+      posting->last = id;
+      self->postings_bytes += posting->ids->len - old_len;
+    }
+}
+
+/* Re-encodes every posting list without the ids of forgotten chunks */
+static void
+prune_postings (HotSshScrollbackIndex *self)
+{
+  GHashTableIter iter;
+  gpointer value;
+  GArray *ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+  self->postings_bytes = 0;
+  g_hash_table_iter_init (&iter, self->postings);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      Posting *posting = value;
+      guint32 prev = 0;
+      gboolean any = FALSE;
+      guint i;
+
+      decode_posting (posting, ids);
+      g_byte_array_set_size (posting->ids, 0);
+      for (i = 0; i < ids->len; i++)
+        {
+          guint32 id = g_array_index (ids, guint32, i);
+          if (id < self->chunk_base)
+            continue;
+          append_varint (posting->ids, any ? id - prev : id);
+          prev = id;
+          any = TRUE;
+        }
+
+      if (!any)
+        {
+          g_hash_table_iter_remove (&iter);
+          continue;
+        }
+      self->postings_bytes += sizeof (Posting) + 2 * sizeof (gpointer) + posting->ids->len;
+    }
+
+  self->dropped_since_prune = 0;
+  g_array_unref (ids);
+}
+
+static gboolean
+spill_chunk (HotSshScrollbackIndex *self,
+             Chunk                 *chunk)
+{
+  const char *p;
+  gsize remaining;
+  goffset offset;
+
+  if (self->spill_fd < 0)
+    {
+      gs_free char *path = NULL;
+      self->spill_fd = g_file_open_tmp ("hotssh-scrollback-XXXXXX", &path, NULL);
+      if (self->spill_fd < 0)
+        return FALSE;
+      (void) g_unlink (path);
+    }
+
+  p = chunk->text->str;
+  remaining = chunk->text->len;
+  offset = self->spill_size;
+  while (remaining > 0)
+    {
+      gssize n = pwrite (self->spill_fd, p, remaining, offset);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return FALSE;
+      p += n;
+      remaining -= n;
+      offset += n;
+    }
+
+  chunk->spill_offset = self->spill_size;
+  chunk->spill_len = chunk->text->len;
+  self->spill_size = offset;
+  self->text_bytes -= chunk->text->len;
+  g_string_free (chunk->text, TRUE);
+  chunk->text = NULL;
+  return TRUE;
+}
+
+static void
+drop_oldest_chunk (HotSshScrollbackIndex *self)
+{
+  Chunk *chunk = self->chunks->pdata[0];
+
+  if (chunk->text)
+    self->text_bytes -= chunk->text->len;
+  g_ptr_array_remove_index (self->chunks, 0);
+  self->chunk_base++;
+  self->dropped_since_prune++;
+
+  /* Posting lists still name forgotten chunks until pruned */
+  if (self->dropped_since_prune >= MAX (16, self->chunks->len / 4))
+    prune_postings (self);
+}
+
+static void
+enforce_limits (HotSshScrollbackIndex *self)
+{
+  guint i = 0;
+
+  if (self->memory_limit == 0)
+    return;
+
+  /* Move text out first if allowed, oldest first */
+  if (self->disk_backed)
+    {
+      while (memory_used (self) > self->memory_limit && i < self->chunks->len)
+        {
+          Chunk *chunk = self->chunks->pdata[i++];
+          if (chunk->text && !spill_chunk (self, chunk))
+            {
+              g_debug ("scrollback index: spilling failed, keeping less history");
+              self->disk_backed = FALSE;
+              break;
+            }
+        }
+    }
+
+  while (memory_used (self) > self->memory_limit && self->chunks->len > 0)
+    drop_oldest_chunk (self);
+}
+
+static void
+seal_open_chunk (HotSshScrollbackIndex *self)
+{
+  Chunk *chunk = self->open;
+  guint32 id = self->chunk_base + self->chunks->len;
+
+  self->open = NULL;
+  add_to_postings (self, id, chunk->text);
+  self->text_bytes += chunk->text->len;
+  g_ptr_array_add (self->chunks, chunk);
+
+  enforce_limits (self);
+}
+
+static void
+add_command (HotSshScrollbackIndex *self,
+             gint64                 row,
+             const char            *text,
+             gsize                  len)
+{
+  Command command;
+
+  command.row = row;
+  command.exit_status = -1;
+  command.text = g_strstrip (g_strndup (text, len));
+
+  /* Shells redraw; the same prompt is reported once */
+  if (self->commands->len > 0 &&
+      g_array_index (self->commands, Command, self->commands->len - 1).row == row)
+    {
+      g_free (command.text);
+      return;
+    }
+
+  /* Anything below a row the cursor moved back up to was overwritten */
+  while (self->commands->len > 0 &&
+         g_array_index (self->commands, Command, self->commands->len - 1).row > row)
+    {
+      Command *last = &g_array_index (self->commands, Command, self->commands->len - 1);
+      self->commands_bytes -= sizeof (Command) + strlen (last->text) + 1;
+      g_array_set_size (self->commands, self->commands->len - 1);
+    }
+
+  g_array_append_val (self->commands, command);
+  self->commands_bytes += sizeof (Command) + strlen (command.text) + 1;
+
+  if (self->commands->len > COMMANDS_MAX)
+    {
+      guint i;
+      for (i = 0; i < COMMANDS_MAX / 2; i++)
+        self->commands_bytes -= sizeof (Command) +
+          strlen (g_array_index (self->commands, Command, i).text) + 1;
+      g_array_remove_range (self->commands, 0, COMMANDS_MAX / 2);
+    }
+}
+
+/* Record the line being built, which starts at @row */
+static void
+record_line (HotSshScrollbackIndex *self,
+             gint64                 row)
+{
+  Chunk *chunk;
+
+  if (!self->open)
+    {
+      self->open = g_slice_new0 (Chunk);
+      self->open->first_row = row;
+      self->open->text = g_string_sized_new (CHUNK_MAX_BYTES);
+    }
+  chunk = self->open;
+
+  /* Rows only go backwards after the cursor was moved up; start a new
+   * chunk so each stays in order.
+   */
+  if (chunk->n_lines > 0 &&
+      row <= chunk->first_row + chunk->row_offsets[chunk->n_lines - 1])
+    {
+      seal_open_chunk (self);
+      record_line (self, row);
+      return;
+    }
+
+  if (chunk->n_lines > 0)
+    g_string_append_c (chunk->text, '\n');
+  g_string_append_len (chunk->text, self->line->str, self->line->len);
+  chunk->row_offsets[chunk->n_lines++] = row - chunk->first_row;
+
+  if (chunk->n_lines == CHUNK_MAX_LINES || chunk->text->len >= CHUNK_MAX_BYTES)
+    seal_open_chunk (self);
+}
+
+static void
+finish_line (HotSshScrollbackIndex *self)
+{
+  gint64 row = self->next_row;
+
+  /* The alternate screen has no scrollback, and the main screen's
+   * line waits for its return.
+   */
+  if (self->alt_screen)
+    return;
+
+  self->next_row = cursor_row (self) + 1;
+  note_row (self, self->next_row);
+
+  if (self->enter_pending)
+    {
+      gsize start = MIN ((gsize)MAX (self->command_start, 0), self->line->len);
+      if (start < self->line->len)
+        add_command (self, row, self->line->str + start, self->line->len - start);
+    }
+
+  record_line (self, row);
+
+  g_string_truncate (self->line, 0);
+  self->line_width = 0;
+  self->pending_cr = FALSE;
+  self->typing = self->enter_pending = FALSE;
+  if (!self->have_shell_integration)
+    self->command_start = -1;
+}
+
+static void
+handle_osc (HotSshScrollbackIndex *self)
+{
+  const char *osc = self->sequence->str;
+
+  if (!g_str_has_prefix (osc, "133;"))
+    return;
+
+  self->have_shell_integration = TRUE;
+  switch (osc[4])
+    {
+    case 'A':
+      /* Prompt start */
+      self->prompt_row = self->next_row;
+      self->command_start = -1;
+      break;
+    case 'B':
+      /* Prompt end, command input start */
+      self->command_start = self->line->len;
+      break;
+    case 'C':
+      /* Command executed */
+      if (self->command_start >= 0 && (gsize)self->command_start <= self->line->len)
+        add_command (self, self->prompt_row >= 0 ? self->prompt_row : self->next_row,
+                     self->line->str + self->command_start,
+                     self->line->len - self->command_start);
+      self->command_start = -1;
+      break;
+    case 'D':
+      /* Command finished, with optional exit status */
+      if (self->commands->len > 0 && osc[5] == ';')
+        {
+          Command *last = &g_array_index (self->commands, Command, self->commands->len - 1);
+          if (last->exit_status < 0)
+            last->exit_status = (int)g_ascii_strtoll (osc + 6, NULL, 10);
+        }
+      break;
+    }
+}
+
+/* The cursor was put on @row directly; what was on its line so far
+ * stays where it was.
+ */
+static void
+move_cursor_to_row (HotSshScrollbackIndex *self,
+                    gint64                 row)
+{
+  if (self->alt_screen)
+    return;
+
+  /* Account for wrapping since the line began */
+  note_row (self, cursor_row (self));
+  row = CLAMP (row, self->screen_top, self->screen_top + self->rows - 1);
+  if (row == cursor_row (self))
+    return;
+
+  if (self->line->len > 0)
+    record_line (self, self->next_row);
+  g_string_truncate (self->line, 0);
+  self->line_width = 0;
+  self->pending_cr = FALSE;
+  self->typing = self->enter_pending = FALSE;
+  if (!self->have_shell_integration)
+    self->command_start = -1;
+  self->next_row = row;
+  note_row (self, row);
+}
+
+/* Like the terminal, a clear pushes the screen into the scrollback and
+ * starts a fresh one below everything so far, the cursor keeping its
+ * place on it.
+ */
+static void
+clear_screen (HotSshScrollbackIndex *self)
+{
+  gint64 offset;
+
+  if (self->alt_screen)
+    return;
+
+  note_row (self, cursor_row (self));
+  offset = cursor_row (self) - self->screen_top;
+  if (self->line->len > 0)
+    record_line (self, self->next_row);
+  g_string_truncate (self->line, 0);
+  self->line_width = 0;
+  self->screen_top = self->end_row;
+  self->next_row = self->screen_top + offset;
+  self->end_row = self->screen_top + self->rows;
+}
+
+/* Numeric parameters of a CSI sequence, missing ones as 0 */
+static guint
+parse_params (const char *params,
+              guint      *out,
+              guint       max)
+{
+  guint n = 0;
+
+  if (*params == '?' || *params == '>' || *params == '=')
+    params++;
+
+  while (n < max)
+    {
+      guint v = 0;
+      while (*params >= '0' && *params <= '9')
+        v = MIN (v * 10 + (*params++ - '0'), 65535);
+      out[n++] = v;
+      if (*params != ';')
+        break;
+      params++;
+    }
+  return n;
+}
+
+static void
+handle_csi (HotSshScrollbackIndex *self,
+            guint8                 final)
+{
+  const char *params = self->sequence->str;
+  guint args[16];
+  guint n_args;
+  guint i;
+
+  n_args = parse_params (params, args, G_N_ELEMENTS (args));
+
+  if (params[0] == '?')
+    {
+      if (final != 'h' && final != 'l')
+        return;
+      for (i = 0; i < n_args; i++)
+        if (args[i] == 1049 || args[i] == 1047 || args[i] == 47)
+          self->alt_screen = final == 'h';
+      return;
+    }
+  if (params[0] == '>' || params[0] == '=')
+    return;
+
+  switch (final)
+    {
+    case 'H':
+    case 'f':
+    case 'd':
+      move_cursor_to_row (self, self->screen_top + MAX (args[0], 1) - 1);
+      break;
+    case 'A':
+      move_cursor_to_row (self, cursor_row (self) - MAX (args[0], 1));
+      break;
+    case 'B':
+    case 'e':
+      move_cursor_to_row (self, cursor_row (self) + MAX (args[0], 1));
+      break;
+    case 's':
+      self->saved_row = cursor_row (self) - self->screen_top;
+      break;
+    case 'u':
+      move_cursor_to_row (self, self->screen_top + self->saved_row);
+      break;
+    case 'J':
+      if (args[0] == 2)
+        clear_screen (self);
+      else if (args[0] == 3 && !self->alt_screen)
+        drop_contents (self);
+      break;
+    }
+}
+
+static void
+append_to_line (HotSshScrollbackIndex *self,
+                guint8                 c)
+{
+  if (self->alt_screen)
+    return;
+
+  if (self->pending_cr)
+    {
+      /* Overwriting from the start; good enough for progress meters */
+      g_string_truncate (self->line, 0);
+      self->line_width = 0;
+      self->pending_cr = FALSE;
+    }
+
+  /* Count display cells at the first byte of each character */
+  if ((c & 0xc0) != 0x80)
+    self->line_width++;
+  if (self->line->len < LINE_MAX_BYTES)
+    g_string_append_c (self->line, c);
+}
+
+static void
+backspace (HotSshScrollbackIndex *self)
+{
+  gsize len = self->line->len;
+
+  if (self->alt_screen)
+    return;
+
+  while (len > 0 && (self->line->str[len - 1] & 0xc0) == 0x80)
+    len--;
+  if (len > 0)
+    len--;
+  g_string_truncate (self->line, len);
+  if (self->line_width > 0)
+    self->line_width--;
+}
+
+static void
+handle_esc (HotSshScrollbackIndex *self,
+            guint8                 final)
+{
+  switch (final)
+    {
+    case 'D':
+    case 'E':
+      finish_line (self);
+      break;
+    case 'M':
+      move_cursor_to_row (self, cursor_row (self) - 1);
+      break;
+    case '7':
+      self->saved_row = cursor_row (self) - self->screen_top;
+      break;
+    case '8':
+      move_cursor_to_row (self, self->screen_top + self->saved_row);
+      break;
+    case 'c':
+      /* A full reset clears the terminal's history, and its rows start
+       * over from zero.
+       */
+      hotssh_scrollback_index_reset (self);
+      break;
+    }
+}
+
+void
+hotssh_scrollback_index_feed (HotSshScrollbackIndex *self,
+                              const guint8          *buf,
+                              gsize                  len)
+{
+  const guint8 *end = buf + len;
+  const guint8 *p = buf;
+
+  while (p < end)
+    {
+      guint8 c = *p++;
+
+      switch (self->state)
+        {
+        case PARSE_GROUND:
+          if (c >= 0x20 && c != 0x7f)
+            append_to_line (self, c);
+          else if (c == '\n')
+            finish_line (self);
+          else if (c == '\r')
+            self->pending_cr = TRUE;
+          else if (c == '\b')
+            backspace (self);
+          else if (c == '\t')
+            append_to_line (self, ' ');
+          else if (c == '\033')
+            self->state = PARSE_ESC;
+          break;
+
+        case PARSE_ESC:
+          g_string_truncate (self->sequence, 0);
+          if (c == '[')
+            self->state = PARSE_CSI;
+          else if (c == ']' || c == 'P' || c == 'X' || c == '^' || c == '_')
+            {
+              self->is_osc = c == ']';
+              self->state = PARSE_STRING;
+            }
+          else if (c >= 0x20 && c <= 0x2f)
+            ;                   /* Intermediate, e.g. a charset selection */
+          else
+            {
+              handle_esc (self, c);
+              self->state = PARSE_GROUND;
+            }
+          break;
+
+        case PARSE_CSI:
+          if (c >= 0x40 && c <= 0x7e)
+            {
+              handle_csi (self, c);
+              self->state = PARSE_GROUND;
+            }
+          else if (self->sequence->len < SEQUENCE_MAX_BYTES)
+            g_string_append_c (self->sequence, c);
+          break;
+
+        case PARSE_STRING:
+          if (c == '\a')
+            {
+              if (self->is_osc)
+                handle_osc (self);
+              self->state = PARSE_GROUND;
+            }
+          else if (c == '\033')
+            self->state = PARSE_STRING_ESC;
+          else if (self->sequence->len < SEQUENCE_MAX_BYTES)
+            g_string_append_c (self->sequence, c);
+          break;
+
+        case PARSE_STRING_ESC:
+          /* ESC \ is the string terminator; anything else aborts it */
+          if (c == '\\')
+            {
+              if (self->is_osc)
+                handle_osc (self);
+              self->state = PARSE_GROUND;
+            }
+          else
+            {
+              /* Start over with this byte following the ESC */
+              self->state = PARSE_ESC;
+              p--;
+            }
+          break;
+        }
+    }
+}
+
+/* Without shell integration, a prompt is whatever was on the line when
+ * the user started typing, and the command is what followed it when
+ * the line was ended by pressing Enter.
+ */
+void
+hotssh_scrollback_index_input (HotSshScrollbackIndex *self,
+                               const guint8          *buf,
+                               gsize                  len)
+{
+  gsize i;
+
+  if (self->have_shell_integration || self->alt_screen)
+    return;
+
+  for (i = 0; i < len; i++)
+    {
+      guint8 c = buf[i];
+
+      if (c == '\r' || c == '\n')
+        {
+          if (self->typing)
+            self->enter_pending = TRUE;
+        }
+      else if (c == 0x03 || c == 0x15)
+        self->typing = FALSE;   /* ^C, ^U */
+      else if (c >= 0x20 && c != 0x7f && !self->typing)
+        {
+          self->typing = TRUE;
+          self->command_start = self->pending_cr ? 0 : self->line->len;
+        }
+    }
+}
+
+gint64
+hotssh_scrollback_index_find_command (HotSshScrollbackIndex  *self,
+                                      gint64                  from_row,
+                                      gboolean                backwards,
+                                      const char            **out_text)
+{
+  guint lo = 0;
+  guint hi = self->commands->len;
+  Command *command;
+
+  /* First command at or after from_row */
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      if (g_array_index (self->commands, Command, mid).row < from_row)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (backwards)
+    {
+      if (lo == 0)
+        return -1;
+      command = &g_array_index (self->commands, Command, lo - 1);
+    }
+  else
+    {
+      while (lo < self->commands->len &&
+             g_array_index (self->commands, Command, lo).row == from_row)
+        lo++;
+      if (lo == self->commands->len)
+        return -1;
+      command = &g_array_index (self->commands, Command, lo);
+    }
+
+  if (out_text)
+    *out_text = command->text;
+  return command->row;
+}
+
+static char *
+load_chunk_text (HotSshScrollbackIndex *self,
+                 Chunk                 *chunk,
+                 gsize                 *out_len)
+{
+  char *buf;
+  gsize done = 0;
+  gsize i;
+
+  if (chunk->text)
+    {
+      *out_len = chunk->text->len;
+      return g_ascii_strdown (chunk->text->str, chunk->text->len);
+    }
+
+  buf = g_malloc (chunk->spill_len + 1);
+  while (done < chunk->spill_len)
+    {
+      gssize n = pread (self->spill_fd, buf + done, chunk->spill_len - done,
+                        chunk->spill_offset + done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          g_free (buf);
+          return NULL;
+        }
+      done += n;
+    }
+  buf[done] = '\0';
+  *out_len = done;
+
+  for (i = 0; i < done; i++)
+    buf[i] = g_ascii_tolower (buf[i]);
+  return buf;
+}
+
+/* Row of the nearest line in @chunk containing @needle, before or after
+ * @from_row, or -1.
+ */
+static gint64
+search_chunk (HotSshScrollbackIndex *self,
+              Chunk                 *chunk,
+              const char            *needle,
+              gint64                 from_row,
+              gboolean               backwards)
+{
+  gs_free char *text = NULL;
+  gsize len;
+  const char *line;
+  const char *end;
+  gint64 found = -1;
+  guint i;
+
+  if (backwards && chunk->first_row >= from_row)
+    return -1;
+  if (!backwards && chunk->first_row + chunk->row_offsets[chunk->n_lines - 1] <= from_row)
+    return -1;
+
+  text = load_chunk_text (self, chunk, &len);
+  if (!text)
+    return -1;
+
+  line = text;
+  end = text + len;
+  for (i = 0; i < chunk->n_lines && line <= end; i++)
+    {
+      const char *nl = memchr (line, '\n', end - line);
+      const char *line_end = nl ? nl : end;
+      gint64 row = chunk->first_row + chunk->row_offsets[i];
+
+      if (backwards ? row < from_row : row > from_row)
+        {
+          if (g_strstr_len (line, line_end - line, needle))
+            {
+              found = row;
+              if (!backwards)
+                break;
+            }
+        }
+      else if (backwards)
+        break;
+
+      line = line_end + 1;
+    }
+
+  return found;
+}
+
+/* Chunk ids that contain every trigram of @needle */
+static GArray *
+candidate_chunks (HotSshScrollbackIndex *self,
+                  const char            *needle)
+{
+  GArray *result = NULL;
+  GArray *ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+  gsize len = strlen (needle);
+  gsize i;
+
+  for (i = 0; i + 2 < len; i++)
+    {
+      Posting *posting = g_hash_table_lookup (self->postings,
+                                              GUINT_TO_POINTER (trigram_key ((const guint8*)needle + i)));
+      guint a, b, n;
+
+      if (!posting)
+        {
+          g_array_set_size (ids, 0);
+          if (result)
+            g_array_set_size (result, 0);
+          else
+            result = g_array_new (FALSE, FALSE, sizeof (guint32));
+          break;
+        }
+
+      if (!result)
+        {
+          result = g_array_new (FALSE, FALSE, sizeof (guint32));
+          decode_posting (posting, result);
+          continue;
+        }
+
+      /* Intersect in place */
+      decode_posting (posting, ids);
+      a = b = n = 0;
+      while (a < result->len && b < ids->len)
+        {
+          guint32 x = g_array_index (result, guint32, a);
+          guint32 y = g_array_index (ids, guint32, b);
+          if (x < y)
+            a++;
+          else if (y < x)
+            b++;
+          else
+            {
+              g_array_index (result, guint32, n++) = x;
+              a++;
+              b++;
+            }
+        }
+      g_array_set_size (result, n);
+      if (n == 0)
+        break;
+    }
+
+  g_array_unref (ids);
+  return result;
+}
+
+gint64
+hotssh_scrollback_index_search (HotSshScrollbackIndex *self,
+                                const char            *text,
+                                gint64                 from_row,
+                                gboolean               backwards)
+{
+  gs_free char *needle = g_ascii_strdown (text, -1);
+  GArray *candidates = NULL;
+  gint64 found = -1;
+  guint n, i;
+
+  if (!*needle)
+    return -1;
+
+  /* The open chunk isn't indexed yet, and is the newest */
+  if (backwards && self->open)
+    {
+      found = search_chunk (self, self->open, needle, from_row, TRUE);
+      if (found >= 0)
+        return found;
+    }
+
+  if (strlen (needle) >= 3)
+    candidates = candidate_chunks (self, needle);
+  n = candidates ? candidates->len : self->chunks->len;
+
+  for (i = 0; i < n && found < 0; i++)
+    {
+      guint j = backwards ? n - 1 - i : i;
+      guint32 id = candidates ? g_array_index (candidates, guint32, j) : self->chunk_base + j;
+
+      if (id < self->chunk_base || id - self->chunk_base >= self->chunks->len)
+        continue;
+      found = search_chunk (self, self->chunks->pdata[id - self->chunk_base],
+                            needle, from_row, backwards);
+    }
+
+  if (found < 0 && !backwards && self->open)
+    found = search_chunk (self, self->open, needle, from_row, FALSE);
+
+  if (candidates)
+    g_array_unref (candidates);
+  return found;
+}
+
+void
+hotssh_scrollback_index_set_limits (HotSshScrollbackIndex *self,
+                                    gsize                  memory_limit,
+                                    gboolean               disk_backed)
+{
+  self->memory_limit = memory_limit;
+  self->disk_backed = disk_backed;
+  enforce_limits (self);
+}
@@ -0,0 +1,70 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* An index of a tab's scrollback, built from the same output stream
+ * the terminal is fed.  It keeps the commands that were run, from
+ * OSC 133 shell integration marks or, failing that, from where typing
+ * started on the line, and a trigram index over the text in chunks of
+ * lines.  Positions are terminal rows, counted the way the terminal
+ * counts them, so a result can be scrolled to directly; cursor
+ * movement, clears and the alternate screen are followed to keep them
+ * so, and a change of width, which rewraps everything, starts over.
+ *
+ * The text can be bounded in memory; past the limit the oldest chunks
+ * move to an unlinked temporary file if disk backing is on, or are
+ * forgotten otherwise.
+ */
+typedef struct _HotSshScrollbackIndex HotSshScrollbackIndex;
+
+HotSshScrollbackIndex *hotssh_scrollback_index_new          (gsize                   memory_limit,
+                                                             gboolean                disk_backed);
+void                   hotssh_scrollback_index_free         (HotSshScrollbackIndex  *self);
+
+void                   hotssh_scrollback_index_reset        (HotSshScrollbackIndex  *self);
+void                   hotssh_scrollback_index_set_limits   (HotSshScrollbackIndex  *self,
+                                                             gsize                   memory_limit,
+                                                             gboolean                disk_backed);
+void                   hotssh_scrollback_index_set_size     (HotSshScrollbackIndex  *self,
+                                                             guint                   columns,
+                                                             guint                   rows,
+                                                             gint64                  cursor_row,
+                                                             gint64                  screen_top);
+
+void                   hotssh_scrollback_index_feed         (HotSshScrollbackIndex  *self,
+                                                             const guint8           *buf,
+                                                             gsize                   len);
+void                   hotssh_scrollback_index_input        (HotSshScrollbackIndex  *self,
+                                                             const guint8           *buf,
+                                                             gsize                   len);
+
+gint64                 hotssh_scrollback_index_find_command (HotSshScrollbackIndex  *self,
+                                                             gint64                  from_row,
+                                                             gboolean                backwards,
+                                                             const char            **out_text);
+gint64                 hotssh_scrollback_index_search       (HotSshScrollbackIndex  *self,
+                                                             const char             *text,
+                                                             gint64                  from_row,
+                                                             gboolean                backwards);
+
+G_END_DECLS
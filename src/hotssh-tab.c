@@ -17,29 +17,147 @@
  */
 
 #include "hotssh-tab.h"
+#include "hotssh-address-cache.h"
+#include "hotssh-address-race.h"
+#include "hotssh-channel-pump.h"
+#include "hotssh-connection-info.h"
+#include "hotssh-connection-pool.h"
+#include "hotssh-expect.h"
+#include "hotssh-gssapi.h"
 #include "hotssh-hostdb.h"
+#include "hotssh-io-worker.h"
+#include "hotssh-keepalive.h"
+#include "hotssh-mirror.h"
 #include "hotssh-password-interaction.h"
+#include "hotssh-preconnect.h"
+#include "hotssh-predictor.h"
+#include "hotssh-recorder.h"
+#include "hotssh-replay.h"
+#include "hotssh-scanner.h"
+#include "hotssh-scrollback-index.h"
 #include "gssh.h"
 
 #include "libgsystem.h"
 
 #include <vte/vte.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
 #include <stdio.h>
 #include <string.h>
 
 #include <glib/gi18n.h>
 
+/* GSSAPI is only tried with Kerberos credentials at hand */
 static const GSshConnectionAuthMechanism default_authentication_order[] = {
+  GSSH_CONNECTION_AUTH_MECHANISM_GSSAPI_MIC,
   GSSH_CONNECTION_AUTH_MECHANISM_PUBLICKEY,
-  /*  GSSH_CONNECTION_AUTH_MECHANISM_GSSAPI_MIC,  Seems broken */
   GSSH_CONNECTION_AUTH_MECHANISM_PASSWORD
 };
 
+/* A mechanism denied this many logins in a row for a host is tried
+ * after the others, password included, until it next succeeds.
+ */
+#define AUTH_DEMOTE_DENIALS (2)
+
+/* Input is staged in a fixed ring handed to the connection's I/O
+ * worker, and nothing is held outside it.  Keyboard input stops being
+ * accepted from the terminal at the high watermark, which leaves room
+ * for the largest paste VTE sends in one go, until the ring drains
+ * below the low watermark.
+ */
+#define WRITE_BUFFER_SIZE (256 * 1024)
+#define WRITE_BUFFER_LOW_WATER (WRITE_BUFFER_SIZE / 4)
+
+/* Pastes larger than this bypass VTE and are streamed in chunks, one
+ * chunk in flight at a time.
+ */
+#define PASTE_STREAM_THRESHOLD (64 * 1024)
+#define WRITE_BUFFER_HIGH_WATER (WRITE_BUFFER_SIZE - PASTE_STREAM_THRESHOLD)
+#define PASTE_CHUNK_SIZE (16 * 1024)
+/* Input typed while a streamed paste's bracket is open is held until
+ * it closes, rather than landing inside the paste.
+ */
+#define PASTE_HELD_INPUT_MAX (4096)
+
+/* Keystrokes typed while connecting are held until the shell opens */
+#define TYPEAHEAD_MAX (4096)
+
+/* Output for tabs nobody can see is parsed in batches at low priority;
+ * past this much backlog it's fed through regardless.
+ */
+#define BACKGROUND_FEED_INTERVAL_MS (500)
+#define BACKGROUND_BACKLOG_MAX (4 * 1024 * 1024)
+
+/* Defaults for per-host expect scripts */
+#define EXPECT_DEFAULT_TIMEOUT_SECONDS (30)
+#define EXPECT_DEFAULT_MAX_STEPS (32)
+
+/* A background command that runs at least this long alerts when done */
+#define LONG_COMMAND_SECONDS (10)
+
+/* Replay catches up in bounded steps, and wakes up at least this often
+ * to move the position slider.
+ */
+#define REPLAY_TICK_MAX_BYTES (1024 * 1024)
+#define REPLAY_TICK_MAX_MS (250)
+
+/* A broadcast group member with this much input still queued is shown
+ * as lagging; past the throttling point it is skipped.
+ */
+#define BROADCAST_LAG_BYTES (4 * 1024)
+
+#define PTY_RESIZE_QUIET_MS (100)
+#define PTY_RESIZE_MAX_DELAY_MS (250)
+
+/* Automatic reconnection backs off from this, doubling, to the max */
+#define RECONNECT_BASE_DELAY_MS (500)
+#define RECONNECT_MAX_DELAY_MS (60 * 1000)
+
+/* How often to look at the connection's round trip time and whether
+ * it has stopped answering
+ */
+#define KEEPALIVE_SAMPLE_SECONDS (1)
+
+/* Steps of logging in that each get their own deadline; waiting on the
+ * user in between is not timed.
+ */
+typedef enum {
+  CONNECT_PHASE_NONE,
+  CONNECT_PHASE_RESOLVE,
+  CONNECT_PHASE_CONNECT,
+  CONNECT_PHASE_HANDSHAKE,
+  CONNECT_PHASE_NEGOTIATE,
+  CONNECT_PHASE_AUTH,
+  CONNECT_PHASE_SHELL_OPEN
+} ConnectPhase;
+
+/* Where output is in a CSI sequence, for tracking bracketed paste
+ * mode across reads.
+ */
+typedef enum {
+  MODE_PARSE_GROUND,
+  MODE_PARSE_ESCAPE,
+  MODE_PARSE_CSI,
+  MODE_PARSE_PRIVATE,
+  MODE_PARSE_IGNORE
+} ModeParseState;
+
 enum {
   PROP_0,
-  PROP_HOSTNAME
+  PROP_HOSTNAME,
+  PROP_ALERT,
+  PROP_BROADCAST,
+  PROP_STALLED
+};
+
+enum {
+  BROADCAST_INPUT,
+  BROADCAST_PASTE,
+  LAST_SIGNAL
 };
 
+static guint signals[LAST_SIGNAL];
+
 struct _HotSshTab
 {
   GtkNotebook parent;
@@ -67,6 +185,13 @@ struct _HotSshTabPrivate
   GSettings *settings;
   GtkWidget *terminal;
   HotSshPasswordInteraction *password_interaction;
+  HotSshPredictor *predictor;
+  HotSshScanner *scanner;
+  HotSshScrollbackIndex *scrollback_index;
+  HotSshExpect *expect;
+  HotSshRecorder *recorder;
+  gboolean record_input;
+  HotSshMirror *mirror;
 
   /* Bound via template */
   GtkWidget *host_entry;
@@ -88,6 +213,17 @@ struct _HotSshTabPrivate
   GtkWidget *disapprove_hostkey_button;
   GtkWidget *terminal_box;
   GtkWidget *terminal_vscrollbar;
+  GtkWidget *paste_progress_box;
+  GtkWidget *paste_progress;
+  GtkWidget *paste_cancel_button;
+  GtkWidget *search_bar;
+  GtkWidget *search_entry;
+  GtkWidget *replay_box;
+  GtkWidget *replay_play_button;
+  GtkWidget *replay_play_icon;
+  GtkWidget *replay_scale;
+  GtkWidget *replay_time_label;
+  GtkWidget *replay_speed_spin;
   GtkWidget *connections_treeview;
   GtkWidget *hostname_column;
   GtkWidget *hostname_renderer;
@@ -98,6 +234,9 @@ struct _HotSshTabPrivate
 
   /* State */
   HotSshTabPage active_page;
+  /* For this host: last to succeed first, then the defaults */
+  GSshConnectionAuthMechanism auth_order[G_N_ELEMENTS (default_authentication_order)];
+  guint n_auth_order;
   guint authmechanism_index;
 
   gboolean indisposed;
@@ -105,37 +244,122 @@ struct _HotSshTabPrivate
   char *hostname;
   char *username;
   GtkEntryCompletion *host_completion;
+  /* Entry the user is lingering on, to connect to ahead of time */
+  char *preconnect_id;
+  guint preconnect_timeout_id;
   GSocketConnectable *address;
+  /* address, narrowed down to the one that answered first */
+  GSocketConnectable *connect_address;
+  HotSshIoWorker *worker;
   GSshConnection *connection;
+  /* Main thread copies of what the connection's worker reported */
+  GSshConnectionState connection_state;
+  HotSshHostKey *host_key;
+  GArray *auth_mechanisms;
+  /* A TabWatch, if our handlers are connected to connection */
+  gpointer connection_watch;
+  /* We hold a use of connection in the pool */
+  gboolean connection_pooled;
+  /* Nonzero while getting a lost session back */
+  guint reconnect_attempt;
+  guint reconnect_timeout_id;
+  ConnectPhase connect_phase;
+  guint connect_phase_timeout_id;
+  /* From the connection's socket, while in a session */
+  guint keepalive_sample_id;
+  guint rtt_usec;
+  guint rtt_var_usec;
+  gboolean stalled;
+  gint64 stalled_since;
   GSshChannel *channel;
+  HotSshChannelPump *pump;
 
   guint queued_pty_size_id;
+  gint64 resize_pending_since;
+  guint pty_width;
+  guint pty_height;
 
   gboolean need_pty_size_request;
   gboolean sent_pty_size_request;
   gboolean awaiting_password_entry;
   gboolean submitted_password;
-  gboolean have_outstanding_write;
   gboolean have_outstanding_auth;
-  GQueue write_queue;
+  gboolean input_throttled;
+  gboolean input_designated;
+
+  char *status_text;
+  gboolean typeahead_enabled;
+  GByteArray *typeahead;
+
+  GByteArray *background_backlog;
+  guint background_feed_id;
+  HotSshTabAlert alert;
+  HotSshTabBroadcast broadcast;
+  gint64 command_started_at;
+  gint64 search_row;
+
+  gboolean bracketed_paste_mode;
+  ModeParseState mode_parse_state;
+  guint mode_parse_param;
+  gboolean mode_parse_is_paste;
+  GBytes *paste_data;
+  gsize paste_offset;
+  gboolean paste_last_was_cr;
+  gboolean paste_bracket_open;
+  GByteArray *held_input;
+
+  HotSshReplay *replay;
+  guint replay_tick_id;
+  gint64 replay_base_usec;
+  gint64 replay_base_time;
+  double replay_speed;
+
+  /* Set when this tab is a view of another tab's session */
+  HotSshTab *mirror_source;
+  guint mirror_view_id;
+  GQueue *mirror_backlog;
+  gsize mirror_backlog_size;
+  gboolean mirror_resync;
 
   GCancellable *cancellable;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(HotSshTab, hotssh_tab, GTK_TYPE_NOTEBOOK);
 
+/* Keeps recordings of sessions started within the same second apart */
+static guint recording_serial;
+
 static void
 on_negotiate_complete (GObject             *src,
                        GAsyncResult        *result,
                        gpointer             user_data);
 
+static void
+update_status_label (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_free char *text = NULL;
+
+  if (priv->typeahead && priv->typeahead->len > 0)
+    text = g_strdup_printf (ngettext ("%s\n(%u byte typed ahead)",
+                                      "%s\n(%u bytes typed ahead)",
+                                      priv->typeahead->len),
+                            priv->status_text ? priv->status_text : "",
+                            priv->typeahead->len);
+
+  gtk_label_set_text ((GtkLabel*)priv->connection_text,
+                      text ? text : (priv->status_text ? priv->status_text : ""));
+}
+
 static void
 set_status (HotSshTab     *self,
 	    const char       *text)
 {
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
   g_debug ("status: %s", text);
-  gtk_label_set_text ((GtkLabel*)priv->connection_text, text);
+  g_free (priv->status_text);
+  priv->status_text = g_strdup (text);
+  update_status_label (self);
 }
 
 static void
@@ -158,389 +382,2924 @@ set_status_printf (HotSshTab  *self,
   set_status (self, msg);
 }
 
+/* Keystrokes are only taken when they can go somewhere: not while the
+ * write queue is full, not in a replay, and for a mirrored session only
+ * in the view that has input.
+ */
 static void
-state_reset_for_new_connection (HotSshTab                *self)
+update_input_enabled (HotSshTab *self)
 {
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  g_debug ("reset state");
-  g_clear_pointer (&priv->connection_id, g_free);
-  g_clear_object (&priv->address);
-  g_clear_object (&priv->connection);
-  g_clear_object (&priv->cancellable);
+
   if (!priv->indisposed)
-    {
-      g_object_notify ((GObject*)self, "hostname");
-      vte_terminal_reset ((VteTerminal*)priv->terminal, TRUE, TRUE);
-      gtk_entry_set_text ((GtkEntry*)priv->password_entry, "");
-      gtk_label_set_text ((GtkLabel*)priv->connection_text, "");
-      gtk_widget_set_sensitive (priv->password_container, TRUE);
-      priv->awaiting_password_entry = priv->submitted_password = FALSE;
-    }
-  if (priv->queued_pty_size_id)
-    {
-      g_source_remove (priv->queued_pty_size_id);
-      priv->queued_pty_size_id = 0;
-    }
-  g_debug ("reset state done");
+    vte_terminal_set_input_enabled ((VteTerminal*)priv->terminal,
+                                    !priv->input_throttled && !priv->replay &&
+                                    priv->input_designated);
 }
 
 static void
-page_transition (HotSshTab        *self,
-		 HotSshTabPage     new_page)
+set_input_throttled (HotSshTab *self,
+                     gboolean   throttled)
 {
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
 
-  if (new_page == priv->active_page)
+  if (priv->input_throttled == throttled)
     return;
 
-  g_debug ("PAGE: %u => %u", priv->active_page, new_page);
-  priv->active_page = new_page;
-
-  if (priv->active_page == HOTSSH_TAB_PAGE_NEW_CONNECTION
-      || priv->active_page == HOTSSH_TAB_PAGE_LIST_CONNECTIONS
-      || priv->active_page == HOTSSH_TAB_PAGE_ERROR)
-    state_reset_for_new_connection (self);
-
-  gtk_notebook_set_current_page ((GtkNotebook*)self, new_page);
-
-  if (priv->active_page == HOTSSH_TAB_PAGE_TERMINAL)
-    gtk_widget_grab_focus ((GtkWidget*)priv->terminal);
+  g_debug ("input %s", throttled ? "throttled" : "resumed");
+  priv->input_throttled = throttled;
+  if (priv->mirror)
+    hotssh_mirror_set_input_throttled (priv->mirror, throttled);
+  update_input_enabled (self);
 }
 
 static void
-page_transition_take_error (HotSshTab               *self,
-			    GError                     *error)
+clear_mirror_backlog (HotSshTab *self)
 {
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  g_debug ("Caught error: %s", error->message);
-  page_transition (self, HOTSSH_TAB_PAGE_ERROR);
-  gtk_label_set_text ((GtkLabel*)priv->error_text, error->message);
-  g_error_free (error);
+
+  if (priv->mirror_backlog)
+    g_queue_free_full (priv->mirror_backlog, (GDestroyNotify)g_bytes_unref);
+  priv->mirror_backlog = NULL;
+  priv->mirror_backlog_size = 0;
 }
 
 static void
-on_istream_read_complete (GObject           *src,
-			  GAsyncResult      *res,
-			  gpointer           user_data)
+cancel_paste (HotSshTab *self,
+              gboolean   close_bracket);
+
+static void
+set_alert (HotSshTab      *self,
+           HotSshTabAlert  alert)
 {
-  HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  gs_unref_bytes GBytes *result = NULL;
-  GError *local_error = NULL;
-  const guint8 *buf;
-  gsize len;
-
-  result = g_input_stream_read_bytes_finish ((GInputStream*)src, res, &local_error);
-  if (!result)
-    goto out;
 
-  buf = g_bytes_get_data (result, &len);
-  g_debug ("read %u bytes", (guint)len);
-  
-  vte_terminal_feed ((VteTerminal*)priv->terminal, (char*)buf, len);
-
-  g_input_stream_read_bytes_async ((GInputStream*)src, 8192, G_PRIORITY_DEFAULT,
-				   priv->cancellable, on_istream_read_complete, self);
+  if (priv->alert == alert)
+    return;
 
- out:
-  if (local_error)
-    page_transition_take_error (self, local_error);
+  priv->alert = alert;
+  g_object_notify ((GObject*)self, "alert");
 }
 
 static void
-on_open_shell_complete (GObject           *src,
-			GAsyncResult      *res,
-			gpointer           user_data)
+set_broadcast_state (HotSshTab          *self,
+                     HotSshTabBroadcast  state)
 {
-  HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  GError *local_error = NULL;
-  GInputStream *istream;
 
-  g_debug ("open shell complete");
+  if (priv->broadcast == state)
+    return;
 
-  priv->channel = gssh_connection_open_shell_finish ((GSshConnection*)src,
-						       res, &local_error);
-  if (!priv->channel)
-    goto out;
+  priv->broadcast = state;
+  g_object_notify ((GObject*)self, "broadcast");
+}
 
-  page_transition (self, HOTSSH_TAB_PAGE_TERMINAL);
+static void
+set_stalled (HotSshTab *self,
+             gboolean   stalled)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
 
-  istream = g_io_stream_get_input_stream ((GIOStream*)priv->channel);
+  if (priv->stalled == stalled)
+    return;
 
-  g_input_stream_read_bytes_async (istream, 8192, G_PRIORITY_DEFAULT,
-				   priv->cancellable, on_istream_read_complete, self);
-  
- out:
-  if (local_error)
-    page_transition_take_error (self, local_error);
+  priv->stalled = stalled;
+  g_object_notify ((GObject*)self, "stalled");
 }
 
 static void
-iterate_authentication_modes (HotSshTab          *self);
+stop_keepalive_sampling (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (priv->keepalive_sample_id)
+    {
+      g_source_remove (priv->keepalive_sample_id);
+      priv->keepalive_sample_id = 0;
+    }
+  priv->rtt_usec = priv->rtt_var_usec = 0;
+  priv->stalled_since = 0;
+  set_stalled (self, FALSE);
+}
 
 static void
-on_connection_state_notify (GSshConnection   *conn,
-			    GParamSpec         *pspec,
-			    gpointer            user_data)
+page_transition_take_error (HotSshTab *self,
+                            GError    *error);
+
+static const char *
+connect_phase_setting (ConnectPhase phase)
 {
-  HotSshTab *self = HOTSSH_TAB (user_data);
+  switch (phase)
+    {
+    case CONNECT_PHASE_RESOLVE:
+      return "deadline-resolve";
+    case CONNECT_PHASE_CONNECT:
+      return "deadline-connect";
+    case CONNECT_PHASE_HANDSHAKE:
+      return "deadline-handshake";
+    case CONNECT_PHASE_NEGOTIATE:
+      return "deadline-negotiate";
+    case CONNECT_PHASE_AUTH:
+      return "deadline-auth";
+    case CONNECT_PHASE_SHELL_OPEN:
+      return "deadline-shell-open";
+    case CONNECT_PHASE_NONE:
+      break;
+    }
+  g_assert_not_reached ();
+}
+
+static gboolean
+on_connect_phase_timeout (gpointer user_data)
+{
+  HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  GSshConnectionState new_state = gssh_connection_get_state (conn);
+  guint seconds = g_settings_get_uint (priv->settings, connect_phase_setting (priv->connect_phase));
+  GError *local_error = NULL;
 
-  switch (new_state)
+  priv->connect_phase_timeout_id = 0;
+
+  switch (priv->connect_phase)
     {
-    case GSSH_CONNECTION_STATE_DISCONNECTED:
-    case GSSH_CONNECTION_STATE_CONNECTING:
-    case GSSH_CONNECTION_STATE_HANDSHAKING:
-    case GSSH_CONNECTION_STATE_PREAUTH:
-    case GSSH_CONNECTION_STATE_NEGOTIATE_AUTH:
+    case CONNECT_PHASE_RESOLVE:
+      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                   _("Timed out after %u seconds looking up the host name"), seconds);
       break;
-    case GSSH_CONNECTION_STATE_AUTHENTICATION_REQUIRED:
+    case CONNECT_PHASE_CONNECT:
+      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                   _("Timed out after %u seconds connecting to the host"), seconds);
       break;
-    case GSSH_CONNECTION_STATE_ERROR:
-      g_debug ("connection in state ERROR!");
+    case CONNECT_PHASE_HANDSHAKE:
+      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                   _("Timed out after %u seconds exchanging keys with the host"), seconds);
       break;
-    case GSSH_CONNECTION_STATE_CONNECTED:
-      gssh_connection_open_shell_async (priv->connection, priv->cancellable,
-					  on_open_shell_complete, self);
+    case CONNECT_PHASE_NEGOTIATE:
+      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                   _("Timed out after %u seconds negotiating authentication"), seconds);
+      break;
+    case CONNECT_PHASE_AUTH:
+      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                   _("Timed out after %u seconds authenticating"), seconds);
+      break;
+    case CONNECT_PHASE_SHELL_OPEN:
+      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                   _("Timed out after %u seconds opening a shell"), seconds);
       break;
+    case CONNECT_PHASE_NONE:
+      g_assert_not_reached ();
     }
+
+  priv->connect_phase = CONNECT_PHASE_NONE;
+  /* Leaving the connecting page cancels what is still outstanding, and
+   * closes the socket.
+   */
+  page_transition_take_error (self, local_error);
+  return FALSE;
 }
 
+/* Start timing a step of logging in, replacing the deadline for the
+ * step before; CONNECT_PHASE_NONE stops timing.  A setting of 0 leaves
+ * that step to the system's own timeouts.
+ */
 static void
-on_auth_complete (GObject                *src,
-                  GAsyncResult           *res,
-                  gpointer                user_data)
+set_connect_phase (HotSshTab    *self,
+                   ConnectPhase  phase)
 {
-  HotSshTab *self = HOTSSH_TAB (user_data);
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  GError *local_error = NULL;
+  guint seconds = 0;
 
-  priv->have_outstanding_auth = FALSE;
+  if (priv->connect_phase_timeout_id)
+    {
+      g_source_remove (priv->connect_phase_timeout_id);
+      priv->connect_phase_timeout_id = 0;
+    }
+  priv->connect_phase = phase;
 
-  if (!gssh_connection_auth_finish ((GSshConnection*)src, res, &local_error))
-    goto out;
+  if (phase != CONNECT_PHASE_NONE)
+    seconds = g_settings_get_uint (priv->settings, connect_phase_setting (phase));
+  if (seconds > 0)
+    priv->connect_phase_timeout_id =
+      g_timeout_add_seconds (seconds, on_connect_phase_timeout, self);
+}
 
-  set_status (self, _("Authenticated, requesting channel…"));
+/* Our handlers on a connection's signals run on its worker and are
+ * given this rather than the tab.  The connection is not referenced;
+ * the main thread only compares against it.
+ */
+typedef struct {
+  HotSshTab *self;
+  HotSshIoWorker *worker;
+  GSshConnection *connection;
+} TabWatch;
 
-  g_debug ("auth complete");
+static gboolean
+unref_in_main (gpointer data)
+{
+  g_object_unref (data);
+  return FALSE;
+}
 
- out:
-  if (local_error)
-    {
-      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED))
-        {
-          g_debug ("Authentication mechanism '%s' denied",
-                   gssh_connection_auth_mechanism_to_string (default_authentication_order[priv->authmechanism_index]));
-          g_clear_error (&local_error);
-          priv->authmechanism_index++;
-          iterate_authentication_modes (self);
-        }
-      else
-        page_transition_take_error (self, local_error);
-    }
+static TabWatch *
+tab_watch_new (HotSshTab      *self,
+               HotSshIoWorker *worker,
+               GSshConnection *connection)
+{
+  TabWatch *watch = g_slice_new0 (TabWatch);
+
+  watch->self = g_object_ref (self);
+  watch->worker = worker;
+  watch->connection = connection;
+  return watch;
+}
+
+/* Destroy notify of the state handler; runs on the worker */
+static void
+tab_watch_free (gpointer  data,
+                GClosure *closure)
+{
+  TabWatch *watch = data;
+
+  hotssh_io_worker_invoke_main (unref_in_main, watch->self, NULL);
+  g_slice_free (TabWatch, watch);
+}
+
+/* Carries a connection to or from its worker.  Only an operation that
+ * returns to the main thread holds the tab.
+ */
+typedef struct {
+  HotSshTab *self;
+  HotSshIoWorker *worker;
+  GSshConnection *connection;
+  TabWatch *watch;
+  GTlsInteraction *interaction;
+  GSocketConnectable *address;
+  char *username;
+  GCancellable *cancellable;
+  guint keepalive_interval;
+  guint keepalive_count;
+  GSshConnectionState state;
+} TabConnectionOp;
+
+static void
+tab_connection_op_free (gpointer data)
+{
+  TabConnectionOp *op = data;
+
+  g_clear_object (&op->self);
+  g_clear_object (&op->connection);
+  g_clear_object (&op->interaction);
+  g_clear_object (&op->address);
+  g_clear_object (&op->cancellable);
+  g_free (op->username);
+  g_slice_free (TabConnectionOp, op);
 }
 
 static gboolean
-have_mechanism (guint                        *available,
-                guint                         n_available,
-                GSshConnectionAuthMechanism   mech)
+op_release_connection (gpointer data)
 {
-  guint i;
-  for (i = 0; i < n_available; i++)
-    if (available[i] == mech)
-      return TRUE;
+  TabConnectionOp *op = data;
+
+  if (op->watch)
+    {
+      g_signal_handlers_disconnect_by_data (gssh_connection_get_socket_client (op->connection),
+                                            op->watch);
+      /* Frees the watch */
+      g_signal_handlers_disconnect_by_data (op->connection, op->watch);
+    }
+  g_clear_object (&op->connection);
   return FALSE;
 }
 
+/* Disconnect our handlers from @connection and drop our reference to
+ * it, on its worker.
+ */
 static void
-iterate_authentication_modes (HotSshTab          *self)
+release_connection (HotSshIoWorker *worker,
+                    GSshConnection *connection,
+                    TabWatch       *watch)
+{
+  TabConnectionOp *op = g_slice_new0 (TabConnectionOp);
+
+  op->connection = connection;
+  op->watch = watch;
+  hotssh_io_worker_invoke (worker, op_release_connection, op, tab_connection_op_free);
+}
+
+static void
+drop_connection (HotSshTab *self)
 {
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  guint n_mechanisms;
-  guint *available_authmechanisms;
-  GError *local_error = NULL;
 
-  gssh_connection_get_authentication_mechanisms (priv->connection,
-                                                 &available_authmechanisms,
-                                                 &n_mechanisms);
+  if (priv->connection_pooled)
+    hotssh_connection_pool_release (priv->connection);
+  priv->connection_pooled = FALSE;
+  if (priv->connection)
+    release_connection (priv->worker, priv->connection, priv->connection_watch);
+  priv->connection = NULL;
+  priv->connection_watch = NULL;
+  priv->connection_state = GSSH_CONNECTION_STATE_DISCONNECTED;
+  g_clear_pointer (&priv->host_key, hotssh_host_key_free);
+  g_clear_pointer (&priv->auth_mechanisms, g_array_unref);
+}
 
-  if (priv->have_outstanding_auth)
+/* Tear down the session and its connection, leaving what the user sees
+ * and which host it is, so it can be reconnected.
+ */
+static void
+state_reset_session (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  g_clear_object (&priv->connect_address);
+  /* Operations still running on the worker complete with an error
+   * that page_transition_take_error() ignores.
+   */
+  if (priv->cancellable)
+    g_cancellable_cancel (priv->cancellable);
+  g_clear_object (&priv->cancellable);
+  set_connect_phase (self, CONNECT_PHASE_NONE);
+  /* The write ring belongs to the pump, and a write in flight on the
+   * worker holds the pump; the ring is freed only once that write
+   * completes, and the next session gets a ring of its own.
+   */
+  g_clear_pointer (&priv->pump, hotssh_channel_pump_stop);
+  if (priv->channel)
+    hotssh_io_worker_release (priv->worker, priv->channel);
+  priv->channel = NULL;
+  stop_keepalive_sampling (self);
+  drop_connection (self);
+  /* Views of this session are told it ended */
+  g_clear_pointer (&priv->mirror, hotssh_mirror_free);
+  if (priv->mirror_source)
     {
-      return;
+      HotSshTabPrivate *source_priv = hotssh_tab_get_instance_private (priv->mirror_source);
+      hotssh_mirror_remove_view (source_priv->mirror, priv->mirror_view_id);
+      priv->mirror_source = NULL;
+      priv->mirror_view_id = 0;
     }
-
-  if (priv->awaiting_password_entry &&
-      !priv->submitted_password)
+  clear_mirror_backlog (self);
+  priv->mirror_resync = FALSE;
+  priv->input_designated = TRUE;
+  set_input_throttled (self, FALSE);
+  cancel_paste (self, FALSE);
+  if (priv->background_feed_id)
     {
-      return;
+      g_source_remove (priv->background_feed_id);
+      priv->background_feed_id = 0;
     }
-
-  while (priv->authmechanism_index < G_N_ELEMENTS (default_authentication_order) &&
-         !have_mechanism (available_authmechanisms, n_mechanisms,
-                          default_authentication_order[priv->authmechanism_index]))
+  if (priv->background_backlog)
+    g_byte_array_set_size (priv->background_backlog, 0);
+  priv->command_started_at = 0;
+  g_clear_pointer (&priv->expect, hotssh_expect_free);
+  g_clear_pointer (&priv->recorder, hotssh_recorder_close);
+  priv->bracketed_paste_mode = FALSE;
+  priv->mode_parse_state = MODE_PARSE_GROUND;
+  if (priv->held_input)
+    g_byte_array_set_size (priv->held_input, 0);
+  priv->authmechanism_index = 0;
+  priv->have_outstanding_auth = FALSE;
+  if (priv->queued_pty_size_id)
     {
-      priv->authmechanism_index++;
+      g_source_remove (priv->queued_pty_size_id);
+      priv->queued_pty_size_id = 0;
     }
+  priv->resize_pending_since = 0;
+  priv->need_pty_size_request = priv->sent_pty_size_request = FALSE;
+  priv->pty_width = priv->pty_height = 0;
+}
+
+static void
+stop_reconnect (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
 
-  if (priv->authmechanism_index >= G_N_ELEMENTS (default_authentication_order))
+  if (priv->reconnect_timeout_id)
     {
-      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   _("No more authentication mechanisms available"));
-      goto out;
+      g_source_remove (priv->reconnect_timeout_id);
+      priv->reconnect_timeout_id = 0;
     }
-  else
-    {
-      GSshConnectionAuthMechanism mech =
-        default_authentication_order[priv->authmechanism_index];
-      gboolean is_password = mech == GSSH_CONNECTION_AUTH_MECHANISM_PASSWORD;
-      gs_free char *authmsg =
-        g_strdup_printf (_("Requesting authentication via '%s'"),
-                         gssh_connection_auth_mechanism_to_string (mech));
+  priv->reconnect_attempt = 0;
+}
+
+static void
+state_reset_for_new_connection (HotSshTab                *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  g_debug ("reset state");
+  g_clear_pointer (&priv->connection_id, g_free);
+  g_clear_object (&priv->address);
+  stop_reconnect (self);
+  state_reset_session (self);
+  hotssh_password_interaction_set_password (priv->password_interaction, NULL);
+  if (priv->replay_tick_id)
+    {
+      g_source_remove (priv->replay_tick_id);
+      priv->replay_tick_id = 0;
+    }
+  if (priv->replay)
+    {
+      g_clear_pointer (&priv->replay, hotssh_replay_free);
+      if (!priv->indisposed)
+        {
+          gtk_toggle_button_set_active ((GtkToggleButton*)priv->replay_play_button, FALSE);
+          gtk_widget_hide (priv->replay_box);
+        }
+    }
+  if (!priv->indisposed)
+    {
+      update_input_enabled (self);
+      g_object_notify ((GObject*)self, "hostname");
+      vte_terminal_reset ((VteTerminal*)priv->terminal, TRUE, TRUE);
+      hotssh_predictor_reset (priv->predictor);
+      hotssh_scanner_reset (priv->scanner);
+      hotssh_scrollback_index_reset (priv->scrollback_index);
+      set_alert (self, HOTSSH_TAB_ALERT_NONE);
+      /* Whatever comes next missed the group's input so far */
+      if (priv->broadcast != HOTSSH_TAB_BROADCAST_NONE)
+        set_broadcast_state (self, HOTSSH_TAB_BROADCAST_SKIPPED);
+      gtk_entry_set_text ((GtkEntry*)priv->password_entry, "");
+      g_clear_pointer (&priv->status_text, g_free);
+      if (priv->typeahead)
+        g_byte_array_set_size (priv->typeahead, 0);
+      gtk_label_set_text ((GtkLabel*)priv->connection_text, "");
+      gtk_widget_set_sensitive (priv->password_container, TRUE);
+      priv->awaiting_password_entry = priv->submitted_password = FALSE;
+    }
+  g_debug ("reset state done");
+}
+
+static void
+page_transition (HotSshTab        *self,
+		 HotSshTabPage     new_page)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (new_page == priv->active_page)
+    return;
+
+  g_debug ("PAGE: %u => %u", priv->active_page, new_page);
+  priv->active_page = new_page;
+
+  if (priv->active_page == HOTSSH_TAB_PAGE_NEW_CONNECTION
+      || priv->active_page == HOTSSH_TAB_PAGE_LIST_CONNECTIONS
+      || priv->active_page == HOTSSH_TAB_PAGE_ERROR)
+    state_reset_for_new_connection (self);
+
+  gtk_notebook_set_current_page ((GtkNotebook*)self, new_page);
+
+  if (priv->active_page == HOTSSH_TAB_PAGE_TERMINAL)
+    gtk_widget_grab_focus ((GtkWidget*)priv->terminal);
+  else if (priv->active_page == HOTSSH_TAB_PAGE_CONNECTING)
+    gtk_widget_grab_focus ((GtkWidget*)self); /* For type-ahead */
+}
+
+static void
+connect_to_entry (HotSshTab *self);
+
+static gboolean
+on_reconnect_timeout (gpointer user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  priv->reconnect_timeout_id = 0;
+  set_status (self, _("Reconnecting…"));
+  connect_to_entry (self);
+  return FALSE;
+}
+
+/* Wait longer after each failure, up to a limit, and not in step with
+ * every other tab that lost its connection at the same moment.
+ */
+static void
+schedule_reconnect (HotSshTab  *self,
+                    const char *reason)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  guint delay_ms;
+
+  delay_ms = MIN (RECONNECT_BASE_DELAY_MS << MIN (priv->reconnect_attempt, 8),
+                  RECONNECT_MAX_DELAY_MS);
+  delay_ms = delay_ms / 2 + g_random_int_range (0, delay_ms / 2 + 1);
+  priv->reconnect_attempt++;
+
+  g_debug ("reconnect attempt %u in %ums", priv->reconnect_attempt, delay_ms);
+  page_transition (self, HOTSSH_TAB_PAGE_CONNECTING);
+  set_status_printf (self, _("%s; reconnecting in %u seconds…"),
+                     reason, (delay_ms + 999) / 1000);
+  g_assert (priv->reconnect_timeout_id == 0);
+  priv->reconnect_timeout_id = g_timeout_add (delay_ms, on_reconnect_timeout, self);
+}
+
+/* Failures worth trying again once the network is back */
+static gboolean
+is_transient_error (const GError *error)
+{
+  if (error->domain == G_RESOLVER_ERROR)
+    return TRUE;
+  if (error->domain != G_IO_ERROR)
+    return FALSE;
+  switch (error->code)
+    {
+    case G_IO_ERROR_TIMED_OUT:
+    case G_IO_ERROR_CONNECTION_REFUSED:
+    case G_IO_ERROR_HOST_UNREACHABLE:
+    case G_IO_ERROR_NETWORK_UNREACHABLE:
+    case G_IO_ERROR_HOST_NOT_FOUND:
+    case G_IO_ERROR_BROKEN_PIPE:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+/* The session dropped out from under us.  If the auto-reconnect setting
+ * allows, log in again behind the same terminal, keeping its
+ * scrollback, the host key we already checked and any password given.
+ */
+static void
+connection_lost (HotSshTab *self,
+                 GError    *error)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (priv->connection_id == NULL || priv->address == NULL
+      || !g_settings_get_boolean (priv->settings, "auto-reconnect"))
+    {
+      page_transition_take_error (self, error);
+      return;
+    }
+
+  g_debug ("session lost: %s", error->message);
+  if (priv->connection_pooled)
+    hotssh_connection_pool_discard (priv->connection);
+  state_reset_session (self);
+  update_input_enabled (self);
+  hotssh_predictor_reset (priv->predictor);
+  if (priv->broadcast != HOTSSH_TAB_BROADCAST_NONE)
+    set_broadcast_state (self, HOTSSH_TAB_BROADCAST_SKIPPED);
+
+  priv->reconnect_attempt = 0;
+  schedule_reconnect (self, error->message);
+  g_error_free (error);
+}
+
+static void
+page_transition_take_error (HotSshTab               *self,
+			    GError                     *error)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  g_debug ("Caught error: %s", error->message);
+  /* We only cancel when tearing down; nothing to report */
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      g_error_free (error);
+      return;
+    }
+  /* Still offline; anything else, such as a changed host key or a
+   * refused password, needs the user.
+   */
+  if (priv->reconnect_attempt > 0 && is_transient_error (error))
+    {
+      state_reset_session (self);
+      schedule_reconnect (self, error->message);
+      g_error_free (error);
+      return;
+    }
+  page_transition (self, HOTSSH_TAB_PAGE_ERROR);
+  gtk_label_set_text ((GtkLabel*)priv->error_text, error->message);
+  g_error_free (error);
+}
+
+/* Every asynchronous operation on the connection is started on its
+ * I/O worker, with the arguments captured here on the main thread; the
+ * callback then runs back on the main thread.  What the main thread
+ * needs from the connection itself, such as the host key or the list
+ * of authentication mechanisms, is read on the worker as the operation
+ * completes and kept in the tab.
+ */
+typedef struct {
+  HotSshTab *self;
+  GSshConnection *connection;
+  GSshChannel *channel;
+  GCancellable *cancellable;
+  GSshConnectionAuthMechanism mech;
+  guint width;
+  guint height;
+  GAsyncReadyCallback callback;
+} TabOp;
+
+static TabOp *
+tab_op_new (HotSshTab           *self,
+            GAsyncReadyCallback  callback)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  TabOp *op = g_slice_new0 (TabOp);
+
+  op->self = g_object_ref (self);
+  op->connection = priv->connection ? g_object_ref (priv->connection) : NULL;
+  op->channel = priv->channel ? g_object_ref (priv->channel) : NULL;
+  op->cancellable = priv->cancellable ? g_object_ref (priv->cancellable) : NULL;
+  op->callback = callback;
+
+  return op;
+}
+
+static void
+tab_op_free (gpointer data)
+{
+  TabOp *op = data;
+
+  g_clear_object (&op->self);
+  g_clear_object (&op->connection);
+  g_clear_object (&op->channel);
+  g_clear_object (&op->cancellable);
+  g_slice_free (TabOp, op);
+}
+
+static gpointer
+tab_op_return (TabOp *op)
+{
+  return hotssh_io_worker_return_to_main (op->callback, (GObject*)op->self);
+}
+
+static gboolean
+op_handshake (gpointer data)
+{
+  TabOp *op = data;
+  gssh_connection_handshake_async (op->connection, op->cancellable,
+                                   hotssh_connection_info_return_handshake, tab_op_return (op));
+  return FALSE;
+}
+
+static gboolean
+op_negotiate (gpointer data)
+{
+  TabOp *op = data;
+  gssh_connection_negotiate_async (op->connection, op->cancellable,
+                                   hotssh_connection_info_return_negotiate, tab_op_return (op));
+  return FALSE;
+}
+
+static gboolean
+op_auth (gpointer data)
+{
+  TabOp *op = data;
+  gssh_connection_auth_async (op->connection, op->mech, op->cancellable,
+                              hotssh_io_worker_return_callback, tab_op_return (op));
+  return FALSE;
+}
+
+static gboolean
+op_open_shell (gpointer data)
+{
+  TabOp *op = data;
+  gssh_connection_open_shell_async (op->connection, op->cancellable,
+                                    hotssh_io_worker_return_callback, tab_op_return (op));
+  return FALSE;
+}
+
+static gboolean
+op_request_pty_size (gpointer data)
+{
+  TabOp *op = data;
+  gssh_channel_request_pty_size_async (op->channel, op->width, op->height, op->cancellable,
+                                       hotssh_io_worker_return_callback, tab_op_return (op));
+  return FALSE;
+}
+
+static void
+run_op (HotSshTab   *self,
+        GSourceFunc  func,
+        TabOp       *op)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  hotssh_io_worker_invoke (priv->worker, func, op, tab_op_free);
+}
+
+/* Pastes don't go through VTE, so we need to know whether the remote
+ * asked for bracketed paste.  Sequences can be split across reads and
+ * can set several modes at once, as in "\033[?1049;2004h".
+ */
+static void
+update_bracketed_paste_mode (HotSshTab    *self,
+                             const guint8 *buf,
+                             gsize         len)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    {
+      guint8 c = buf[i];
+
+      if (c == '\033')
+        {
+          priv->mode_parse_state = MODE_PARSE_ESCAPE;
+          continue;
+        }
+      /* CAN and SUB abort a sequence */
+      if (c == 0x18 || c == 0x1a)
+        {
+          priv->mode_parse_state = MODE_PARSE_GROUND;
+          continue;
+        }
+
+      switch (priv->mode_parse_state)
+        {
+        case MODE_PARSE_GROUND:
+          break;
+        case MODE_PARSE_ESCAPE:
+          priv->mode_parse_state = c == '[' ? MODE_PARSE_CSI : MODE_PARSE_GROUND;
+          break;
+        case MODE_PARSE_CSI:
+          if (c == '?')
+            {
+              priv->mode_parse_state = MODE_PARSE_PRIVATE;
+              priv->mode_parse_param = 0;
+              priv->mode_parse_is_paste = FALSE;
+            }
+          else
+            priv->mode_parse_state = MODE_PARSE_IGNORE;
+          break;
+        case MODE_PARSE_PRIVATE:
+          if (c >= '0' && c <= '9')
+            {
+              if (priv->mode_parse_param < 100000)
+                priv->mode_parse_param = priv->mode_parse_param * 10 + (c - '0');
+              break;
+            }
+          if (priv->mode_parse_param == 2004)
+            priv->mode_parse_is_paste = TRUE;
+          priv->mode_parse_param = 0;
+          if (c == ';')
+            break;
+          if ((c == 'h' || c == 'l') && priv->mode_parse_is_paste)
+            priv->bracketed_paste_mode = (c == 'h');
+          priv->mode_parse_state = (c >= 0x40 && c <= 0x7e) ? MODE_PARSE_GROUND : MODE_PARSE_IGNORE;
+          break;
+        case MODE_PARSE_IGNORE:
+          if (c >= 0x40 && c <= 0x7e)
+            priv->mode_parse_state = MODE_PARSE_GROUND;
+          break;
+        }
+    }
+}
+
+static gboolean
+terminal_is_visible (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GdkWindow *window;
+
+  if (!gtk_widget_get_mapped (priv->terminal))
+    return FALSE;
+
+  window = gtk_widget_get_window (gtk_widget_get_toplevel (priv->terminal));
+  return !(window && (gdk_window_get_state (window) & GDK_WINDOW_STATE_ICONIFIED));
+}
+
+static void
+flush_mirror_backlog (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  HotSshTabPrivate *source_priv = hotssh_tab_get_instance_private (priv->mirror_source);
+  GBytes *bytes;
+
+  if (priv->mirror_resync)
+    {
+      /* Fell too far behind while hidden; start over from the snapshot */
+      priv->mirror_resync = FALSE;
+      hotssh_mirror_resync_view (source_priv->mirror, priv->mirror_view_id);
+      return;
+    }
+
+  if (!priv->mirror_backlog)
+    return;
+
+  g_debug ("feeding %" G_GSIZE_FORMAT " bytes of mirrored output", priv->mirror_backlog_size);
+  while ((bytes = g_queue_pop_head (priv->mirror_backlog)) != NULL)
+    {
+      gsize len;
+      const char *buf = g_bytes_get_data (bytes, &len);
+      vte_terminal_feed ((VteTerminal*)priv->terminal, buf, len);
+      g_bytes_unref (bytes);
+    }
+  clear_mirror_backlog (self);
+}
+
+static void
+flush_background_backlog (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (priv->background_feed_id)
+    {
+      g_source_remove (priv->background_feed_id);
+      priv->background_feed_id = 0;
+    }
+
+  if (priv->mirror_source)
+    {
+      flush_mirror_backlog (self);
+      return;
+    }
+
+  if (!(priv->background_backlog && priv->background_backlog->len > 0))
+    return;
+
+  g_debug ("feeding %u bytes of background output", priv->background_backlog->len);
+  hotssh_predictor_feed (priv->predictor, priv->background_backlog->data,
+                         priv->background_backlog->len);
+  g_byte_array_set_size (priv->background_backlog, 0);
+}
+
+static gboolean
+on_background_feed_timeout (gpointer user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  priv->background_feed_id = 0;
+  flush_background_backlog (self);
+
+  return FALSE;
+}
+
+static void
+on_scanner_match (HotSshScannerMatch  match,
+                  gpointer            user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gboolean attention = FALSE;
+
+  switch (match)
+    {
+    case HOTSSH_SCANNER_MATCH_COMMAND_START:
+      priv->command_started_at = g_get_monotonic_time ();
+      break;
+    case HOTSSH_SCANNER_MATCH_COMMAND_DONE:
+      attention = priv->command_started_at > 0 &&
+        g_get_monotonic_time () - priv->command_started_at >= LONG_COMMAND_SECONDS * G_USEC_PER_SEC;
+      priv->command_started_at = 0;
+      break;
+    case HOTSSH_SCANNER_MATCH_BELL:
+    case HOTSSH_SCANNER_MATCH_PATTERN:
+      attention = TRUE;
+      break;
+    }
+
+  if (attention && !terminal_is_visible (self))
+    set_alert (self, HOTSSH_TAB_ALERT_ATTENTION);
+}
+
+static void
+on_pump_output (GBytes   *bytes,
+                gpointer  user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  const guint8 *buf;
+  gsize len;
+
+  buf = g_bytes_get_data (bytes, &len);
+  g_debug ("read %u bytes", (guint)len);
+
+  if (priv->recorder)
+    hotssh_recorder_output (priv->recorder, bytes);
+  if (priv->mirror)
+    hotssh_mirror_output (priv->mirror, bytes);
+
+  update_bracketed_paste_mode (self, buf, len);
+  if (priv->expect)
+    {
+      hotssh_expect_feed (priv->expect, buf, len);
+      if (!hotssh_expect_is_running (priv->expect))
+        g_clear_pointer (&priv->expect, hotssh_expect_free);
+    }
+  hotssh_scanner_scan (priv->scanner, buf, len, on_scanner_match, self);
+  hotssh_scrollback_index_feed (priv->scrollback_index, buf, len);
+
+  if (terminal_is_visible (self))
+    {
+      flush_background_backlog (self);
+      hotssh_predictor_feed (priv->predictor, buf, len);
+      return;
+    }
+
+  if (priv->alert == HOTSSH_TAB_ALERT_NONE)
+    set_alert (self, HOTSSH_TAB_ALERT_ACTIVITY);
+
+  /* Nobody is looking; let it pile up and parse it in one go later */
+  if (!priv->background_backlog)
+    priv->background_backlog = g_byte_array_new ();
+  g_byte_array_append (priv->background_backlog, buf, len);
+
+  if (priv->background_backlog->len >= BACKGROUND_BACKLOG_MAX)
+    flush_background_backlog (self);
+  else if (priv->background_feed_id == 0)
+    priv->background_feed_id =
+      g_timeout_add_full (G_PRIORITY_LOW, BACKGROUND_FEED_INTERVAL_MS,
+                          on_background_feed_timeout, self, NULL);
+}
+
+static void
+on_mirror_source_input (gboolean  enabled,
+                        gpointer  user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  priv->input_designated = enabled;
+  update_input_enabled (self);
+}
+
+static void
+on_mirror_reset (guint     width,
+                 guint     height,
+                 gpointer  user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  clear_mirror_backlog (self);
+  vte_terminal_reset ((VteTerminal*)priv->terminal, TRUE, TRUE);
+  vte_terminal_set_size ((VteTerminal*)priv->terminal, width, height);
+}
+
+static void
+on_mirror_output (GBytes   *bytes,
+                  gpointer  user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gsize len;
+  const char *buf = g_bytes_get_data (bytes, &len);
+
+  if (terminal_is_visible (self) && !priv->mirror_backlog && !priv->mirror_resync)
+    {
+      vte_terminal_feed ((VteTerminal*)priv->terminal, buf, len);
+      return;
+    }
+
+  if (priv->alert == HOTSSH_TAB_ALERT_NONE)
+    set_alert (self, HOTSSH_TAB_ALERT_ACTIVITY);
+
+  if (priv->mirror_resync)
+    return;
+
+  /* Hold on to the source's buffers until someone looks */
+  if (!priv->mirror_backlog)
+    priv->mirror_backlog = g_queue_new ();
+  g_queue_push_tail (priv->mirror_backlog, g_bytes_ref (bytes));
+  priv->mirror_backlog_size += len;
+
+  if (priv->mirror_backlog_size >= BACKGROUND_BACKLOG_MAX)
+    {
+      clear_mirror_backlog (self);
+      priv->mirror_resync = TRUE;
+    }
+}
+
+static void
+on_mirror_resize (guint     width,
+                  guint     height,
+                  gpointer  user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  /* The resize has to land after what's queued; rather than keep
+   * track, catch up from the snapshot at the new size.
+   */
+  if (priv->mirror_backlog)
+    {
+      clear_mirror_backlog (self);
+      priv->mirror_resync = TRUE;
+    }
+  if (priv->mirror_resync)
+    return;
+
+  vte_terminal_set_size ((VteTerminal*)priv->terminal, width, height);
+}
+
+static void
+on_mirror_input (gboolean  enabled,
+                 gpointer  user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  priv->input_designated = enabled;
+  update_input_enabled (self);
+}
+
+static void
+on_mirror_closed (gpointer user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  priv->mirror_source = NULL;
+  priv->mirror_view_id = 0;
+  page_transition_take_error (self, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CLOSED,
+                                                         _("The mirrored session has ended")));
+}
+
+static const HotSshMirrorViewCallbacks mirror_view_callbacks = {
+  on_mirror_reset,
+  on_mirror_output,
+  on_mirror_resize,
+  on_mirror_input,
+  on_mirror_closed
+};
+
+static void
+on_terminal_map (GtkWidget *widget,
+                 gpointer   user_data)
+{
+  HotSshTab *self = user_data;
+
+  /* Catch up before the first frame is drawn */
+  flush_background_backlog (self);
+  set_alert (self, HOTSSH_TAB_ALERT_NONE);
+}
+
+static gboolean
+on_toplevel_window_state_event (GtkWidget           *widget,
+                                GdkEventWindowState *event,
+                                gpointer             user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if ((event->changed_mask & GDK_WINDOW_STATE_ICONIFIED) &&
+      !(event->new_window_state & GDK_WINDOW_STATE_ICONIFIED))
+    {
+      flush_background_backlog (self);
+      if (gtk_widget_get_mapped (priv->terminal))
+        set_alert (self, HOTSSH_TAB_ALERT_NONE);
+    }
+
+  return FALSE;
+}
+
+static void
+on_hierarchy_changed (GtkWidget *widget,
+                      GtkWidget *previous_toplevel,
+                      gpointer   user_data)
+{
+  HotSshTab *self = user_data;
+  GtkWidget *toplevel = gtk_widget_get_toplevel (widget);
+
+  if (previous_toplevel)
+    g_signal_handlers_disconnect_by_func (previous_toplevel,
+                                          on_toplevel_window_state_event, self);
+  if (gtk_widget_is_toplevel (toplevel))
+    g_signal_connect_object (toplevel, "window-state-event",
+                             G_CALLBACK (on_toplevel_window_state_event), self, 0);
+}
+
+static void
+on_pump_drained (gpointer user_data);
+
+static void
+on_pump_error (GError   *error,
+               gpointer  user_data)
+{
+  HotSshTab *self = user_data;
+
+  /* The remote end closed the session, as on logout */
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CLOSED))
+    page_transition_take_error (self, error);
+  else
+    connection_lost (self, error);
+}
+
+static const HotSshChannelPumpCallbacks pump_callbacks = {
+  on_pump_output,
+  on_pump_drained,
+  on_pump_error
+};
+
+static gsize
+queue_write (HotSshTab    *self,
+             const guint8 *buf,
+             gsize         len);
+
+static gsize
+queue_write_full (HotSshTab    *self,
+                  const guint8 *buf,
+                  gsize         len,
+                  gboolean      record);
+
+static void
+send_pty_size_request (HotSshTab             *self,
+                       guint                  width,
+                       guint                  height);
+
+static void
+get_initial_pty_size (HotSshTab             *self,
+                      guint                 *out_width,
+                      guint                 *out_height);
+
+static void
+on_expect_send (const guint8 *buf,
+                gsize         len,
+                gboolean      secret,
+                gpointer      user_data)
+{
+  /* Keep the password out of the session recording */
+  (void) queue_write_full ((HotSshTab*)user_data, buf, len, !secret);
+}
+
+/* Scripts are per host, as extra keys in hostdb.ini:
+ *   expect=prompt;response;prompt;response
+ *   expect-timeout, expect-max-steps, expect-repeat
+ * A response of "@password" answers with the password given at login.
+ */
+static void
+start_expect_script (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_unref_object HotSshHostDB *hostdb = hotssh_hostdb_get_instance ();
+  gs_strfreev char **script = NULL;
+  char *password;
+
+  if (!priv->connection_id)
+    return;
+
+  script = hotssh_hostdb_get_entry_strv (hostdb, priv->connection_id, "expect");
+  if (!script)
+    return;
+
+  password = hotssh_password_interaction_dup_password (priv->password_interaction);
+  priv->expect =
+    hotssh_expect_new ((const char * const *)script, password,
+                       hotssh_hostdb_get_entry_uint (hostdb, priv->connection_id, "expect-timeout",
+                                                     EXPECT_DEFAULT_TIMEOUT_SECONDS),
+                       hotssh_hostdb_get_entry_uint (hostdb, priv->connection_id, "expect-max-steps",
+                                                     EXPECT_DEFAULT_MAX_STEPS),
+                       hotssh_hostdb_get_entry_boolean (hostdb, priv->connection_id, "expect-repeat",
+                                                        FALSE),
+                       on_expect_send, self);
+  if (password)
+    {
+      memset (password, 0, strlen (password));
+      g_free (password);
+    }
+}
+
+static void
+start_recording (HotSshTab *self,
+                 guint      width,
+                 guint      height)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_free char *mode = g_settings_get_string (priv->settings, "record-sessions");
+  gs_free char *dir = NULL;
+  gs_free char *host = NULL;
+  gs_free char *stamp = NULL;
+  gs_free char *name = NULL;
+  gs_free char *path = NULL;
+  gs_free char *title = NULL;
+  gboolean compress;
+  GDateTime *now;
+
+  if (strcmp (mode, "never") == 0)
+    return;
+
+  dir = hotssh_recorder_dup_directory (priv->settings);
+  compress = g_settings_get_boolean (priv->settings, "recording-compression") &&
+    hotssh_recorder_can_compress ();
+
+  host = g_strdelimit (g_strdup (priv->hostname), "/", '_');
+  now = g_date_time_new_now_local ();
+  stamp = g_date_time_format (now, "%Y%m%d-%H%M%S");
+  g_date_time_unref (now);
+  name = g_strdup_printf ("%s-%s-%u.cast%s", host, stamp, ++recording_serial,
+                          compress ? ".zst" : "");
+  path = g_build_filename (dir, name, NULL);
+  title = g_strdup_printf ("%s@%s", priv->username ? priv->username : g_get_user_name (),
+                           priv->hostname);
+
+  g_debug ("recording to %s", path);
+  priv->record_input = strcmp (mode, "all") == 0;
+  priv->recorder = hotssh_recorder_new (path, compress, width, height, title);
+}
+
+/* Every KEEPALIVE_SAMPLE_SECONDS while a session is up */
+static gboolean
+on_keepalive_sample (gpointer user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  guint interval = g_settings_get_uint (priv->settings, "keepalive-interval");
+  guint misses = MAX (g_settings_get_uint (priv->settings, "keepalive-count"), 1);
+  HotSshKeepaliveSample sample;
+
+  if (!hotssh_keepalive_sample (priv->connection, interval * 1000, &sample))
+    return TRUE;
+
+  /* Already smoothed by the kernel, as RFC 6298 describes */
+  if (sample.rtt_usec > 0)
+    {
+      priv->rtt_usec = sample.rtt_usec;
+      priv->rtt_var_usec = sample.rtt_var_usec;
+    }
+
+  if (interval == 0)
+    return TRUE;
+
+  if (sample.stalled && !priv->stalled)
+    priv->stalled_since = g_get_monotonic_time ();
+  set_stalled (self, sample.stalled);
+
+  /* The kernel should have given up by now; don't rely on it */
+  if (priv->stalled
+      && g_get_monotonic_time () - priv->stalled_since >= (gint64)interval * misses * G_USEC_PER_SEC)
+    {
+      priv->keepalive_sample_id = 0;
+      connection_lost (self, g_error_new (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                                          _("No response from the host for %u seconds"),
+                                          interval * misses));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* The shell is open, whether just now or ahead of time as a spare */
+static void
+start_session (HotSshTab   *self,
+               GSshChannel *channel)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  guint width, height;
+
+  set_connect_phase (self, CONNECT_PHASE_NONE);
+  priv->channel = g_object_ref (channel);
+  priv->pump = hotssh_channel_pump_new (priv->worker, priv->channel,
+                                        WRITE_BUFFER_SIZE, &pump_callbacks, self);
+
+  /* Size the pty before anything else goes over the channel, so the
+   * remote never draws at the library default size.  (A spare already
+   * has; this makes it redraw.)
+   */
+  get_initial_pty_size (self, &width, &height);
+  send_pty_size_request (self, width, height);
+  start_recording (self, width, height);
+  priv->mirror = hotssh_mirror_new (width, height, on_mirror_source_input, self);
+
+  page_transition (self, HOTSSH_TAB_PAGE_TERMINAL);
+
+  if (!priv->keepalive_sample_id)
+    priv->keepalive_sample_id = g_timeout_add_seconds (KEEPALIVE_SAMPLE_SECONDS,
+                                                       on_keepalive_sample, self);
+
+  if (priv->reconnect_attempt > 0)
+    {
+      gs_free char *msg = g_strdup_printf ("\r\n\033[7m%s\033[0m\r\n", _("Reconnected"));
+      vte_terminal_feed ((VteTerminal*)priv->terminal, msg, -1);
+      priv->reconnect_attempt = 0;
+    }
+
+  start_expect_script (self);
+  hotssh_channel_pump_start (priv->pump);
+
+  if (priv->typeahead && priv->typeahead->len > 0)
+    {
+      g_debug ("replaying %u bytes of type-ahead", priv->typeahead->len);
+      queue_write (self, priv->typeahead->data, priv->typeahead->len);
+      g_byte_array_set_size (priv->typeahead, 0);
+      update_status_label (self);
+    }
+}
+
+static void
+start_connection (HotSshTab *self);
+
+static void
+on_open_shell_complete (GObject           *src,
+			GAsyncResult      *res,
+			gpointer           user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GError *local_error = NULL;
+  gs_unref_object GSshChannel *channel = NULL;
+
+  g_debug ("open shell complete");
+
+  channel = gssh_connection_open_shell_finish ((GSshConnection*)src,
+                                               res, &local_error);
+  if ((GSshConnection*)src != priv->connection)
+    {
+      g_clear_error (&local_error);
+      /* Connections to a host all share its worker */
+      if (channel)
+        hotssh_io_worker_release (priv->worker, g_object_ref (channel));
+      return;
+    }
+  if (!channel)
+    {
+      /* The pooled connection died quietly while nobody was using it;
+       * log in afresh instead.
+       */
+      if (priv->connection_pooled && priv->address
+          && !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_debug ("pooled connection failed: %s", local_error->message);
+          g_clear_error (&local_error);
+          hotssh_connection_pool_discard (priv->connection);
+          start_connection (self);
+        }
+      goto out;
+    }
+
+  start_session (self, channel);
+
+ out:
+  if (local_error)
+    page_transition_take_error (self, local_error);
+}
+
+static void
+iterate_authentication_modes (HotSshTab          *self);
+
+static void
+handle_connection_state (HotSshTab           *self,
+                         GSshConnectionState  new_state)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  switch (new_state)
+    {
+    case GSSH_CONNECTION_STATE_DISCONNECTED:
+    case GSSH_CONNECTION_STATE_CONNECTING:
+    case GSSH_CONNECTION_STATE_HANDSHAKING:
+    case GSSH_CONNECTION_STATE_PREAUTH:
+    case GSSH_CONNECTION_STATE_NEGOTIATE_AUTH:
+      break;
+    case GSSH_CONNECTION_STATE_AUTHENTICATION_REQUIRED:
+      break;
+    case GSSH_CONNECTION_STATE_ERROR:
+      g_debug ("connection in state ERROR!");
+      if (priv->connection_pooled)
+        hotssh_connection_pool_discard (priv->connection);
+      break;
+    case GSSH_CONNECTION_STATE_CONNECTED:
+      {
+        gs_unref_object GSshChannel *spare = NULL;
+
+        if (priv->connection_pooled)
+          spare = hotssh_connection_pool_take_spare (priv->connection);
+        if (spare)
+          {
+            g_debug ("using spare channel");
+            start_session (self, spare);
+          }
+        else
+          {
+            set_connect_phase (self, CONNECT_PHASE_SHELL_OPEN);
+            run_op (self, op_open_shell, tab_op_new (self, on_open_shell_complete));
+          }
+      }
+      break;
+    }
+}
+
+/* Connection signals are emitted on its I/O worker; what they carry is
+ * captured there and handled on the main thread.
+ */
+typedef struct {
+  HotSshTab *self;
+  HotSshIoWorker *worker;
+  GSshConnection *connection;
+  GSshConnectionState state;
+  GSocketClientEvent event;
+  GSocketAddress *remote_address;
+} TabEvent;
+
+static TabEvent *
+tab_event_new (TabWatch *watch)
+{
+  TabEvent *ev = g_slice_new0 (TabEvent);
+  ev->self = g_object_ref (watch->self);
+  ev->worker = watch->worker;
+  ev->connection = g_object_ref (watch->connection);
+  return ev;
+}
+
+static void
+tab_event_free (gpointer data)
+{
+  TabEvent *ev = data;
+  g_clear_object (&ev->self);
+  hotssh_io_worker_release (ev->worker, ev->connection);
+  g_clear_object (&ev->remote_address);
+  g_slice_free (TabEvent, ev);
+}
+
+static gboolean
+on_connection_state_main (gpointer data)
+{
+  TabEvent *ev = data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (ev->self);
+
+  if (ev->connection == priv->connection)
+    {
+      priv->connection_state = ev->state;
+      handle_connection_state (ev->self, ev->state);
+    }
+
+  return FALSE;
+}
+
+static void
+on_connection_state_notify (GSshConnection   *conn,
+			    GParamSpec         *pspec,
+			    gpointer            user_data)
+{
+  TabEvent *ev = tab_event_new (user_data);
+
+  /* Read now; by the time the main thread looks it may have moved on */
+  ev->state = gssh_connection_get_state (conn);
+  hotssh_io_worker_invoke_main (on_connection_state_main, ev, tab_event_free);
+}
+
+static void
+append_auth_mechanism (HotSshTabPrivate            *priv,
+                       GSshConnectionAuthMechanism  mech)
+{
+  guint i;
+  for (i = 0; i < priv->n_auth_order; i++)
+    if (priv->auth_order[i] == mech)
+      return;
+  g_assert (priv->n_auth_order < G_N_ELEMENTS (priv->auth_order));
+  priv->auth_order[priv->n_auth_order++] = mech;
+}
+
+/* Only mechanisms we would try anyway are taken from the hostdb */
+static gboolean
+auth_mechanism_from_string (const char                  *name,
+                            GSshConnectionAuthMechanism *out_mech)
+{
+  guint i;
+  for (i = 0; i < G_N_ELEMENTS (default_authentication_order); i++)
+    {
+      if (strcmp (gssh_connection_auth_mechanism_to_string (default_authentication_order[i]), name) == 0)
+        {
+          *out_mech = default_authentication_order[i];
+          return TRUE;
+        }
+    }
+  return FALSE;
+}
+
+/* Whether trying @mech means asking the user something */
+static gboolean
+auth_mechanism_is_interactive (GSshConnectionAuthMechanism mech)
+{
+  return mech == GSSH_CONNECTION_AUTH_MECHANISM_PASSWORD;
+}
+
+static guint
+get_auth_denials (HotSshHostDB                *hostdb,
+                  const char                  *connection_id,
+                  GSshConnectionAuthMechanism  mech)
+{
+  gs_free char *key = g_strconcat ("auth-denied-",
+                                   gssh_connection_auth_mechanism_to_string (mech), NULL);
+  return hotssh_hostdb_get_entry_uint (hostdb, connection_id, key, 0);
+}
+
+/* Start with what worked last time for this host, so a host that
+ * refuses one key type or Kerberos doesn't cost a refusal every login.
+ * What was learned only reorders mechanisms that need nobody at the
+ * keyboard among themselves, and never puts a password prompt ahead of
+ * them: a host where a password once worked may well take a key later.
+ * The exception is a mechanism the host keeps denying, which goes
+ * after everything else, so that a password-only host prompts at once.
+ */
+static void
+load_authentication_order (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_unref_object HotSshHostDB *hostdb = hotssh_hostdb_get_instance ();
+  gs_strfreev char **learned = NULL;
+  GSshConnectionAuthMechanism interactive[G_N_ELEMENTS (default_authentication_order)];
+  GSshConnectionAuthMechanism demoted[G_N_ELEMENTS (default_authentication_order)];
+  guint n_interactive = 0;
+  guint n_demoted = 0;
+  char **iter;
+  guint i, n;
+
+  learned = hotssh_hostdb_get_entry_strv (hostdb, priv->connection_id, "auth-order");
+  priv->n_auth_order = 0;
+  for (iter = learned; iter && *iter; iter++)
+    {
+      GSshConnectionAuthMechanism mech;
+      if (auth_mechanism_from_string (*iter, &mech))
+        append_auth_mechanism (priv, mech);
+    }
+  for (i = 0; i < G_N_ELEMENTS (default_authentication_order); i++)
+    append_auth_mechanism (priv, default_authentication_order[i]);
+
+  /* Interactive ones go next, then demoted ones, each keeping their
+   * order
+   */
+  for (i = 0, n = 0; i < priv->n_auth_order; i++)
+    {
+      GSshConnectionAuthMechanism mech = priv->auth_order[i];
+
+      if (get_auth_denials (hostdb, priv->connection_id, mech) >= AUTH_DEMOTE_DENIALS)
+        demoted[n_demoted++] = mech;
+      else if (auth_mechanism_is_interactive (mech))
+        interactive[n_interactive++] = mech;
+      else
+        priv->auth_order[n++] = mech;
+    }
+  for (i = 0; i < n_interactive; i++)
+    priv->auth_order[n++] = interactive[i];
+  for (i = 0; i < n_demoted; i++)
+    priv->auth_order[n++] = demoted[i];
+
+  priv->authmechanism_index = 0;
+}
+
+/* Move a mechanism that logged in to the front of the host's order
+ * and forget its denials; count one denied, up to the point where
+ * load_authentication_order() demotes it, so that the host's entry
+ * stops changing once it has.
+ */
+static void
+learn_authentication_result (HotSshTab                   *self,
+                             GSshConnectionAuthMechanism  mech,
+                             gboolean                     accepted)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_unref_object HotSshHostDB *hostdb = hotssh_hostdb_get_instance ();
+  const char *name = gssh_connection_auth_mechanism_to_string (mech);
+  gs_free char *denials_key = g_strconcat ("auth-denied-", name, NULL);
+  guint denials = hotssh_hostdb_get_entry_uint (hostdb, priv->connection_id, denials_key, 0);
+  const char *order[G_N_ELEMENTS (default_authentication_order) + 1];
+  guint i, n = 0;
+
+  if (!accepted)
+    {
+      if (denials < AUTH_DEMOTE_DENIALS)
+        {
+          if (denials + 1 == AUTH_DEMOTE_DENIALS)
+            g_debug ("demoting authentication mechanism '%s'", name);
+          hotssh_hostdb_set_entry_uint (hostdb, priv->connection_id, denials_key, denials + 1);
+        }
+      return;
+    }
+
+  if (denials > 0)
+    hotssh_hostdb_set_entry_uint (hostdb, priv->connection_id, denials_key, 0);
+
+  if (priv->authmechanism_index == 0)
+    return;  /* Already first; nothing to write */
+
+  order[n++] = name;
+  for (i = 0; i < priv->n_auth_order; i++)
+    if (priv->auth_order[i] != mech)
+      order[n++] = gssh_connection_auth_mechanism_to_string (priv->auth_order[i]);
+  order[n] = NULL;
+
+  hotssh_hostdb_set_entry_strv (hostdb, priv->connection_id, "auth-order", order);
+}
+
+static void
+on_auth_complete (GObject                *src,
+                  GAsyncResult           *res,
+                  gpointer                user_data)
+{
+  HotSshTab *self = HOTSSH_TAB (user_data);
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GError *local_error = NULL;
+  gboolean ok;
+
+  ok = gssh_connection_auth_finish ((GSshConnection*)src, res, &local_error);
+  if ((GSshConnection*)src != priv->connection)
+    {
+      g_clear_error (&local_error);
+      return;
+    }
+
+  priv->have_outstanding_auth = FALSE;
+
+  if (!ok)
+    goto out;
+
+  set_status (self, _("Authenticated, requesting channel…"));
+
+  g_debug ("auth complete");
+  learn_authentication_result (self, priv->auth_order[priv->authmechanism_index], TRUE);
+
+  {
+    gs_free char *key =
+      hotssh_connection_pool_make_key (priv->username, priv->hostname,
+                                       g_network_address_get_port ((GNetworkAddress*)priv->address));
+    priv->connection_pooled =
+      hotssh_connection_pool_add (key, priv->worker, priv->connection);
+  }
+
+ out:
+  if (local_error)
+    {
+      GSshConnectionAuthMechanism mech = priv->auth_order[priv->authmechanism_index];
+
+      /* A host that can't check our ticket (no keytab, clock skew, no
+       * principal for the name we know it by) fails GSSAPI rather than
+       * denying it; either way, the next mechanism may well work.
+       */
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED)
+          || (mech == GSSH_CONNECTION_AUTH_MECHANISM_GSSAPI_MIC
+              && !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)))
+        {
+          g_debug ("Authentication mechanism '%s' denied",
+                   gssh_connection_auth_mechanism_to_string (mech));
+          g_clear_error (&local_error);
+          learn_authentication_result (self, mech, FALSE);
+          priv->authmechanism_index++;
+          iterate_authentication_modes (self);
+        }
+      else
+        page_transition_take_error (self, local_error);
+    }
+}
+
+static gboolean
+have_mechanism (guint                        *available,
+                guint                         n_available,
+                GSshConnectionAuthMechanism   mech)
+{
+  guint i;
+  if (mech == GSSH_CONNECTION_AUTH_MECHANISM_GSSAPI_MIC
+      && !hotssh_gssapi_have_credentials ())
+    return FALSE;
+  for (i = 0; i < n_available; i++)
+    if (available[i] == mech)
+      return TRUE;
+  return FALSE;
+}
+
+static void
+iterate_authentication_modes (HotSshTab          *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  guint n_mechanisms;
+  guint *available_authmechanisms;
+  GError *local_error = NULL;
+
+  if (priv->auth_mechanisms == NULL)
+    return;
+  available_authmechanisms = (guint*)priv->auth_mechanisms->data;
+  n_mechanisms = priv->auth_mechanisms->len;
+
+  if (priv->have_outstanding_auth)
+    {
+      return;
+    }
+
+  if (priv->awaiting_password_entry &&
+      !priv->submitted_password)
+    {
+      return;
+    }
+
+  while (priv->authmechanism_index < priv->n_auth_order &&
+         !have_mechanism (available_authmechanisms, n_mechanisms,
+                          priv->auth_order[priv->authmechanism_index]))
+    {
+      priv->authmechanism_index++;
+    }
+
+  if (priv->authmechanism_index >= priv->n_auth_order)
+    {
+      g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   _("No more authentication mechanisms available"));
+      goto out;
+    }
+  else
+    {
+      GSshConnectionAuthMechanism mech =
+        priv->auth_order[priv->authmechanism_index];
+      gboolean is_password = mech == GSSH_CONNECTION_AUTH_MECHANISM_PASSWORD;
+      gs_free char *authmsg =
+        g_strdup_printf (_("Requesting authentication via '%s'"),
+                         gssh_connection_auth_mechanism_to_string (mech));
       /* Ugly gross hack until we have separate auth pages */
       set_status (self, authmsg);
       gtk_widget_set_sensitive (priv->password_container,
                                 is_password);
       if (is_password)
         {
-          priv->awaiting_password_entry = TRUE;
-          if (!priv->submitted_password)
-            {
-              page_transition (self, HOTSSH_TAB_PAGE_PASSWORD);
-              return;
-            }
+          priv->awaiting_password_entry = TRUE;
+          if (!priv->submitted_password)
+            {
+              set_connect_phase (self, CONNECT_PHASE_NONE);
+              page_transition (self, HOTSSH_TAB_PAGE_PASSWORD);
+              return;
+            }
+        }
+      else
+        {
+          set_status (self, authmsg);
+        }
+        
+      {
+        TabOp *op = tab_op_new (self, on_auth_complete);
+        set_connect_phase (self, CONNECT_PHASE_AUTH);
+        op->mech = mech;
+        run_op (self, op_auth, op);
+      }
+      priv->have_outstanding_auth = TRUE;
+    }
+  
+ out:
+  if (local_error)
+    page_transition_take_error (self, local_error);
+}
+
+static void
+handle_unknown_hostkey (HotSshTab *self,
+                        const char *connected_hostkey_type,
+                        const char *connected_hostkey_sha1)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  gtk_label_set_text ((GtkLabel*)priv->hostkey_fingerprint_label,
+		      connected_hostkey_sha1);
+  page_transition (self, HOTSSH_TAB_PAGE_HOSTKEY);
+}
+
+static void
+verify_hostkey (HotSshTab              *self,
+                const char             *connected_hostkey_type,
+                const char             *connected_hostkey_base64,
+                const char             *saved_hostkey_type,
+                const char             *saved_hostkey_base64)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_free char *errdetails = NULL;
+
+  if (strcmp (connected_hostkey_type, saved_hostkey_type) != 0)
+    {
+      errdetails = g_strdup_printf (_("The remote host key type has changed; it was previously \"%s\", now \"%s\""),
+                                    saved_hostkey_type, connected_hostkey_type);
+    }
+  else if (strcmp (connected_hostkey_base64, saved_hostkey_base64) != 0)
+    {
+      errdetails = g_strdup (_("The remote host key has changed"));
+    }
+    
+  if (errdetails)
+    {
+      GError *local_error = NULL;
+
+      g_set_error (&local_error, G_IO_ERROR,
+                   G_IO_ERROR_FAILED,
+                   _("Error: The host credentials for \"%s\" (%s) do not match the previously "
+                     "saved credentials.  This may represent an attempt by a malicious party to "
+                     "intercept communication; however, it is also possible that the host key was changed "
+                     "by a system administrator.\n\nDetails: %s"),
+                   priv->hostname,
+                   g_network_address_get_hostname ((GNetworkAddress*)priv->address),
+                   errdetails);
+      page_transition_take_error (self, local_error);
+    }
+  else
+    {
+      g_debug ("Remote host key matches");
+      page_transition (self, HOTSSH_TAB_PAGE_CONNECTING);
+      set_status (self, _("Negotiating authentication…"));
+
+      set_connect_phase (self, CONNECT_PHASE_NEGOTIATE);
+      run_op (self, op_negotiate, tab_op_new (self, on_negotiate_complete));
+    }
+}
+
+/* Key exchange is done; check the host is the one we saved */
+static void
+check_host_key (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_free char *saved_hostkey_type = NULL;
+  gs_free char *saved_hostkey_base64 = NULL;
+  gs_unref_object GtkTreeModel *model = NULL;
+  const char *connected_hostkey_type;
+  const char *connected_hostkey_sha1_text;
+  const char *connected_hostkey_base64;
+  GtkTreeIter iter;
+
+  /* The server left between the key exchange and now */
+  if (priv->host_key == NULL)
+    {
+      page_transition_take_error (self, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CLOSED,
+                                                             _("Connection closed by remote host")));
+      return;
+    }
+  connected_hostkey_type = priv->host_key->type;
+  connected_hostkey_sha1_text = priv->host_key->sha1;
+  connected_hostkey_base64 = priv->host_key->base64;
+
+  model = hotssh_hostdb_get_model (hotssh_hostdb_get_instance ());
+
+  g_debug ("handshake complete");
+  g_debug ("remote key type:%s SHA1:%s",
+           connected_hostkey_type,
+           connected_hostkey_sha1_text);
+
+  g_assert (hotssh_hostdb_lookup_by_id (hotssh_hostdb_get_instance (), priv->connection_id, &iter));
+
+  gtk_tree_model_get (model, &iter,
+                      HOTSSH_HOSTDB_COLUMN_HOST_KEY_TYPE,
+                      &saved_hostkey_type,
+                      HOTSSH_HOSTDB_COLUMN_HOST_KEY_BASE64,
+                      &saved_hostkey_base64,
+                      -1);
+
+  if (saved_hostkey_type == NULL)
+    {
+      handle_unknown_hostkey (self,
+                              connected_hostkey_type,
+                              connected_hostkey_sha1_text);
+    }
+  else
+    {
+      verify_hostkey (self,
+                      connected_hostkey_type,
+                      connected_hostkey_base64,
+                      saved_hostkey_type,
+                      saved_hostkey_base64);
+    }
+}
+
+static void
+on_connection_handshake (GObject         *object,
+			 GAsyncResult    *result,
+			 gpointer         user_data)
+{
+  HotSshTab *self = HOTSSH_TAB (user_data);
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GError *local_error = NULL;
+
+  /* Superseded by a newer connection attempt */
+  if ((GSshConnection*)object != priv->connection)
+    {
+      (void) gssh_connection_handshake_finish ((GSshConnection*)object, result, NULL);
+      return;
+    }
+
+  if (!gssh_connection_handshake_finish ((GSshConnection*)object, result, &local_error))
+    {
+      page_transition_take_error (self, local_error);
+      return;
+    }
+
+  g_clear_pointer (&priv->host_key, hotssh_host_key_free);
+  priv->host_key = hotssh_host_key_copy (hotssh_connection_info_get_host_key (result));
+
+  /* Approving a new host key is up to the user, and takes as long as it takes */
+  set_connect_phase (self, CONNECT_PHASE_NONE);
+  check_host_key (self);
+}
+
+static void
+show_connect_progress (HotSshTab          *self,
+                       GSocketClientEvent  event,
+                       GSocketAddress     *remote_address)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  switch (event)
+    {
+    case G_SOCKET_CLIENT_RESOLVING:
+      set_status_printf (self, _("Resolving '%s'…"),
+                         priv->hostname);
+      break;
+    case G_SOCKET_CLIENT_CONNECTING:
+      {
+        g_debug ("socket connecting remote=%p", remote_address);
+        if (remote_address && G_IS_INET_SOCKET_ADDRESS (remote_address))
+          {
+            GInetAddress *inetaddr =
+              g_inet_socket_address_get_address ((GInetSocketAddress*)remote_address);
+            gs_free char *inet_str = g_inet_address_to_string (inetaddr);
+            set_status_printf (self, _("Connecting to '%s'…"),
+                               inet_str);
+          }
+        break;
+      }
+    default:
+      break;
+    }
+}
+
+static gboolean
+on_socket_client_event_main (gpointer data)
+{
+  TabEvent *ev = data;
+  HotSshTab *self = ev->self;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (ev->connection != priv->connection)
+    return FALSE;
+
+  show_connect_progress (self, ev->event, ev->remote_address);
+
+  return FALSE;
+}
+
+static void
+on_socket_client_event (GSocketClient      *client,
+                        GSocketClientEvent  event,
+                        GSocketConnectable *connectable,
+                        GIOStream          *connection,
+                        gpointer            user_data)
+{
+  TabEvent *ev;
+
+  if (event != G_SOCKET_CLIENT_RESOLVING && event != G_SOCKET_CLIENT_CONNECTING)
+    return;
+
+  ev = tab_event_new (user_data);
+  ev->event = event;
+  if (event == G_SOCKET_CLIENT_CONNECTING)
+    ev->remote_address =
+      g_socket_connection_get_remote_address (G_SOCKET_CONNECTION (connection), NULL);
+  hotssh_io_worker_invoke_main (on_socket_client_event_main, ev, tab_event_free);
+}
+
+static void
+on_add_new_connection (GtkButton     *button,
+                       HotSshTab  *self)
+{
+  page_transition (self, HOTSSH_TAB_PAGE_NEW_CONNECTION);
+}
+                        
+static void
+on_create_and_connect (GtkButton     *button,
+                       HotSshTab  *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GError *local_error = NULL;
+  GError **error = &local_error;
+  GtkTreeIter iter;
+  gs_unref_object GNetworkAddress *address = NULL;
+  const char *hostname;
+  gs_free char *stripped_hostname = NULL;
+  const char *username;
+  gs_free char *stripped_username = NULL;
+
+  hostname = gtk_entry_get_text (GTK_ENTRY (priv->host_entry));
+  stripped_hostname = g_strstrip (g_strdup (hostname));
+  username = gtk_entry_get_text (GTK_ENTRY (priv->username_entry));
+  stripped_username = g_strstrip (g_strdup (username));
+
+  g_clear_object (&priv->cancellable);
+  priv->cancellable = g_cancellable_new ();
+
+  g_clear_object (&priv->address);
+  address = (GNetworkAddress*)g_network_address_parse (stripped_hostname, 22, error);
+  if (!address)
+    {
+      page_transition_take_error (self, local_error);
+      return;
+    }
+
+  g_clear_pointer (&priv->connection_id, g_free);
+  hotssh_hostdb_add_entry (hotssh_hostdb_get_instance (),
+                           stripped_username,
+                           (GNetworkAddress*)address,
+                           &priv->connection_id);
+  hotssh_hostdb_lookup_by_id (hotssh_hostdb_get_instance (),
+                              priv->connection_id, &iter);
+  /*
+  gtk_tree_selection_select_iter (gtk_tree_view_get_selection ((GtkTreeView*)priv->connections_treeview),
+                                  &iter);
+  */
+
+  page_transition (self, HOTSSH_TAB_PAGE_LIST_CONNECTIONS);
+}
+
+/* Hook a connection up to this tab; on the worker, so that no state
+ * change slips past between here and the signal being connected.
+ */
+static void
+adopt_connection (TabConnectionOp *op)
+{
+  op->watch->connection = op->connection;
+  gssh_connection_set_interaction (op->connection, op->interaction);
+  g_signal_connect_data (op->connection, "notify::state",
+                         G_CALLBACK (on_connection_state_notify),
+                         op->watch, tab_watch_free, 0);
+  op->state = gssh_connection_get_state (op->connection);
+}
+
+/* Hand a connection made or adopted on the worker to the tab, unless
+ * it has moved on in the meantime.
+ */
+static gboolean
+take_connection (TabConnectionOp *op)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (op->self);
+
+  if (op->cancellable != priv->cancellable
+      || g_cancellable_is_cancelled (op->cancellable))
+    {
+      release_connection (op->worker, op->connection, op->watch);
+      op->connection = NULL;
+      return FALSE;
+    }
+
+  priv->worker = op->worker;
+  priv->connection = op->connection;
+  op->connection = NULL;
+  priv->connection_watch = op->watch;
+  priv->connection_state = op->state;
+  return TRUE;
+}
+
+static gboolean
+on_connection_created (gpointer data)
+{
+  TabConnectionOp *op = data;
+
+  if (!take_connection (op))
+    return FALSE;
+
+  g_debug ("connected, beginning handshake");
+  set_connect_phase (op->self, CONNECT_PHASE_HANDSHAKE);
+  run_op (op->self, op_handshake, tab_op_new (op->self, on_connection_handshake));
+  return FALSE;
+}
+
+/* The connection's sources must be created against the worker's
+ * context, so it is made there.
+ */
+static gboolean
+op_create_connection (gpointer data)
+{
+  TabConnectionOp *op = data;
+
+  op->connection = gssh_connection_new (op->address, op->username);
+  op->watch->connection = op->connection;
+  g_signal_connect (gssh_connection_get_socket_client (op->connection),
+                    "event", G_CALLBACK (on_socket_client_event), op->watch);
+  hotssh_keepalive_attach (op->connection, op->keepalive_interval, op->keepalive_count);
+  adopt_connection (op);
+  hotssh_io_worker_invoke_main (on_connection_created, op, tab_connection_op_free);
+  return FALSE;
+}
+
+static gboolean
+on_connection_adopted (gpointer data)
+{
+  TabConnectionOp *op = data;
+  HotSshTab *self = op->self;
+
+  if (!take_connection (op))
+    return FALSE;
+
+  /* Dropped since the key exchange; start over */
+  if (op->state != GSSH_CONNECTION_STATE_PREAUTH)
+    {
+      start_connection (self);
+      return FALSE;
+    }
+
+  check_host_key (self);
+  return FALSE;
+}
+
+static gboolean
+op_adopt_connection (gpointer data)
+{
+  TabConnectionOp *op = data;
+
+  adopt_connection (op);
+  hotssh_io_worker_invoke_main (on_connection_adopted, op, tab_connection_op_free);
+  return FALSE;
+}
+
+static TabConnectionOp *
+tab_connection_op_new (HotSshTab      *self,
+                       HotSshIoWorker *worker)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  TabConnectionOp *op = g_slice_new0 (TabConnectionOp);
+
+  op->self = g_object_ref (self);
+  op->worker = worker;
+  op->watch = tab_watch_new (self, worker, NULL);
+  op->interaction = g_object_ref (priv->password_interaction);
+  op->cancellable = g_object_ref (priv->cancellable);
+  return op;
+}
+
+static void
+on_address_race_event (GSocketClientEvent  event,
+                       GSocketAddress     *address,
+                       gpointer            user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  /* Later attempts in the race share the first one's deadline */
+  if (event == G_SOCKET_CLIENT_CONNECTING && priv->connect_phase == CONNECT_PHASE_RESOLVE)
+    set_connect_phase (self, CONNECT_PHASE_CONNECT);
+  show_connect_progress (self, event, address);
+}
+
+static void
+on_address_race_complete (GObject      *src,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GError *local_error = NULL;
+  GSocketConnectable *address;
+  gs_unref_object GInetAddress *winner = NULL;
+  GList *resolved = NULL;
+  TabConnectionOp *op;
+
+  address = hotssh_address_race_finish (res, &winner, &resolved, &local_error);
+  /* Superseded */
+  if (g_cancellable_is_cancelled (g_task_get_cancellable ((GTask*)res)))
+    {
+      g_clear_object (&address);
+      g_clear_error (&local_error);
+      goto out;
+    }
+  if (!address)
+    {
+      page_transition_take_error (self, local_error);
+      goto out;
+    }
+
+  hotssh_address_cache_store (priv->connection_id, winner, resolved);
+
+  g_clear_object (&priv->connect_address);
+  priv->connect_address = address;
+  op = tab_connection_op_new (self, priv->worker);
+  op->address = g_object_ref (address);
+  op->username = g_strdup (priv->username);
+  op->keepalive_interval = g_settings_get_uint (priv->settings, "keepalive-interval");
+  op->keepalive_count = g_settings_get_uint (priv->settings, "keepalive-count");
+  hotssh_io_worker_invoke (priv->worker, op_create_connection, op, NULL);
+
+ out:
+  g_resolver_free_addresses (resolved);
+  g_object_unref (self);
+}
+
+static void
+start_connection (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GNetworkAddress *address = (GNetworkAddress*)priv->address;
+  GSshConnection *preconnected;
+  HotSshIoWorker *worker;
+  HotSshHostKey *host_key;
+  GList *cached;
+
+  drop_connection (self);
+  if (priv->cancellable)
+    g_cancellable_cancel (priv->cancellable);
+  g_clear_object (&priv->cancellable);
+  priv->cancellable = g_cancellable_new ();
+  set_connect_phase (self, CONNECT_PHASE_NONE);
+  hotssh_gssapi_refresh_credentials ();
+
+  preconnected = hotssh_preconnect_take (priv->connection_id, &worker, &host_key);
+  if (preconnected)
+    {
+      TabConnectionOp *op = tab_connection_op_new (self, worker);
+
+      op->connection = preconnected;
+      priv->host_key = host_key;
+      hotssh_io_worker_invoke (worker, op_adopt_connection, op, NULL);
+      return;
+    }
+
+  priv->worker = hotssh_io_worker_get_for_key (priv->connection_id);
+  cached = hotssh_address_cache_lookup (priv->connection_id);
+  set_connect_phase (self, CONNECT_PHASE_RESOLVE);
+  hotssh_address_race_async (g_network_address_get_hostname (address),
+                             g_network_address_get_port (address),
+                             cached,
+                             priv->cancellable,
+                             on_address_race_event, self,
+                             on_address_race_complete, g_object_ref (self));
+  g_resolver_free_addresses (cached);
+}
+
+/* Reuse a connection another tab logged in with, or make a new one */
+static void
+connect_to_entry (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_free char *key = NULL;
+  GSshConnection *pooled;
+  HotSshIoWorker *worker;
+
+  key = hotssh_connection_pool_make_key (priv->username, priv->hostname,
+                                         g_network_address_get_port ((GNetworkAddress*)priv->address));
+  pooled = hotssh_connection_pool_acquire (key, &worker);
+  if (pooled)
+    {
+      drop_connection (self);
+      g_clear_object (&priv->cancellable);
+      priv->cancellable = g_cancellable_new ();
+      priv->worker = worker;
+      priv->connection = pooled;
+      priv->connection_state = GSSH_CONNECTION_STATE_CONNECTED;
+      priv->connection_pooled = TRUE;
+      set_status (self, _("Authenticated, requesting channel…"));
+      handle_connection_state (self, GSSH_CONNECTION_STATE_CONNECTED);
+    }
+  else
+    start_connection (self);
+}
+
+static void
+on_connection_row_activated (GtkTreeView       *tree_view,
+                             GtkTreePath       *path,
+                             GtkTreeViewColumn *column,
+                             gpointer           user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GtkTreeIter iter;
+  guint port;
+  gs_unref_object GSocketConnectable *address = NULL;
+  gs_unref_object GtkTreeModel *model = NULL;
+
+  model = hotssh_hostdb_get_model (hotssh_hostdb_get_instance ());
+
+  g_assert (gtk_tree_model_get_iter (model, &iter, path));
+
+  g_clear_pointer (&priv->connection_id, g_free);
+  g_clear_pointer (&priv->hostname, g_free);
+  g_clear_pointer (&priv->username, g_free);
+  gtk_tree_model_get (model, &iter,
+                      HOTSSH_HOSTDB_COLUMN_ID,
+                      &priv->connection_id,
+                      HOTSSH_HOSTDB_COLUMN_HOSTNAME,
+                      &priv->hostname,
+                      HOTSSH_HOSTDB_COLUMN_PORT,
+                      &port,
+                      HOTSSH_HOSTDB_COLUMN_USERNAME,
+                      &priv->username,
+                      -1);
+
+  g_clear_object (&priv->address);
+  priv->address = g_network_address_new (priv->hostname, port);
+
+  priv->typeahead_enabled =
+    hotssh_hostdb_get_entry_boolean (hotssh_hostdb_get_instance (),
+                                     priv->connection_id, "typeahead", TRUE);
+
+  g_object_notify ((GObject*)self, "hostname");
+
+  page_transition (self, HOTSSH_TAB_PAGE_CONNECTING);
+  connect_to_entry (self);
+
+  hotssh_hostdb_update_last_used (hotssh_hostdb_get_instance (),
+                                  priv->connection_id);
+}
+
+/* Don't connect to every row the pointer or selection passes over */
+#define PRECONNECT_DWELL_MS (300)
+
+static gboolean
+on_preconnect_timeout (gpointer user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  priv->preconnect_timeout_id = 0;
+  hotssh_preconnect_request (priv->preconnect_id);
+  return FALSE;
+}
+
+static void
+schedule_preconnect (HotSshTab  *self,
+                     const char *id)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (g_strcmp0 (id, priv->preconnect_id) == 0)
+    return;
+
+  if (priv->preconnect_timeout_id)
+    {
+      g_source_remove (priv->preconnect_timeout_id);
+      priv->preconnect_timeout_id = 0;
+    }
+  g_free (priv->preconnect_id);
+  priv->preconnect_id = g_strdup (id);
+
+  if (id && g_settings_get_boolean (priv->settings, "speculative-connect"))
+    priv->preconnect_timeout_id = g_timeout_add (PRECONNECT_DWELL_MS, on_preconnect_timeout, self);
+}
+
+static void
+schedule_preconnect_path (HotSshTab   *self,
+                          GtkTreePath *path)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GtkTreeModel *model = gtk_tree_view_get_model ((GtkTreeView*)priv->connections_treeview);
+  gs_free char *id = NULL;
+  GtkTreeIter iter;
+
+  if (path && gtk_tree_model_get_iter (model, &iter, path))
+    gtk_tree_model_get (model, &iter, HOTSSH_HOSTDB_COLUMN_ID, &id, -1);
+  schedule_preconnect (self, id);
+}
+
+static void
+on_connections_selection_changed (GtkTreeSelection *selection,
+                                  gpointer          user_data)
+{
+  HotSshTab *self = user_data;
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  gs_free char *id = NULL;
+
+  if (gtk_tree_selection_get_selected (selection, &model, &iter))
+    gtk_tree_model_get (model, &iter, HOTSSH_HOSTDB_COLUMN_ID, &id, -1);
+  schedule_preconnect (self, id);
+}
+
+static gboolean
+on_connections_motion (GtkWidget      *widget,
+                       GdkEventMotion *event,
+                       gpointer        user_data)
+{
+  HotSshTab *self = user_data;
+  GtkTreePath *path = NULL;
+
+  if (gtk_tree_view_get_path_at_pos ((GtkTreeView*)widget, event->x, event->y,
+                                     &path, NULL, NULL, NULL))
+    {
+      schedule_preconnect_path (self, path);
+      gtk_tree_path_free (path);
+    }
+  else
+    schedule_preconnect (self, NULL);
+
+  return FALSE;
+}
+
+static gboolean
+on_connections_leave (GtkWidget        *widget,
+                      GdkEventCrossing *event,
+                      gpointer          user_data)
+{
+  schedule_preconnect ((HotSshTab*)user_data, NULL);
+  return FALSE;
+}
+
+/* Once what's been typed for a new connection can only mean one saved
+ * host, connect to it.
+ */
+static void
+on_host_entry_changed (GtkEditable *editable,
+                       gpointer     user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_unref_object GtkTreeModel *model = hotssh_hostdb_get_model (hotssh_hostdb_get_instance ());
+  gs_free char *typed = g_strstrip (g_strdup (gtk_entry_get_text ((GtkEntry*)priv->host_entry)));
+  const char *username = gtk_entry_get_text ((GtkEntry*)priv->username_entry);
+  gs_free char *match = NULL;
+  GtkTreeIter iter;
+
+  if (*typed == '\0' || !gtk_tree_model_get_iter_first (model, &iter))
+    {
+      schedule_preconnect (self, NULL);
+      return;
+    }
+
+  do
+    {
+      gs_free char *id = NULL;
+      gs_free char *hostname = NULL;
+      gs_free char *entry_username = NULL;
+
+      gtk_tree_model_get (model, &iter,
+                          HOTSSH_HOSTDB_COLUMN_ID, &id,
+                          HOTSSH_HOSTDB_COLUMN_HOSTNAME, &hostname,
+                          HOTSSH_HOSTDB_COLUMN_USERNAME, &entry_username,
+                          -1);
+      if (!g_str_has_prefix (hostname, typed))
+        continue;
+      if (*username && g_strcmp0 (username, entry_username) != 0)
+        continue;
+      if (match)
+        {
+          g_clear_pointer (&match, g_free);
+          break;
+        }
+      match = id;
+      id = NULL;
+    }
+  while (gtk_tree_model_iter_next (model, &iter));
+
+  schedule_preconnect (self, match);
+}
+
+static void
+pump_paste (HotSshTab *self);
+
+static void
+on_pump_drained (gpointer user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (priv->input_throttled
+      && hotssh_channel_pump_get_write_queued (priv->pump) <= WRITE_BUFFER_LOW_WATER)
+    set_input_throttled (self, FALSE);
+
+  if (priv->broadcast == HOTSSH_TAB_BROADCAST_LAGGING
+      && hotssh_channel_pump_get_write_queued (priv->pump) < BROADCAST_LAG_BYTES)
+    set_broadcast_state (self, HOTSSH_TAB_BROADCAST_ACTIVE);
+
+  pump_paste (self);
+}
+
+/* Returns: How much of @buf fit in the write ring; callers that can
+ * wait, like a streamed paste, only offer as much as there is room for.
+ */
+static gsize
+queue_write_full (HotSshTab    *self,
+                  const guint8 *buf,
+                  gsize         len,
+                  gboolean      record)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gsize taken;
+
+  if (!priv->pump)
+    return 0;
+
+  taken = hotssh_channel_pump_write (priv->pump, buf, len);
+
+  /* Everything sent is recorded, typed, pasted, replayed or scripted,
+   * except a password an expect script answers with */
+  if (record && priv->recorder && priv->record_input && taken > 0)
+    hotssh_recorder_input (priv->recorder, buf, taken);
+
+  /* Input is throttled at the high-water mark, which leaves room for
+   * any commit smaller than PASTE_STREAM_THRESHOLD, and larger ones are
+   * streamed; bytes are only dropped if something bypasses both. */
+  if (taken < len)
+    {
+      g_debug ("write ring full, dropped %" G_GSIZE_FORMAT " bytes", len - taken);
+      if (!priv->indisposed)
+        gtk_widget_error_bell (priv->terminal);
+    }
+
+  if (hotssh_channel_pump_get_write_queued (priv->pump) >= WRITE_BUFFER_HIGH_WATER)
+    set_input_throttled (self, TRUE);
+
+  return taken;
+}
+
+static gsize
+queue_write (HotSshTab    *self,
+             const guint8 *buf,
+             gsize         len)
+{
+  return queue_write_full (self, buf, len, TRUE);
+}
+
+static void
+send_input (HotSshTab    *self,
+            const guint8 *buf,
+            gsize         len)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (priv->paste_bracket_open)
+    {
+      if (!priv->held_input)
+        priv->held_input = g_byte_array_new ();
+      if (priv->held_input->len + len > PASTE_HELD_INPUT_MAX)
+        {
+          gtk_widget_error_bell ((GtkWidget*)self);
+          return;
         }
+      g_byte_array_append (priv->held_input, buf, len);
+      return;
+    }
+
+  hotssh_scrollback_index_input (priv->scrollback_index, buf, len);
+  queue_write (self, buf, len);
+}
+
+static void
+stream_paste (HotSshTab *self,
+              GBytes    *data);
+
+/* Keyboard input, and pastes small enough to be sent whole */
+static void
+handle_input (HotSshTab    *self,
+              const guint8 *buf,
+              gsize         len)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  /* VTE's own pastes (middle click, its paste keys) arrive as one
+   * commit, already bracketed and with newlines converted; one too
+   * large to queue whole is streamed like ours.  Converting newlines
+   * again changes nothing, and the paste is bracketed again the same
+   * way.
+   */
+  if (len >= PASTE_STREAM_THRESHOLD)
+    {
+      gs_unref_bytes GBytes *data = NULL;
+
+      if (memcmp (buf, "\033[200~", 6) == 0
+          && memcmp (buf + len - 6, "\033[201~", 6) == 0)
+        data = g_bytes_new (buf + 6, len - 12);
       else
+        data = g_bytes_new (buf, len);
+      stream_paste (self, data);
+      return;
+    }
+
+  /* A mirror view with input types into its source's session */
+  if (priv->mirror_source)
+    {
+      send_input (priv->mirror_source, buf, len);
+      return;
+    }
+
+  hotssh_predictor_input (priv->predictor, buf, len);
+
+  /* The window hands it to every member, this tab included */
+  if (priv->broadcast == HOTSSH_TAB_BROADCAST_ACTIVE ||
+      priv->broadcast == HOTSSH_TAB_BROADCAST_LAGGING)
+    {
+      GBytes *bytes = g_bytes_new (buf, len);
+      g_signal_emit (self, signals[BROADCAST_INPUT], 0, bytes);
+      g_bytes_unref (bytes);
+      return;
+    }
+
+  send_input (self, buf, len);
+}
+
+/* Same newline conversion as vte_terminal_paste_clipboard(): LF and
+ * CRLF become CR.  Never lengthens its input; returns the bytes written
+ * to @out.
+ */
+static gsize
+convert_paste_newlines (const guint8 *buf,
+                        gsize         len,
+                        guint8       *out,
+                        gboolean     *last_was_cr)
+{
+  gsize i;
+  gsize n = 0;
+
+  for (i = 0; i < len; i++)
+    {
+      guint8 c = buf[i];
+      if (c == '\n')
         {
-          set_status (self, authmsg);
+          gboolean was_cr = *last_was_cr;
+          *last_was_cr = FALSE;
+          if (was_cr)
+            continue;
+          c = '\r';
         }
-        
-      gssh_connection_auth_async (priv->connection,
-                                  mech,
-                                  priv->cancellable,
-                                  on_auth_complete, self);
-      priv->have_outstanding_auth = TRUE;
+      else
+        *last_was_cr = (c == '\r');
+      out[n++] = c;
+    }
+  return n;
+}
+
+static void
+update_paste_progress (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gsize total = g_bytes_get_size (priv->paste_data);
+  gs_free char *sent_str = g_format_size (priv->paste_offset);
+  gs_free char *total_str = g_format_size (total);
+  gs_free char *text = g_strdup_printf (_("Pasting %s of %s"), sent_str, total_str);
+
+  gtk_progress_bar_set_fraction ((GtkProgressBar*)priv->paste_progress,
+                                 (gdouble)priv->paste_offset / total);
+  gtk_progress_bar_set_text ((GtkProgressBar*)priv->paste_progress, text);
+}
+
+static void
+cancel_paste (HotSshTab *self,
+              gboolean   close_bracket)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (!priv->paste_data)
+    return;
+
+  g_debug ("paste finished at %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes",
+           priv->paste_offset, g_bytes_get_size (priv->paste_data));
+
+  g_clear_pointer (&priv->paste_data, g_bytes_unref);
+  priv->paste_offset = 0;
+  priv->paste_last_was_cr = FALSE;
+  if (!priv->indisposed)
+    gtk_widget_hide (priv->paste_progress_box);
+
+  if (priv->paste_bracket_open)
+    {
+      priv->paste_bracket_open = FALSE;
+      if (close_bracket)
+        queue_write (self, (const guint8*)"\033[201~", 6);
+    }
+
+  if (close_bracket && priv->held_input && priv->held_input->len > 0)
+    {
+      g_debug ("sending %u bytes held during paste", priv->held_input->len);
+      send_input (self, priv->held_input->data, priv->held_input->len);
+      g_byte_array_set_size (priv->held_input, 0);
+    }
+}
+
+/* Feed the next chunk of a streaming paste.  Only one chunk is kept
+ * queued at a time, so memory stays bounded by the chunk size, and
+ * unless the paste is bracketed anything typed meanwhile is sent ahead
+ * of the remainder.
+ */
+static void
+pump_paste (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  const guint8 *data;
+  gsize len;
+
+  if (!priv->paste_data || !priv->pump)
+    return;
+
+  data = g_bytes_get_data (priv->paste_data, &len);
+
+  /* With less than a chunk queued there is always room for another,
+   * as newline conversion never lengthens one.
+   */
+  if (priv->paste_offset < len
+      && hotssh_channel_pump_get_write_queued (priv->pump) < PASTE_CHUNK_SIZE)
+    {
+      guint8 chunk[PASTE_CHUNK_SIZE];
+      gsize n = MIN (len - priv->paste_offset, PASTE_CHUNK_SIZE);
+      gsize out;
+
+      out = convert_paste_newlines (data + priv->paste_offset, n, chunk,
+                                    &priv->paste_last_was_cr);
+      priv->paste_offset += n;
+
+      queue_write (self, chunk, out);
+      update_paste_progress (self);
     }
-  
- out:
-  if (local_error)
-    page_transition_take_error (self, local_error);
+
+  if (priv->paste_offset >= len)
+    cancel_paste (self, TRUE);
 }
 
 static void
-handle_unknown_hostkey (HotSshTab *self,
-                        const char *connected_hostkey_type,
-                        const char *connected_hostkey_sha1)
+on_paste_cancel_clicked (GtkButton *button,
+                         gpointer   user_data)
+{
+  HotSshTab *self = user_data;
+  cancel_paste (self, TRUE);
+}
+
+/* Begin streaming @data through the write queue; fails if a paste is
+ * already under way.
+ */
+static gboolean
+start_streamed_paste (HotSshTab *self,
+                      GBytes    *data)
 {
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
 
-  gtk_label_set_text ((GtkLabel*)priv->hostkey_fingerprint_label,
-		      connected_hostkey_sha1);
-  page_transition (self, HOTSSH_TAB_PAGE_HOSTKEY);
+  if (priv->paste_data)
+    return FALSE;
+
+  priv->paste_data = g_bytes_ref (data);
+  priv->paste_offset = 0;
+  priv->paste_last_was_cr = FALSE;
+
+  if (priv->bracketed_paste_mode)
+    {
+      queue_write (self, (const guint8*)"\033[200~", 6);
+      priv->paste_bracket_open = TRUE;
+    }
+
+  update_paste_progress (self);
+  gtk_widget_show (priv->paste_progress_box);
+  pump_paste (self);
+  return TRUE;
 }
 
+/* A paste too large to send whole */
 static void
-verify_hostkey (HotSshTab              *self,
-                const char             *connected_hostkey_type,
-                const char             *connected_hostkey_base64,
-                const char             *saved_hostkey_type,
-                const char             *saved_hostkey_base64)
+stream_paste (HotSshTab *self,
+              GBytes    *data)
 {
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  gs_free char *errdetails = NULL;
 
-  if (strcmp (connected_hostkey_type, saved_hostkey_type) != 0)
+  /* A mirror view's paste is streamed by its source, paced by the
+   * source's write queue, as its typing is sent there */
+  if (priv->mirror_source)
     {
-      errdetails = g_strdup_printf (_("The remote host key type has changed; it was previously \"%s\", now \"%s\""),
-                                    saved_hostkey_type, connected_hostkey_type);
+      if (!start_streamed_paste (priv->mirror_source, data))
+        gtk_widget_error_bell (priv->terminal);
+      return;
     }
-  else if (strcmp (connected_hostkey_base64, saved_hostkey_base64) != 0)
+
+  /* Like typed input, the window starts it on every member */
+  if (priv->broadcast == HOTSSH_TAB_BROADCAST_ACTIVE ||
+      priv->broadcast == HOTSSH_TAB_BROADCAST_LAGGING)
     {
-      errdetails = g_strdup (_("The remote host key has changed"));
+      g_signal_emit (self, signals[BROADCAST_PASTE], 0, data);
+      return;
     }
-    
-  if (errdetails)
-    {
-      GError *local_error = NULL;
 
-      g_set_error (&local_error, G_IO_ERROR,
-                   G_IO_ERROR_FAILED,
-                   _("Error: The host credentials for \"%s\" (%s) do not match the previously "
-                     "saved credentials.  This may represent an attempt by a malicious party to "
-                     "intercept communication; however, it is also possible that the host key was changed "
-                     "by a system administrator.\n\nDetails: %s"),
-                   priv->hostname,
-                   g_network_address_get_hostname ((GNetworkAddress*)priv->address),
-                   errdetails);
-      page_transition_take_error (self, local_error);
-    }
-  else
-    {
-      g_debug ("Remote host key matches");
-      page_transition (self, HOTSSH_TAB_PAGE_CONNECTING);
-      set_status (self, _("Negotiating authentication…"));
+  if (!start_streamed_paste (self, data))
+    gtk_widget_error_bell (priv->terminal);
+}
+
+/* A paste sent whole, as keyboard input is */
+static void
+paste_text (HotSshTab  *self,
+            const char *text,
+            gsize       len)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  HotSshTab *session = priv->mirror_source ? priv->mirror_source : self;
+  HotSshTabPrivate *session_priv = hotssh_tab_get_instance_private (session);
+  gboolean bracketed = session_priv->bracketed_paste_mode;
+  gboolean last_was_cr = FALSE;
+  GByteArray *buf = g_byte_array_sized_new (len + 12);
+  gsize n;
+
+  if (bracketed)
+    g_byte_array_append (buf, (const guint8*)"\033[200~", 6);
+  n = buf->len;
+  g_byte_array_set_size (buf, n + len);
+  n += convert_paste_newlines ((const guint8*)text, len, buf->data + n, &last_was_cr);
+  g_byte_array_set_size (buf, n);
+  if (bracketed)
+    g_byte_array_append (buf, (const guint8*)"\033[201~", 6);
+
+  handle_input (self, buf->data, buf->len);
+  g_byte_array_unref (buf);
+}
+
+static void
+on_paste_text_received (GtkClipboard *clipboard,
+                        const gchar  *text,
+                        gpointer      user_data)
+{
+  gs_unref_object HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_unref_bytes GBytes *data = NULL;
+  gsize len;
 
-      gssh_connection_negotiate_async (priv->connection, priv->cancellable,
-                                       on_negotiate_complete, self);
+  if (text == NULL || priv->indisposed || !(priv->channel || priv->mirror_source))
+    return;
+
+  len = strlen (text);
+  if (len < PASTE_STREAM_THRESHOLD)
+    {
+      paste_text (self, text, len);
+      return;
     }
+
+  data = g_bytes_new (text, len);
+  stream_paste (self, data);
 }
 
 static void
-on_connection_handshake (GObject         *object,
-			 GAsyncResult    *result,
-			 gpointer         user_data)
+on_terminal_commit (VteTerminal *vteterminal,
+		    gchar       *text,
+		    guint        size,
+		    gpointer     user_data) 
+{
+  handle_input ((HotSshTab*)user_data, (const guint8*)text, size);
+}
+
+static void
+submit_password (HotSshTab *self)
 {
-  HotSshTab *self = HOTSSH_TAB (user_data);
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  GError *local_error = NULL;
-  GError **error = &local_error;
-  gs_free char *saved_hostkey_type = NULL;
-  gs_free char *saved_hostkey_base64 = NULL;
-  gs_unref_object GtkTreeModel *model = NULL;
-  gs_free char *connected_hostkey_type = NULL;
-  gs_free char *connected_hostkey_sha1_text = NULL;
-  gs_free char *connected_hostkey_base64 = NULL;
-  GtkTreeIter iter;
 
-  model = hotssh_hostdb_get_model (hotssh_hostdb_get_instance ());
+  g_debug ("password submit");
+  
+  gtk_widget_set_sensitive (priv->password_container, FALSE);
+  gtk_widget_grab_focus ((GtkWidget*)self); /* For type-ahead */
 
-  if (!gssh_connection_handshake_finish ((GSshConnection*)object, result, error))
-    goto out;
+  priv->submitted_password = TRUE;
+  hotssh_password_interaction_set_password (priv->password_interaction,
+                                            gtk_entry_get_text ((GtkEntry*)priv->password_entry));
+  iterate_authentication_modes (self);
+}
 
-  gssh_connection_preauth_get_host_key (priv->connection,
-                                        &connected_hostkey_type,
-                                        &connected_hostkey_sha1_text,
-                                        &connected_hostkey_base64);
+static void
+on_connect_cancel (GtkButton     *button,
+		   gpointer       user_data)
+{
+  HotSshTab *self = user_data;
+  page_transition (self, HOTSSH_TAB_PAGE_LIST_CONNECTIONS);
+}
 
-  g_debug ("handshake complete");
-  g_debug ("remote key type:%s SHA1:%s",
-           connected_hostkey_type,
-           connected_hostkey_sha1_text);
+static gboolean
+auth_mechanisms_contain (GArray                       *mechanisms,
+                         GSshConnectionAuthMechanism   mech)
+{
+  guint i;
+  for (i = 0; i < mechanisms->len; i++)
+    if (g_array_index (mechanisms, guint, i) == mech)
+      return TRUE;
+  return FALSE;
+}
 
-  g_assert (hotssh_hostdb_lookup_by_id (hotssh_hostdb_get_instance (), priv->connection_id, &iter));
+typedef struct {
+  HotSshTab *self;
+  GSshConnection *connection;
+} GssapiWait;
 
-  gtk_tree_model_get (model, &iter,
-                      HOTSSH_HOSTDB_COLUMN_HOST_KEY_TYPE,
-                      &saved_hostkey_type,
-                      HOTSSH_HOSTDB_COLUMN_HOST_KEY_BASE64,
-                      &saved_hostkey_base64,
-                      -1);
+static void
+on_gssapi_checked (GObject             *src,
+                   GAsyncResult        *result,
+                   gpointer             user_data)
+{
+  GssapiWait *wait = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (wait->self);
+  GError *local_error = NULL;
 
-  if (saved_hostkey_type == NULL)
+  /* The answer itself is picked up by have_mechanism() */
+  (void) hotssh_gssapi_check_credentials_finish (result, &local_error);
+  if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)
+      && wait->connection == priv->connection)
+    iterate_authentication_modes (wait->self);
+
+  g_clear_error (&local_error);
+  g_object_unref (wait->connection);
+  g_object_unref (wait->self);
+  g_free (wait);
+}
+
+static void
+on_negotiate_complete (GObject             *src,
+                       GAsyncResult        *result,
+                       gpointer             user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GError *local_error = NULL;
+
+  if ((GSshConnection*)src != priv->connection)
     {
-      handle_unknown_hostkey (self,
-                              connected_hostkey_type,
-                              connected_hostkey_sha1_text);
+      (void) gssh_connection_negotiate_finish ((GSshConnection*)src, result, NULL);
+      return;
     }
-  else
+
+  if (!gssh_connection_negotiate_finish ((GSshConnection*)src, result, &local_error))
+    goto out;
+
+  g_clear_pointer (&priv->auth_mechanisms, g_array_unref);
+  priv->auth_mechanisms = hotssh_connection_info_get_auth_mechanisms (result);
+
+  set_status (self, _("Authenticating…"));
+
+  load_authentication_order (self);
+
+  /* Offering GSSAPI depends on having a ticket; wait for the look
+   * started along with the connection rather than skipping it.
+   */
+  if (auth_mechanisms_contain (priv->auth_mechanisms,
+                               GSSH_CONNECTION_AUTH_MECHANISM_GSSAPI_MIC))
     {
-      verify_hostkey (self,
-                      connected_hostkey_type,
-                      connected_hostkey_base64,
-                      saved_hostkey_type,
-                      saved_hostkey_base64);
+      GssapiWait *wait = g_new0 (GssapiWait, 1);
+      wait->self = g_object_ref (self);
+      wait->connection = g_object_ref (priv->connection);
+      hotssh_gssapi_check_credentials_async (priv->cancellable,
+                                             on_gssapi_checked, wait);
     }
+  else
+    iterate_authentication_modes (self);
 
  out:
   if (local_error)
@@ -548,405 +3307,678 @@ on_connection_handshake (GObject         *object,
 }
 
 static void
-on_socket_client_event (GSocketClient      *client,
-                        GSocketClientEvent  event,
-                        GSocketConnectable *connectable,
-                        GIOStream          *connection,
-                        gpointer            user_data)
+on_approve_hostkey_clicked (GtkButton     *button,
+			    gpointer       user_data)
 {
-  HotSshTab *self = HOTSSH_TAB (user_data);
+  HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  switch (event)
+
+  page_transition (self, HOTSSH_TAB_PAGE_CONNECTING);
+  set_status (self, _("Negotiating authentication…"));
+
+  hotssh_hostdb_set_entry_host_key_known (hotssh_hostdb_get_instance (),
+                                          priv->connection_id,
+                                          priv->host_key->type,
+                                          priv->host_key->base64,
+                                          NULL);
+
+  set_connect_phase (self, CONNECT_PHASE_NEGOTIATE);
+  run_op (self, op_negotiate, tab_op_new (self, on_negotiate_complete));
+}
+
+static void
+flush_pty_size_request (HotSshTab             *self);
+
+static void
+on_pty_size_complete (GObject                    *src,
+		      GAsyncResult               *result,
+		      gpointer                    user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GError *local_error = NULL;
+
+  g_debug ("pty size request complete");
+
+  if (!gssh_channel_request_pty_size_finish ((GSshChannel*)src, result, &local_error))
+    goto out;
+
+  if ((GSshChannel*)src != priv->channel)
+    return;
+
+  priv->sent_pty_size_request = FALSE;
+
+  if (priv->need_pty_size_request)
+    flush_pty_size_request (self);
+
+ out:
+  if (local_error)
     {
-    case G_SOCKET_CLIENT_RESOLVING:
-      set_status_printf (self, _("Resolving '%s'…"),
-                         priv->hostname);
-      break;
-    case G_SOCKET_CLIENT_CONNECTING:
-      {
-        GSocketConnection *socketconn = G_SOCKET_CONNECTION (connection);
-        gs_unref_object GSocketAddress *remote_address =
-          g_socket_connection_get_remote_address (socketconn, NULL);
+      if ((GSshChannel*)src == priv->channel)
+        page_transition_take_error (self, local_error);
+      else
+        g_clear_error (&local_error);
+    }
+}
 
-        g_debug ("socket connecting remote=%p", remote_address);
-        if (remote_address && G_IS_INET_SOCKET_ADDRESS (remote_address))
-          {
-            GInetAddress *inetaddr =
-              g_inet_socket_address_get_address ((GInetSocketAddress*)remote_address);
-            gs_free char *inet_str = g_inet_address_to_string (inetaddr);
-            set_status_printf (self, _("Connecting to '%s'…"),
-                               inet_str);
-          }
-        break;
-      }
-    default:
-      break;
+static void
+send_pty_size_request (HotSshTab             *self,
+                       guint                  width,
+                       guint                  height)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  TabOp *op;
+
+  g_debug ("requesting pty size %ux%u", width, height);
+  priv->need_pty_size_request = FALSE;
+  priv->sent_pty_size_request = TRUE;
+  priv->pty_width = width;
+  priv->pty_height = height;
+  if (priv->recorder)
+    hotssh_recorder_resize (priv->recorder, width, height);
+  if (priv->mirror)
+    hotssh_mirror_resize (priv->mirror, width, height);
+  op = tab_op_new (self, on_pty_size_complete);
+  op->width = width;
+  op->height = height;
+  run_op (self, op_request_pty_size, op);
+}
+
+static void
+flush_pty_size_request (HotSshTab             *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  guint width = vte_terminal_get_column_count ((VteTerminal*)priv->terminal);
+  guint height = vte_terminal_get_row_count ((VteTerminal*)priv->terminal);
+
+  priv->resize_pending_since = 0;
+
+  if (!(priv->channel && priv->connection &&
+        priv->connection_state == GSSH_CONNECTION_STATE_CONNECTED))
+    return;
+
+  if (priv->sent_pty_size_request)
+    {
+      /* Only one request in flight per channel; pick up the latest
+       * size when it completes.
+       */
+      priv->need_pty_size_request = TRUE;
+      return;
     }
+
+  priv->need_pty_size_request = FALSE;
+  if (width == priv->pty_width && height == priv->pty_height)
+    return;
+
+  send_pty_size_request (self, width, height);
+}
+
+static gboolean
+on_pty_resize_timeout (gpointer user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  priv->queued_pty_size_id = 0;
+  flush_pty_size_request (self);
+
+  return FALSE;
 }
 
+/* Trailing-edge debounce: wait for allocations to go quiet, but never
+ * hold a size change back for longer than PTY_RESIZE_MAX_DELAY_MS, so a
+ * long window drag still produces at most a few window-change requests
+ * per second.
+ */
 static void
-on_add_new_connection (GtkButton     *button,
-                       HotSshTab  *self)
+schedule_pty_size_request (HotSshTab             *self)
 {
-  page_transition (self, HOTSSH_TAB_PAGE_NEW_CONNECTION);
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gint64 now = g_get_monotonic_time ();
+  gint64 waited_ms;
+  guint delay;
+
+  if (priv->resize_pending_since == 0)
+    priv->resize_pending_since = now;
+  waited_ms = (now - priv->resize_pending_since) / 1000;
+
+  if (waited_ms >= PTY_RESIZE_MAX_DELAY_MS)
+    delay = 0;
+  else
+    delay = MIN (PTY_RESIZE_QUIET_MS, PTY_RESIZE_MAX_DELAY_MS - waited_ms);
+
+  if (priv->queued_pty_size_id > 0)
+    g_source_remove (priv->queued_pty_size_id);
+  priv->queued_pty_size_id = g_timeout_add (delay, on_pty_resize_timeout, self);
 }
-                        
+
 static void
-on_create_and_connect (GtkButton     *button,
-                       HotSshTab  *self)
+on_terminal_size_allocate (GtkWidget    *widget,
+			   GdkRectangle *allocation,
+			   gpointer      user_data)
 {
+  HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  GError *local_error = NULL;
-  GError **error = &local_error;
-  GtkTreeIter iter;
-  gs_unref_object GNetworkAddress *address = NULL;
-  const char *hostname;
-  gs_free char *stripped_hostname = NULL;
-  const char *username;
-  gs_free char *stripped_username = NULL;
+  VteTerminal *terminal = (VteTerminal*)priv->terminal;
+  GtkAdjustment *adj = gtk_scrollable_get_vadjustment ((GtkScrollable*)terminal);
+  glong rows = vte_terminal_get_row_count (terminal);
+  glong column, row;
+
+  /* Output held back while in the background was written for the old
+   * size and must land before VTE is asked where things are; take
+   * positions from the terminal as it is after the resize.
+   */
+  flush_background_backlog (self);
+  vte_terminal_get_cursor_position (terminal, &column, &row);
+  hotssh_scrollback_index_set_size (priv->scrollback_index,
+                                    vte_terminal_get_column_count (terminal), rows, row,
+                                    (gint64)gtk_adjustment_get_upper (adj) - rows);
+  if (priv->channel)
+    schedule_pty_size_request (self);
+}
 
-  hostname = gtk_entry_get_text (GTK_ENTRY (priv->host_entry));
-  stripped_hostname = g_strstrip (g_strdup (hostname));
-  username = gtk_entry_get_text (GTK_ENTRY (priv->username_entry));
-  stripped_username = g_strstrip (g_strdup (username));
+/* The terminal page isn't allocated until the shell is open, so work
+ * out its grid from the space the tab occupies.
+ */
+static void
+get_initial_pty_size (HotSshTab             *self,
+                      guint                 *out_width,
+                      guint                 *out_height)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  VteTerminal *terminal = (VteTerminal*)priv->terminal;
+  glong char_width = vte_terminal_get_char_width (terminal);
+  glong char_height = vte_terminal_get_char_height (terminal);
+  GtkAllocation alloc;
+  gint scrollbar_width = 0;
 
-  g_clear_object (&priv->cancellable);
-  priv->cancellable = g_cancellable_new ();
+  gtk_widget_get_allocation ((GtkWidget*)self, &alloc);
+  gtk_widget_get_preferred_width (priv->terminal_vscrollbar, NULL, &scrollbar_width);
 
-  g_clear_object (&priv->address);
-  address = (GNetworkAddress*)g_network_address_parse (stripped_hostname, 22, error);
-  if (!address)
+  if (char_width > 0 && char_height > 0 &&
+      alloc.width > scrollbar_width + char_width && alloc.height > char_height)
     {
-      page_transition_take_error (self, local_error);
-      return;
+      *out_width = (alloc.width - scrollbar_width) / char_width;
+      *out_height = alloc.height / char_height;
+    }
+  else
+    {
+      *out_width = vte_terminal_get_column_count (terminal);
+      *out_height = vte_terminal_get_row_count (terminal);
     }
-
-  g_clear_pointer (&priv->connection_id, g_free);
-  hotssh_hostdb_add_entry (hotssh_hostdb_get_instance (),
-                           stripped_username,
-                           (GNetworkAddress*)address,
-                           &priv->connection_id);
-  hotssh_hostdb_lookup_by_id (hotssh_hostdb_get_instance (),
-                              priv->connection_id, &iter);
-  /*
-  gtk_tree_selection_select_iter (gtk_tree_view_get_selection ((GtkTreeView*)priv->connections_treeview),
-                                  &iter);
-  */
-
-  page_transition (self, HOTSSH_TAB_PAGE_LIST_CONNECTIONS);
 }
 
 static void
-on_connection_row_activated (GtkTreeView       *tree_view,
-                             GtkTreePath       *path,
-                             GtkTreeViewColumn *column,
-                             gpointer           user_data)
+hotssh_tab_style_updated (GtkWidget      *widget)
 {
-  HotSshTab *self = user_data;
+  HotSshTab   *self = (HotSshTab*)widget;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  GtkTreeIter iter;
-  guint port;
-  gs_unref_object GSocketConnectable *address = NULL;
-  gs_unref_object GtkTreeModel *model = NULL;
+  GdkRGBA fg, bg;
 
-  model = hotssh_hostdb_get_model (hotssh_hostdb_get_instance ());
+  GTK_WIDGET_CLASS (hotssh_tab_parent_class)->style_updated (widget);
 
-  g_assert (gtk_tree_model_get_iter (model, &iter, path));
+  /* Hardcode black on white for now; in the future I'd like to do
+   * per-host colors.
+   */
+  fg.red = fg.blue = fg.green = 0;
+  fg.alpha = 1;
+  bg.red = bg.blue = bg.green = 1;
+  bg.alpha = 1;
 
-  g_clear_pointer (&priv->connection_id, g_free);
-  g_clear_pointer (&priv->hostname, g_free);
-  g_clear_pointer (&priv->username, g_free);
-  gtk_tree_model_get (model, &iter,
-                      HOTSSH_HOSTDB_COLUMN_ID,
-                      &priv->connection_id,
-                      HOTSSH_HOSTDB_COLUMN_HOSTNAME,
-                      &priv->hostname,
-                      HOTSSH_HOSTDB_COLUMN_PORT,
-                      &port,
-                      HOTSSH_HOSTDB_COLUMN_USERNAME,
-                      &priv->username,
-                      -1);
+  vte_terminal_set_color_foreground ((VteTerminal*)priv->terminal, &fg);
+  vte_terminal_set_color_background ((VteTerminal*)priv->terminal, &bg);
+  vte_terminal_set_color_bold ((VteTerminal*)priv->terminal, &fg);
+  if (priv->predictor)
+    hotssh_predictor_set_colors (priv->predictor, &fg, &bg);
+}
 
-  g_clear_object (&priv->address);
-  priv->address = g_network_address_new (priv->hostname, port);
+static gboolean
+host_entry_match (GtkEntryCompletion *completion,
+                  const char         *key,
+                  GtkTreeIter        *iter,
+                  gpointer            user_data)
+{
+  gs_free char *host = NULL;
+  GtkTreeModel *model = gtk_entry_completion_get_model (completion);
 
-  g_object_notify ((GObject*)self, "hostname");
+  if (host == NULL)
+    return FALSE;
 
-  page_transition (self, HOTSSH_TAB_PAGE_CONNECTING);
-  g_clear_object (&priv->connection);
-  priv->connection = gssh_connection_new (priv->address, priv->username); 
-  g_signal_connect (gssh_connection_get_socket_client (priv->connection),
-                    "event", G_CALLBACK (on_socket_client_event), self);
-  gssh_connection_set_interaction (priv->connection, (GTlsInteraction*)priv->password_interaction);
-  g_signal_connect_object (priv->connection, "notify::state",
-			   G_CALLBACK (on_connection_state_notify),
-			   self, 0);
-  g_debug ("connected, beginning handshake");
-  gssh_connection_handshake_async (priv->connection, priv->cancellable,
-				   on_connection_handshake, self);
-  
-  hotssh_hostdb_update_last_used (hotssh_hostdb_get_instance (),
-                                  priv->connection_id);
+  gtk_tree_model_get (model, iter, 0, &host, -1);
+
+  return g_str_has_prefix (host, key);
+}
+
+static void
+on_predictive_echo_changed (GSettings   *settings,
+                            const char  *key,
+                            gpointer     user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_free char *mode_str = g_settings_get_string (settings, "predictive-echo");
+  guint threshold = g_settings_get_uint (settings, "predictive-echo-threshold");
+  HotSshPredictorMode mode;
+
+  if (strcmp (mode_str, "always") == 0)
+    mode = HOTSSH_PREDICTOR_MODE_ALWAYS;
+  else if (strcmp (mode_str, "adaptive") == 0)
+    mode = HOTSSH_PREDICTOR_MODE_ADAPTIVE;
+  else
+    mode = HOTSSH_PREDICTOR_MODE_NEVER;
+
+  hotssh_predictor_set_mode (priv->predictor, mode, threshold);
 }
 
 static void
-process_write_queue (HotSshTab        *self);
+on_alert_patterns_changed (GSettings   *settings,
+                           const char  *key,
+                           gpointer     user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gs_strfreev char **patterns = g_settings_get_strv (settings, "alert-patterns");
+
+  g_clear_pointer (&priv->scanner, hotssh_scanner_free);
+  priv->scanner = hotssh_scanner_new ((const char * const *)patterns);
+}
 
 static void
-on_ostream_write_complete (GObject           *src,
-			   GAsyncResult      *res,
-			   gpointer           user_data)
+on_scrollback_index_settings_changed (GSettings   *settings,
+                                      const char  *key,
+                                      gpointer     user_data)
 {
   HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  gssize result;
-  GError *local_error = NULL;
-  GBytes *buf;
-  gsize bufsize;
+  gsize limit = (gsize)g_settings_get_uint (settings, "scrollback-index-memory") * 1024 * 1024;
+  gboolean disk_backed = g_settings_get_boolean (settings, "scrollback-index-disk");
 
-  priv->have_outstanding_write = FALSE;
+  if (!priv->scrollback_index)
+    priv->scrollback_index = hotssh_scrollback_index_new (limit, disk_backed);
+  else
+    hotssh_scrollback_index_set_limits (priv->scrollback_index, limit, disk_backed);
+}
 
-  result = g_output_stream_write_bytes_finish ((GOutputStream*)src, res, &local_error);
-  if (result < 0)
-    goto out;
+static void
+scroll_to_row (HotSshTab *self,
+               gint64     row)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GtkAdjustment *adj = gtk_scrollable_get_vadjustment ((GtkScrollable*)priv->terminal);
+  double upper = gtk_adjustment_get_upper (adj) - gtk_adjustment_get_page_size (adj);
 
-  buf = g_queue_pop_head (&priv->write_queue);
-  g_assert (buf != NULL);
-  bufsize = g_bytes_get_size (buf);
-  
-  if (result == bufsize)
-    ;
-  else 
-    {
-      GBytes *subbuf;
-      g_assert (result < bufsize);
-      subbuf = g_bytes_new_from_bytes (buf, result, bufsize - result);
-      g_queue_push_head (&priv->write_queue, subbuf);
-    }
-  
-  process_write_queue (self);
+  gtk_adjustment_set_value (adj, CLAMP ((double)row, gtk_adjustment_get_lower (adj), upper));
+}
 
- out:
-  if (local_error)
-    page_transition_take_error (self, local_error);
+/* The row navigation starts from: the top of the view if scrolled
+ * back, otherwise the cursor.
+ */
+static gint64
+get_navigation_row (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GtkAdjustment *adj = gtk_scrollable_get_vadjustment ((GtkScrollable*)priv->terminal);
+  glong column, row;
+
+  if (gtk_adjustment_get_value (adj) <
+      gtk_adjustment_get_upper (adj) - gtk_adjustment_get_page_size (adj))
+    return (gint64)gtk_adjustment_get_value (adj);
+
+  vte_terminal_get_cursor_position ((VteTerminal*)priv->terminal, &column, &row);
+  return row;
 }
 
 static void
-process_write_queue (HotSshTab        *self)
+run_search (HotSshTab *self,
+            gint64     from_row,
+            gboolean   backwards)
 {
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  if (!priv->have_outstanding_write && priv->write_queue.length > 0)
-    {
-      GOutputStream *ostream = g_io_stream_get_output_stream ((GIOStream*)priv->channel);
-      GBytes *buf = g_queue_peek_head (&priv->write_queue);
+  const char *text = gtk_entry_get_text ((GtkEntry*)priv->search_entry);
+  gint64 row;
+
+  if (!*text)
+    return;
 
-      g_output_stream_write_bytes_async (ostream, buf, G_PRIORITY_DEFAULT,
-					 priv->cancellable, on_ostream_write_complete, self);
-      priv->have_outstanding_write = TRUE;
+  row = hotssh_scrollback_index_search (priv->scrollback_index, text, from_row, backwards);
+  if (row < 0)
+    {
+      gtk_widget_error_bell (priv->search_entry);
+      return;
     }
+
+  priv->search_row = row;
+  scroll_to_row (self, row);
 }
 
 static void
-on_terminal_commit (VteTerminal *vteterminal,
-		    gchar       *text,
-		    guint        size,
-		    gpointer     user_data) 
+on_search_changed (GtkSearchEntry *entry,
+                   gpointer        user_data)
 {
   HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
 
-  g_queue_push_tail (&priv->write_queue, g_bytes_new (text, size));
-  process_write_queue (self);
+  priv->search_row = G_MAXINT64;
+  run_search (self, priv->search_row, TRUE);
 }
 
-static void
-submit_password (HotSshTab *self)
+static gboolean
+on_search_entry_key_press (GtkWidget   *widget,
+                           GdkEventKey *event,
+                           gpointer     user_data)
 {
+  HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
 
-  g_debug ("password submit");
-  
-  gtk_widget_set_sensitive (priv->password_container, FALSE);
+  if (event->keyval != GDK_KEY_Return && event->keyval != GDK_KEY_KP_Enter)
+    return FALSE;
 
-  priv->submitted_password = TRUE;
-  iterate_authentication_modes (self);
+  run_search (self, priv->search_row, !(event->state & GDK_SHIFT_MASK));
+  return TRUE;
 }
 
 static void
-on_connect_cancel (GtkButton     *button,
-		   gpointer       user_data)
+on_search_mode_changed (GObject    *object,
+                        GParamSpec *pspec,
+                        gpointer    user_data)
 {
   HotSshTab *self = user_data;
-  page_transition (self, HOTSSH_TAB_PAGE_LIST_CONNECTIONS);
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (!gtk_search_bar_get_search_mode ((GtkSearchBar*)priv->search_bar))
+    gtk_widget_grab_focus (priv->terminal);
 }
 
 static void
-on_negotiate_complete (GObject             *src,
-                       GAsyncResult        *result,
-                       gpointer             user_data)
+on_replay_event (HotSshReplayEventType  type,
+                 const guint8          *buf,
+                 gsize                  len,
+                 guint                  width,
+                 guint                  height,
+                 gpointer               user_data)
 {
   HotSshTab *self = user_data;
-  GError *local_error = NULL;
-
-  if (!gssh_connection_negotiate_finish ((GSshConnection*)src, result, &local_error))
-    goto out;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  VteTerminal *terminal = (VteTerminal*)priv->terminal;
 
-  set_status (self, _("Authenticating…"));
+  switch (type)
+    {
+    case HOTSSH_REPLAY_EVENT_RESET:
+      vte_terminal_reset (terminal, TRUE, TRUE);
+      vte_terminal_set_size (terminal, width, height);
+      break;
+    case HOTSSH_REPLAY_EVENT_OUTPUT:
+      vte_terminal_feed (terminal, (const char*)buf, len);
+      break;
+    case HOTSSH_REPLAY_EVENT_RESIZE:
+      vte_terminal_set_size (terminal, width, height);
+      break;
+    }
+}
 
-  iterate_authentication_modes (self);
+static char *
+format_replay_time (gint64 usec)
+{
+  guint s = usec / G_USEC_PER_SEC;
 
- out:
-  if (local_error)
-    page_transition_take_error (self, local_error);
+  if (s >= 3600)
+    return g_strdup_printf ("%u:%02u:%02u", s / 3600, (s / 60) % 60, s % 60);
+  return g_strdup_printf ("%u:%02u", s / 60, s % 60);
 }
 
 static void
-on_approve_hostkey_clicked (GtkButton     *button,
-			    gpointer       user_data)
+update_replay_position (HotSshTab *self)
 {
-  HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  gs_free char *keytype = NULL;
-  gs_free char *key_base64 = NULL;
+  gint64 position = hotssh_replay_get_position (priv->replay);
+  gs_free char *position_text = format_replay_time (position);
+  gs_free char *duration_text = format_replay_time (hotssh_replay_get_duration (priv->replay));
+  gs_free char *text = g_strdup_printf ("%s / %s", position_text, duration_text);
 
-  page_transition (self, HOTSSH_TAB_PAGE_CONNECTING);
-  set_status (self, _("Negotiating authentication…"));
-
-  gssh_connection_preauth_get_host_key (priv->connection,
-                                        &keytype, NULL, &key_base64);
+  gtk_range_set_value ((GtkRange*)priv->replay_scale, (double)position / G_USEC_PER_SEC);
+  gtk_label_set_text ((GtkLabel*)priv->replay_time_label, text);
+}
 
-  hotssh_hostdb_set_entry_host_key_known (hotssh_hostdb_get_instance (),
-                                          priv->connection_id,
-                                          keytype, key_base64,
-                                          NULL);
+/* Where playback would be now, in recording time */
+static gint64
+replay_clock_now (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gint64 elapsed = g_get_monotonic_time () - priv->replay_base_time;
 
-  gssh_connection_negotiate_async (priv->connection, priv->cancellable,
-                                   on_negotiate_complete, self);
+  return priv->replay_base_usec + (gint64)(elapsed * priv->replay_speed);
 }
 
 static void
-send_pty_size_request (HotSshTab             *self);
-
-static void
-on_pty_size_complete (GObject                    *src,
-		      GAsyncResult               *result,
-		      gpointer                    user_data)
+set_replay_clock (HotSshTab *self,
+                  gint64     usec)
 {
-  HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  GError *local_error = NULL;
 
-  g_debug ("pty size request complete");
-  priv->sent_pty_size_request = FALSE;
+  priv->replay_base_usec = usec;
+  priv->replay_base_time = g_get_monotonic_time ();
+}
 
-  if (!gssh_channel_request_pty_size_finish (priv->channel, result, &local_error))
-    goto out;
+static gboolean
+on_replay_tick (gpointer user_data);
 
-  if (priv->need_pty_size_request)
-    send_pty_size_request (self);
+static void
+schedule_replay_tick (HotSshTab *self,
+                      guint      delay_ms)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
 
- out:
-  if (local_error)
-    page_transition_take_error (self, local_error);
+  if (priv->replay_tick_id)
+    g_source_remove (priv->replay_tick_id);
+  /* Below redraw priority, so fast playback still gets painted */
+  priv->replay_tick_id = g_timeout_add_full (G_PRIORITY_DEFAULT_IDLE, delay_ms,
+                                             on_replay_tick, self, NULL);
 }
 
 static gboolean
-idle_send_pty_size_request (gpointer user_data)
+on_replay_tick (gpointer user_data)
 {
   HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  guint width = vte_terminal_get_column_count ((VteTerminal*)priv->terminal);
-  guint height = vte_terminal_get_row_count ((VteTerminal*)priv->terminal);
+  gint64 target = replay_clock_now (self);
+  gint64 next;
+  gint64 delay_ms;
 
-  priv->queued_pty_size_id = 0;
+  priv->replay_tick_id = 0;
 
-  g_assert (priv->connection);
+  next = hotssh_replay_play_until (priv->replay, target, REPLAY_TICK_MAX_BYTES,
+                                   on_replay_event, self);
+  update_replay_position (self);
 
-  if (gssh_connection_get_state (priv->connection) == GSSH_CONNECTION_STATE_CONNECTED)
+  if (next < 0)
     {
-      priv->need_pty_size_request = FALSE;
-      priv->sent_pty_size_request = TRUE;
-      gssh_channel_request_pty_size_async (priv->channel, width, height,
-                                           priv->cancellable, on_pty_size_complete, self);
+      gtk_toggle_button_set_active ((GtkToggleButton*)priv->replay_play_button, FALSE);
+      return FALSE;
     }
 
+  delay_ms = (gint64)((next - target) / priv->replay_speed / 1000);
+  schedule_replay_tick (self, CLAMP (delay_ms, 0, REPLAY_TICK_MAX_MS));
   return FALSE;
 }
 
 static void
-send_pty_size_request (HotSshTab             *self)
+on_replay_play_toggled (GtkToggleButton *button,
+                        gpointer         user_data)
 {
+  HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gboolean playing = gtk_toggle_button_get_active (button);
 
-  if (!priv->connection)
-    return;
+  gtk_image_set_from_icon_name ((GtkImage*)priv->replay_play_icon,
+                                playing ? "media-playback-pause-symbolic" : "media-playback-start-symbolic",
+                                GTK_ICON_SIZE_MENU);
+  gtk_widget_set_tooltip_text ((GtkWidget*)button, playing ? _("Pause") : _("Play"));
 
-  if (priv->queued_pty_size_id > 0)
+  if (priv->replay_tick_id)
+    {
+      g_source_remove (priv->replay_tick_id);
+      priv->replay_tick_id = 0;
+    }
+
+  if (!(playing && priv->replay))
     return;
-  
-  priv->queued_pty_size_id = g_idle_add (idle_send_pty_size_request, self);
+
+  if (hotssh_replay_get_position (priv->replay) >= hotssh_replay_get_duration (priv->replay))
+    {
+      hotssh_replay_seek (priv->replay, 0, on_replay_event, self);
+      update_replay_position (self);
+    }
+  set_replay_clock (self, hotssh_replay_get_position (priv->replay));
+  schedule_replay_tick (self, 0);
+}
+
+static gboolean
+on_replay_scale_change_value (GtkRange      *range,
+                              GtkScrollType  scroll,
+                              gdouble        value,
+                              gpointer       user_data)
+{
+  HotSshTab *self = user_data;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gint64 usec = (gint64)(value * G_USEC_PER_SEC);
+
+  if (!priv->replay)
+    return TRUE;
+
+  hotssh_replay_seek (priv->replay, usec, on_replay_event, self);
+  update_replay_position (self);
+  set_replay_clock (self, usec);
+  if (priv->replay_tick_id)
+    schedule_replay_tick (self, 0);
+
+  return TRUE;
 }
 
 static void
-on_terminal_size_allocate (GtkWidget    *widget,
-			   GdkRectangle *allocation,
-			   gpointer      user_data)
+on_replay_speed_changed (GtkSpinButton *spin,
+                         gpointer       user_data)
 {
   HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
 
-  if (priv->channel)
-    {
-      priv->need_pty_size_request = TRUE;
-      if (!priv->sent_pty_size_request)
-	send_pty_size_request (self);
-    }
+  if (priv->replay_tick_id)
+    set_replay_clock (self, replay_clock_now (self));
+  priv->replay_speed = gtk_spin_button_get_value (spin);
+  if (priv->replay_tick_id)
+    schedule_replay_tick (self, 0);
 }
 
 static void
-hotssh_tab_style_updated (GtkWidget      *widget)
+on_replay_open_complete (GObject      *src,
+                         GAsyncResult *result,
+                         gpointer      user_data)
 {
-  HotSshTab   *self = (HotSshTab*)widget;
+  gs_unref_object HotSshTab *self = user_data;
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
-  GdkRGBA fg, bg;
+  GError *local_error = NULL;
+  HotSshReplay *replay;
 
-  GTK_WIDGET_CLASS (hotssh_tab_parent_class)->style_updated (widget);
+  replay = hotssh_replay_open_finish (result, &local_error);
+  /* Closed or disconnected while indexing */
+  if (g_cancellable_is_cancelled (g_task_get_cancellable ((GTask*)result)))
+    {
+      g_clear_error (&local_error);
+      g_clear_pointer (&replay, hotssh_replay_free);
+      return;
+    }
+  if (!replay)
+    {
+      page_transition_take_error (self, local_error);
+      return;
+    }
 
-  /* Hardcode black on white for now; in the future I'd like to do
-   * per-host colors.
-   */
-  fg.red = fg.blue = fg.green = 0;
-  fg.alpha = 1;
-  bg.red = bg.blue = bg.green = 1;
-  bg.alpha = 1;
+  priv->replay = replay;
+  priv->replay_speed = gtk_spin_button_get_value ((GtkSpinButton*)priv->replay_speed_spin);
+  gtk_range_set_range ((GtkRange*)priv->replay_scale, 0,
+                       MAX ((double)hotssh_replay_get_duration (replay) / G_USEC_PER_SEC, 1));
+  update_input_enabled (self);
+  gtk_widget_show (priv->replay_box);
+  page_transition (self, HOTSSH_TAB_PAGE_TERMINAL);
 
-  vte_terminal_set_color_foreground ((VteTerminal*)priv->terminal, &fg);
-  vte_terminal_set_color_background ((VteTerminal*)priv->terminal, &bg);
-  vte_terminal_set_color_bold ((VteTerminal*)priv->terminal, &fg);
+  hotssh_replay_seek (replay, 0, on_replay_event, self);
+  update_replay_position (self);
+  gtk_toggle_button_set_active ((GtkToggleButton*)priv->replay_play_button, TRUE);
+}
+
+static void
+on_vte_realize (GtkWidget   *widget,
+                HotSshTab   *self)
+{
+  hotssh_tab_style_updated ((GtkWidget*)self);
 }
 
 static gboolean
-host_entry_match (GtkEntryCompletion *completion,
-                  const char         *key,
-                  GtkTreeIter        *iter,
-                  gpointer            user_data)
+capture_typeahead_key (HotSshTab   *self,
+                       GdkEventKey *event)
 {
-  gs_free char *host = NULL;
-  GtkTreeModel *model = gtk_entry_completion_get_model (completion);
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  char utf8[6];
+  gint len = 0;
 
-  if (host == NULL)
+  if (event->state & (GDK_CONTROL_MASK | GDK_MOD1_MASK))
     return FALSE;
 
-  gtk_tree_model_get (model, iter, 0, &host, -1);
+  switch (event->keyval)
+    {
+    case GDK_KEY_Return:
+    case GDK_KEY_KP_Enter:
+      utf8[len++] = '\r';
+      break;
+    case GDK_KEY_Tab:
+      utf8[len++] = '\t';
+      break;
+    case GDK_KEY_BackSpace:
+      if (priv->typeahead && priv->typeahead->len > 0)
+        {
+          const char *start = (const char*)priv->typeahead->data;
+          const char *prev = g_utf8_find_prev_char (start, start + priv->typeahead->len);
+          g_byte_array_set_size (priv->typeahead, prev ? prev - start : 0);
+          update_status_label (self);
+        }
+      return TRUE;
+    default:
+      {
+        gunichar c = gdk_keyval_to_unicode (event->keyval);
+        if (c == 0 || !g_unichar_isprint (c))
+          return FALSE;
+        len = g_unichar_to_utf8 (c, utf8);
+      }
+    }
 
-  return g_str_has_prefix (host, key);
+  if (!priv->typeahead)
+    priv->typeahead = g_byte_array_new ();
+  if (priv->typeahead->len + len > TYPEAHEAD_MAX)
+    {
+      gtk_widget_error_bell ((GtkWidget*)self);
+      return TRUE;
+    }
+
+  g_byte_array_append (priv->typeahead, (guint8*)utf8, len);
+  update_status_label (self);
+  return TRUE;
 }
 
-static void
-on_vte_realize (GtkWidget   *widget,
-                HotSshTab   *self)
+static gboolean
+hotssh_tab_key_press_event (GtkWidget   *widget,
+                            GdkEventKey *event)
 {
-  hotssh_tab_style_updated ((GtkWidget*)self);
+  HotSshTab *self = (HotSshTab*)widget;
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gboolean capturing;
+
+  capturing = priv->typeahead_enabled &&
+    (priv->active_page == HOTSSH_TAB_PAGE_CONNECTING ||
+     (priv->active_page == HOTSSH_TAB_PAGE_PASSWORD && priv->submitted_password));
+
+  if (capturing && capture_typeahead_key (self, event))
+    return TRUE;
+
+  return GTK_WIDGET_CLASS (hotssh_tab_parent_class)->key_press_event (widget, event);
 }
 
 static void
@@ -963,6 +3995,15 @@ hotssh_tab_get_property (GObject    *object,
     case PROP_HOSTNAME:
       g_value_set_string (value, priv->hostname);
       break;
+    case PROP_ALERT:
+      g_value_set_uint (value, priv->alert);
+      break;
+    case PROP_BROADCAST:
+      g_value_set_uint (value, priv->broadcast);
+      break;
+    case PROP_STALLED:
+      g_value_set_boolean (value, priv->stalled);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -975,6 +4016,7 @@ hotssh_tab_init (HotSshTab *self)
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
 
   priv->settings = g_settings_new ("org.gnome.hotssh");
+  priv->input_designated = TRUE;
 
   gtk_widget_init_template (GTK_WIDGET (self));
 
@@ -990,20 +4032,54 @@ hotssh_tab_init (HotSshTab *self)
   g_signal_connect_swapped (priv->password_entry, "activate", G_CALLBACK (submit_password), self);
   g_signal_connect_swapped (priv->password_submit, "clicked", G_CALLBACK (submit_password), self);
   g_signal_connect (priv->connections_treeview, "row-activated", G_CALLBACK (on_connection_row_activated), self);
-
-  priv->password_interaction = hotssh_password_interaction_new ((GtkEntry*)priv->password_entry);
+  g_signal_connect (gtk_tree_view_get_selection ((GtkTreeView*)priv->connections_treeview), "changed",
+                    G_CALLBACK (on_connections_selection_changed), self);
+  g_signal_connect (priv->connections_treeview, "motion-notify-event", G_CALLBACK (on_connections_motion), self);
+  g_signal_connect (priv->connections_treeview, "leave-notify-event", G_CALLBACK (on_connections_leave), self);
+  g_signal_connect (priv->host_entry, "changed", G_CALLBACK (on_host_entry_changed), self);
+  g_signal_connect (priv->username_entry, "changed", G_CALLBACK (on_host_entry_changed), self);
+  g_signal_connect (priv->paste_cancel_button, "clicked", G_CALLBACK (on_paste_cancel_clicked), self);
+  g_signal_connect (priv->replay_play_button, "toggled", G_CALLBACK (on_replay_play_toggled), self);
+  g_signal_connect (priv->replay_scale, "change-value", G_CALLBACK (on_replay_scale_change_value), self);
+  g_signal_connect (priv->replay_speed_spin, "value-changed", G_CALLBACK (on_replay_speed_changed), self);
+
+  priv->password_interaction = hotssh_password_interaction_new ();
   
   priv->terminal = vte_terminal_new ();
   g_signal_connect (priv->terminal, "realize", G_CALLBACK (on_vte_realize), self);
   vte_terminal_set_audible_bell ((VteTerminal*)priv->terminal, FALSE);  /* Audible bell is a terrible idea */
   g_signal_connect ((GObject*)priv->terminal, "size-allocate", G_CALLBACK (on_terminal_size_allocate), self);
   g_signal_connect ((GObject*)priv->terminal, "commit", G_CALLBACK (on_terminal_commit), self);
+  g_signal_connect ((GObject*)priv->terminal, "map", G_CALLBACK (on_terminal_map), self);
+  g_signal_connect (self, "hierarchy-changed", G_CALLBACK (on_hierarchy_changed), self);
   gtk_box_pack_start ((GtkBox*)priv->terminal_box, priv->terminal, TRUE, TRUE, 0);
   gtk_range_set_adjustment ((GtkRange*)priv->terminal_vscrollbar,
                             gtk_scrollable_get_vadjustment ((GtkScrollable*)priv->terminal));
   gtk_widget_show_all (priv->terminal_box);
 
-  g_queue_init (&priv->write_queue);
+  priv->predictor = hotssh_predictor_new ((VteTerminal*)priv->terminal);
+  g_signal_connect (priv->settings, "changed::predictive-echo",
+                    G_CALLBACK (on_predictive_echo_changed), self);
+  g_signal_connect (priv->settings, "changed::predictive-echo-threshold",
+                    G_CALLBACK (on_predictive_echo_changed), self);
+  on_predictive_echo_changed (priv->settings, NULL, self);
+
+  g_signal_connect (priv->settings, "changed::scrollback-index-memory",
+                    G_CALLBACK (on_scrollback_index_settings_changed), self);
+  g_signal_connect (priv->settings, "changed::scrollback-index-disk",
+                    G_CALLBACK (on_scrollback_index_settings_changed), self);
+  on_scrollback_index_settings_changed (priv->settings, NULL, self);
+
+  gtk_search_bar_connect_entry ((GtkSearchBar*)priv->search_bar, (GtkEntry*)priv->search_entry);
+  g_signal_connect (priv->search_bar, "notify::search-mode-enabled",
+                    G_CALLBACK (on_search_mode_changed), self);
+  g_signal_connect (priv->search_entry, "search-changed", G_CALLBACK (on_search_changed), self);
+  g_signal_connect (priv->search_entry, "key-press-event",
+                    G_CALLBACK (on_search_entry_key_press), self);
+
+  g_signal_connect (priv->settings, "changed::alert-patterns",
+                    G_CALLBACK (on_alert_patterns_changed), self);
+  on_alert_patterns_changed (priv->settings, NULL, self);
 
   {
     gs_unref_object HotSshHostDB *hostdb = hotssh_hostdb_get_instance ();
@@ -1028,6 +4104,22 @@ hotssh_tab_dispose (GObject *object)
   page_transition (self, HOTSSH_TAB_PAGE_LIST_CONNECTIONS);
 
   g_clear_object (&priv->host_completion);
+  if (priv->preconnect_timeout_id)
+    {
+      g_source_remove (priv->preconnect_timeout_id);
+      priv->preconnect_timeout_id = 0;
+    }
+  g_clear_pointer (&priv->preconnect_id, g_free);
+  g_clear_pointer (&priv->typeahead, g_byte_array_unref);
+  g_clear_pointer (&priv->held_input, g_byte_array_unref);
+  g_clear_pointer (&priv->background_backlog, g_byte_array_unref);
+  g_clear_pointer (&priv->status_text, g_free);
+  g_clear_pointer (&priv->predictor, hotssh_predictor_free);
+  g_clear_pointer (&priv->scanner, hotssh_scanner_free);
+  g_clear_pointer (&priv->scrollback_index, hotssh_scrollback_index_free);
+  if (priv->settings)
+    g_signal_handlers_disconnect_by_data (priv->settings, self);
+  g_clear_object (&priv->settings);
 
   G_OBJECT_CLASS (hotssh_tab_parent_class)->dispose (object);
 }
@@ -1209,14 +4301,61 @@ hotssh_tab_class_init (HotSshTabClass *class)
   gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, disapprove_hostkey_button);
   gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, terminal_box);
   gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, terminal_vscrollbar);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, paste_progress_box);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, paste_progress);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, paste_cancel_button);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, search_bar);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, search_entry);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, replay_box);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, replay_play_button);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, replay_play_icon);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, replay_scale);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, replay_time_label);
+  gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), HotSshTab, replay_speed_spin);
 
   GTK_WIDGET_CLASS (class)->style_updated = hotssh_tab_style_updated;
+  GTK_WIDGET_CLASS (class)->key_press_event = hotssh_tab_key_press_event;
 
   g_object_class_install_property (G_OBJECT_CLASS (class),
                                    PROP_HOSTNAME,
                                    g_param_spec_string ("hostname", "Hostname", "",
 							NULL,
                                                         G_PARAM_READABLE));
+  g_object_class_install_property (G_OBJECT_CLASS (class),
+                                   PROP_ALERT,
+                                   g_param_spec_uint ("alert", "Alert", "",
+                                                      HOTSSH_TAB_ALERT_NONE,
+                                                      HOTSSH_TAB_ALERT_ATTENTION,
+                                                      HOTSSH_TAB_ALERT_NONE,
+                                                      G_PARAM_READABLE));
+  g_object_class_install_property (G_OBJECT_CLASS (class),
+                                   PROP_BROADCAST,
+                                   g_param_spec_uint ("broadcast", "Broadcast", "",
+                                                      HOTSSH_TAB_BROADCAST_NONE,
+                                                      HOTSSH_TAB_BROADCAST_SKIPPED,
+                                                      HOTSSH_TAB_BROADCAST_NONE,
+                                                      G_PARAM_READABLE));
+  /* The host has stopped answering, though the connection hasn't
+   * failed (yet)
+   */
+  g_object_class_install_property (G_OBJECT_CLASS (class),
+                                   PROP_STALLED,
+                                   g_param_spec_boolean ("stalled", "Stalled", "",
+                                                         FALSE,
+                                                         G_PARAM_READABLE));
+
+  /* Input typed into a broadcast group member, for the window to send
+   * to every member.
+   */
+  signals[BROADCAST_INPUT] =
+    g_signal_new ("broadcast-input", G_TYPE_FROM_CLASS (class),
+                  G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 1, G_TYPE_BYTES | G_SIGNAL_TYPE_STATIC_SCOPE);
+  /* A paste large enough to be streamed, likewise */
+  signals[BROADCAST_PASTE] =
+    g_signal_new ("broadcast-paste", G_TYPE_FROM_CLASS (class),
+                  G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 1, G_TYPE_BYTES | G_SIGNAL_TYPE_STATIC_SCOPE);
 }
 
 HotSshTab *
@@ -1238,8 +4377,89 @@ hotssh_tab_new_channel  (HotSshTab *source)
   page_transition (tab, HOTSSH_TAB_PAGE_CONNECTING);
 
   priv->hostname = g_strdup (source_priv->hostname);
+  priv->typeahead_enabled = source_priv->typeahead_enabled;
+  priv->connection_id = g_strdup (source_priv->connection_id);
+  priv->username = g_strdup (source_priv->username);
+  if (source_priv->address)
+    priv->address = g_object_ref (source_priv->address);
+  priv->worker = source_priv->worker;
+  priv->cancellable = g_cancellable_new ();
   priv->connection = g_object_ref (source_priv->connection);
-  on_connection_state_notify (priv->connection, NULL, tab);
+  priv->connection_pooled = hotssh_connection_pool_hold (priv->connection);
+  priv->connection_state = source_priv->connection_state;
+  handle_connection_state (tab, priv->connection_state);
+
+  return tab;
+}
+
+/**
+ * hotssh_tab_new_replay:
+ *
+ * Open the session recording at @path in a read-only tab.  The file
+ * is indexed in the background first, so that seeking is cheap.
+ */
+HotSshTab *
+hotssh_tab_new_replay (const char *path)
+{
+  HotSshTab *tab = hotssh_tab_new ();
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (tab);
+
+  state_reset_for_new_connection (tab);
+
+  g_free (priv->hostname);
+  priv->hostname = g_path_get_basename (path);
+  g_object_notify ((GObject*)tab, "hostname");
+
+  set_status (tab, _("Indexing recording…"));
+  page_transition (tab, HOTSSH_TAB_PAGE_CONNECTING);
+
+  priv->cancellable = g_cancellable_new ();
+  hotssh_replay_open_async (path, priv->cancellable, on_replay_open_complete,
+                            g_object_ref (tab));
+
+  return tab;
+}
+
+/**
+ * hotssh_tab_new_mirror:
+ *
+ * Open another view of the session in @source, sharing its output
+ * rather than opening a channel.  The view starts without input; see
+ * hotssh_tab_take_input().
+ *
+ * Returns: (allow-none): A new tab, or %NULL if @source has no session
+ */
+HotSshTab *
+hotssh_tab_new_mirror (HotSshTab *source)
+{
+  HotSshTabPrivate *source_priv = hotssh_tab_get_instance_private (source);
+  HotSshTab *tab;
+  HotSshTabPrivate *priv;
+
+  /* A mirror of a mirror is another view of the same session */
+  if (source_priv->mirror_source)
+    {
+      source = source_priv->mirror_source;
+      source_priv = hotssh_tab_get_instance_private (source);
+    }
+  if (!source_priv->mirror)
+    return NULL;
+
+  tab = hotssh_tab_new ();
+  priv = hotssh_tab_get_instance_private (tab);
+
+  state_reset_for_new_connection (tab);
+
+  g_free (priv->hostname);
+  priv->hostname = g_strdup_printf (_("%s (mirror)"), source_priv->hostname);
+  g_object_notify ((GObject*)tab, "hostname");
+
+  priv->mirror_source = source;
+  priv->input_designated = FALSE;
+  update_input_enabled (tab);
+  page_transition (tab, HOTSSH_TAB_PAGE_TERMINAL);
+  priv->mirror_view_id = hotssh_mirror_add_view (source_priv->mirror,
+                                                 &mirror_view_callbacks, tab);
 
   return tab;
 }
@@ -1247,6 +4467,15 @@ hotssh_tab_new_channel  (HotSshTab *source)
 void
 hotssh_tab_disconnect  (HotSshTab *self)
 {
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  /* Don't leave it in the pool for the next tab to pick up */
+  if (priv->connection_pooled)
+    {
+      hotssh_connection_pool_release (priv->connection);
+      priv->connection_pooled = FALSE;
+      hotssh_connection_pool_evict (priv->connection);
+    }
   page_transition (self, HOTSSH_TAB_PAGE_LIST_CONNECTIONS);
 }
 
@@ -1257,12 +4486,271 @@ hotssh_tab_get_hostname (HotSshTab *self)
   return priv->hostname;
 }
 
+HotSshTabAlert
+hotssh_tab_get_alert (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  return priv->alert;
+}
+
 gboolean
 hotssh_tab_is_connected (HotSshTab *self)
 {
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
   return priv->connection &&
-    gssh_connection_get_state (priv->connection) == GSSH_CONNECTION_STATE_CONNECTED;
+    priv->connection_state == GSSH_CONNECTION_STATE_CONNECTED;
+}
+
+const char *
+hotssh_tab_get_connection_id (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  return priv->connection_id;
+}
+
+/**
+ * hotssh_tab_get_connection:
+ *
+ * Returns: (transfer none): The tab's authenticated connection, for
+ * opening further channels on, or %NULL if it isn't connected
+ */
+GSshConnection *
+hotssh_tab_get_connection (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (!hotssh_tab_is_connected (self))
+    return NULL;
+  return priv->connection;
+}
+
+/* Whether @addr is still configured on one of our interfaces; once it
+ * goes, so have the connections made from it, whatever TCP thinks.
+ */
+static gboolean
+local_address_present (GInetAddress *addr)
+{
+  struct ifaddrs *ifaddrs;
+  struct ifaddrs *ifa;
+  gboolean ret = FALSE;
+
+  /* Can't tell, so don't assume the worst */
+  if (getifaddrs (&ifaddrs) != 0)
+    return TRUE;
+
+  for (ifa = ifaddrs; ifa && !ret; ifa = ifa->ifa_next)
+    {
+      gs_unref_object GSocketAddress *sockaddr = NULL;
+      gsize len;
+
+      if (!ifa->ifa_addr)
+        continue;
+      if (ifa->ifa_addr->sa_family == AF_INET)
+        len = sizeof (struct sockaddr_in);
+      else if (ifa->ifa_addr->sa_family == AF_INET6)
+        len = sizeof (struct sockaddr_in6);
+      else
+        continue;
+
+      sockaddr = g_socket_address_new_from_native (ifa->ifa_addr, len);
+      if (sockaddr && G_IS_INET_SOCKET_ADDRESS (sockaddr)
+          && g_inet_address_equal (g_inet_socket_address_get_address ((GInetSocketAddress*)sockaddr), addr))
+        ret = TRUE;
+    }
+
+  freeifaddrs (ifaddrs);
+  return ret;
+}
+
+/**
+ * hotssh_tab_network_changed:
+ *
+ * The network came back or changed, or the system resumed.  Drop a
+ * session whose local address has gone away, and retry straight away
+ * if waiting to reconnect.
+ */
+void
+hotssh_tab_network_changed (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GSocket *socket;
+  gs_unref_object GSocketAddress *local_address = NULL;
+
+  if (priv->reconnect_timeout_id)
+    {
+      g_source_remove (priv->reconnect_timeout_id);
+      priv->reconnect_attempt = 1;
+      /* Still spread out, but the network is probably there now */
+      priv->reconnect_timeout_id =
+        g_timeout_add (g_random_int_range (0, RECONNECT_BASE_DELAY_MS * 2),
+                       on_reconnect_timeout, self);
+      return;
+    }
+
+  if (!(priv->channel && priv->connection))
+    return;
+
+  socket = hotssh_keepalive_get_socket (priv->connection);
+  if (socket)
+    local_address = g_socket_get_local_address (socket, NULL);
+  if (local_address && G_IS_INET_SOCKET_ADDRESS (local_address)
+      && !local_address_present (g_inet_socket_address_get_address ((GInetSocketAddress*)local_address)))
+    {
+      g_debug ("local address of connection is gone");
+      connection_lost (self, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_NETWORK_UNREACHABLE,
+                                                  _("The network changed")));
+    }
+}
+
+gboolean
+hotssh_tab_is_stalled (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  return priv->stalled;
+}
+
+/**
+ * hotssh_tab_get_rtt:
+ * @out_usec: (out): The kernel's smoothed round trip time
+ * @out_var_usec: (out): Its mean deviation
+ *
+ * Returns: %FALSE if there's no measurement yet
+ */
+gboolean
+hotssh_tab_get_rtt (HotSshTab *self,
+                    guint     *out_usec,
+                    guint     *out_var_usec)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (priv->rtt_usec == 0)
+    return FALSE;
+
+  *out_usec = priv->rtt_usec;
+  *out_var_usec = priv->rtt_var_usec;
+  return TRUE;
+}
+
+void
+hotssh_tab_set_broadcast (HotSshTab *self,
+                          gboolean   member)
+{
+  set_broadcast_state (self, member ? HOTSSH_TAB_BROADCAST_ACTIVE : HOTSSH_TAB_BROADCAST_NONE);
+}
+
+HotSshTabBroadcast
+hotssh_tab_get_broadcast (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  return priv->broadcast;
+}
+
+/**
+ * hotssh_tab_send_broadcast:
+ *
+ * Queue input from the window's broadcast group.  A member that can't
+ * take it promptly, because it is disconnected or its write queue is
+ * backed up, is skipped rather than waited for, and stays out until
+ * it rejoins.
+ */
+void
+hotssh_tab_send_broadcast (HotSshTab *self,
+                           GBytes    *bytes)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gsize len;
+  const guint8 *buf = g_bytes_get_data (bytes, &len);
+  gsize queued;
+
+  if (!(priv->broadcast == HOTSSH_TAB_BROADCAST_ACTIVE ||
+        priv->broadcast == HOTSSH_TAB_BROADCAST_LAGGING))
+    return;
+
+  if (!priv->pump || priv->input_throttled)
+    {
+      set_broadcast_state (self, HOTSSH_TAB_BROADCAST_SKIPPED);
+      return;
+    }
+
+  send_input (self, buf, len);
+
+  queued = hotssh_channel_pump_get_write_queued (priv->pump);
+  if (queued >= BROADCAST_LAG_BYTES)
+    set_broadcast_state (self, HOTSSH_TAB_BROADCAST_LAGGING);
+}
+
+/**
+ * hotssh_tab_send_broadcast_paste:
+ *
+ * Start streaming a large paste from the window's broadcast group.
+ * The data is shared between members, each pacing it through its own
+ * write queue; a member that can't start it now is skipped as with
+ * hotssh_tab_send_broadcast().
+ */
+void
+hotssh_tab_send_broadcast_paste (HotSshTab *self,
+                                 GBytes    *bytes)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (!(priv->broadcast == HOTSSH_TAB_BROADCAST_ACTIVE ||
+        priv->broadcast == HOTSSH_TAB_BROADCAST_LAGGING))
+    return;
+
+  if (!priv->pump || priv->input_throttled || priv->indisposed
+      || !start_streamed_paste (self, bytes))
+    set_broadcast_state (self, HOTSSH_TAB_BROADCAST_SKIPPED);
+}
+
+/**
+ * hotssh_tab_paste_clipboard:
+ *
+ * Paste the clipboard into the session.  Small pastes are sent whole,
+ * like typed input; large ones are streamed through the write queue in
+ * bounded chunks with a progress bar and a way to cancel.
+ */
+void
+hotssh_tab_paste_clipboard (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  GtkClipboard *clipboard = gtk_widget_get_clipboard (priv->terminal, GDK_SELECTION_CLIPBOARD);
+
+  gtk_clipboard_request_text (clipboard, on_paste_text_received, g_object_ref (self));
+}
+
+/**
+ * hotssh_tab_jump_to_command:
+ *
+ * Scroll to the prompt of the command before or after the one at the
+ * top of the view, or at the cursor if not scrolled back.
+ */
+void
+hotssh_tab_jump_to_command (HotSshTab *self,
+                            gboolean   backwards)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+  gint64 row;
+
+  row = hotssh_scrollback_index_find_command (priv->scrollback_index,
+                                              get_navigation_row (self),
+                                              backwards, NULL);
+  if (row < 0)
+    {
+      gtk_widget_error_bell (priv->terminal);
+      return;
+    }
+
+  scroll_to_row (self, row);
+}
+
+void
+hotssh_tab_start_search (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  priv->search_row = get_navigation_row (self);
+  gtk_search_bar_set_search_mode ((GtkSearchBar*)priv->search_bar, TRUE);
+  gtk_widget_grab_focus (priv->search_entry);
 }
 
 VteTerminal *
@@ -1271,3 +4759,27 @@ hotssh_tab_get_terminal (HotSshTab *self)
   HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
   return (VteTerminal*)priv->terminal;
 }
+
+/**
+ * hotssh_tab_take_input:
+ *
+ * For a mirrored session, make this the view whose keystrokes go to
+ * the remote, in place of whichever view had them.
+ */
+void
+hotssh_tab_take_input (HotSshTab *self)
+{
+  HotSshTabPrivate *priv = hotssh_tab_get_instance_private (self);
+
+  if (priv->mirror_source)
+    {
+      HotSshTabPrivate *source_priv = hotssh_tab_get_instance_private (priv->mirror_source);
+      hotssh_mirror_set_input_view (source_priv->mirror, priv->mirror_view_id);
+    }
+  else if (priv->mirror)
+    hotssh_mirror_set_input_view (priv->mirror, 0);
+  else
+    return;
+
+  gtk_widget_grab_focus (priv->terminal);
+}
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <vte/vte.h>
+#include "gssh.h"
 
 #define HOTSSH_TYPE_TAB (hotssh_tab_get_type ())
 #define HOTSSH_TAB(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), HOTSSH_TYPE_TAB, HotSshTab))
@@ -26,15 +27,62 @@
 typedef struct _HotSshTab         HotSshTab;
 typedef struct _HotSshTabClass    HotSshTabClass;
 
+/* Something happened in a tab the user isn't looking at */
+typedef enum {
+  HOTSSH_TAB_ALERT_NONE,
+  HOTSSH_TAB_ALERT_ACTIVITY,
+  HOTSSH_TAB_ALERT_ATTENTION
+} HotSshTabAlert;
+
+/* Where a tab stands in its window's broadcast group */
+typedef enum {
+  HOTSSH_TAB_BROADCAST_NONE,
+  HOTSSH_TAB_BROADCAST_ACTIVE,
+  /* Still receiving, but input is queued behind a slow connection */
+  HOTSSH_TAB_BROADCAST_LAGGING,
+  /* Missed input because it fell too far behind or disconnected;
+   * receives nothing more until it rejoins.
+   */
+  HOTSSH_TAB_BROADCAST_SKIPPED
+} HotSshTabBroadcast;
+
 
 GType                   hotssh_tab_get_type     (void);
 HotSshTab              *hotssh_tab_new          (void);
 HotSshTab              *hotssh_tab_new_channel  (HotSshTab *source);
+HotSshTab              *hotssh_tab_new_replay   (const char *path);
+HotSshTab              *hotssh_tab_new_mirror   (HotSshTab *source);
 
 void                    hotssh_tab_disconnect  (HotSshTab *source);
 
 const char *            hotssh_tab_get_hostname (HotSshTab *self);
 
 gboolean                hotssh_tab_is_connected (HotSshTab *self);
+const char *            hotssh_tab_get_connection_id (HotSshTab *self);
+GSshConnection *        hotssh_tab_get_connection    (HotSshTab *self);
+
+void                    hotssh_tab_network_changed   (HotSshTab *self);
+gboolean                hotssh_tab_is_stalled        (HotSshTab *self);
+gboolean                hotssh_tab_get_rtt           (HotSshTab *self,
+                                                      guint     *out_usec,
+                                                      guint     *out_var_usec);
+
+HotSshTabAlert          hotssh_tab_get_alert    (HotSshTab *self);
+
+void                    hotssh_tab_set_broadcast  (HotSshTab *self,
+                                                   gboolean   member);
+HotSshTabBroadcast      hotssh_tab_get_broadcast  (HotSshTab *self);
+void                    hotssh_tab_send_broadcast (HotSshTab *self,
+                                                   GBytes    *bytes);
+void                    hotssh_tab_send_broadcast_paste (HotSshTab *self,
+                                                         GBytes    *bytes);
 
 VteTerminal            *hotssh_tab_get_terminal (HotSshTab *self);
+
+void                    hotssh_tab_paste_clipboard (HotSshTab *self);
+
+void                    hotssh_tab_jump_to_command (HotSshTab *self,
+                                                    gboolean   backwards);
+void                    hotssh_tab_start_search    (HotSshTab *self);
+
+void                    hotssh_tab_take_input      (HotSshTab *self);
@@ -18,6 +18,8 @@
 
 #include "hotssh-win.h"
 #include "hotssh-tab.h"
+#include "hotssh-recorder.h"
+#include "hotssh-fleet-window.h"
 
 #include "libgsystem.h"
 
@@ -41,6 +43,39 @@ static void paste_activated (GSimpleAction    *action,
 static void switch_tab_activated (GSimpleAction    *action,
                                   GVariant         *parameter,
                                   gpointer          user_data);
+static void open_recording_activated (GSimpleAction    *action,
+                                      GVariant         *parameter,
+                                      gpointer          user_data);
+static void previous_command_activated (GSimpleAction    *action,
+                                        GVariant         *parameter,
+                                        gpointer          user_data);
+static void next_command_activated (GSimpleAction    *action,
+                                    GVariant         *parameter,
+                                    gpointer          user_data);
+static void find_activated (GSimpleAction    *action,
+                            GVariant         *parameter,
+                            gpointer          user_data);
+static void mirror_tab_activated (GSimpleAction    *action,
+                                  GVariant         *parameter,
+                                  gpointer          user_data);
+static void mirror_window_activated (GSimpleAction    *action,
+                                     GVariant         *parameter,
+                                     gpointer          user_data);
+static void take_input_activated (GSimpleAction    *action,
+                                  GVariant         *parameter,
+                                  gpointer          user_data);
+static void broadcast_activated (GSimpleAction    *action,
+                                 GVariant         *parameter,
+                                 gpointer          user_data);
+static void broadcast_all_activated (GSimpleAction    *action,
+                                     GVariant         *parameter,
+                                     gpointer          user_data);
+static void broadcast_none_activated (GSimpleAction    *action,
+                                      GVariant         *parameter,
+                                      gpointer          user_data);
+static void fleet_exec_activated (GSimpleAction    *action,
+                                  GVariant         *parameter,
+                                  gpointer          user_data);
 
 static GActionEntry win_entries[] = {
   /* For now, autotab == new channel if possible */
@@ -50,6 +85,17 @@ static GActionEntry win_entries[] = {
   { "disconnect", disconnect_activated, NULL, NULL, NULL },
   { "copy", copy_activated, NULL, NULL, NULL },
   { "paste", paste_activated, NULL, NULL, NULL },
+  { "open-recording", open_recording_activated, NULL, NULL, NULL },
+  { "previous-command", previous_command_activated, NULL, NULL, NULL },
+  { "next-command", next_command_activated, NULL, NULL, NULL },
+  { "find", find_activated, NULL, NULL, NULL },
+  { "mirror-tab", mirror_tab_activated, NULL, NULL, NULL },
+  { "mirror-window", mirror_window_activated, NULL, NULL, NULL },
+  { "take-input", take_input_activated, NULL, NULL, NULL },
+  { "broadcast", broadcast_activated, NULL, NULL, NULL },
+  { "broadcast-all", broadcast_all_activated, NULL, NULL, NULL },
+  { "broadcast-none", broadcast_none_activated, NULL, NULL, NULL },
+  { "fleet-exec", fleet_exec_activated, NULL, NULL, NULL },
   { "switch-tab", switch_tab_activated, "u", "uint32 0", NULL }
 };
 
@@ -75,6 +121,9 @@ struct _HotSshWindowPrivate
 
   gboolean indisposed;
 
+  /* Tabs whose input is sent to all of them; see HotSshTabBroadcast */
+  GPtrArray *broadcast_members;
+
   /* Bound via template */
   GtkWidget *main_notebook;
   GtkWidget *gears;
@@ -138,6 +187,28 @@ on_tab_close_button_clicked (GtkButton    *button,
     set_close_button_visibility (win, FALSE);
 }
 
+/* Round trip times change too often to keep a tooltip up to date */
+static gboolean
+on_tab_label_query_tooltip (GtkWidget  *widget,
+                            gint        x,
+                            gint        y,
+                            gboolean    keyboard_mode,
+                            GtkTooltip *tooltip,
+                            gpointer    user_data)
+{
+  HotSshTab *tab = user_data;
+  guint rtt_usec, rtt_var_usec;
+  gs_free char *text = NULL;
+
+  if (!hotssh_tab_get_rtt (tab, &rtt_usec, &rtt_var_usec))
+    return FALSE;
+
+  text = g_strdup_printf (_("Smoothed round trip time %.1f ms (deviation %.1f ms)"),
+                          rtt_usec / 1000.0, rtt_var_usec / 1000.0);
+  gtk_tooltip_set_text (tooltip, text);
+  return TRUE;
+}
+
 static GtkWidget *
 create_tab_label (HotSshWindow       *self,
 		  HotSshTab          *tab)
@@ -146,6 +217,9 @@ create_tab_label (HotSshWindow       *self,
   GtkLabel *label;
   GtkButton *close_button;
   GtkImage *close_image;
+  GtkImage *alert_image;
+  GtkImage *stalled_image;
+  GtkImage *broadcast_image;
 
   label_box = (GtkContainer*)gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
   label = (GtkLabel*)gtk_label_new ("");
@@ -154,6 +228,23 @@ create_tab_label (HotSshWindow       *self,
   gtk_misc_set_padding ((GtkMisc*)label, 0, 0);
   gtk_box_pack_start ((GtkBox*)label_box, (GtkWidget*)label, TRUE, TRUE, 0);
   gtk_widget_set_halign ((GtkWidget*)label, GTK_ALIGN_CENTER);
+  gtk_widget_set_has_tooltip ((GtkWidget*)label, TRUE);
+  g_signal_connect (label, "query-tooltip", G_CALLBACK (on_tab_label_query_tooltip), tab);
+
+  alert_image = (GtkImage*)gtk_image_new_from_icon_name ("dialog-information-symbolic",
+                                                         GTK_ICON_SIZE_MENU);
+  gtk_widget_set_no_show_all ((GtkWidget*)alert_image, TRUE);
+  gtk_box_pack_start ((GtkBox*)label_box, (GtkWidget*)alert_image, FALSE, FALSE, 0);
+
+  stalled_image = (GtkImage*)gtk_image_new_from_icon_name ("network-no-route-symbolic",
+                                                           GTK_ICON_SIZE_MENU);
+  gtk_widget_set_tooltip_text ((GtkWidget*)stalled_image, _("The host has stopped responding"));
+  gtk_widget_set_no_show_all ((GtkWidget*)stalled_image, TRUE);
+  gtk_box_pack_start ((GtkBox*)label_box, (GtkWidget*)stalled_image, FALSE, FALSE, 0);
+
+  broadcast_image = (GtkImage*)gtk_image_new ();
+  gtk_widget_set_no_show_all ((GtkWidget*)broadcast_image, TRUE);
+  gtk_box_pack_start ((GtkBox*)label_box, (GtkWidget*)broadcast_image, FALSE, FALSE, 0);
 
   close_button = (GtkButton*)gtk_button_new ();
   gtk_widget_set_name ((GtkWidget*)close_button, "hotssh-tab-close-button");
@@ -174,6 +265,9 @@ create_tab_label (HotSshWindow       *self,
   gtk_widget_set_halign ((GtkWidget*)label_box, GTK_ALIGN_FILL);
   g_object_set_data ((GObject*)label_box, "label-text", label);
   g_object_set_data ((GObject*)label_box, "close-button", close_button);
+  g_object_set_data ((GObject*)label_box, "alert-image", alert_image);
+  g_object_set_data ((GObject*)label_box, "stalled-image", stalled_image);
+  g_object_set_data ((GObject*)label_box, "broadcast-image", broadcast_image);
   return (GtkWidget*)label_box;
 }
 
@@ -185,8 +279,102 @@ on_tab_hostname_changed (HotSshTab           *tab,
   HotSshWindowPrivate *priv = hotssh_window_get_instance_private (self);
   GtkWidget *label_box = gtk_notebook_get_tab_label ((GtkNotebook*)priv->main_notebook, (GtkWidget*)tab);
   GtkLabel *real_label = GTK_LABEL (g_object_get_data ((GObject*)label_box, "label-text"));
+  GtkWidget *alert_image = g_object_get_data ((GObject*)label_box, "alert-image");
+  GtkWidget *stalled_image = g_object_get_data ((GObject*)label_box, "stalled-image");
+  GtkWidget *broadcast_image = g_object_get_data ((GObject*)label_box, "broadcast-image");
   const char *hostname = hotssh_tab_get_hostname (tab);
-  gtk_label_set_text (real_label, hostname ? hostname : _("Disconnected"));
+  const char *text = hostname ? hostname : _("Disconnected");
+  gs_free char *markup = NULL;
+
+  switch (hotssh_tab_get_alert (tab))
+    {
+    case HOTSSH_TAB_ALERT_NONE:
+      gtk_label_set_text (real_label, text);
+      gtk_widget_hide (alert_image);
+      break;
+    case HOTSSH_TAB_ALERT_ACTIVITY:
+      markup = g_markup_printf_escaped ("<i>%s</i>", text);
+      gtk_label_set_markup (real_label, markup);
+      gtk_widget_hide (alert_image);
+      break;
+    case HOTSSH_TAB_ALERT_ATTENTION:
+      markup = g_markup_printf_escaped ("<b>%s</b>", text);
+      gtk_label_set_markup (real_label, markup);
+      gtk_widget_show (alert_image);
+      break;
+    }
+
+  gtk_widget_set_visible (stalled_image, hotssh_tab_is_stalled (tab));
+
+  switch (hotssh_tab_get_broadcast (tab))
+    {
+    case HOTSSH_TAB_BROADCAST_NONE:
+      gtk_widget_hide (broadcast_image);
+      return;
+    case HOTSSH_TAB_BROADCAST_ACTIVE:
+      gtk_image_set_from_icon_name ((GtkImage*)broadcast_image, "network-transmit-symbolic",
+                                    GTK_ICON_SIZE_MENU);
+      gtk_widget_set_tooltip_text (broadcast_image, _("Receiving broadcast input"));
+      break;
+    case HOTSSH_TAB_BROADCAST_LAGGING:
+      gtk_image_set_from_icon_name ((GtkImage*)broadcast_image, "network-idle-symbolic",
+                                    GTK_ICON_SIZE_MENU);
+      gtk_widget_set_tooltip_text (broadcast_image, _("Broadcast input is queued behind a slow connection"));
+      break;
+    case HOTSSH_TAB_BROADCAST_SKIPPED:
+      gtk_image_set_from_icon_name ((GtkImage*)broadcast_image, "network-error-symbolic",
+                                    GTK_ICON_SIZE_MENU);
+      gtk_widget_set_tooltip_text (broadcast_image, _("Missed broadcast input; toggle broadcast to rejoin"));
+      break;
+    }
+  gtk_widget_show (broadcast_image);
+}
+
+static void
+on_tab_broadcast_input (HotSshTab    *tab,
+                        GBytes       *bytes,
+                        HotSshWindow *self)
+{
+  HotSshWindowPrivate *priv = hotssh_window_get_instance_private (self);
+  guint i;
+
+  for (i = 0; i < priv->broadcast_members->len; i++)
+    hotssh_tab_send_broadcast (priv->broadcast_members->pdata[i], bytes);
+}
+
+static void
+on_tab_broadcast_paste (HotSshTab    *tab,
+                        GBytes       *bytes,
+                        HotSshWindow *self)
+{
+  HotSshWindowPrivate *priv = hotssh_window_get_instance_private (self);
+  guint i;
+
+  for (i = 0; i < priv->broadcast_members->len; i++)
+    hotssh_tab_send_broadcast_paste (priv->broadcast_members->pdata[i], bytes);
+}
+
+static void
+set_broadcast_member (HotSshWindow *self,
+                      HotSshTab    *tab,
+                      gboolean      member)
+{
+  HotSshWindowPrivate *priv = hotssh_window_get_instance_private (self);
+
+  g_ptr_array_remove (priv->broadcast_members, tab);
+  if (member)
+    g_ptr_array_add (priv->broadcast_members, tab);
+  hotssh_tab_set_broadcast (tab, member);
+}
+
+static void
+on_notebook_page_removed (GtkNotebook  *notebook,
+                          GtkWidget    *child,
+                          guint         page_num,
+                          HotSshWindow *self)
+{
+  HotSshWindowPrivate *priv = hotssh_window_get_instance_private (self);
+  g_ptr_array_remove (priv->broadcast_members, child);
 }
 
 typedef enum {
@@ -195,30 +383,16 @@ typedef enum {
 } NewTabKind;
 
 static void
-hotssh_win_append_tab (HotSshWindow   *self, NewTabKind kind)
+hotssh_win_add_tab (HotSshWindow   *self,
+                    HotSshTab      *tab)
 {
   HotSshWindowPrivate *priv = hotssh_window_get_instance_private (self);
   GtkWidget *label;
-  HotSshTab *tab;
   int idx;
   guint n_pages;
   gboolean is_first_tab;
   gboolean was_single_tab;
 
-  if (kind == NEW_TAB_CHANNEL_OR_AUTO)
-    {
-      guint i = gtk_notebook_get_current_page ((GtkNotebook*)priv->main_notebook);
-      HotSshTab *current_tab = (HotSshTab*)gtk_notebook_get_nth_page ((GtkNotebook*)priv->main_notebook, i);
-      if (hotssh_tab_is_connected (current_tab))
-        tab = hotssh_tab_new_channel (current_tab);
-      else
-        tab = hotssh_tab_new ();
-    }
-  else
-    {
-      tab = hotssh_tab_new ();
-    }
-
   n_pages = gtk_notebook_get_n_pages ((GtkNotebook*)priv->main_notebook);
   is_first_tab = n_pages == 0;
   was_single_tab = n_pages == 1;
@@ -226,6 +400,11 @@ hotssh_win_append_tab (HotSshWindow   *self, NewTabKind kind)
   g_object_set_data ((GObject*)tab, "window", self);
   label = create_tab_label (self, tab);
   g_signal_connect ((GObject*)tab, "notify::hostname", G_CALLBACK (on_tab_hostname_changed), self);
+  g_signal_connect ((GObject*)tab, "notify::alert", G_CALLBACK (on_tab_hostname_changed), self);
+  g_signal_connect ((GObject*)tab, "notify::broadcast", G_CALLBACK (on_tab_hostname_changed), self);
+  g_signal_connect ((GObject*)tab, "notify::stalled", G_CALLBACK (on_tab_hostname_changed), self);
+  g_signal_connect ((GObject*)tab, "broadcast-input", G_CALLBACK (on_tab_broadcast_input), self);
+  g_signal_connect ((GObject*)tab, "broadcast-paste", G_CALLBACK (on_tab_broadcast_paste), self);
   idx = gtk_notebook_append_page ((GtkNotebook*)priv->main_notebook,
                                   (GtkWidget*)tab,
                                   (GtkWidget*)label);
@@ -242,6 +421,29 @@ hotssh_win_append_tab (HotSshWindow   *self, NewTabKind kind)
   gtk_widget_grab_focus ((GtkWidget*)tab);
 }
 
+static void
+hotssh_win_append_tab (HotSshWindow   *self, NewTabKind kind)
+{
+  HotSshWindowPrivate *priv = hotssh_window_get_instance_private (self);
+  HotSshTab *tab;
+
+  if (kind == NEW_TAB_CHANNEL_OR_AUTO)
+    {
+      guint i = gtk_notebook_get_current_page ((GtkNotebook*)priv->main_notebook);
+      HotSshTab *current_tab = (HotSshTab*)gtk_notebook_get_nth_page ((GtkNotebook*)priv->main_notebook, i);
+      if (hotssh_tab_is_connected (current_tab))
+        tab = hotssh_tab_new_channel (current_tab);
+      else
+        tab = hotssh_tab_new ();
+    }
+  else
+    {
+      tab = hotssh_tab_new ();
+    }
+
+  hotssh_win_add_tab (self, tab);
+}
+
 static void
 new_tab_activated (GSimpleAction    *action,
 		   GVariant         *parameter,
@@ -359,7 +561,136 @@ paste_activated (GSimpleAction    *action,
   if (GTK_IS_EDITABLE (focus))
     gtk_editable_paste_clipboard ((GtkEditable*) focus);
   else if (VTE_IS_TERMINAL (focus))
-    vte_terminal_paste_clipboard ((VteTerminal*) focus);
+    {
+      GtkWidget *tab = gtk_widget_get_ancestor (focus, HOTSSH_TYPE_TAB);
+      if (tab)
+        hotssh_tab_paste_clipboard ((HotSshTab*)tab);
+      else
+        vte_terminal_paste_clipboard ((VteTerminal*) focus);
+    }
+}
+
+static HotSshTab *
+get_current_tab (HotSshWindow *self)
+{
+  HotSshWindowPrivate *priv = hotssh_window_get_instance_private (self);
+  guint i = gtk_notebook_get_current_page ((GtkNotebook*)priv->main_notebook);
+  return (HotSshTab*)gtk_notebook_get_nth_page ((GtkNotebook*)priv->main_notebook, i);
+}
+
+static void
+previous_command_activated (GSimpleAction    *action,
+                            GVariant         *parameter,
+                            gpointer          user_data)
+{
+  hotssh_tab_jump_to_command (get_current_tab ((HotSshWindow*)user_data), TRUE);
+}
+
+static void
+next_command_activated (GSimpleAction    *action,
+                        GVariant         *parameter,
+                        gpointer          user_data)
+{
+  hotssh_tab_jump_to_command (get_current_tab ((HotSshWindow*)user_data), FALSE);
+}
+
+static void
+find_activated (GSimpleAction    *action,
+                GVariant         *parameter,
+                gpointer          user_data)
+{
+  hotssh_tab_start_search (get_current_tab ((HotSshWindow*)user_data));
+}
+
+static void
+mirror_tab_activated (GSimpleAction    *action,
+                      GVariant         *parameter,
+                      gpointer          user_data)
+{
+  HotSshWindow *self = user_data;
+  HotSshTab *mirror = hotssh_tab_new_mirror (get_current_tab (self));
+
+  if (!mirror)
+    {
+      gtk_widget_error_bell ((GtkWidget*)self);
+      return;
+    }
+
+  hotssh_win_add_tab (self, mirror);
+}
+
+static void
+mirror_window_activated (GSimpleAction    *action,
+                         GVariant         *parameter,
+                         gpointer          user_data)
+{
+  HotSshWindow *self = user_data;
+  HotSshTab *mirror = hotssh_tab_new_mirror (get_current_tab (self));
+  HotSshWindow *win;
+  HotSshWindowPrivate *win_priv;
+
+  if (!mirror)
+    {
+      gtk_widget_error_bell ((GtkWidget*)self);
+      return;
+    }
+
+  win = hotssh_window_new ((HotSshApp*)gtk_window_get_application ((GtkWindow*)self));
+  win_priv = hotssh_window_get_instance_private (win);
+  /* In place of the new window's empty tab */
+  gtk_notebook_remove_page ((GtkNotebook*)win_priv->main_notebook, 0);
+  hotssh_win_add_tab (win, mirror);
+  gtk_widget_show_all ((GtkWidget*)win);
+  gtk_window_present ((GtkWindow*)win);
+}
+
+static void
+take_input_activated (GSimpleAction    *action,
+                      GVariant         *parameter,
+                      gpointer          user_data)
+{
+  hotssh_tab_take_input (get_current_tab ((HotSshWindow*)user_data));
+}
+
+/* Join or leave; a tab that was skipped rejoins */
+static void
+broadcast_activated (GSimpleAction    *action,
+                     GVariant         *parameter,
+                     gpointer          user_data)
+{
+  HotSshWindow *self = user_data;
+  HotSshTab *tab = get_current_tab (self);
+  HotSshTabBroadcast state = hotssh_tab_get_broadcast (tab);
+
+  set_broadcast_member (self, tab, state == HOTSSH_TAB_BROADCAST_NONE ||
+                        state == HOTSSH_TAB_BROADCAST_SKIPPED);
+}
+
+static void
+broadcast_all_activated (GSimpleAction    *action,
+                         GVariant         *parameter,
+                         gpointer          user_data)
+{
+  HotSshWindow *self = user_data;
+  GList *tabs = hotssh_window_get_tabs (self);
+  GList *l;
+
+  for (l = tabs; l; l = l->next)
+    if (hotssh_tab_is_connected (l->data))
+      set_broadcast_member (self, l->data, TRUE);
+  g_list_free (tabs);
+}
+
+static void
+broadcast_none_activated (GSimpleAction    *action,
+                          GVariant         *parameter,
+                          gpointer          user_data)
+{
+  HotSshWindow *self = user_data;
+  HotSshWindowPrivate *priv = hotssh_window_get_instance_private (self);
+
+  while (priv->broadcast_members->len > 0)
+    set_broadcast_member (self, priv->broadcast_members->pdata[0], FALSE);
 }
 
 static void
@@ -374,6 +705,49 @@ switch_tab_activated (GSimpleAction    *action,
   gtk_notebook_set_current_page ((GtkNotebook*)priv->main_notebook, tabnum);
 }
 
+static void
+open_recording_activated (GSimpleAction    *action,
+                          GVariant         *parameter,
+                          gpointer          user_data)
+{
+  HotSshWindow *self = user_data;
+  HotSshWindowPrivate *priv = hotssh_window_get_instance_private (self);
+  gs_free char *dir = hotssh_recorder_dup_directory (priv->settings);
+  gs_free char *path = NULL;
+  GtkWidget *dialog;
+  GtkFileFilter *filter;
+
+  dialog = gtk_file_chooser_dialog_new (_("Replay Recording"), (GtkWindow*)self,
+                                        GTK_FILE_CHOOSER_ACTION_OPEN,
+                                        _("_Cancel"), GTK_RESPONSE_CANCEL,
+                                        _("_Open"), GTK_RESPONSE_ACCEPT,
+                                        NULL);
+  filter = gtk_file_filter_new ();
+  gtk_file_filter_set_name (filter, _("Session recordings"));
+  gtk_file_filter_add_pattern (filter, "*.cast");
+  gtk_file_filter_add_pattern (filter, "*.cast.zst");
+  gtk_file_chooser_add_filter ((GtkFileChooser*)dialog, filter);
+  if (g_file_test (dir, G_FILE_TEST_IS_DIR))
+    gtk_file_chooser_set_current_folder ((GtkFileChooser*)dialog, dir);
+
+  if (gtk_dialog_run ((GtkDialog*)dialog) == GTK_RESPONSE_ACCEPT)
+    path = gtk_file_chooser_get_filename ((GtkFileChooser*)dialog);
+  gtk_widget_destroy (dialog);
+
+  if (path)
+    hotssh_win_add_tab (self, hotssh_tab_new_replay (path));
+}
+
+static void
+fleet_exec_activated (GSimpleAction    *action,
+                      GVariant         *parameter,
+                      gpointer          user_data)
+{
+  HotSshFleetWindow *fleet_window = hotssh_fleet_window_new ((HotSshWindow*)user_data);
+
+  gtk_window_present ((GtkWindow*)fleet_window);
+}
+
 static void
 hotssh_window_init (HotSshWindow *self)
 {
@@ -383,6 +757,9 @@ hotssh_window_init (HotSshWindow *self)
 
   gtk_widget_init_template (GTK_WIDGET (self));
   priv->settings = g_settings_new ("org.gnome.hotssh");
+  priv->broadcast_members = g_ptr_array_new ();
+  g_signal_connect (priv->main_notebook, "page-removed",
+                    G_CALLBACK (on_notebook_page_removed), self);
 
   g_action_map_add_action_entries ((GActionMap*) self, win_entries,
 				   G_N_ELEMENTS (win_entries), self);
@@ -408,6 +785,9 @@ hotssh_window_dispose (GObject *object)
   g_clear_object (&priv->settings);
 
   G_OBJECT_CLASS (hotssh_window_parent_class)->dispose (object);
+
+  /* After the tabs are gone, so page-removed can still find it */
+  g_clear_pointer (&priv->broadcast_members, g_ptr_array_unref);
 }
 
 static void
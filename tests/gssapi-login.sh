@@ -0,0 +1,117 @@
+#!/bin/bash
+# Copyright (C) 2013 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see <http://www.gnu.org/licenses/>.
+
+# Log in with a ticket from a throwaway KDC to a throwaway sshd, both
+# running as the current user on loopback.  Skipped when the MIT
+# Kerberos server tools or sshd aren't installed.
+
+set -e
+
+skip () {
+    echo "SKIP: $1"
+    exit 77
+}
+
+for tool in krb5kdc kdb5_util kadmin.local kinit ssh-keygen; do
+    command -v $tool >/dev/null 2>&1 || skip "$tool not found"
+done
+sshd=$(command -v sshd 2>/dev/null || echo /usr/sbin/sshd)
+test -x "$sshd" || skip "sshd not found"
+
+builddir=$(pwd)
+tmpdir=$(mktemp -d)
+kdc_pid=
+sshd_pid=
+cleanup () {
+    test -z "$kdc_pid" || kill $kdc_pid 2>/dev/null || true
+    test -z "$sshd_pid" || kill $sshd_pid 2>/dev/null || true
+    rm -rf "$tmpdir"
+}
+trap cleanup EXIT
+
+realm=HOTSSH.TEST
+user=$(id -un)
+kdc_port=$((20000 + $$ % 20000))
+ssh_port=$((kdc_port + 1))
+
+cat > $tmpdir/krb5.conf <<EOC
+[libdefaults]
+    default_realm = $realm
+    dns_lookup_kdc = false
+    dns_lookup_realm = false
+    rdns = false
+[realms]
+    $realm = {
+        kdc = 127.0.0.1:$kdc_port
+    }
+[domain_realm]
+    localhost = $realm
+EOC
+cat > $tmpdir/kdc.conf <<EOC
+[kdcdefaults]
+    kdc_ports = $kdc_port
+    kdc_tcp_ports = $kdc_port
+[realms]
+    $realm = {
+        database_name = $tmpdir/principal
+        key_stash_file = $tmpdir/stash
+        acl_file = $tmpdir/kadm5.acl
+    }
+EOC
+export KRB5_CONFIG=$tmpdir/krb5.conf
+export KRB5_KDC_PROFILE=$tmpdir/kdc.conf
+export KRB5CCNAME=FILE:$tmpdir/ccache
+export KRB5_KTNAME=FILE:$tmpdir/host.keytab
+
+kdb5_util create -s -r $realm -P hotssh-test >/dev/null
+kadmin.local -q "addprinc -randkey $user" >/dev/null
+kadmin.local -q "ktadd -k $tmpdir/user.keytab $user" >/dev/null
+kadmin.local -q "addprinc -randkey host/localhost" >/dev/null
+kadmin.local -q "ktadd -k $tmpdir/host.keytab host/localhost" >/dev/null
+krb5kdc -n &
+kdc_pid=$!
+
+ssh-keygen -q -t ed25519 -N '' -f $tmpdir/host_key
+cat > $tmpdir/sshd_config <<EOC
+Port $ssh_port
+ListenAddress 127.0.0.1
+HostKey $tmpdir/host_key
+PidFile none
+UsePAM no
+StrictModes no
+PubkeyAuthentication no
+PasswordAuthentication no
+KbdInteractiveAuthentication no
+GSSAPIAuthentication yes
+GSSAPIStrictAcceptorCheck no
+EOC
+"$sshd" -D -e -f $tmpdir/sshd_config &
+sshd_pid=$!
+
+# Both are up once they answer
+for i in $(seq 50); do
+    if (exec 3<>/dev/tcp/127.0.0.1/$ssh_port) 2>/dev/null; then
+        break
+    fi
+    sleep 0.1
+done
+
+export GSETTINGS_SCHEMA_DIR=$builddir
+export GSETTINGS_BACKEND=memory
+
+$builddir/test-gssapi-login --no-credentials
+kinit -k -t $tmpdir/user.keytab $user
+$builddir/test-gssapi-login localhost $ssh_port $user
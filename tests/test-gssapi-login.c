@@ -0,0 +1,165 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2013 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Run by gssapi-login.sh against a throwaway KDC and sshd.
+ *
+ *   test-gssapi-login --no-credentials
+ *     There is no ticket; the check must say so.
+ *   test-gssapi-login HOST PORT USER
+ *     There is a ticket; the check must find it, and the host must
+ *     take it.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgsystem.h"
+#include "gssh.h"
+#include "hotssh-gssapi.h"
+
+static GMainLoop *loop;
+static gboolean have_credentials;
+static GError *error;
+
+static void
+on_checked (GObject      *src,
+            GAsyncResult *res,
+            gpointer      user_data)
+{
+  have_credentials = hotssh_gssapi_check_credentials_finish (res, &error);
+  g_main_loop_quit (loop);
+}
+
+static void
+on_handshake (GObject      *src,
+              GAsyncResult *res,
+              gpointer      user_data)
+{
+  (void) gssh_connection_handshake_finish ((GSshConnection*)src, res, &error);
+  g_main_loop_quit (loop);
+}
+
+static void
+on_negotiate (GObject      *src,
+              GAsyncResult *res,
+              gpointer      user_data)
+{
+  (void) gssh_connection_negotiate_finish ((GSshConnection*)src, res, &error);
+  g_main_loop_quit (loop);
+}
+
+static void
+on_auth (GObject      *src,
+         GAsyncResult *res,
+         gpointer      user_data)
+{
+  (void) gssh_connection_auth_finish ((GSshConnection*)src, res, &error);
+  g_main_loop_quit (loop);
+}
+
+static gboolean
+check_credentials (void)
+{
+  hotssh_gssapi_check_credentials_async (NULL, on_checked, NULL);
+  g_main_loop_run (loop);
+  return have_credentials;
+}
+
+static gboolean
+log_in (const char *hostname,
+        guint       port,
+        const char *username)
+{
+  gs_unref_object GSocketConnectable *address = g_network_address_new (hostname, port);
+  gs_unref_object GSshConnection *connection = gssh_connection_new (address, username);
+  guint *available = NULL;
+  guint n_available = 0;
+  guint i;
+
+  gssh_connection_handshake_async (connection, NULL, on_handshake, NULL);
+  g_main_loop_run (loop);
+  if (error)
+    return FALSE;
+
+  /* The host key was made up for this run; nothing to compare it to */
+  gssh_connection_negotiate_async (connection, NULL, on_negotiate, NULL);
+  g_main_loop_run (loop);
+  if (error)
+    return FALSE;
+
+  gssh_connection_get_authentication_mechanisms (connection, &available, &n_available);
+  for (i = 0; i < n_available; i++)
+    if (available[i] == GSSH_CONNECTION_AUTH_MECHANISM_GSSAPI_MIC)
+      break;
+  if (i == n_available)
+    {
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Host does not offer GSSAPI");
+      return FALSE;
+    }
+
+  gssh_connection_auth_async (connection, GSSH_CONNECTION_AUTH_MECHANISM_GSSAPI_MIC,
+                              NULL, on_auth, NULL);
+  g_main_loop_run (loop);
+  return error == NULL;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  loop = g_main_loop_new (NULL, FALSE);
+
+  if (argc == 2 && strcmp (argv[1], "--no-credentials") == 0)
+    {
+      if (check_credentials ())
+        {
+          g_printerr ("Found credentials where there are none\n");
+          return EXIT_FAILURE;
+        }
+      /* Not remembered: looking again looks again */
+      if (hotssh_gssapi_have_credentials ())
+        {
+          g_printerr ("Remembered having credentials\n");
+          return EXIT_FAILURE;
+        }
+      return EXIT_SUCCESS;
+    }
+
+  if (argc != 4)
+    {
+      g_printerr ("usage: %s --no-credentials | HOST PORT USER\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  if (!check_credentials ())
+    {
+      g_printerr ("No credentials found%s%s\n",
+                  error ? ": " : "", error ? error->message : "");
+      return EXIT_FAILURE;
+    }
+  if (!log_in (argv[1], atoi (argv[2]), argv[3]))
+    {
+      g_printerr ("Logging in: %s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}